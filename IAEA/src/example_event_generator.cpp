@@ -4,7 +4,10 @@
  *
  *  This is an example event generator written in C++.
  *  It provides a mono-energetic pencil beam with particle type, energy and
- *  position defined in an input file.
+ *  position defined in an input file, optionally followed by the standard
+ *  deviation of a Gaussian spot in x and y. The spot is sampled with a
+ *  random stream per parallel chunk (see iaea_random.h), so that
+ *  instances running in different threads give different particles.
  *  This event generator can be loaded several times. 
  *  This is implemented to demonstrate the idea that each event generator 
  *  shared library (DLL) may be used several times in a run.
@@ -12,10 +15,12 @@
  *****************************************************************************/
 
 #include "iaea_config.h"
+#include "iaea_random.h"
 
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <cmath>
 
 using namespace std;
 
@@ -34,21 +39,44 @@ public:
     int   getTypeExtraLongVariables(IAEA_I32 index) const { return -1; };
     int   getTypeExtraFloatVariables(IAEA_I32 index) const { return -1; };
     IAEA_I64 getNstat() const { return count; };
-    void  setParallelRun(const IAEA_I32 *,const IAEA_I32 *,const IAEA_I32 *,
-           IAEA_I32 *is_ok) const { *is_ok = 0; };
+    // Stream i_chunk of seed i_parallel
+    void  setParallelRun(const IAEA_I32 *i_parallel,const IAEA_I32 *i_chunk,
+           const IAEA_I32 *, IAEA_I32 *is_ok) {
+            iaea_random_init(&rng,*i_parallel,*i_chunk-1); *is_ok = 0; };
     void  getNextParticle(IAEA_I32 *n_stat, IAEA_I32 *type, float *E,
            float *wt, float *x, float *y, float *z, float *u, float *v, 
            float *w, float *extra_floats, IAEA_I32 *extra_longs) {
             *n_stat = 1; *type = q; *E = e; *wt = 1; 
-            *x = xo; *y = yo; *z = zo; *u = 0; *v = 0; *w = 1;
+            getSpot(x,y); *z = zo; *u = 0; *v = 0; *w = 1;
+            count++;
+          };
+    void  getNextParticles(IAEA_I32 n, IAEA_I32 *n_stat, IAEA_I32 *type,
+           float *E, float *wt, float *x, float *y, float *z, float *u,
+           float *v, float *w) {
+            for(IAEA_I32 i=0; i<n; i++) {
+                n_stat[i] = 1; type[i] = q; E[i] = e; wt[i] = 1;
+                x[i] = xo; y[i] = yo; z[i] = zo; u[i] = 0; v[i] = 0; w[i] = 1;
+            }
+            if( sigma > 0 ) for(IAEA_I32 i=0; i<n; i++) getSpot(&x[i],&y[i]);
+            count += n;
           };
 
 private:
 
+    // Box-Muller: a pair of Gaussian numbers from two uniform ones
+    void  getSpot(float *x, float *y) {
+            if( sigma <= 0 ) { *x = xo; *y = yo; return; }
+            double r = sigma*sqrt(-2*log(iaea_random_uniform(&rng)));
+            double phi = 6.283185307179586*iaea_random_uniform(&rng);
+            *x = xo + r*cos(phi); *y = yo + r*sin(phi);
+          };
+
     int   q;
     float e;
     IAEA_I64 count;
     float xo,yo,zo;
+    float sigma;
+    iaea_random rng;
     bool  ok;
 
 };
@@ -57,7 +85,10 @@ MySimplePencilBeam::MySimplePencilBeam(const char *input_file) :
            count(0), ok(false) {
     ifstream in(input_file); if( !in ) return;
     in >> q >> e >> xo >> yo >> zo;
-    if( in.good() && !in.fail() ) ok = true;
+    if( in.fail() ) return;
+    ok = true;
+    if( !(in >> sigma) ) sigma = 0;
+    iaea_random_init(&rng,0,0);
 }
 
 #ifdef WIN32
@@ -103,20 +134,20 @@ MY_EXPORT void get_minimum_energy(const IAEA_I32 *id, float *energy) {
         *energy = sources[*id]->getMinimumEnergy();
 }
 
-MY_EXPORT void get_extra_numbers(const IAEA_I32 *id, int *ni, int *nf) {
+MY_EXPORT void get_extra_numbers(const IAEA_I32 *id, IAEA_I32 *ni, IAEA_I32 *nf) {
     if( *id >= 0 && *id < sources.size() ) sources[*id]->getExtraNumbers(ni,nf);
     else { *ni = 0; *nf = 0; }
 }
 
-MY_EXPORT void get_type_extra_long_variable(const IAEA_I32 *id, const int *ind,
-                                            int *typ) {
+MY_EXPORT void get_type_extra_long_variable(const IAEA_I32 *id, const IAEA_I32 *ind,
+                                            IAEA_I32 *typ) {
     if( *id >= 0 && *id < sources.size() ) 
         *typ = sources[*id]->getTypeExtraLongVariables(*ind);
     else *typ = -1;
 }
 
-MY_EXPORT void get_type_extra_float_variable(const IAEA_I32 *id, const int *ind,
-                                             int *typ) {
+MY_EXPORT void get_type_extra_float_variable(const IAEA_I32 *id, const IAEA_I32 *ind,
+                                             IAEA_I32 *typ) {
     if( *id >= 0 && *id < sources.size() ) 
         *typ = sources[*id]->getTypeExtraFloatVariables(*ind);
     else *typ = -1;
@@ -145,6 +176,19 @@ MY_EXPORT void get_next_particle(const IAEA_I32 *id,IAEA_I32 *n_stat,
     else *n_stat = -1;
 }
 
+// Optional: a block of particles at once, in arrays with one entry per
+// particle (the beam has no extra variables)
+MY_EXPORT void get_next_particles(const IAEA_I32 *id, const IAEA_I32 *n_max,
+           IAEA_I32 *n_read, IAEA_I32 *n_stat, IAEA_I32 *type, float *E,
+           float *wt, float *x, float *y, float *z, float *u, float *v,
+           float *w, float *extra_floats, IAEA_I32 *extra_longs) {
+    if( *id >= 0 && *id < sources.size() && sources[*id] ) {
+        sources[*id]->getNextParticles(*n_max,n_stat,type,E,wt,x,y,z,u,v,w);
+        *n_read = *n_max;
+    }
+    else *n_read = -1;
+}
+
 MY_EXPORT void destroy_source(const IAEA_I32 *id,IAEA_I32 *result) {
     if( *id >= 0 && *id < sources.size() ) {
         if( sources[*id] ) { delete sources[*id]; sources[*id] = 0; *result=0;}
@@ -0,0 +1,158 @@
+/******************************************************************************
+ *
+ *  Compile-time specialized codecs for packed IAEA phase space records
+ *
+ *  The generic decode_particle()/encode_particle() test nine record
+ *  content flags for every particle although they are fixed for the
+ *  lifetime of a source. Here the record layout is a template parameter
+ *  (stored-coordinate mask, number of extra floats and extra longs), so
+ *  all tests fold away and the copies have a compile-time length. Only
+ *  the layouts listed in codec_table are instantiated; any other layout
+ *  keeps using the generic code.
+ *
+ *****************************************************************************/
+
+#include <cstring>
+#include <cmath>
+#include "iaea_codec.h"
+
+/* *********************************************************************** */
+
+template<int MASK> struct codec_nfloat
+{
+  // floats stored per record besides the energy and the extra floats
+  enum { value = ((MASK & CODEC_X) != 0) + ((MASK & CODEC_Y) != 0) +
+                 ((MASK & CODEC_Z) != 0) + ((MASK & CODEC_U) != 0) +
+                 ((MASK & CODEC_V) != 0) + ((MASK & CODEC_WEIGHT) != 0) };
+};
+
+template<int MASK, int NEF, int NEL>
+static void codec_decode(iaea_record_type *p, const unsigned char *record)
+{
+  enum { NF = 1 + codec_nfloat<MASK>::value + NEF };
+  float floatArray[NF];
+  int i = 0, is = 1;
+
+  p->particle = (short) ((const signed char *) record)[0];
+  if(p->particle < 0) {is = -1; p->particle = -p->particle;}
+
+  // records are packed, so the floats are not aligned in memory
+  memcpy(floatArray, record + sizeof(char), sizeof(floatArray));
+
+  p->IsNewHistory = 0;
+  if(floatArray[0] < 0) p->IsNewHistory = 1; // like egsnrc
+  p->energy = (float) fabs(floatArray[0]);
+
+  if(MASK & CODEC_X) p->x = floatArray[++i];
+  if(MASK & CODEC_Y) p->y = floatArray[++i];
+  if(MASK & CODEC_Z) p->z = floatArray[++i];
+  if(MASK & CODEC_U) p->u = floatArray[++i];
+  if(MASK & CODEC_V) p->v = floatArray[++i];
+  if(MASK & CODEC_WEIGHT) p->weight = floatArray[++i];
+  for(int j=0;j<NEF;j++) p->extrafloat[j] = floatArray[++i];
+
+  if(MASK & CODEC_W)
+  {
+      p->w = 0.f;
+      double aux = (p->u*p->u + p->v*p->v);
+      if (aux<=1.0) p->w = (float) (is * sqrt((float)(1.0 - aux)));
+      else
+      {
+            aux = sqrt((float)aux);
+            p->u /= (float)aux;
+            p->v /= (float)aux;
+      }
+  }
+
+  if(NEL > 0)
+     memcpy(p->extralong, record + sizeof(char) + NF*sizeof(float),
+            NEL*sizeof(IAEA_I32));
+}
+
+template<int MASK, int NEF, int NEL>
+static void codec_encode(iaea_record_type *p, unsigned char *record)
+{
+  enum { NF = 1 + codec_nfloat<MASK>::value + NEF };
+  float floatArray[NF];
+  int i = 0;
+
+  char ishort = (char) p->particle;
+  if(p->w < 0) ishort = -ishort; // Sign of w is stored in particle type
+  record[0] = (unsigned char) ishort;
+
+  if(p->IsNewHistory > 0) p->energy *= (-1); // New history is signaled by negative energy
+
+  floatArray[0] = p->energy;
+  if(MASK & CODEC_X) floatArray[++i] = p->x;
+  if(MASK & CODEC_Y) floatArray[++i] = p->y;
+  if(MASK & CODEC_Z) floatArray[++i] = p->z;
+  if(MASK & CODEC_U) floatArray[++i] = p->u;
+  if(MASK & CODEC_V) floatArray[++i] = p->v;
+  if(MASK & CODEC_WEIGHT) floatArray[++i] = p->weight;
+  for(int j=0;j<NEF;j++) floatArray[++i] = p->extrafloat[j];
+
+  memcpy(record + sizeof(char), floatArray, sizeof(floatArray));
+
+  if(NEL > 0)
+     memcpy(record + sizeof(char) + NF*sizeof(float), p->extralong,
+            NEL*sizeof(IAEA_I32));
+}
+
+/* *********************************************************************** */
+
+struct codec_entry
+{
+  int mask, iextrafloat, iextralong;
+  void (*decode)(iaea_record_type *, const unsigned char *);
+  void (*encode)(iaea_record_type *, unsigned char *);
+};
+
+#define CODEC(MASK,NEF,NEL) \
+  { MASK, NEF, NEL, codec_decode<MASK,NEF,NEL>, codec_encode<MASK,NEF,NEL> }
+
+#define CODEC_NOZ (CODEC_ALL & ~CODEC_Z) // scored on a constant-Z plane
+
+static const codec_entry codec_table[] =
+{
+  // EGS: full 7 floats, n_stat and optionally LATCH (plus ZLAST)
+  CODEC(CODEC_ALL, 0, 0),
+  CODEC(CODEC_ALL, 0, 1),
+  CODEC(CODEC_ALL, 0, 2),
+  CODEC(CODEC_ALL, 1, 2),
+  // Same layouts on a constant-Z plane
+  CODEC(CODEC_NOZ, 0, 0),
+  CODEC(CODEC_NOZ, 0, 1),
+  CODEC(CODEC_NOZ, 0, 2),
+  CODEC(CODEC_NOZ, 1, 2),
+  // PENELOPE: n_stat followed by ILB(1..5)
+  CODEC(CODEC_ALL, 0, 6),
+  CODEC(CODEC_NOZ, 0, 6)
+};
+
+void iaea_select_codec(iaea_record_type *p)
+{
+  int mask = 0;
+  if(p->ix > 0) mask |= CODEC_X;
+  if(p->iy > 0) mask |= CODEC_Y;
+  if(p->iz > 0) mask |= CODEC_Z;
+  if(p->iu > 0) mask |= CODEC_U;
+  if(p->iv > 0) mask |= CODEC_V;
+  if(p->iw > 0) mask |= CODEC_W;
+  if(p->iweight > 0) mask |= CODEC_WEIGHT;
+
+  p->codec_decode = NULL;
+  p->codec_encode = NULL;
+
+  int n = sizeof(codec_table)/sizeof(codec_table[0]);
+  for(int k=0; k<n; k++)
+  {
+    if(codec_table[k].mask == mask &&
+       codec_table[k].iextrafloat == p->iextrafloat &&
+       codec_table[k].iextralong  == p->iextralong)
+    {
+      p->codec_decode = codec_table[k].decode;
+      p->codec_encode = codec_table[k].encode;
+      return;
+    }
+  }
+}
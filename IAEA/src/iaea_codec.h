@@ -0,0 +1,29 @@
+/******************************************************************************
+ *
+ *  Compile-time specialized codecs for packed IAEA phase space records
+ *
+ *****************************************************************************/
+#ifndef IAEA_CODEC
+#define IAEA_CODEC
+
+#include "iaea_record.h"
+
+/* *********************************************************************** */
+// Bits of the stored-coordinate mask, in record_contents order
+#define CODEC_X      0x01
+#define CODEC_Y      0x02
+#define CODEC_Z      0x04
+#define CODEC_U      0x08
+#define CODEC_V      0x10
+#define CODEC_W      0x20   // w reconstructed from u, v and the type sign
+#define CODEC_WEIGHT 0x40
+#define CODEC_ALL    0x7f
+
+/* *********************************************************************** */
+// Points p->codec_decode/p->codec_encode to the specialized codec for
+// the record contents of p (ix..iweight, iextrafloat, iextralong), or
+// to NULL if the layout was not pre-instantiated, in which case the
+// generic decode_particle()/encode_particle() code is used.
+void iaea_select_codec(iaea_record_type *p);
+
+#endif
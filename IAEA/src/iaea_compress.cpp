@@ -0,0 +1,447 @@
+/******************************************************************************
+ *
+ *  Block-compressed phase space files (.IAEAphspz)
+ *
+ *  Phase space files are large and mostly read from start to end, often
+ *  from network storage, where reading the records costs more than
+ *  decoding them. Most bytes of a record change little from one record to
+ *  the next (particle type, exponents, high bytes of positions, extralongs)
+ *  so storing each byte plane of a block as bit-packed differences takes
+ *  a fraction of its size and is undone with shifts and additions only.
+ *
+ *  The file holds the compressed blocks one after the other, then the
+ *  offsets of the n_blocks blocks and of the end of the last one, and the
+ *  trailer: n_records, n_blocks and the offset of the offsets (8 bytes
+ *  each), block_records and reclength (4 bytes each) and the magic string
+ *  IAEA_PHSPZ_MAGIC. Numbers are little-endian. The records themselves
+ *  keep the byte order of the machine which wrote them (see BYTE_ORDER in
+ *  the header).
+ *
+ *****************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#endif
+#include "utilities.h"
+#include "iaea_prefetch.h"
+#include "iaea_compress.h"
+
+#define IAEA_PHSPZ_MAGIC "IAEAphz1"
+#define TRAILER_SIZE 40
+
+#define PLANE_RAW    0   // the bytes as they are
+#define PLANE_CONST  1   // one byte, the same in all records
+#define PLANE_PACKED 2   // groups of differences, see pack_plane()
+#define GROUP        32  // differences per group
+
+/* *********************************************************************** */
+// Little-endian numbers of the index and trailer
+
+static void put_u64(unsigned char *buf, IAEA_I64 value)
+{
+  unsigned long long v = (unsigned long long) value;
+  for(int i=0; i<8; i++) buf[i] = (unsigned char)(v >> 8*i);
+}
+
+static IAEA_I64 get_u64(const unsigned char *buf)
+{
+  unsigned long long v = 0;
+  for(int i=0; i<8; i++) v |= (unsigned long long) buf[i] << 8*i;
+  return (IAEA_I64) v;
+}
+
+static void put_u32(unsigned char *buf, int value)
+{
+  for(int i=0; i<4; i++) buf[i] = (unsigned char)((unsigned int) value >> 8*i);
+}
+
+static int get_u32(const unsigned char *buf)
+{
+  unsigned int v = 0;
+  for(int i=0; i<4; i++) v |= (unsigned int) buf[i] << 8*i;
+  return (int) v;
+}
+
+/* *********************************************************************** */
+// Byte planes
+
+// Codes byte j of the n records at out. The differences d of consecutive
+// bytes (the first to 0) are mapped to small numbers, 0,-1,1,-2,... to
+// 0,1,2,3,..., and every group of GROUP of them is stored as one byte
+// with the bits w needed by the largest followed by GROUP*w bits.
+// Returns the bytes used.
+static IAEA_I64 pack_plane(const unsigned char *records, int n, int reclength,
+                           int j, unsigned char *out)
+{
+  const unsigned char *src = records + j;
+  unsigned char *p = out;
+
+  int k;
+  for(k=1; k<n && src[(size_t)k*reclength] == src[0]; k++);
+  if(k >= n)
+  {
+     *p++ = PLANE_CONST;
+     *p++ = src[0];
+     return p - out;
+  }
+
+  *p++ = PLANE_PACKED;
+  unsigned char prev = 0, z[GROUP];
+  for(int g=0; g<n; g+=GROUP)
+  {
+     int m = (n - g < GROUP) ? n - g : GROUP;
+     unsigned char any = 0;
+     int i;
+     for(i=0; i<m; i++)
+     {
+        unsigned char b = src[(size_t)(g + i)*reclength];
+        unsigned char d = (unsigned char)(b - prev);
+        prev = b;
+        z[i] = (unsigned char)((d << 1) ^ (unsigned char)((signed char) d >> 7));
+        any |= z[i];
+     }
+     for(; i<GROUP; i++) z[i] = 0;
+
+     int w = 0;
+     while(w < 8 && (any >> w) != 0) w++;
+     *p++ = (unsigned char) w;
+     if(w == 8) {memcpy(p, z, GROUP); p += GROUP;}
+     else if(w > 0)
+     {
+        unsigned long long acc = 0;
+        int bits = 0;
+        for(i=0; i<GROUP; i++)
+        {
+           acc |= (unsigned long long) z[i] << bits;
+           bits += w;
+           while(bits >= 8) {*p++ = (unsigned char) acc; acc >>= 8; bits -= 8;}
+        }
+     }
+  }
+
+  if(p - out > 1 + n)
+  {
+     // Differences do not help (e.g. low bytes of the mantissas)
+     p = out;
+     *p++ = PLANE_RAW;
+     for(k=0; k<n; k++) *p++ = src[(size_t)k*reclength];
+  }
+  return p - out;
+}
+
+// Decodes the plane at p (coded by pack_plane) into byte j of the n
+// records. Returns the end of the plane, or NULL if it goes past end.
+static const unsigned char *unpack_plane(const unsigned char *p,
+                                         const unsigned char *end, int n,
+                                         int reclength, int j,
+                                         unsigned char *records)
+{
+  unsigned char *dst = records + j;
+  if(p >= end) return NULL;
+  int mode = *p++;
+  int k;
+
+  if(mode == PLANE_CONST)
+  {
+     if(p >= end) return NULL;
+     unsigned char b = *p++;
+     for(k=0; k<n; k++) dst[(size_t)k*reclength] = b;
+     return p;
+  }
+  if(mode == PLANE_RAW)
+  {
+     if(end - p < n) return NULL;
+     for(k=0; k<n; k++) dst[(size_t)k*reclength] = p[k];
+     return p + n;
+  }
+  if(mode != PLANE_PACKED) return NULL;
+
+  unsigned char prev = 0, z[GROUP];
+  for(int g=0; g<n; g+=GROUP)
+  {
+     if(p >= end) return NULL;
+     int w = *p++, i;
+     if(w > 8 || end - p < GROUP*w/8) return NULL;
+
+     if(w == 0) memset(z, 0, GROUP);
+     else if(w == 8) memcpy(z, p, GROUP);
+     else
+     {
+        const unsigned char *q = p;
+        unsigned long long acc = 0;
+        unsigned int mask = (1u << w) - 1;
+        int bits = 0;
+        for(i=0; i<GROUP; i++)
+        {
+           if(bits < w) {acc |= (unsigned long long) *q++ << bits; bits += 8;}
+           z[i] = (unsigned char)(acc & mask);
+           acc >>= w;
+           bits -= w;
+        }
+     }
+     p += GROUP*w/8;
+
+     int m = (n - g < GROUP) ? n - g : GROUP;
+     for(i=0; i<m; i++)
+     {
+        prev = (unsigned char)(prev + ((z[i] >> 1) ^ (unsigned char)(-(z[i] & 1))));
+        dst[(size_t)(g + i)*reclength] = prev;
+     }
+  }
+  return p;
+}
+
+/* *********************************************************************** */
+
+IAEA_I64 iaea_compress_bound(int n, int reclength)
+{
+  IAEA_I64 groups = (n + GROUP - 1)/GROUP;
+  return (IAEA_I64) reclength*(2 + groups*(GROUP + 1)) + n;
+}
+
+IAEA_I64 iaea_compress_block(const unsigned char *records, int n,
+                             int reclength, unsigned char *out)
+{
+  IAEA_I64 size = 0;
+  if(n <= 0) return size;
+  for(int j=0; j<reclength; j++)
+     size += pack_plane(records, n, reclength, j, out + size);
+  return size;
+}
+
+int iaea_decompress_block(const unsigned char *in, IAEA_I64 size, int n,
+                          int reclength, unsigned char *records)
+{
+  if(n <= 0) return(size == 0 ? OK : FAIL);
+  const unsigned char *p = in, *end = in + size;
+  for(int j=0; j<reclength && p != NULL; j++)
+     p = unpack_plane(p, end, n, reclength, j, records);
+  return(p == end ? OK : FAIL);
+}
+
+/* *********************************************************************** */
+// Writing
+
+// Makes room in z->offset for one block more
+static int grow_offsets(iaea_compressed_file *z)
+{
+  if(z->n_blocks + 2 <= z->max_blocks) return(OK);
+  IAEA_I64 max_blocks = (z->max_blocks > 0) ? 2*z->max_blocks : 1024;
+  IAEA_I64 *offset = (IAEA_I64 *) realloc(z->offset, max_blocks*sizeof(IAEA_I64));
+  if(offset == NULL) return(FAIL);
+  z->offset = offset;
+  z->max_blocks = max_blocks;
+  return(OK);
+}
+
+static int write_block(iaea_compressed_file *z, FILE *f,
+                       const unsigned char *records, int n)
+{
+  if(grow_offsets(z) != OK) return(FAIL);
+  IAEA_I64 size = iaea_compress_block(records, n, z->reclength, z->out);
+  if(fwrite(z->out, 1, (size_t) size, f) != (size_t) size) return(FAIL);
+  z->offset[z->n_blocks + 1] = z->offset[z->n_blocks] + size;
+  z->n_blocks++;
+  z->n_records += n;
+  return(OK);
+}
+
+iaea_compressed_file *iaea_compressed_new(int block_records)
+{
+  if(block_records <= 0) return NULL;
+  iaea_compressed_file *z = (iaea_compressed_file *) calloc(1, sizeof(iaea_compressed_file));
+  if(z == NULL) return NULL;
+  z->block_records = block_records;
+  if(grow_offsets(z) != OK) {free(z); return NULL;}
+  z->offset[0] = 0;
+  return z;
+}
+
+int iaea_compressed_write(iaea_compressed_file *z, FILE *f,
+                          const unsigned char *records, IAEA_I64 n,
+                          int reclength)
+{
+  if(n <= 0) return(OK);
+  if(z->reclength == 0)
+  {
+     z->reclength = reclength;
+     z->stage = (unsigned char *) malloc((size_t) z->block_records*reclength);
+     z->out = (unsigned char *) malloc((size_t) iaea_compress_bound(z->block_records, reclength));
+     if(z->stage == NULL || z->out == NULL) return(FAIL);
+  }
+  if(reclength != z->reclength) return(FAIL);
+
+  while(n > 0)
+  {
+     if(z->n_staged == 0 && n >= z->block_records)
+     {
+        // Whole blocks are compressed where they are
+        if(write_block(z, f, records, z->block_records) != OK) return(FAIL);
+        records += (size_t) z->block_records*reclength;
+        n -= z->block_records;
+        continue;
+     }
+     IAEA_I64 m = z->block_records - z->n_staged;
+     if(m > n) m = n;
+     memcpy(z->stage + (size_t) z->n_staged*reclength, records, (size_t) m*reclength);
+     z->n_staged += (int) m;
+     records += (size_t) m*reclength;
+     n -= m;
+     if(z->n_staged == z->block_records)
+     {
+        z->n_staged = 0;
+        if(write_block(z, f, z->stage, z->block_records) != OK) return(FAIL);
+     }
+  }
+  return(OK);
+}
+
+int iaea_compressed_close(iaea_compressed_file *z, FILE *f)
+{
+  if(z->n_staged > 0)
+  {
+     int n = z->n_staged;
+     z->n_staged = 0;
+     if(write_block(z, f, z->stage, n) != OK) return(FAIL);
+  }
+
+  unsigned char buf[TRAILER_SIZE];
+  for(IAEA_I64 b=0; b<=z->n_blocks; b++)
+  {
+     put_u64(buf, z->offset[b]);
+     if(fwrite(buf, 1, 8, f) != 8) return(FAIL);
+  }
+  put_u64(buf, z->n_records);
+  put_u64(buf + 8, z->n_blocks);
+  put_u64(buf + 16, z->offset[z->n_blocks]);
+  put_u32(buf + 24, z->block_records);
+  put_u32(buf + 28, z->reclength);
+  memcpy(buf + 32, IAEA_PHSPZ_MAGIC, 8);
+  if(fwrite(buf, 1, TRAILER_SIZE, f) != TRAILER_SIZE) return(FAIL);
+  return(OK);
+}
+
+/* *********************************************************************** */
+// Reading
+
+iaea_compressed_file *iaea_compressed_open(int fd)
+{
+#ifdef WIN32
+  struct _stati64 st;
+  if(_fstati64(fd, &st) != 0) return NULL;
+#else
+  struct stat st;
+  if(fstat(fd, &st) != 0) return NULL;
+#endif
+  IAEA_I64 size = st.st_size;
+  if(size < TRAILER_SIZE + 8) return NULL;
+
+  unsigned char buf[TRAILER_SIZE];
+  if(iaea_pread(fd, buf, TRAILER_SIZE, size - TRAILER_SIZE) != TRAILER_SIZE ||
+     memcmp(buf + 32, IAEA_PHSPZ_MAGIC, 8) != 0) return NULL;
+
+  IAEA_I64 n_records = get_u64(buf), n_blocks = get_u64(buf + 8);
+  IAEA_I64 index_offset = get_u64(buf + 16);
+  int block_records = get_u32(buf + 24), reclength = get_u32(buf + 28);
+  if(n_records < 0 || n_blocks < 0 || block_records <= 0 || reclength < 0 ||
+     index_offset + 8*(n_blocks + 1) + TRAILER_SIZE != size ||
+     n_records > n_blocks*block_records ||
+     (n_blocks > 0 && n_records <= (n_blocks - 1)*block_records)) return NULL;
+
+  iaea_compressed_file *z = (iaea_compressed_file *) calloc(1, sizeof(iaea_compressed_file));
+  unsigned char *index = (unsigned char *) malloc((size_t)(8*(n_blocks + 1)));
+  if(z == NULL || index == NULL) {free(z); free(index); return NULL;}
+  z->block_records = block_records;
+  z->reclength = reclength;
+  z->n_records = n_records;
+  z->n_blocks = n_blocks;
+  z->max_blocks = n_blocks + 1;
+  z->offset = (IAEA_I64 *) malloc((size_t) z->max_blocks*sizeof(IAEA_I64));
+
+  int status = (z->offset != NULL &&
+                iaea_pread(fd, index, 8*(n_blocks + 1), index_offset) == 8*(n_blocks + 1))
+               ? OK : FAIL;
+  for(IAEA_I64 b=0; b<=n_blocks && status == OK; b++)
+  {
+     z->offset[b] = get_u64(index + 8*b);
+     if(z->offset[b] < (b > 0 ? z->offset[b-1] : 0)) status = FAIL;
+  }
+  free(index);
+  if(status != OK || z->offset[n_blocks] != index_offset)
+  {
+     iaea_compressed_free(z);
+     return NULL;
+  }
+  return z;
+}
+
+const unsigned char *iaea_compressed_read(const iaea_compressed_file *z, int fd,
+                                          iaea_compressed_cache **cache,
+                                          IAEA_I64 record, IAEA_I32 n_max,
+                                          IAEA_I32 *n_read)
+{
+  *n_read = 0;
+  if(record < 0 || record >= z->n_records) return NULL;
+
+  iaea_compressed_cache *c = *cache;
+  if(c == NULL)
+  {
+     c = *cache = (iaea_compressed_cache *) calloc(1, sizeof(iaea_compressed_cache));
+     if(c == NULL) return NULL;
+     c->block = -1;
+  }
+
+  IAEA_I64 b = record/z->block_records;
+  if(c->block != b)
+  {
+     IAEA_I64 size = z->offset[b+1] - z->offset[b];
+     int n = (int)((b == z->n_blocks - 1) ? z->n_records - b*z->block_records
+                                          : z->block_records);
+     if(c->records == NULL)
+     {
+        c->records = (unsigned char *) malloc((size_t) z->block_records*z->reclength);
+        if(c->records == NULL) return NULL;
+     }
+     if(size > c->data_size)
+     {
+        unsigned char *data = (unsigned char *) realloc(c->data, (size_t) size);
+        if(data == NULL) return NULL;
+        c->data = data;
+        c->data_size = size;
+     }
+     c->block = -1;
+     if(iaea_pread(fd, c->data, size, z->offset[b]) != size ||
+        iaea_decompress_block(c->data, size, n, z->reclength, c->records) != OK)
+        return NULL;
+     c->block = b;
+     c->n_records = n;
+  }
+
+  IAEA_I64 i = record - b*z->block_records;
+  IAEA_I64 m = c->n_records - i;
+  if(m > n_max) m = n_max;
+  *n_read = (IAEA_I32) m;
+  return c->records + i*z->reclength;
+}
+
+void iaea_compressed_free(iaea_compressed_file *z)
+{
+  if(z == NULL) return;
+  free(z->offset);
+  free(z->stage);
+  free(z->out);
+  free(z);
+}
+
+void iaea_compressed_cache_free(iaea_compressed_cache *cache)
+{
+  if(cache == NULL) return;
+  free(cache->records);
+  free(cache->data);
+  free(cache);
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+ *
+ *  Block-compressed phase space files (.IAEAphspz)
+ *
+ *****************************************************************************/
+#ifndef IAEA_COMPRESS
+#define IAEA_COMPRESS
+
+#include <cstdio>
+#include "iaea_config.h"
+
+#ifndef COMPRESSION_BLOCK_RECORDS
+  #define COMPRESSION_BLOCK_RECORDS 4096  // default records per compressed block
+#endif
+
+/* *********************************************************************** */
+// The records are compressed in blocks of block_records records (the last
+// block may hold less), each on its own, so any record is reached
+// decompressing a single block. Within a block the records are split in
+// byte planes (byte j of every record), each plane is replaced by the
+// differences of consecutive bytes and these are stored bit-packed in
+// groups of 32, with the bits needed by the largest of the group, or the
+// plane is stored as it is when that does not make it smaller.
+// The blocks are followed by the offsets of the blocks and a trailer with
+// the counts (see iaea_compress.cpp), all little-endian.
+struct iaea_compressed_file
+{
+  int block_records;         // records per block
+  int reclength;             // bytes per record, 0 until the first is written
+  IAEA_I64 n_records;        // records in the file
+  IAEA_I64 n_blocks;
+  IAEA_I64 *offset;          // of every block, offset[n_blocks] = end of data
+  IAEA_I64 max_blocks;       // room in offset
+
+  // writing
+  unsigned char *stage;      // records not compressed yet
+  int n_staged;
+  unsigned char *out;        // a compressed block
+};
+
+// Last block decompressed by a reader (every cursor has its own)
+struct iaea_compressed_cache
+{
+  IAEA_I64 block;            // block held in records, -1 = none
+  int n_records;
+  unsigned char *records;    // decompressed
+  unsigned char *data;       // compressed, as read from the file
+  IAEA_I64 data_size;        // allocated for data
+};
+
+/* *********************************************************************** */
+// Bytes enough for n records of reclength bytes compressed in one block
+IAEA_I64 iaea_compress_bound(int n, int reclength);
+
+// Compresses n records of reclength bytes into out (iaea_compress_bound
+// bytes). Returns the compressed size.
+IAEA_I64 iaea_compress_block(const unsigned char *records, int n,
+                             int reclength, unsigned char *out);
+
+// Decompresses the block in of size bytes holding n records of reclength
+// bytes into records. Returns OK, or FAIL if the block is damaged.
+int iaea_decompress_block(const unsigned char *in, IAEA_I64 size, int n,
+                          int reclength, unsigned char *records);
+
+// Returns an empty file to be written with block_records records per
+// block, or NULL if out of memory
+iaea_compressed_file *iaea_compressed_new(int block_records);
+
+// Adds n records of reclength bytes, writing every block filled to f.
+// Returns OK or FAIL.
+int iaea_compressed_write(iaea_compressed_file *z, FILE *f,
+                          const unsigned char *records, IAEA_I64 n,
+                          int reclength);
+
+// Writes the records left, the offsets of the blocks and the trailer to
+// f. Returns OK or FAIL.
+int iaea_compressed_close(iaea_compressed_file *z, FILE *f);
+
+// Reads the trailer and the offsets of the blocks of the file open as fd.
+// Returns NULL if it is not a compressed phase space file or is damaged.
+iaea_compressed_file *iaea_compressed_open(int fd);
+
+// Returns up to n_max records starting at record (counted from 0) and
+// sets n_read to their number, at most to the end of the block holding
+// record, which is decompressed into cache (allocated on first use). The
+// records stay valid until the next call. Returns NULL on read errors or
+// damaged blocks.
+const unsigned char *iaea_compressed_read(const iaea_compressed_file *z, int fd,
+                                          iaea_compressed_cache **cache,
+                                          IAEA_I64 record, IAEA_I32 n_max,
+                                          IAEA_I32 *n_read);
+
+void iaea_compressed_free(iaea_compressed_file *z);
+void iaea_compressed_cache_free(iaea_compressed_cache *cache);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * iaea_convert: converts a phase space file to the byte order of this
+ *               machine
+ *
+ * Usage: iaea_convert input [output]
+ *
+ * The names are given without the .IAEAheader/.IAEAphsp extensions.
+ * Without output the input is replaced by the converted files. The records
+ * are swapped block by block without decoding them (see
+ * iaea_convert_source); the header keeps the description, counters and
+ * statistics of the input.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "iaea_phsp.h"
+
+// Replaces name.extension by converted.extension
+static int replace_file(const char *name, const char *converted,
+                        const char *extension)
+{
+   char *from = (char *) malloc(strlen(converted) + strlen(extension) + 1);
+   char *to = (char *) malloc(strlen(name) + strlen(extension) + 1);
+   if(from == NULL || to == NULL) return(1);
+   sprintf(from,"%s%s",converted,extension);
+   sprintf(to,"%s%s",name,extension);
+
+   remove(to);
+   int status = rename(from, to);
+   free(from);
+   free(to);
+   return(status);
+}
+
+int main(int argc, char *argv[])
+{
+   if(argc < 2 || argc > 3)
+   {
+      printf("\n Usage: %s input [output]\n",argv[0]);
+      printf(" (file names without the .IAEAheader/.IAEAphsp extensions,\n");
+      printf("  the input is converted in place without output)\n\n");
+      return(1);
+   }
+
+   IAEA_I32 result, len;
+   IAEA_I32 access_read = 1, access_write = 2;
+
+   IAEA_I32 source;
+   len = (IAEA_I32) strlen(argv[1]);
+   iaea_new_source(&source, argv[1], &access_read, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot open phase space %s (%ld)\n",argv[1],(long)result);
+      return(1);
+   }
+
+   iaea_check_file_size_byte_order(&source, &result);
+   if(argc == 2 && (result == 0 || result == -3))
+   {
+      printf("\n %s is already in the byte order of this machine\n",argv[1]);
+      iaea_destroy_source(&source, &result);
+      return(0);
+   }
+
+   char *output = (char *) malloc(strlen(argv[1]) + 16);
+   if(output == NULL) return(1);
+   if(argc == 3) strcpy(output, argv[2]);
+   else sprintf(output,"%s_converted",argv[1]);
+
+   IAEA_I32 destiny;
+   len = (IAEA_I32) strlen(output);
+   iaea_new_source(&destiny, output, &access_write, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot create phase space %s (%ld)\n",output,(long)result);
+      return(1);
+   }
+
+   iaea_copy_header(&source, &destiny, &result);
+   iaea_convert_source(&source, &destiny, &result);
+   if(result != 0)
+   {
+      printf("\n ERROR: converting the phase space failed (%ld)\n",(long)result);
+      return(1);
+   }
+
+   IAEA_I32 type = -1;
+   IAEA_I64 n_particles;
+   iaea_get_max_particles(&destiny, &type, &n_particles);
+
+   iaea_destroy_source(&source, &result);
+   iaea_destroy_source(&destiny, &result);
+
+   if(argc == 2 && (replace_file(argv[1], output, ".IAEAphsp") != 0 ||
+                    replace_file(argv[1], output, ".IAEAheader") != 0))
+   {
+      printf("\n ERROR: cannot replace %s by %s\n",argv[1],output);
+      return(1);
+   }
+
+   printf("\n Converted %lld particles of %s\n", n_particles, argv[1]);
+   free(output);
+
+   return(0);
+}
@@ -0,0 +1,330 @@
+/******************************************************************************
+ *
+ *  Block decoding of packed IAEA phase space records
+ *
+ *  Records are unpacked DECODE_CHUNK at a time: every stored column is
+ *  gathered into a small scratch array (AVX2 gathers, or a strided scalar
+ *  copy), and the sign handling (particle type -> sign of w, energy -> new
+ *  history) and the reconstruction of w = sqrt(1-u*u-v*v) are then done
+ *  on whole vectors. Compile with -DIAEA_NO_SIMD to get the scalar code
+ *  only.
+ *
+ *****************************************************************************/
+
+#include <cstring>
+#include <cmath>
+#include "iaea_decoder.h"
+
+#if !defined(IAEA_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || \
+                              (defined(_M_IX86_FP) && _M_IX86_FP >= 2) )
+  #define IAEA_SSE2
+  #include <emmintrin.h>
+#endif
+
+#if defined(IAEA_SSE2) && defined(__GNUC__)
+  // AVX2 code is compiled for the target only and selected at run time
+  #define IAEA_AVX2
+  #define IAEA_TARGET_AVX2 __attribute__((target("avx2")))
+  #include <immintrin.h>
+  #define CPU_HAS_AVX2() __builtin_cpu_supports("avx2")
+#elif defined(IAEA_SSE2) && defined(__AVX2__)
+  #define IAEA_AVX2
+  #define IAEA_TARGET_AVX2
+  #include <immintrin.h>
+  #define CPU_HAS_AVX2() 1
+#endif
+
+#define DECODE_CHUNK 256 // records unpacked per pass through the scratch arrays
+
+/* *********************************************************************** */
+// Scalar kernels
+
+static void gather_scalar(const unsigned char *rec, int reclength, int offset,
+                          int m, float *dst)
+{
+  // records are packed, so the floats are not aligned in memory
+  rec += offset;
+  for(int i=0; i<m; i++, rec += reclength) memcpy(dst+i, rec, sizeof(float));
+}
+
+static void gather_type_scalar(const unsigned char *rec, int reclength,
+                               int m, int *dst)
+{
+  for(int i=0; i<m; i++, rec += reclength) dst[i] = ((const signed char *) rec)[0];
+}
+
+static void finish_scalar(int m, int *tc, int *nh, float *e,
+                          float *u, float *v, float *w, int iw)
+{
+  for(int i=0; i<m; i++)
+  {
+    int is = 1; // getting sign of Z director cosine w
+    if(tc[i] < 0) {is = -1; tc[i] = -tc[i];}
+
+    nh[i] = 0;
+    if(e[i] < 0) nh[i] = 1; // like egsnrc
+    e[i] = (float) fabs(e[i]);
+
+    if(iw > 0)
+    {
+      w[i] = 0.f;
+      float aux = u[i]*u[i] + v[i]*v[i];
+      if(aux <= 1.0f) w[i] = (float) (is * sqrt((float)(1.0f - aux)));
+      else
+      {
+        aux = (float) sqrt(aux);
+        u[i] /= aux;
+        v[i] /= aux;
+      }
+    }
+  }
+}
+
+/* *********************************************************************** */
+// SSE2 kernel (no gather instruction, columns are collected by
+// gather_scalar)
+
+#ifdef IAEA_SSE2
+static void finish_sse2(int m, int *tc, int *nh, float *e,
+                        float *u, float *v, float *w, int iw)
+{
+  const __m128  zero = _mm_setzero_ps();
+  const __m128  one  = _mm_set1_ps(1.f);
+  const __m128  abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128i ione = _mm_set1_epi32(1);
+
+  int i = 0;
+  for(; i+4 <= m; i+=4)
+  {
+    __m128i t   = _mm_loadu_si128((const __m128i *)(tc+i));
+    __m128i neg = _mm_srai_epi32(t, 31);             // -1 where w < 0
+    _mm_storeu_si128((__m128i *)(tc+i), _mm_sub_epi32(_mm_xor_si128(t, neg), neg));
+
+    __m128 ev = _mm_loadu_ps(e+i);
+    _mm_storeu_si128((__m128i *)(nh+i),
+                     _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(ev, zero)), ione));
+    _mm_storeu_ps(e+i, _mm_and_ps(ev, abs_mask));
+
+    if(iw > 0)
+    {
+      __m128 uv = _mm_loadu_ps(u+i);
+      __m128 vv = _mm_loadu_ps(v+i);
+      __m128 s  = _mm_add_ps(_mm_mul_ps(uv, uv), _mm_mul_ps(vv, vv));
+      __m128 ok = _mm_cmple_ps(s, one);
+      __m128 ws = _mm_castsi128_ps(_mm_slli_epi32(neg, 31));
+      __m128 wv = _mm_xor_ps(_mm_sqrt_ps(_mm_sub_ps(one, s)), ws);
+      _mm_storeu_ps(w+i, _mm_and_ps(ok, wv));
+
+      // |(u,v)| > 1: w = 0 and (u,v) renormalized
+      __m128 r = _mm_sqrt_ps(s);
+      _mm_storeu_ps(u+i, _mm_or_ps(_mm_and_ps(ok, uv), _mm_andnot_ps(ok, _mm_div_ps(uv, r))));
+      _mm_storeu_ps(v+i, _mm_or_ps(_mm_and_ps(ok, vv), _mm_andnot_ps(ok, _mm_div_ps(vv, r))));
+    }
+  }
+  finish_scalar(m-i, tc+i, nh+i, e+i, u+i, v+i, w+i, iw);
+}
+#endif
+
+/* *********************************************************************** */
+// AVX2 kernels
+
+#ifdef IAEA_AVX2
+IAEA_TARGET_AVX2
+static void gather_avx2(const unsigned char *rec, int reclength, int offset,
+                        int m, float *dst)
+{
+  const __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                         _mm256_set1_epi32(reclength));
+  int i = 0;
+  for(; i+8 <= m; i+=8)
+    _mm256_storeu_ps(dst+i, _mm256_i32gather_ps(
+                     (const float *)(rec + i*reclength + offset), idx, 1));
+  gather_scalar(rec + i*reclength, reclength, offset, m-i, dst+i);
+}
+
+IAEA_TARGET_AVX2
+static void gather_type_avx2(const unsigned char *rec, int reclength,
+                             int m, int *dst)
+{
+  // The 4 bytes gathered at the start of a record are the particle type
+  // and the first bytes of the energy; the type is sign-extended from
+  // the low byte (x86 is little endian)
+  const __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                         _mm256_set1_epi32(reclength));
+  int i = 0;
+  for(; i+8 <= m; i+=8)
+  {
+    __m256i g = _mm256_i32gather_epi32((const int *)(rec + i*reclength), idx, 1);
+    _mm256_storeu_si256((__m256i *)(dst+i),
+                        _mm256_srai_epi32(_mm256_slli_epi32(g, 24), 24));
+  }
+  gather_type_scalar(rec + i*reclength, reclength, m-i, dst+i);
+}
+
+IAEA_TARGET_AVX2
+static void finish_avx2(int m, int *tc, int *nh, float *e,
+                        float *u, float *v, float *w, int iw)
+{
+  const __m256  zero = _mm256_setzero_ps();
+  const __m256  one  = _mm256_set1_ps(1.f);
+  const __m256  abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256i ione = _mm256_set1_epi32(1);
+
+  int i = 0;
+  for(; i+8 <= m; i+=8)
+  {
+    __m256i t   = _mm256_loadu_si256((const __m256i *)(tc+i));
+    __m256i neg = _mm256_srai_epi32(t, 31);          // -1 where w < 0
+    _mm256_storeu_si256((__m256i *)(tc+i), _mm256_abs_epi32(t));
+
+    __m256 ev = _mm256_loadu_ps(e+i);
+    _mm256_storeu_si256((__m256i *)(nh+i), _mm256_and_si256(
+                   _mm256_castps_si256(_mm256_cmp_ps(ev, zero, _CMP_LT_OQ)), ione));
+    _mm256_storeu_ps(e+i, _mm256_and_ps(ev, abs_mask));
+
+    if(iw > 0)
+    {
+      __m256 uv = _mm256_loadu_ps(u+i);
+      __m256 vv = _mm256_loadu_ps(v+i);
+      __m256 s  = _mm256_add_ps(_mm256_mul_ps(uv, uv), _mm256_mul_ps(vv, vv));
+      __m256 ok = _mm256_cmp_ps(s, one, _CMP_LE_OQ);
+      __m256 ws = _mm256_castsi256_ps(_mm256_slli_epi32(neg, 31));
+      __m256 wv = _mm256_xor_ps(_mm256_sqrt_ps(_mm256_sub_ps(one, s)), ws);
+      _mm256_storeu_ps(w+i, _mm256_and_ps(ok, wv));
+
+      // |(u,v)| > 1: w = 0 and (u,v) renormalized
+      __m256 r = _mm256_sqrt_ps(s);
+      _mm256_storeu_ps(u+i, _mm256_blendv_ps(_mm256_div_ps(uv, r), uv, ok));
+      _mm256_storeu_ps(v+i, _mm256_blendv_ps(_mm256_div_ps(vv, r), vv, ok));
+    }
+  }
+  finish_scalar(m-i, tc+i, nh+i, e+i, u+i, v+i, w+i, iw);
+}
+#endif
+
+/* *********************************************************************** */
+
+void iaea_decode_block(const iaea_record_layout *layout,
+                       const float *constant,
+                       const unsigned char *block, IAEA_I32 n,
+                       IAEA_I32 *new_history, IAEA_I32 *type,
+                       IAEA_Float *E, IAEA_Float *wt,
+                       IAEA_Float *x, IAEA_Float *y, IAEA_Float *z,
+                       IAEA_Float *u, IAEA_Float *v, IAEA_Float *w,
+                       IAEA_Float *extra_floats, IAEA_I32 *extra_ints,
+                       IAEA_I32 ld_extra)
+{
+  int   tc[DECODE_CHUNK], nh[DECODE_CHUNK];
+  float e[DECODE_CHUNK], col[7][DECODE_CHUNK];
+  IAEA_Float *out[7] = {x, y, z, u, v, w, wt};
+
+  void (*gather)(const unsigned char *, int, int, int, float *) = gather_scalar;
+  void (*gather_type)(const unsigned char *, int, int, int *) = gather_type_scalar;
+  void (*finish)(int, int *, int *, float *, float *, float *, float *, int) = finish_scalar;
+#ifdef IAEA_SSE2
+  finish = finish_sse2;
+#endif
+#ifdef IAEA_AVX2
+  if( CPU_HAS_AVX2() )
+  {
+     gather = gather_avx2;
+     gather_type = gather_type_avx2;
+     finish = finish_avx2;
+  }
+#endif
+
+  int reclength = layout->reclength;
+  int i, j, k;
+
+  for(IAEA_I32 i0 = 0; i0 < n; i0 += DECODE_CHUNK)
+  {
+    int m = (int) (n - i0 < DECODE_CHUNK ? n - i0 : DECODE_CHUNK);
+    const unsigned char *rec = block + i0*reclength;
+
+    gather_type(rec, reclength, m, tc);
+    gather(rec, reclength, sizeof(char), m, e);
+    for(j=0; j<7; j++)
+    {
+      if(layout->offset[j] >= 0) gather(rec, reclength, layout->offset[j], m, col[j]);
+      else for(i=0; i<m; i++) col[j][i] = constant[j];
+    }
+
+    finish(m, tc, nh, e, col[3], col[4], col[5], layout->iw);
+
+    for(i=0; i<m; i++)
+    {
+      type[i0+i] = tc[i];
+      new_history[i0+i] = nh[i];
+      E[i0+i] = e[i];
+    }
+    for(j=0; j<7; j++)
+    {
+      IAEA_Float *o = out[j] + i0;
+      for(i=0; i<m; i++) o[i] = col[j][i];
+    }
+
+    for(k=0; k<layout->iextrafloat; k++)
+    {
+      gather(rec, reclength, layout->offset_extrafloat + k*sizeof(float), m, e);
+      IAEA_Float *o = extra_floats + k*ld_extra + i0;
+      for(i=0; i<m; i++) o[i] = e[i];
+    }
+    for(k=0; k<layout->iextralong; k++)
+    {
+      const unsigned char *r = rec + layout->offset_extralong + k*sizeof(IAEA_I32);
+      IAEA_I32 *o = extra_ints + k*ld_extra + i0;
+      for(i=0; i<m; i++, r += reclength) memcpy(o+i, r, sizeof(IAEA_I32));
+    }
+  }
+}
+
+/* *********************************************************************** */
+// Byte order. Every quantity of a record but the particle type is a 4
+// byte float, or an extralong of sizeof(IAEA_I32) bytes, so the floats of
+// a record are swapped 16 bytes at a time by reversing the bytes of each
+// 32-bit lane, and the extralongs one by one.
+
+static void swap_scalar(unsigned char *p, int n_words, int size)
+{
+  for(int k=0; k<n_words; k++, p += size)
+    for(int i=0, j=size-1; i<j; i++, j--)
+    {
+      unsigned char t = p[i]; p[i] = p[j]; p[j] = t;
+    }
+}
+
+#ifdef IAEA_SSE2
+static void swap_floats_sse2(unsigned char *p, int n_words)
+{
+  int k = 0;
+  for(; k+4 <= n_words; k+=4, p += 16)
+  {
+    // bytes of each 16-bit half swapped, then the halves of each lane
+    __m128i a = _mm_loadu_si128((const __m128i *) p);
+    a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+    a = _mm_shufflelo_epi16(a, _MM_SHUFFLE(2,3,0,1));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(2,3,0,1));
+    _mm_storeu_si128((__m128i *) p, a);
+  }
+  swap_scalar(p, n_words-k, sizeof(float));
+}
+#endif
+
+void iaea_swap_block(const iaea_record_layout *layout, unsigned char *block,
+                     IAEA_I32 n)
+{
+  int reclength = layout->reclength;
+  int n_floats = (layout->offset_extralong - 1)/sizeof(float); // E included
+  int n_longs = layout->iextralong;
+
+  for(IAEA_I32 i=0; i<n; i++, block += reclength)
+  {
+#ifdef IAEA_SSE2
+    swap_floats_sse2(block + 1, n_floats);
+#else
+    swap_scalar(block + 1, n_floats, sizeof(float));
+#endif
+    // whole extralongs, as stored (see offset_extralong and RECORD_LENGTH)
+    swap_scalar(block + layout->offset_extralong, n_longs, sizeof(IAEA_I32));
+  }
+}
@@ -0,0 +1,53 @@
+/******************************************************************************
+ *
+ *  Block decoding of packed IAEA phase space records
+ *
+ *****************************************************************************/
+#ifndef IAEA_DECODER
+#define IAEA_DECODER
+
+#include "iaea_config.h"
+
+/* *********************************************************************** */
+// Byte layout of a packed record. It only depends on which quantities
+// are stored (ix,iy,iz,iu,iv,iweight,iextrafloat,iextralong), which is
+// fixed for the lifetime of a source, so it is derived once by
+// iaea_record_type::set_layout() and then shared by all block decodes.
+struct iaea_record_layout
+{
+  int reclength;          // bytes per record
+  int offset[7];          // byte offset of x,y,z,u,v,w,weight inside the
+                          // record, -1 if the quantity is not stored
+                          // (w is never stored, offset[5] is always -1)
+  int iw;                 // w has to be reconstructed from u, v
+  int iextrafloat;        // number of extra floats ...
+  int offset_extrafloat;  // ... stored from this offset on
+  int iextralong;         // number of extra longs ...
+  int offset_extralong;   // ... stored from this offset on
+};
+
+/* *********************************************************************** */
+// Decodes n consecutive records of block into the caller arrays.
+// constant[0..6] holds x,y,z,u,v,w,weight used for quantities that are
+// not stored. new_history[i] is set to 1 if the energy was negative.
+// Extra variables go to extra_floats[k*ld_extra+i] and
+// extra_ints[k*ld_extra+i]. The unpacking uses AVX2 or SSE2 when
+// available (AVX2 is selected at run time) and a scalar loop otherwise;
+// all variants give identical results.
+void iaea_decode_block(const iaea_record_layout *layout,
+                       const float *constant,
+                       const unsigned char *block, IAEA_I32 n,
+                       IAEA_I32 *new_history, IAEA_I32 *type,
+                       IAEA_Float *E, IAEA_Float *wt,
+                       IAEA_Float *x, IAEA_Float *y, IAEA_Float *z,
+                       IAEA_Float *u, IAEA_Float *v, IAEA_Float *w,
+                       IAEA_Float *extra_floats, IAEA_I32 *extra_ints,
+                       IAEA_I32 ld_extra);
+
+// Reverses the byte order of every quantity of the n records of block
+// (written on a machine of the other byte order), in place. Uses SSE2
+// when available.
+void iaea_swap_block(const iaea_record_layout *layout, unsigned char *block,
+                     IAEA_I32 n);
+
+#endif
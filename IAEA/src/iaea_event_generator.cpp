@@ -7,6 +7,7 @@
 #include "iaea_event_generator.h"
 
 #include <string>
+#include <vector>
 #include <iostream>
 #include <cstring>
 
@@ -44,6 +45,9 @@ typedef void (*SetParallel)(const IAEA_I32 *,const IAEA_I32 *,const IAEA_I32 *,c
 typedef void (*GetParticle)(const IAEA_I32 *,IAEA_I32 *, IAEA_I32 *,
    float *,float *,float *,float *,float *,float *,float *,float *,float *,
    IAEA_I32 *);
+typedef void (*GetParticles)(const IAEA_I32 *,const IAEA_I32 *,IAEA_I32 *,
+   IAEA_I32 *,IAEA_I32 *,float *,float *,float *,float *,float *,float *,
+   float *,float *,float *,IAEA_I32 *);
 typedef void (*Destroy)(const IAEA_I32 *,IAEA_I32 *);
 
 class PrivateEventGenerator {
@@ -56,11 +60,14 @@ public:
 
     void *resolve(const char *symb);
     void *tryResolve(const char *funcname);
+    int   addInstance();
+    void  setStreams(IAEA_I32 *is_ok);
 
     int         ok;
     string      libname;
+    string      inputfile;
     DLL_HANDLE  lib;
-    IAEA_I32    source_id;
+    IAEA_I32    source_id;     // the first instance
 
     InitLib     createSource;
     GetFloat1   getMaximumEnergy;
@@ -72,8 +79,22 @@ public:
     //GetFloat1   getFluence;
     SetParallel setParallelRun;
     GetParticle getNextParticle;
+    GetParticles getNextParticles; // optional, 0 => getNextParticle is looped
     Destroy     destroySource;
 
+    IAEA_I32    n_extra_float, n_extra_long;
+
+    // Instances of the generator in the library, one per thread
+    struct Instance {
+        IAEA_I32         id;
+        vector<float>    extra_floats;  // one particle, for the loop
+        vector<IAEA_I32> extra_longs;
+    };
+    vector<Instance> instances;
+
+    // Last setParallelRun (n_chunk = 0 if not called)
+    IAEA_I32    i_parallel, i_chunk, n_chunk;
+
 };
 
 
@@ -118,8 +139,8 @@ void IAEA_EventGenerator::getTypeExtraFloatVariable(IAEA_I32 *index,
 void IAEA_EventGenerator::getTypeExtraVariables(IAEA_I32 *index, IAEA_I32 *res,
               IAEA_I32 long_types[],IAEA_I32 float_types[]) const {
     if( !p->ok ) { *res = -1; return; }
-    int nf, ni; p->getExtraNumbers(&p->source_id,&nf,&ni);
-    int j;
+    IAEA_I32 nf, ni; p->getExtraNumbers(&p->source_id,&nf,&ni);
+    IAEA_I32 j;
     for(j=0; j<ni; j++) 
         p->getTypeExtraLongVariable(&p->source_id,&j,&long_types[j]);
     for(j=0; j<nf; j++) 
@@ -128,8 +149,16 @@ void IAEA_EventGenerator::getTypeExtraVariables(IAEA_I32 *index, IAEA_I32 *res,
 }
 
 void IAEA_EventGenerator::getOriginalHistories(IAEA_I64 *nstat) const {
-    if( p->ok ) p->getNstat(&p->source_id,nstat);
-    else *nstat = -1;
+    *nstat = -1;
+    if( !p->ok ) return;
+    // Summed over the instances of all threads
+    IAEA_I64 sum = 0;
+    for(size_t t=0; t<p->instances.size(); t++) {
+        IAEA_I64 n; p->getNstat(&p->instances[t].id,&n);
+        if( n < 0 ) return;
+        sum += n;
+    }
+    *nstat = sum;
 }
 
 /*
@@ -139,25 +168,101 @@ void IAEA_EventGenerator::getFluence(float *fluence) const {
 }
 */
 
+void IAEA_EventGenerator::getOriginalHistories(const IAEA_I32 *i_thread,
+                                               IAEA_I64 *nstat) const {
+    if( p->ok && *i_thread >= 1 && *i_thread <= (IAEA_I32) p->instances.size() )
+        p->getNstat(&p->instances[*i_thread-1].id,nstat);
+    else *nstat = -1;
+}
+
 void IAEA_EventGenerator::setParallelRun(const IAEA_I32 *i_parallel,
       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, IAEA_I32 *is_ok) const {
-    if( p->ok ) 
-        p->setParallelRun(&p->source_id,i_parallel,i_chunk,n_chunk,is_ok);
-    else *is_ok = -1;
+    if( !p->ok ) { *is_ok = -1; return; }
+    p->i_parallel = *i_parallel; p->i_chunk = *i_chunk; p->n_chunk = *n_chunk;
+    p->setStreams(is_ok);
+}
+
+void IAEA_EventGenerator::setThreads(const IAEA_I32 *n_threads, 
+                                     IAEA_I32 *is_ok) {
+    if( !p->ok || *n_threads < 1 ) { *is_ok = -1; return; }
+    while( (IAEA_I32) p->instances.size() > *n_threads ) {
+        IAEA_I32 failed;
+        p->destroySource(&p->instances.back().id,&failed);
+        p->instances.pop_back();
+    }
+    *is_ok = 0;
+    while( (IAEA_I32) p->instances.size() < *n_threads && *is_ok == 0 )
+        *is_ok = p->addInstance();
+    if( *is_ok == 0 && (p->n_chunk > 0 || *n_threads > 1) ) p->setStreams(is_ok);
+}
+
+IAEA_I32 IAEA_EventGenerator::getThreads() const {
+    return (IAEA_I32) p->instances.size();
 }
 
 void IAEA_EventGenerator::getNextParticle(IAEA_I32 *n_stat,
      IAEA_I32 *type, float *E, float *wt, 
      float *x, float *y, float *z, float *u, float *v, float *w, 
      float *extra_floats, IAEA_I32 *extra_longs) const {
-    if( p->ok ) p->getNextParticle(&p->source_id,n_stat,type,
+    IAEA_I32 i_thread = 1;
+    getNextParticle(&i_thread,n_stat,type,E,wt,x,y,z,u,v,w,
+                    extra_floats,extra_longs);
+}
+
+void IAEA_EventGenerator::getNextParticle(const IAEA_I32 *i_thread,
+     IAEA_I32 *n_stat, IAEA_I32 *type, float *E, float *wt, 
+     float *x, float *y, float *z, float *u, float *v, float *w, 
+     float *extra_floats, IAEA_I32 *extra_longs) const {
+    if( p->ok && *i_thread >= 1 && *i_thread <= (IAEA_I32) p->instances.size() )
+        p->getNextParticle(&p->instances[*i_thread-1].id,n_stat,type,
                     E,wt,x,y,z,u,v,w,extra_floats,extra_longs);
     else *n_stat = -1;
 }
 
+void IAEA_EventGenerator::getNextParticles(const IAEA_I32 *n_max,
+     IAEA_I32 *n_read, IAEA_I32 *n_stat, IAEA_I32 *type, float *E, 
+     float *wt, float *x, float *y, float *z, float *u, float *v, float *w,
+     float *extra_floats, IAEA_I32 *extra_longs) const {
+    IAEA_I32 i_thread = 1;
+    getNextParticles(&i_thread,n_max,n_read,n_stat,type,E,wt,x,y,z,u,v,w,
+                     extra_floats,extra_longs);
+}
+
+void IAEA_EventGenerator::getNextParticles(const IAEA_I32 *i_thread,
+     const IAEA_I32 *n_max, IAEA_I32 *n_read, IAEA_I32 *n_stat,
+     IAEA_I32 *type, float *E, float *wt, float *x, float *y, float *z,
+     float *u, float *v, float *w, float *extra_floats,
+     IAEA_I32 *extra_longs) const {
+    if( !p->ok || *i_thread < 1 || *i_thread > (IAEA_I32) p->instances.size() )
+        { *n_read = -1; return; }
+    PrivateEventGenerator::Instance &g = p->instances[*i_thread-1];
+    if( p->getNextParticles ) {
+        p->getNextParticles(&g.id,n_max,n_read,n_stat,type,
+                    E,wt,x,y,z,u,v,w,extra_floats,extra_longs);
+        return;
+    }
+    // No batch function in the library: one call per particle, the extra
+    // variables of each scattered to the (n_max,n_extra) arrays
+    float    *ef = p->n_extra_float > 0 ? &g.extra_floats[0] : 0;
+    IAEA_I32 *el = p->n_extra_long > 0 ? &g.extra_longs[0] : 0;
+    IAEA_I32 i, k;
+    for(i=0; i<*n_max; i++) {
+        p->getNextParticle(&g.id,&n_stat[i],&type[i],&E[i],&wt[i],
+                    &x[i],&y[i],&z[i],&u[i],&v[i],&w[i],ef,el);
+        if( n_stat[i] < 0 ) break;
+        for(k=0; k<p->n_extra_float; k++) extra_floats[k*(*n_max)+i] = ef[k];
+        for(k=0; k<p->n_extra_long; k++) extra_longs[k*(*n_max)+i] = el[k];
+    }
+    // the end of the stream (-2) or an error on the first particle
+    if( i == 0 && *n_max > 0 ) *n_read = (n_stat[0] == -2) ? -2 : -1;
+    else *n_read = i;
+}
+
 PrivateEventGenerator::PrivateEventGenerator(const char *lib_name,
                          const char *input_file) {
-    lib = 0; ok = false;
+    lib = 0; ok = false; getNextParticles = 0;
+    n_extra_float = n_extra_long = 0;
+    i_parallel = 0; i_chunk = 1; n_chunk = 0;
     if( !lib_name ) return;
 #ifdef WIN32
     libname = lib_name;
@@ -211,6 +316,8 @@ PrivateEventGenerator::PrivateEventGenerator(const char *lib_name,
     if( !getNextParticle ) return;
     destroySource = (Destroy) tryResolve("destroy_source");
     if( !destroySource ) return;
+    // Generators may also give blocks of particles
+    getNextParticles = (GetParticles) tryResolve("get_next_particles");
 
     IAEA_I32 result; int slen = strlen(input_file);
     createSource(&source_id,input_file,&result,slen);
@@ -222,10 +329,49 @@ PrivateEventGenerator::PrivateEventGenerator(const char *lib_name,
         return;
     }
 
+    getExtraNumbers(&source_id,&n_extra_float,&n_extra_long);
+    if( n_extra_float < 0 ) n_extra_float = 0;
+    if( n_extra_long < 0 ) n_extra_long = 0;
+
+    inputfile = input_file;
+    instances.resize(1);
+    instances[0].id = source_id;
+    instances[0].extra_floats.resize(n_extra_float);
+    instances[0].extra_longs.resize(n_extra_long);
+
     ok = true;
     
 }
 
+int PrivateEventGenerator::addInstance() {
+    // One more instance of the generator, from the same input file
+    Instance g;
+    IAEA_I32 result; int slen = inputfile.size();
+    createSource(&g.id,inputfile.c_str(),&result,slen);
+    if( result ) {
+        IAEA_I32 failed; destroySource(&g.id,&failed);
+        return result;
+    }
+    g.extra_floats.resize(n_extra_float);
+    g.extra_longs.resize(n_extra_long);
+    instances.push_back(g);
+    return 0;
+}
+
+void PrivateEventGenerator::setStreams(IAEA_I32 *is_ok) {
+    // Chunk i_chunk of n_chunk is divided among the instances: instance t
+    // (from 0) of n runs chunk (i_chunk-1)*n + t+1 of n_chunk*n
+    IAEA_I32 n = instances.size();
+    IAEA_I32 nc = (n_chunk > 0) ? n_chunk : 1;
+    IAEA_I32 ic = (n_chunk > 0) ? i_chunk : 1;
+    IAEA_I32 n_all = nc*n;
+    *is_ok = 0;
+    for(IAEA_I32 t=0; t<n && *is_ok == 0; t++) {
+        IAEA_I32 i_all = (ic - 1)*n + t + 1;
+        setParallelRun(&instances[t].id,&i_parallel,&i_all,&n_all,is_ok);
+    }
+}
+
 void *PrivateEventGenerator::resolve(const char *symb) {
     if( !lib ) return 0;
     return RESOLVE_SYMBOL(lib,symb);
@@ -254,12 +400,13 @@ void *PrivateEventGenerator::tryResolve(const char *symb) {
     
 PrivateEventGenerator::~PrivateEventGenerator() {
     if( lib ) {
-        IAEA_I32 failed;
-        destroySource(&source_id,&failed);
-        if( failed ) {
+        for(size_t t=0; t<instances.size(); t++) {
+            IAEA_I32 failed;
+            destroySource(&instances[t].id,&failed);
 #ifdef DEBUG
-            cerr << "\n **** Failed to destroy source " << source_id << 
-             " from library " << libname << ": error code = " << failed << endl;
+            if( failed ) cerr << "\n **** Failed to destroy source " << 
+                instances[t].id << " from library " << libname << 
+                ": error code = " << failed << endl;
 #endif
         }
         int result = FREE_LIBRARY(lib);
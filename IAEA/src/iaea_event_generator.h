@@ -49,6 +49,50 @@ public:
            float *x, float *y, float *z, float *u, float *v, float *w,
            float *extra_floats, IAEA_I32 *extra_longs) const;
 
+    /*
+     *  Get up to n_max particles at once into arrays with one entry per
+     *  particle, n_read set to their number. As for iaea_get_particles,
+     *  extra_floats[k*n_max+i] is the k-th extra float of particle i
+     *  and extra_longs[k*n_max+i] its k-th extra long. Libraries may
+     *  export get_next_particles with these arguments (after the source
+     *  id) to fill the arrays in one call; otherwise get_next_particle
+     *  is called for every particle. n_read is -2 if the generator
+     *  ended before giving any particle and -1 if it failed.
+     *
+     */
+    void getNextParticles(const IAEA_I32 *n_max, IAEA_I32 *n_read,
+           IAEA_I32 *n_stat, IAEA_I32 *type, float *E, float *wt,
+           float *x, float *y, float *z, float *u, float *v, float *w,
+           float *extra_floats, IAEA_I32 *extra_longs) const;
+
+    /*
+     *  Run n_threads instances of the generator, one per thread, created
+     *  here (not concurrently) from the same input file; the existing
+     *  instance stays the first. Thread i_thread (1..n_threads) then gets
+     *  its particles with the overloads below, which may be called by all
+     *  threads at the same time: get_next_particle(s) of different source
+     *  ids must not share state in the library. The chunk set with
+     *  setParallelRun is divided among the instances, instance t getting
+     *  chunk (i_chunk-1)*n_threads+t of n_chunk*n_threads, so that a
+     *  library using a random stream per chunk (see iaea_random.h) gives
+     *  independent particles to every thread. getOriginalHistories adds
+     *  the histories of all instances, its overload with i_thread those
+     *  of one. The calls without i_thread use the first instance.
+     *
+     */
+    void setThreads(const IAEA_I32 *n_threads, IAEA_I32 *is_ok);
+    IAEA_I32 getThreads() const;
+    void getOriginalHistories(const IAEA_I32 *i_thread, IAEA_I64 *nstat) const;
+    void getNextParticle(const IAEA_I32 *i_thread, IAEA_I32 *n_stat,
+           IAEA_I32 *type, float *E, float *wt,
+           float *x, float *y, float *z, float *u, float *v, float *w,
+           float *extra_floats, IAEA_I32 *extra_longs) const;
+    void getNextParticles(const IAEA_I32 *i_thread, const IAEA_I32 *n_max,
+           IAEA_I32 *n_read, IAEA_I32 *n_stat, IAEA_I32 *type,
+           float *E, float *wt,
+           float *x, float *y, float *z, float *u, float *v, float *w,
+           float *extra_floats, IAEA_I32 *extra_longs) const;
+
 private:
 
     PrivateEventGenerator *p;
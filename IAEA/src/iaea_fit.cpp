@@ -0,0 +1,161 @@
+/*
+ * iaea_fit: builds a histogram model of a phase space
+ *
+ * Usage: iaea_fit input output [library]
+ *
+ * The names are given without the .IAEAheader/.IAEAphsp extensions. The
+ * input is read once and reduced to histograms per particle type (see
+ * iaea_model.h), written to output.IAEAmodel, together with the header
+ * output.IAEAheader of an event generator sampling them with library
+ * (iaea_model by default, built from model_event_generator.cpp; found,
+ * like the model, next to the header). Opening output with
+ * iaea_new_source thus gives particles like those of the input, without
+ * reading it. Extra variables are not modelled.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "iaea_phsp.h"
+#include "utilities.h"
+#include "iaea_model.h"
+
+#define FIT_BLOCK 4096
+
+static const char *type_names[MODEL_TYPES] =
+   {"photons", "electrons", "positrons", "neutrons", "protons"};
+
+// The header of the event generator: the mandatory keywords, the model
+// as its input file and the library
+static int write_header(const char *output, IAEA_I32 index,
+                        const char *input, const char *library)
+{
+   char name[4096];
+   if(strlen(output) + 12 > sizeof(name)) return(FAIL);
+   sprintf(name, "%s.IAEAheader", output);
+   FILE *f = fopen(name, "w");
+   if(f == NULL) return(FAIL);
+
+   const char *base = output;
+   for(const char *c = output; *c; c++) if(*c == '/' || *c == '\\') base = c+1;
+
+   fprintf(f, "$IAEA_INDEX:\n%ld   // Histogram model\n\n", (long) index);
+   fprintf(f, "$TITLE:\nHistogram model of %s\n\n", input);
+   fprintf(f, "$FILE_TYPE:\n1\n\n$CHECKSUM:\n0\n\n");
+   fprintf(f, "$RECORD_CONTENTS:\n"
+              "    1     // X is stored ?\n"
+              "    1     // Y is stored ?\n"
+              "    1     // Z is stored ?\n"
+              "    1     // U is stored ?\n"
+              "    1     // V is stored ?\n"
+              "    1     // W is stored ?\n"
+              "    1     // Weight is stored ?\n"
+              "    0     // Extra floats stored ?\n"
+              "    0     // Extra longs stored ?\n\n");
+   fprintf(f, "$RECORD_CONSTANT:\n\n$RECORD_LENGTH:\n33\n\n$BYTE_ORDER:\n1234\n\n");
+   fprintf(f, "$INPUT_FILE_FOR_EVENT_GENERATOR:\n%s.IAEAmodel\n\n", base);
+   fprintf(f, "$EVENT_GENERATOR_LIBRARY:\n%s\n\n", library);
+   fprintf(f, "$TRANSPORT_PARAMETERS:\n\n$MACHINE_TYPE:\n\n"
+              "$MONTE_CARLO_CODE_VERSION:\n\n"
+              "$GLOBAL_PHOTON_ENERGY_CUTOFF:\n  0.00000 \n"
+              "$GLOBAL_PARTICLE_ENERGY_CUTOFF:\n  0.00000 \n"
+              "$COORDINATE_SYSTEM_DESCRIPTION:\n\n"
+              "$BEAM_NAME:\n\n$FIELD_SIZE:\n\n$NOMINAL_SSD:\n\n"
+              "$MC_INPUT_FILENAME:\n\n$VARIANCE_REDUCTION_TECHNIQUES:\n\n"
+              "$INITIAL_SOURCE_DESCRIPTION:\n\n$PUBLISHED_REFERENCE:\n\n"
+              "$AUTHORS:\n\n$INSTITUTION:\n\n$LINK_VALIDATION:\n\n"
+              "$ADDITIONAL_NOTES:\n\n");
+   return (fclose(f) == 0) ? OK : FAIL;
+}
+
+int main(int argc, char *argv[])
+{
+   if(argc < 3 || argc > 4)
+   {
+      printf("\n Usage: %s input output [library]\n",argv[0]);
+      printf(" (file names without the .IAEAheader/.IAEAphsp extensions)\n\n");
+      return(1);
+   }
+   const char *library = (argc == 4) ? argv[3] : "iaea_model";
+
+   IAEA_I32 result, len, index;
+   IAEA_I32 access_read = 1;
+
+   IAEA_I32 source;
+   len = (IAEA_I32) strlen(argv[1]);
+   iaea_new_source(&source, argv[1], &access_read, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot open phase space %s (%ld)\n",argv[1],(long)result);
+      return(1);
+   }
+   index = result;
+
+   iaea_model *m = iaea_model_new(MODEL_POSITION_BINS, MODEL_POSITION_BINS,
+                                  MODEL_RADIAL_BINS, MODEL_ENERGY_BINS);
+   if(m == NULL)
+   {
+      printf("\n ERROR: out of memory\n");
+      return(1);
+   }
+
+   // Blocks of particles, the extra variables are read and dropped
+   IAEA_I32 n_max = FIT_BLOCK, n_read, n_extra_float, n_extra_long;
+   iaea_get_extra_numbers(&source, &n_extra_float, &n_extra_long);
+   IAEA_I32 *n_stat = new IAEA_I32[FIT_BLOCK], *type = new IAEA_I32[FIT_BLOCK];
+   IAEA_Float *E = new IAEA_Float[9*FIT_BLOCK];
+   IAEA_Float *wt = E + FIT_BLOCK, *x = wt + FIT_BLOCK, *y = x + FIT_BLOCK;
+   IAEA_Float *z = y + FIT_BLOCK, *u = z + FIT_BLOCK, *v = u + FIT_BLOCK;
+   IAEA_Float *w = v + FIT_BLOCK;
+   IAEA_Float *extra_floats = new IAEA_Float[(n_extra_float+1)*FIT_BLOCK];
+   IAEA_I32 *extra_longs = new IAEA_I32[(n_extra_long+1)*FIT_BLOCK];
+
+   IAEA_I64 n_particles = 0;
+   for(;;)
+   {
+      iaea_get_particles(&source, &n_max, &n_read, n_stat, type, E, wt,
+                         x, y, z, u, v, w, extra_floats, extra_longs);
+      if(n_read == -2) break;
+      if(n_read < 0)
+      {
+         printf("\n ERROR: reading %s failed (%ld)\n",argv[1],(long)n_read);
+         return(1);
+      }
+      if(iaea_model_add(m, n_read, type, E, wt, x, y, z, u, v, w) != OK)
+      {
+         printf("\n ERROR: out of memory\n");
+         return(1);
+      }
+      n_particles += n_read;
+      if(n_read < n_max) break;
+   }
+
+   iaea_get_total_original_particles(&source, &m->orig_histories);
+   if(m->orig_histories <= 0)
+      iaea_get_used_original_particles(&source, &m->orig_histories);
+   iaea_destroy_source(&source, &result);
+
+   char name[4096];
+   if(strlen(argv[2]) + 11 > sizeof(name)) return(1);
+   sprintf(name, "%s.IAEAmodel", argv[2]);
+   if(iaea_model_write(m, name) != OK ||
+      write_header(argv[2], index, argv[1], library) != OK)
+   {
+      printf("\n ERROR: cannot write the model %s\n",argv[2]);
+      return(1);
+   }
+
+   printf("\n Read %lld particles of %s (%lld histories)\n",
+          n_particles, argv[1], m->orig_histories);
+   for(int i=0; i<MODEL_TYPES; i++) if(m->type[i].n_particles > 0)
+      printf("   %-10s %12lld particles, weight %g\n", type_names[i],
+             m->type[i].n_particles, m->type[i].weight);
+   printf(" Bins: %g cm in x, %g cm in y, %g cm in r, %g MeV in E\n",
+          m->x_width, m->y_width, m->r_width, m->e_width);
+   printf(" Model written to %s, event generator header %s.IAEAheader\n",
+          name, argv[2]);
+
+   delete [] n_stat; delete [] type; delete [] E;
+   delete [] extra_floats; delete [] extra_longs;
+   iaea_model_free(m);
+   return(0);
+}
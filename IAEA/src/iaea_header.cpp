@@ -59,14 +59,23 @@
 
 int iaea_header_type::read_header ()
 {
-    char line[MAX_STR_LEN]; 
-    
     if(fheader==NULL)
     {
       printf("\n ERROR: Unable to open header file \n"); 
         return(FAIL);
     }
 
+    // The header file is read once; blocks are then found in the index
+    if( index_header() != OK ) {free_index(); return(FAIL);}
+    int status = parse_header();
+    free_index();
+    return(status);
+}
+
+int iaea_header_type::parse_header ()
+{
+    char line[MAX_STR_LEN]; 
+
   // ******************************************************************************
   // 1. PHSP format
 
@@ -102,6 +111,11 @@ int iaea_header_type::read_header ()
       }
       else byte_order = atoi(line); 
 
+      /*********************************************/
+      // Optional, only for compressed phase space files
+      compression_block = 0;
+      if ( read_block(line,"COMPRESSION") == OK ) compression_block = atoi(line);
+
       /*********************************************/
     if( get_blockname(line,"RECORD_CONTENTS") == FAIL) 
     {
@@ -114,21 +128,21 @@ int iaea_header_type::read_header ()
 
     for (i=0;i<9;i++)
     {
-      if( get_string(fheader,line) == FAIL ) return FAIL;
+      if( next_line(line) == FAIL ) return FAIL;
       if( *line == SEGMENT_BEG_TOKEN ) break; 
       record_contents[i] = atoi(line); 
     };
 
     for(i=0;i<record_contents[7];i++) 
     {
-      if( get_string(fheader,line) == FAIL ) return FAIL;
+      if( next_line(line) == FAIL ) return FAIL;
       if( *line == SEGMENT_BEG_TOKEN ) break; 
       extrafloat_contents[i] = atoi(line); 
     }
     
     for(i=0;i<record_contents[8];i++) 
     {
-      if( get_string(fheader,line) == FAIL ) return FAIL;
+      if( next_line(line) == FAIL ) return FAIL;
       if( *line == SEGMENT_BEG_TOKEN ) break; 
       extralong_contents[i] = atoi(line); 
     }
@@ -144,7 +158,7 @@ int iaea_header_type::read_header ()
     {
         record_constant[i] = 32000.f;
         if(record_contents[i] > 0) continue;
-        if( get_string(fheader,line) == FAIL ) return FAIL;
+        if( next_line(line) == FAIL ) return FAIL;
         if( *line == SEGMENT_BEG_TOKEN ) break; 
         record_constant[i] = (float)atof(line); 
     };
@@ -152,7 +166,7 @@ int iaea_header_type::read_header ()
 // ******************************************************************************
 // 2. Mandatory description of the phsp
 
-      if ( read_block(coordinate_system_description,"COORDINATE_SYSTEM_DESCRIPTION") == FAIL)   
+      if ( read_text(&coordinate_system_description,"COORDINATE_SYSTEM_DESCRIPTION") == FAIL)   
       {
             printf("\nMandatory keyword COORDINATE_SYSTEM_DESCRIPTION is not defined in input\n");
             return FAIL;
@@ -161,11 +175,15 @@ int iaea_header_type::read_header ()
   if(file_type == 1) // For event generators
   {
     /*********************************************/
-      if ( read_block(line,"INPUT_FILE_FOR_EVENT_GENERATOR") == FAIL ) 
+      if ( read_text(&input_file_for_event_generator,"INPUT_FILE_FOR_EVENT_GENERATOR") == FAIL ) 
       {
             printf("\nMandatory keyword INPUT_FILE_FOR_EVENT_GENERATOR is not defined in input\n");
             return FAIL;
       }
+
+      /*********************************************/
+      // Optional, the header name is used if not given
+      read_text(&event_generator_library,"EVENT_GENERATOR_LIBRARY");
   }
 
   if(file_type == 0) // for phsp files
@@ -214,21 +232,21 @@ int iaea_header_type::read_header ()
       else iaea_index = atoi(line); 
 
       /*********************************************/
-      if ( read_block(title,"TITLE") == FAIL ) 
+      if ( read_text(&title,"TITLE") == FAIL ) 
       {
             printf("\nMandatory keyword TITLE is not defined in input\n");
             return FAIL;
       }
 
       /*********************************************/
-      if ( read_block(machine_type,"MACHINE_TYPE") == FAIL) 
+      if ( read_text(&machine_type,"MACHINE_TYPE") == FAIL) 
       {
             printf("\nMandatory keyword MACHINE_TYPE is not defined in input\n");
             return FAIL;
       }
  
       /*********************************************/
-      if ( read_block(MC_code_and_version,"MONTE_CARLO_CODE_VERSION") == FAIL ) 
+      if ( read_text(&MC_code_and_version,"MONTE_CARLO_CODE_VERSION") == FAIL ) 
       {
             printf("\nMandatory keyword MONTE_CARLO_CODE_VERSION is not defined in input\n");
             return FAIL;
@@ -251,7 +269,7 @@ int iaea_header_type::read_header ()
       else global_particle_energy_cutoff = (float)atof(line); 
 
       /*********************************************/
-      if ( read_block(transport_parameters,"TRANSPORT_PARAMETERS") == FAIL ) 
+      if ( read_text(&transport_parameters,"TRANSPORT_PARAMETERS") == FAIL ) 
       {
             printf("\nMandatory keyword TRANSPORT_PARAMETERS is not defined in input\n");
             return FAIL;
@@ -260,29 +278,29 @@ int iaea_header_type::read_header ()
 // ******************************************************************************
 // 4. Optional description
 
-      if ( read_block(beam_name,"BEAM_NAME") == FAIL ) 
+      if ( read_text(&beam_name,"BEAM_NAME") == FAIL ) 
             printf("ERROR reading BEAM_NAME\n");
-      if ( read_block(field_size,"FIELD_SIZE") == FAIL ) 
+      if ( read_text(&field_size,"FIELD_SIZE") == FAIL ) 
             printf("ERROR reading FIELD_SIZE\n");
-      if ( read_block(nominal_SSD,"NOMINAL_SSD") == FAIL ) 
+      if ( read_text(&nominal_SSD,"NOMINAL_SSD") == FAIL ) 
             printf("ERROR reading NOMINAL_SSD\n");
-      if ( read_block(variance_reduction_techniques,
-                        "VARIANCE_REDUCTION_TECHNIQUES") == FAIL ) 
+      if ( read_text(&variance_reduction_techniques,
+                       "VARIANCE_REDUCTION_TECHNIQUES") == FAIL ) 
             printf("VARIANCE_REDUCTION_TECHNIQUES\n");
-      if ( read_block(initial_source_description,"INITIAL_SOURCE_DESCRIPTION") == FAIL ) 
+      if ( read_text(&initial_source_description,"INITIAL_SOURCE_DESCRIPTION") == FAIL ) 
             printf("INITIAL_SOURCE_DESCRIPTION:\n");
   
       // Documentation sub-section
       /*********************************************/
-      if ( read_block(MC_input_filename,"MC_INPUT_FILENAME") == FAIL ) 
+      if ( read_text(&MC_input_filename,"MC_INPUT_FILENAME") == FAIL ) 
             printf("MC_INPUT_FILENAME\n");
-      if ( read_block(published_reference,"PUBLISHED_REFERENCE") == FAIL ) 
+      if ( read_text(&published_reference,"PUBLISHED_REFERENCE") == FAIL ) 
             printf("PUBLISHED_REFERENCE\n");
-      if ( read_block(authors,"AUTHORS") == FAIL ) printf("AUTHORS\n");
-      if ( read_block(institution,"INSTITUTION") == FAIL ) printf("INSTITUTION\n");
-      if ( read_block(link_validation,"LINK_VALIDATION") == FAIL ) 
+      if ( read_text(&authors,"AUTHORS") == FAIL ) printf("AUTHORS\n");
+      if ( read_text(&institution,"INSTITUTION") == FAIL ) printf("INSTITUTION\n");
+      if ( read_text(&link_validation,"LINK_VALIDATION") == FAIL ) 
             printf("LINK_VALIDATION\n");
-      if ( read_block(additional_notes,"ADDITIONAL_NOTES") == FAIL ) 
+      if ( read_text(&additional_notes,"ADDITIONAL_NOTES") == FAIL ) 
             printf("ADDITIONAL_NOTES\n");
 
 // ******************************************************************************
@@ -292,7 +310,7 @@ int iaea_header_type::read_header ()
     {
         for(i=0;i<MAX_NUM_PARTICLES;i++) 
         {
-              if( get_string(fheader,line) == FAIL ) return FAIL;
+              if( next_line(line) == FAIL ) return FAIL;
               if( *line == SEGMENT_BEG_TOKEN ) break;
 
               if(particle_number[i] == 0) continue;
@@ -324,7 +342,7 @@ int iaea_header_type::read_header ()
         {
             if(record_contents[i] == 1) 
             {
-                  if( get_string(fheader,line) == FAIL ) return FAIL;
+                  if( next_line(line) == FAIL ) return FAIL;
                   if( *line == SEGMENT_BEG_TOKEN ) break;
 
                 // -------------------------------------------------------
@@ -354,46 +372,122 @@ int iaea_header_type::write_blockname(char *blockname)
   (fprintf(fheader,"%c%s%c\n",SEGMENT_BEG_TOKEN,blockname,SEGMENT_END_TOKEN));
 }
 
-int iaea_header_type::get_blockname(char *line, char *blockname)
+// Lines of the header file as returned by get_string (comments removed,
+// empty lines skipped) together with the position of every block
+struct iaea_header_index
+{
+  char *text;       // the lines, each one terminated by '\0'
+  long text_size;   // allocated and ...
+  long text_used;   // ... used bytes of text
+  long *line;       // offset of every line in text
+  int n_lines, max_lines;
+  int *block;       // line numbers of the "$KEYWORD:" lines
+  int n_blocks;
+  int next;         // line returned by the next call to next_line()
+  char *block_text; // text block being read by read_text()
+};
+
+int iaea_header_type::index_header()
 {
-  char *begptr, *endptr;
+  // Reads the whole header file once, in a single pass
+  char line[MAX_STR_LEN];
 
-  // printf("                       Reading block: %s ...\n",blockname);
+  free_index();
+  index = (iaea_header_index *) calloc(1, sizeof(iaea_header_index));
+  if(index == NULL) return(FAIL);
+  index->block_text = (char *) malloc(MAX_STR_LEN*MAX_NUMB_LINES+1);
+  if(index->block_text == NULL) return(FAIL);
 
-  if(fheader==NULL)
+  rewind(fheader);
+  while( get_string(fheader,line) == OK )
+  {
+    long len = (long) strlen(line) + 1;
+    if(index->text_used + len > index->text_size)
+    {
+       long size = 2*index->text_size + len + 4096;
+       char *tmp = (char *) realloc(index->text, size);
+       if(tmp == NULL) return(FAIL);
+       index->text = tmp;
+       index->text_size = size;
+    }
+    if(index->n_lines == index->max_lines)
+    {
+       int max_lines = 2*index->max_lines + 64;
+       long *tmp = (long *) realloc(index->line, max_lines*sizeof(long));
+       int *tmp_block = (int *) realloc(index->block, max_lines*sizeof(int));
+       if(tmp != NULL) index->line = tmp;
+       if(tmp_block != NULL) index->block = tmp_block;
+       if(tmp == NULL || tmp_block == NULL) return(FAIL);
+       index->max_lines = max_lines;
+    }
+
+    memcpy(index->text + index->text_used, line, len);
+    if( *line == SEGMENT_BEG_TOKEN ) index->block[index->n_blocks++] = index->n_lines;
+    index->line[index->n_lines++] = index->text_used;
+    index->text_used += len;
+  }
+  return(OK);
+}
+
+void iaea_header_type::free_index()
+{
+  if(index == NULL) return;
+  free(index->text);
+  free(index->line);
+  free(index->block);
+  free(index->block_text);
+  free(index);
+  index = NULL;
+}
+
+int iaea_header_type::next_line(char *line)
+{
+  // Next line of the header, as get_string(fheader,line) would return it
+  if(index == NULL || index->next >= index->n_lines) return(FAIL);
+  strcpy(line, index->text + index->line[index->next++]);
+  return(OK);
+}
+
+int iaea_header_type::get_blockname(char *line, char *blockname)
+{
+  // Positions next_line() after the first "$blockname:" line
+  if(index == NULL)
   {
     printf("\n ERROR: Opening header file to Get Block \n"); return(FAIL);
   }
-  rewind(fheader) ;
 
-  while( get_string(fheader,line) == OK )
-  {   
-    if( *line == SEGMENT_BEG_TOKEN ) 
-      {
-         begptr = line + 1 ;
-             // printf("                       Read line %s ...\n",line);
-         endptr = strchr(begptr,SEGMENT_END_TOKEN) ;
-         if( endptr != NULL ) {
-           *endptr = '\0' ;
-               // printf("                       Comparing %s ...\n",begptr);
-           if( strcmp(begptr,blockname) == 0 ) return(OK) ;
-         }
-      }
-  };
+  size_t len = strlen(blockname);
+  for(int i=0; i<index->n_blocks; i++)
+  {
+    const char *begptr = index->text + index->line[index->block[i]] + 1;
+    if( strncmp(begptr,blockname,len) == 0 && begptr[len] == SEGMENT_END_TOKEN )
+    {
+       strcpy(line, begptr - 1);
+       index->next = index->block[i] + 1;
+       return(OK);
+    }
+  }
+  index->next = index->n_lines;
   return(FAIL) ;
 }
 
-int iaea_header_type::get_block(char *lineread)
+int iaea_header_type::get_block(char *lineread, size_t size)
 {
       int read = FAIL, count = 0;
+      size_t len = 0, line_len;
 
       char line[MAX_STR_LEN]; 
 
       strcpy (lineread,""); // Deleting lineread contents
-      while( get_string(fheader,line) == OK )
+      while( next_line(line) == OK )
     {
         if( *line == SEGMENT_BEG_TOKEN ) break; 
-        strcat(lineread+count*MAX_NUMB_LINES,line); count++;
+        // Line count goes to lineread+count*MAX_NUMB_LINES, as it always
+        // did: it only shows up if the lines before reach that far
+        line_len = strlen(line);
+        if( (size_t)count*MAX_NUMB_LINES <= len && len + line_len < size )
+          {strcpy(lineread+len,line); len += line_len;}
+        count++;
         read = OK;
     };
       return (read);
@@ -403,10 +497,78 @@ int iaea_header_type::read_block(char *lineread,char *blockname)
 {
     char line[MAX_STR_LEN]; 
     if( get_blockname(line,blockname) != OK) return FAIL; 
-      if( get_block(lineread) != OK) return FAIL; 
+      if( get_block(lineread,MAX_STR_LEN) != OK) return FAIL; 
       return OK;  
 }
 
+int iaea_header_type::read_text(char **text,char *blockname)
+{
+    // As read_block(), keeping the block in the text arena
+    char line[MAX_STR_LEN]; 
+    if( get_blockname(line,blockname) != OK) return FAIL; 
+      int read = get_block(index->block_text,MAX_STR_LEN*MAX_NUMB_LINES+1);
+      if( set_text(text,index->block_text) != OK) return FAIL; 
+      return read;  
+}
+
+// Text blocks are kept in chunks which are never moved, so the blocks
+// already set stay where they are when more are added
+struct iaea_header_text
+{
+  iaea_header_text *next;
+  size_t size, used;
+  char data[1];
+};
+
+#define TEXT_CHUNK_SIZE 4096
+
+static char empty_text[] = "";
+
+void iaea_header_type::init_text()
+{
+  coordinate_system_description = input_file_for_event_generator = empty_text;
+  event_generator_library = empty_text;
+  title = machine_type = MC_code_and_version = transport_parameters = empty_text;
+  beam_name = field_size = nominal_SSD = empty_text;
+  variance_reduction_techniques = initial_source_description = empty_text;
+  MC_input_filename = published_reference = authors = institution = empty_text;
+  link_validation = additional_notes = empty_text;
+}
+
+int iaea_header_type::set_text(char **text, const char *value)
+{
+  size_t len = strlen(value) + 1;
+  if(len == 1) {*text = empty_text; return(OK);}
+
+  iaea_header_text *chunk = text_arena;
+  if(chunk == NULL || chunk->used + len > chunk->size)
+  {
+     size_t size = (len > TEXT_CHUNK_SIZE) ? len : TEXT_CHUNK_SIZE;
+     chunk = (iaea_header_text *) malloc(sizeof(iaea_header_text) + size);
+     if(chunk == NULL) return(FAIL);
+     chunk->next = text_arena;
+     chunk->size = size;
+     chunk->used = 0;
+     text_arena = chunk;
+  }
+
+  // value may be a block of this header: it is copied, never moved
+  *text = (char *) memcpy(chunk->data + chunk->used, value, len);
+  chunk->used += len;
+  return(OK);
+}
+
+void iaea_header_type::free_text()
+{
+  while(text_arena != NULL)
+  {
+    iaea_header_text *next = text_arena->next;
+    free(text_arena);
+    text_arena = next;
+  }
+  init_text();
+}
+
 int iaea_header_type::set_record_contents(iaea_record_type *p_iaea_record)
 {
    int i;
@@ -437,6 +599,9 @@ int iaea_header_type::set_record_contents(iaea_record_type *p_iaea_record)
    if(p_iaea_record->iextrafloat>0) record_contents[7] = p_iaea_record->iextrafloat;
    if(p_iaea_record->iextralong>0) record_contents[8] = p_iaea_record->iextralong;
 
+   // Record layout and codec for the default contents
+   p_iaea_record->set_layout();
+
    record_length = 5; // To consider for particle type (1 byte) and energy (4 bytes)
    for(i=0;i<8;i++) record_length += record_contents[i]*sizeof(float);          
    record_length -= 4; // 4 bytes substracted as w is not stored, just his sign
@@ -487,6 +652,10 @@ int iaea_header_type::get_record_contents(iaea_record_type *p_iaea_record)
    p_iaea_record->iextralong = 0;
    if(record_contents[8] > 0) p_iaea_record->iextralong = record_contents[8];         
 
+   // Record layout is now fixed, set it up once for the block decoder
+   // and select the codec specialized for it
+   p_iaea_record->set_layout();
+
    record_length = 5; // To consider for particle type (1 bytes) and energy (4 bytes)
    for(i=0;i<8;i++) record_length += record_contents[i]*sizeof(float);
    record_length -= 4; // 4 bytes substracted as w is not stored, just his sign
@@ -520,42 +689,262 @@ void iaea_header_type::initialize_counters()
 
 void iaea_header_type::update_counters(iaea_record_type *p_iaea_record)
 {
-  if (p_iaea_record->x > maximumX )  maximumX = p_iaea_record->x;
-  if (p_iaea_record->x < minimumX )  minimumX = p_iaea_record->x;
-
-  if (p_iaea_record->y > maximumY )  maximumY = p_iaea_record->y;
-  if (p_iaea_record->y < minimumY )  minimumY = p_iaea_record->y;
-
-  if (p_iaea_record->z > maximumZ )  maximumZ = p_iaea_record->z;
-  if (p_iaea_record->z < minimumZ )  minimumZ = p_iaea_record->z;
-
-      
   nParticles++;
 
   if ( p_iaea_record->IsNewHistory > 0 ) 
       read_indep_histories += p_iaea_record->IsNewHistory;
 
   int i = p_iaea_record->particle-1;
+  if( i >= 0 && i < MAX_NUM_PARTICLES ) particle_number[i]++;
+
+  add_statistics(p_iaea_record->particle, p_iaea_record->energy,
+                 p_iaea_record->weight, p_iaea_record->x,
+                 p_iaea_record->y, p_iaea_record->z);
+}
+
+void iaea_header_type::update_counters(IAEA_I32 n, const IAEA_I32 *n_stat,
+                           const IAEA_I32 *type, const IAEA_Float *E,
+                           const IAEA_Float *wt, const IAEA_Float *x,
+                           const IAEA_Float *y, const IAEA_Float *z)
+{
+  // Same as update_counters() for each of the n particles
+  nParticles += n;
+  for(IAEA_I32 k=0; k<n; k++)
+      if ( n_stat[k] > 0 ) read_indep_histories += n_stat[k];
+
+  if( statistics == IAEA_STATISTICS_DEFERRED )
+  {
+      // particles counted by type while they are added to the batch
+      for(IAEA_I32 k=0; k<n; )
+      {
+          int m = STAT_BATCH - stat_batch->n;
+          if( m > n - k ) m = (int)(n - k);
+          iaea_stat_batch_add_n(stat_batch, m, type+k, E+k, wt+k, x+k, y+k, z+k,
+                                particle_number);
+          if( stat_batch->n == STAT_BATCH ) flush_statistics();
+          k += m;
+      }
+      return;
+  }
+
+  for(IAEA_I32 k=0; k<n; k++)
+      if ( type[k] >= 1 && type[k] <= MAX_NUM_PARTICLES ) particle_number[type[k]-1]++;
+
+  if( statistics == IAEA_STATISTICS_OFF ) return;
+  for(IAEA_I32 k=0; k<n; k++)
+      add_statistics((int)type[k], (float)E[k], (float)wt[k],
+                     (float)x[k], (float)y[k], (float)z[k]);
+}
+
+void iaea_header_type::update_counters(int i_shard, iaea_record_type *p_iaea_record)
+{
+  iaea_stat_shard_add(shards[i_shard], p_iaea_record->IsNewHistory,
+                      p_iaea_record->particle, p_iaea_record->energy,
+                      p_iaea_record->weight, p_iaea_record->x,
+                      p_iaea_record->y, p_iaea_record->z);
+}
+
+void iaea_header_type::update_counters(int i_shard, IAEA_I32 n,
+                           const IAEA_I32 *n_stat, const IAEA_I32 *type,
+                           const IAEA_Float *E, const IAEA_Float *wt,
+                           const IAEA_Float *x, const IAEA_Float *y,
+                           const IAEA_Float *z)
+{
+  // Same as above, but the particles go to shard i_shard, so threads
+  // writing to different shards can run concurrently
+  iaea_stat_shard_add_n(shards[i_shard], n, n_stat, type, E, wt, x, y, z);
+}
+
+void iaea_header_type::add_statistics(int type, float E, float wt,
+                                      float x, float y, float z)
+{
+  if( statistics == IAEA_STATISTICS_OFF ) return;
+  if( statistics == IAEA_STATISTICS_DEFERRED )
+  {
+      iaea_stat_batch_add(stat_batch, type, E, wt, x, y, z);
+      if( stat_batch->n == STAT_BATCH ) flush_statistics();
+      return;
+  }
+
+  if (x > maximumX )  maximumX = x;
+  if (x < minimumX )  minimumX = x;
+
+  if (y > maximumY )  maximumY = y;
+  if (y < minimumY )  minimumY = y;
+
+  if (z > maximumZ )  maximumZ = z;
+  if (z < minimumZ )  minimumZ = z;
+
+  int i = type-1;
   if( i >= 0 && i < MAX_NUM_PARTICLES ) {
-      particle_number[i]++;
-      sumParticleWeight[i] +=  p_iaea_record->weight;
-      averageKineticEnergy[i] += p_iaea_record->weight*
-                                 fabs(p_iaea_record->energy);
-      if (p_iaea_record->weight > maximumWeight[i] )  
-            maximumWeight[i] = p_iaea_record->weight;
-      if (p_iaea_record->weight < minimumWeight[i] )  
-            minimumWeight[i] = p_iaea_record->weight;
-
-      if (fabs(p_iaea_record->energy) > maximumKineticEnergy[i] )  
-         maximumKineticEnergy[i] = fabs(p_iaea_record->energy);
-      if (fabs(p_iaea_record->energy) < minimumKineticEnergy[i] )  
-         minimumKineticEnergy[i] = fabs(p_iaea_record->energy);
+      sumParticleWeight[i] +=  wt;
+      averageKineticEnergy[i] += wt*fabs(E);
+      if (wt > maximumWeight[i] )  maximumWeight[i] = wt;
+      if (wt < minimumWeight[i] )  minimumWeight[i] = wt;
+
+      if (fabs(E) > maximumKineticEnergy[i] )  
+         maximumKineticEnergy[i] = fabs(E);
+      if (fabs(E) < minimumKineticEnergy[i] )  
+         minimumKineticEnergy[i] = fabs(E);
   }
 
 }
 
+int iaea_header_type::set_statistics(int mode)
+{
+  if( mode != IAEA_STATISTICS_OFF && mode != IAEA_STATISTICS_EACH &&
+      mode != IAEA_STATISTICS_DEFERRED ) return(FAIL);
+
+  flush_statistics();
+  if( mode == IAEA_STATISTICS_DEFERRED && stat_batch == NULL )
+  {
+      stat_batch = (iaea_stat_batch *) malloc(sizeof(iaea_stat_batch));
+      if( stat_batch == NULL ) return(FAIL);
+      iaea_stat_batch_clear(stat_batch);
+  }
+  if( mode != IAEA_STATISTICS_DEFERRED )
+  {
+      free(stat_batch);
+      stat_batch = NULL;
+  }
+  statistics = mode;
+  return(OK);
+}
+
+int iaea_header_type::set_shards(int n)
+{
+  // The counters of the current shards are kept in the header
+  flush_statistics();
+  for(int i=0; i<n_shards; i++) free(shards[i]);
+  free(shards);
+  shards = NULL;
+  n_shards = 0;
+  if( n <= 0 ) return(OK);
+
+  shards = (iaea_stat_shard **) calloc(n, sizeof(iaea_stat_shard *));
+  if( shards == NULL ) return(FAIL);
+  // one allocation per shard, so threads do not share cache lines
+  for(n_shards=0; n_shards<n; n_shards++)
+  {
+      shards[n_shards] = (iaea_stat_shard *) malloc(sizeof(iaea_stat_shard));
+      if( shards[n_shards] == NULL ) { set_shards(0); return(FAIL); }
+      iaea_stat_shard_clear(shards[n_shards]);
+  }
+  return(OK);
+}
+
+void iaea_header_type::flush_statistics()
+{
+  // Reduces the particles collected so far, if any
+  if( stat_batch != NULL && stat_batch->n > 0 )
+  {
+      iaea_statistics s;
+      iaea_statistics_reduce(stat_batch, &s);
+      merge_statistics(&s);
+      iaea_stat_batch_clear(stat_batch);
+  }
+
+  // Shards are merged in a fixed order, the sums do not depend on which
+  // thread finished first
+  for(int j=0; j<n_shards; j++)
+  {
+      iaea_stat_shard *shard = shards[j];
+      if( shard->nParticles == 0 ) continue;
+      iaea_stat_shard_flush(shard);
+      nParticles += shard->nParticles;
+      read_indep_histories += shard->read_indep_histories;
+      for(int i=0; i<MAX_NUM_PARTICLES; i++)
+          particle_number[i] += shard->particle_number[i];
+      if( statistics != IAEA_STATISTICS_OFF ) merge_statistics(&shard->statistics);
+      iaea_stat_shard_clear(shard);
+  }
+}
+
+void iaea_header_type::merge_statistics(const iaea_statistics *s)
+{
+  if (s->max_x > maximumX )  maximumX = s->max_x;
+  if (s->min_x < minimumX )  minimumX = s->min_x;
+
+  if (s->max_y > maximumY )  maximumY = s->max_y;
+  if (s->min_y < minimumY )  minimumY = s->min_y;
+
+  if (s->max_z > maximumZ )  maximumZ = s->max_z;
+  if (s->min_z < minimumZ )  minimumZ = s->min_z;
+
+  for(int i=0; i<MAX_NUM_PARTICLES; i++)
+  {
+      sumParticleWeight[i] += s->sum_weight[i];
+      averageKineticEnergy[i] += s->sum_energy[i];
+      if (s->max_weight[i] > maximumWeight[i] )  maximumWeight[i] = s->max_weight[i];
+      if (s->min_weight[i] < minimumWeight[i] )  minimumWeight[i] = s->min_weight[i];
+      if (s->max_energy[i] > maximumKineticEnergy[i] )  
+         maximumKineticEnergy[i] = s->max_energy[i];
+      if (s->min_energy[i] < minimumKineticEnergy[i] )  
+         minimumKineticEnergy[i] = s->min_energy[i];
+  }
+}
+
+void iaea_header_type::merge_counters(const iaea_header_type *h)
+{
+  // Adds the histories, particles and statistics of the phase space
+  // described by the header h, as read by read_header()
+  orig_histories += h->orig_histories;
+  nParticles += h->nParticles;
+
+  iaea_statistics s;
+  iaea_statistics_init(&s);
+  for(int i=0; i<MAX_NUM_PARTICLES; i++)
+  {
+      particle_number[i] += h->particle_number[i];
+      if( h->particle_number[i] == 0 ) continue;
+      s.sum_weight[i] = h->sumParticleWeight[i];
+      // the header holds the average energy, the counters the sum
+      s.sum_energy[i] = h->averageKineticEnergy[i]*h->sumParticleWeight[i];
+      s.min_weight[i] = h->minimumWeight[i];
+      s.max_weight[i] = h->maximumWeight[i];
+      s.min_energy[i] = h->minimumKineticEnergy[i];
+      s.max_energy[i] = h->maximumKineticEnergy[i];
+  }
+  if( h->nParticles > 0 )
+  {
+      if( h->record_contents[0] == 1 ) {s.min_x = h->minimumX; s.max_x = h->maximumX;}
+      if( h->record_contents[1] == 1 ) {s.min_y = h->minimumY; s.max_y = h->maximumY;}
+      if( h->record_contents[2] == 1 ) {s.min_z = h->minimumZ; s.max_z = h->maximumZ;}
+  }
+  merge_statistics(&s);
+}
+
+int iaea_header_type::same_layout(const iaea_header_type *h)
+{
+  // True if the records described by h are laid out as ours
+  int i;
+  if( record_length != h->record_length ) return(false);
+  for(i=0;i<9;i++) if( record_contents[i] != h->record_contents[i] ) return(false);
+  for(i=0;i<7;i++)
+      if( record_contents[i] == 0 && record_constant[i] != h->record_constant[i] )
+          return(false);
+  for(i=0;i<record_contents[7];i++)
+      if( extrafloat_contents[i] != h->extrafloat_contents[i] ) return(false);
+  for(i=0;i<record_contents[8];i++)
+      if( extralong_contents[i] != h->extralong_contents[i] ) return(false);
+  return(true);
+}
+
+void iaea_header_type::copy_layout(const iaea_header_type *h)
+{
+  // Takes the record layout of h; apply it to the record with
+  // get_record_contents()
+  int i;
+  for(i=0;i<9;i++) record_contents[i] = h->record_contents[i];
+  for(i=0;i<7;i++) record_constant[i] = h->record_constant[i];
+  for(i=0;i<NUM_EXTRA_FLOAT;i++) extrafloat_contents[i] = h->extrafloat_contents[i];
+  for(i=0;i<NUM_EXTRA_LONG;i++) extralong_contents[i] = h->extralong_contents[i];
+  record_length = h->record_length;
+}
+
 void iaea_header_type::print_statistics()
 {
+   flush_statistics();
    printf("\n *************************************** \n");
    printf("           IAEA PHSP STATISTICS          \n");
    printf(" *************************************** \n");
@@ -698,6 +1087,7 @@ int iaea_header_type::write_header()
       printf("\n ERROR: Opening header file to write \n"); return(FAIL);
   }
 
+  flush_statistics();
   rewind(fheader);
 
   if( write_blockname("IAEA_INDEX") == FAIL ) return(FAIL); 
@@ -785,6 +1175,13 @@ int iaea_header_type::write_header()
   int byte_order = check_byte_order();
   write_blockname("BYTE_ORDER");fprintf(fheader,"%i\n\n",byte_order);
 
+  if(compression_block > 0)
+  {
+     write_blockname("COMPRESSION");
+     fprintf(fheader,"%i     // records per block of the .IAEAphspz file\n\n",
+             compression_block);
+  }
+
   write_blockname("ORIG_HISTORIES");
   if( orig_histories == 0) printf(
      "\n The number of primary particles (ORIG_HISTORIES) is zero in the HEADER !\n");
@@ -914,6 +1311,8 @@ int iaea_header_type::print_header ()
     printf("RECORD LENGTH: %i\n",record_length);
 
       if(byte_order > 0) printf("BYTE ORDER: %i\n",byte_order);
+      if(compression_block > 0) 
+         printf("COMPRESSION: %i records per block\n",compression_block);
 
     int i;
     printf("\nRECORD_CONTENTS:\n");
@@ -972,6 +1371,8 @@ int iaea_header_type::print_header ()
       {
             // For event generators
           printf("INPUT FILE for event generator: %s \n",input_file_for_event_generator);
+          if( *event_generator_library ) 
+              printf("EVENT GENERATOR LIBRARY: %s \n",event_generator_library);
             return OK;
       }
       printf("\n");
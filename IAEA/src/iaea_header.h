@@ -3,6 +3,7 @@
 
 /* *********************************************************************** */
 #include "iaea_record.h"
+#include "iaea_statistics.h"
 
 // defines
 #define SEGMENT_BEG_TOKEN '$'
@@ -29,14 +30,21 @@
  //  more to be defined
 
 
+struct iaea_header_index;
+struct iaea_header_text;
+
 struct iaea_header_type
 {
   FILE *fheader;
+  iaea_header_index *index; // header lines, only while read_header() runs
+  iaea_header_text *text_arena; // storage of the text blocks (see set_text)
   // ******************************************************************************
   // 1. PHSP format
   
   int file_type;            // 0 = phsp file ;  1 = phsp generator 
   int byte_order;           // as defined by get_byte_order routine
+  int compression_block;    // records per block of a compressed phsp file
+                            // (.IAEAphspz), 0 = not compressed (.IAEAphsp)
   int record_contents[9];   // record_contents[i] = 1 or 0 (variable or constant)
                             // correspond to the following logical variables :
                             //             ix,iy,iz,iu.iv,iw;
@@ -65,8 +73,11 @@ struct iaea_header_type
 
   // ******************************************************************************
   // 2. Mandatory description of the phsp
+  //
+  // Text blocks point into text_arena (or to an empty string), they are
+  // never NULL once init_text() was called. Change them with set_text().
   
-  char coordinate_system_description[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *coordinate_system_description;
 
   // Counters for phsp file
   IAEA_I64 orig_histories;  
@@ -74,49 +85,52 @@ struct iaea_header_type
   IAEA_I64 particle_number[MAX_NUM_PARTICLES];
 
   // Event generator input file
-  char input_file_for_event_generator[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *input_file_for_event_generator;
+  // and library (without prefix and extension, see IAEA_EventGenerator),
+  // empty if it has the name of the header
+  char *event_generator_library;
   
   // ******************************************************************************
   // 3. Mandatory additional information
   
   unsigned int iaea_index; // Agency ID
-  char title[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *title;
   
-  char machine_type[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *machine_type;
   
-  char MC_code_and_version[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *MC_code_and_version;
   
   float global_photon_energy_cutoff;
   
   float global_particle_energy_cutoff;
   
-  char transport_parameters[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *transport_parameters;
 
   // ******************************************************************************
   // 4. Optional description
   
-  char beam_name[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *beam_name;
   
-  char field_size[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *field_size;
   
-  char nominal_SSD[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *nominal_SSD;
   
-  char variance_reduction_techniques[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *variance_reduction_techniques;
   
-  char initial_source_description[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *initial_source_description;
 
   // Documentation sub-section
-  char MC_input_filename[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *MC_input_filename;
   
   // Assumed to be the preferred citation
-  char published_reference[MAX_STR_LEN*MAX_NUMB_LINES+1]; 
-  char authors[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *published_reference; 
+  char *authors;
   
-  char institution[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *institution;
   
-  char link_validation[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *link_validation;
 
-  char additional_notes[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  char *additional_notes;
 
   // ******************************************************************************
   // 5. Optional statistical information
@@ -132,6 +146,12 @@ struct iaea_header_type
 
   IAEA_I64 read_indep_histories;  
 
+  int statistics;              // IAEA_STATISTICS_OFF, _EACH or _DEFERRED
+  iaea_stat_batch *stat_batch; // particles not yet in the statistics
+
+  int n_shards;                // statistics of the writing threads,
+  iaea_stat_shard **shards;    // merged in this order by flush_statistics
+
 // CLASS FUNCTIONS
 
 public:
@@ -141,14 +161,41 @@ public:
       int set_record_contents(iaea_record_type *p_iaea_record);
       int get_record_contents(iaea_record_type *p_iaea_record);
       void initialize_counters();
+      void init_text();
+      int set_text(char **text, const char *value);
+      void free_text();
       void update_counters(iaea_record_type *p_iaea_record);
+      void update_counters(IAEA_I32 n, const IAEA_I32 *n_stat,
+                           const IAEA_I32 *type, const IAEA_Float *E,
+                           const IAEA_Float *wt, const IAEA_Float *x,
+                           const IAEA_Float *y, const IAEA_Float *z);
+      void update_counters(int i_shard, iaea_record_type *p_iaea_record);
+      void update_counters(int i_shard, IAEA_I32 n, const IAEA_I32 *n_stat,
+                           const IAEA_I32 *type, const IAEA_Float *E,
+                           const IAEA_Float *wt, const IAEA_Float *x,
+                           const IAEA_Float *y, const IAEA_Float *z);
+      int set_statistics(int mode);
+      int set_shards(int n);
+      void flush_statistics();
+      void merge_statistics(const iaea_statistics *s);
+      void merge_counters(const iaea_header_type *h);
+      int same_layout(const iaea_header_type *h);
+      void copy_layout(const iaea_header_type *h);
 
 private:
+      int parse_header();
+      int index_header();
+      void free_index();
+      int next_line(char *line);
       int read_block(char *lineread,char *blockname);
-      int get_block(char *lineread);
+      int read_text(char **text,char *blockname);
+      int get_block(char *lineread, size_t size);
       int get_blockname(char *line, char *blockname);
       int write_blockname(char *blockname);
 
+      void add_statistics(int type, float E, float wt,
+                          float x, float y, float z);
+
       int check_byte_order();
       void print_statistics();
 };
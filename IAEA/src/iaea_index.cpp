@@ -0,0 +1,271 @@
+/******************************************************************************
+ *
+ *  Index of the histories of a phase space file (.IAEAindex)
+ *
+ *  Finding where a history starts otherwise needs the records to be read
+ *  and their energy sign or extralong of type 1 decoded. The index is built
+ *  once, while the file is written or in one pass over it, and saved next
+ *  to the header. The file holds the magic string IAEA_INDEX_MAGIC and
+ *  n_records, the size and modification time of the phsp file, n_histories,
+ *  n_stat and the size of the entries, all as variable length integers,
+ *  followed by the entries (see iaea_index.h), so it does not depend on the
+ *  byte order. A phsp file rewritten with as many records as before keeps
+ *  n_records but not its modification time, and its index is rebuilt.
+ *
+ *****************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "utilities.h"
+#include "iaea_index.h"
+
+#define IAEA_INDEX_MAGIC "IAEAindex2\n"
+
+/* *********************************************************************** */
+// Variable length integers
+
+// Codes value at buf, which must have room for 10 bytes. Returns the bytes used.
+static int put_varint(unsigned char *buf, IAEA_I64 value)
+{
+  unsigned long long v = (unsigned long long) value;
+  int n = 0;
+  while(v >= 0x80)
+  {
+     buf[n++] = (unsigned char)(v | 0x80);
+     v >>= 7;
+  }
+  buf[n++] = (unsigned char) v;
+  return n;
+}
+
+// Decodes the integer at *pos of buf (of size bytes) and moves *pos past
+// it. Returns -1 if the integer does not end before size.
+static IAEA_I64 get_varint(const unsigned char *buf, IAEA_I64 size, IAEA_I64 *pos)
+{
+  unsigned long long v = 0;
+  for(int shift=0; shift<64 && *pos<size; shift+=7)
+  {
+     unsigned char b = buf[(*pos)++];
+     v |= (unsigned long long)(b & 0x7f) << shift;
+     if(b < 0x80) return (IAEA_I64) v;
+  }
+  return -1;
+}
+
+/* *********************************************************************** */
+
+iaea_history_index *iaea_index_new()
+{
+  iaea_history_index *index = (iaea_history_index *) calloc(1, sizeof(iaea_history_index));
+  if(index != NULL) index->last_record = -1;
+  return index;
+}
+
+void iaea_index_free(iaea_history_index *index)
+{
+  if(index == NULL) return;
+  free(index->data);
+  free(index->marks);
+  free(index);
+}
+
+int iaea_index_add(iaea_history_index *index, IAEA_I64 record, IAEA_I64 n_stat)
+{
+  if(record <= index->last_record || n_stat < 1) return(FAIL);
+
+  if(index->size + 20 > index->capacity)
+  {
+     IAEA_I64 capacity = (index->capacity > 0) ? 2*index->capacity : 4096;
+     unsigned char *data = (unsigned char *) realloc(index->data, capacity);
+     if(data == NULL) return(FAIL);
+     index->data = data;
+     index->capacity = capacity;
+  }
+
+  if(index->n_histories % INDEX_MARK_HISTORIES == 0)
+  {
+     if(index->n_marks == index->max_marks)
+     {
+        IAEA_I64 max_marks = (index->max_marks > 0) ? 2*index->max_marks : 64;
+        iaea_index_mark *marks = (iaea_index_mark *)
+                           realloc(index->marks, max_marks*sizeof(iaea_index_mark));
+        if(marks == NULL) return(FAIL);
+        index->marks = marks;
+        index->max_marks = max_marks;
+     }
+     iaea_index_mark *m = &index->marks[index->n_marks++];
+     m->record = record;
+     m->n_stat = index->n_stat;
+     m->offset = index->size;
+  }
+
+  index->size += put_varint(index->data + index->size, record - (index->last_record + 1));
+  index->size += put_varint(index->data + index->size, n_stat - 1);
+  index->last_record = record;
+  index->n_histories++;
+  index->n_stat += n_stat;
+  return(OK);
+}
+
+void iaea_index_end(iaea_history_index *index, IAEA_I64 n_records)
+{
+  index->n_records = n_records;
+}
+
+// Decodes the entries from the mark of history k up to history k. Sets
+// record to its first record and n_stat to the sum of n_stat before it,
+// and returns its own n_stat.
+static IAEA_I64 decode_to(const iaea_history_index *index, IAEA_I64 k,
+                          IAEA_I64 *record, IAEA_I64 *n_stat)
+{
+  const iaea_index_mark *m = &index->marks[k/INDEX_MARK_HISTORIES];
+  IAEA_I64 pos = m->offset, rec = m->record, sum = m->n_stat;
+
+  get_varint(index->data, index->size, &pos);  // the mark holds its record
+  IAEA_I64 n = get_varint(index->data, index->size, &pos) + 1;
+  for(IAEA_I64 j = k%INDEX_MARK_HISTORIES; j > 0; j--)
+  {
+     sum += n;
+     rec += 1 + get_varint(index->data, index->size, &pos);
+     n = get_varint(index->data, index->size, &pos) + 1;
+  }
+  *record = rec;
+  *n_stat = sum;
+  return n;
+}
+
+int iaea_index_find(const iaea_history_index *index, IAEA_I64 k,
+                    IAEA_I64 *first, IAEA_I64 *last, IAEA_I64 *n_stat)
+{
+  if(k < 0 || k >= index->n_histories) return(FAIL);
+
+  IAEA_I64 sum;
+  *n_stat = decode_to(index, k, first, &sum) + sum;
+  if(k + 1 < index->n_histories) decode_to(index, k + 1, last, &sum);
+  else *last = index->n_records;
+  return(OK);
+}
+
+IAEA_I64 iaea_index_next(const iaea_history_index *index, IAEA_I64 record,
+                         IAEA_I64 *n_stat)
+{
+  *n_stat = 0;
+  if(index->n_histories == 0) return index->n_records;
+
+  // last mark at or before record, then the entries after it
+  IAEA_I64 lo = 0, hi = index->n_marks - 1;
+  if(record <= index->marks[0].record) return index->marks[0].record;
+  while(lo < hi)
+  {
+     IAEA_I64 mid = (lo + hi + 1)/2;
+     if(index->marks[mid].record <= record) lo = mid; else hi = mid - 1;
+  }
+
+  const iaea_index_mark *m = &index->marks[lo];
+  IAEA_I64 pos = m->offset, rec = m->record, sum = m->n_stat;
+  for(IAEA_I64 j = lo*INDEX_MARK_HISTORIES; j < index->n_histories; j++)
+  {
+     IAEA_I64 delta = get_varint(index->data, index->size, &pos);
+     IAEA_I64 n = get_varint(index->data, index->size, &pos) + 1;
+     if(j > lo*INDEX_MARK_HISTORIES) rec += 1 + delta;
+     if(rec >= record)
+     {
+        *n_stat = sum;
+        return rec;
+     }
+     sum += n;
+  }
+  *n_stat = sum;
+  return index->n_records;
+}
+
+/* *********************************************************************** */
+
+static FILE *open_index(const char *name, const char *access)
+{
+  char *file = (char *) malloc(strlen(name) + strlen(".IAEAindex") + 1);
+  if(file == NULL) return NULL;
+  strcpy(file, name);
+  strcat(file, ".IAEAindex");
+  FILE *f = fopen(file, access);
+  free(file);
+  return f;
+}
+
+int iaea_index_write(const iaea_history_index *index, const char *name,
+                     IAEA_I64 file_size, IAEA_I64 file_time)
+{
+  FILE *f = open_index(name, "wb");
+  if(f == NULL) return(FAIL);
+
+  unsigned char buf[60];
+  int n = 0;
+  n += put_varint(buf + n, index->n_records);
+  n += put_varint(buf + n, file_size);
+  n += put_varint(buf + n, file_time);
+  n += put_varint(buf + n, index->n_histories);
+  n += put_varint(buf + n, index->n_stat);
+  n += put_varint(buf + n, index->size);
+
+  int status = OK;
+  size_t len = strlen(IAEA_INDEX_MAGIC);
+  if(fwrite(IAEA_INDEX_MAGIC, 1, len, f) != len ||
+     fwrite(buf, 1, n, f) != (size_t) n ||
+     fwrite(index->data, 1, index->size, f) != (size_t) index->size) status = FAIL;
+  if(fclose(f) != 0) status = FAIL;
+  return(status);
+}
+
+iaea_history_index *iaea_index_read(const char *name, IAEA_I64 n_records,
+                                    IAEA_I64 file_size, IAEA_I64 file_time)
+{
+  FILE *f = open_index(name, "rb");
+  if(f == NULL) return NULL;
+
+  char magic[16];
+  unsigned char buf[60];
+  size_t len = strlen(IAEA_INDEX_MAGIC);
+  size_t n = fread(magic, 1, len, f);
+  if(n != len || memcmp(magic, IAEA_INDEX_MAGIC, len) != 0) {fclose(f); return NULL;}
+
+  n = fread(buf, 1, sizeof(buf), f);
+  IAEA_I64 pos = 0;
+  IAEA_I64 n_indexed   = get_varint(buf, n, &pos);
+  IAEA_I64 size_stamp  = get_varint(buf, n, &pos);
+  IAEA_I64 time_stamp  = get_varint(buf, n, &pos);
+  IAEA_I64 n_histories = get_varint(buf, n, &pos);
+  IAEA_I64 n_stat      = get_varint(buf, n, &pos);
+  IAEA_I64 size        = get_varint(buf, n, &pos);
+  if(n_indexed != n_records || size_stamp != file_size ||
+     time_stamp != file_time || n_histories < 0 || n_stat < 0 || size < 0)
+     {fclose(f); return NULL;}
+
+  unsigned char *data = (unsigned char *) malloc(size > 0 ? size : 1);
+  if(data == NULL || fseek(f, (long)(len + pos), SEEK_SET) != 0 ||
+     fread(data, 1, size, f) != (size_t) size) {free(data); fclose(f); return NULL;}
+  fclose(f);
+
+  // The marks are rebuilt adding the entries again
+  iaea_history_index *index = iaea_index_new();
+  if(index == NULL) {free(data); return NULL;}
+  IAEA_I64 record = -1;
+  pos = 0;
+  for(IAEA_I64 k=0; k<n_histories; k++)
+  {
+     IAEA_I64 delta = get_varint(data, size, &pos);
+     IAEA_I64 n_hist = get_varint(data, size, &pos);
+     if(n_hist < 0 || delta < 0) break;
+     record += 1 + delta;
+     if(record >= n_records || iaea_index_add(index, record, n_hist + 1) != OK) break;
+  }
+  free(data);
+
+  if(index->n_histories != n_histories || index->n_stat != n_stat)
+  {
+     iaea_index_free(index);
+     return NULL;
+  }
+  iaea_index_end(index, n_records);
+  return index;
+}
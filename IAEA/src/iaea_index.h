@@ -0,0 +1,77 @@
+/******************************************************************************
+ *
+ *  Index of the histories of a phase space file (.IAEAindex)
+ *
+ *****************************************************************************/
+#ifndef IAEA_INDEX
+#define IAEA_INDEX
+
+#include "iaea_config.h"
+
+#define INDEX_MARK_HISTORIES 1024 // histories between two marks
+
+/* *********************************************************************** */
+// The first record of every history and its n_stat (the original histories
+// it accounts for, more than 1 when histories without particles are
+// counted through an extralong of type 1). Entries are stored as the
+// difference to the first record of the previous history and n_stat - 1,
+// both as variable length integers (7 bits per byte, low bits first), so
+// a history usually takes 2 bytes. Marks every INDEX_MARK_HISTORIES
+// histories let a history be found decoding at most that many entries.
+struct iaea_index_mark
+{
+  IAEA_I64 record;           // first record of the history
+  IAEA_I64 n_stat;           // sum of n_stat of the histories before it
+  IAEA_I64 offset;           // of its entry in data
+};
+
+struct iaea_history_index
+{
+  IAEA_I64 n_records;        // records indexed
+  IAEA_I64 n_histories;      // histories starting in them
+  IAEA_I64 n_stat;           // sum of n_stat of all histories
+  IAEA_I64 size, capacity;   // bytes of data used and allocated
+  unsigned char *data;       // the entries
+  IAEA_I64 n_marks, max_marks;
+  iaea_index_mark *marks;    // of histories 0, INDEX_MARK_HISTORIES, ...
+  IAEA_I64 last_record;      // first record of the last history, or -1
+};
+
+/* *********************************************************************** */
+// Returns an empty index, or NULL if out of memory
+iaea_history_index *iaea_index_new();
+
+// Frees index and its entries
+void iaea_index_free(iaea_history_index *index);
+
+// Adds a history starting at record (counted from 0), after the last one.
+// n_stat must be positive. Returns OK or FAIL.
+int iaea_index_add(iaea_history_index *index, IAEA_I64 record, IAEA_I64 n_stat);
+
+// Sets the records indexed, from 0 to n_records-1
+void iaea_index_end(iaea_history_index *index, IAEA_I64 n_records);
+
+// Finds history k (counted from 0): its records [first,last) and the sum
+// n_stat of the n_stat of histories 0 to k. Returns OK, or FAIL if k is
+// not between 0 and n_histories-1.
+int iaea_index_find(const iaea_history_index *index, IAEA_I64 k,
+                    IAEA_I64 *first, IAEA_I64 *last, IAEA_I64 *n_stat);
+
+// Finds the first history starting at record or after it. Returns its
+// first record (n_records if there is none) and sets n_stat to the sum
+// of the n_stat of the histories before it.
+IAEA_I64 iaea_index_next(const iaea_history_index *index, IAEA_I64 record,
+                         IAEA_I64 *n_stat);
+
+// Writes index to the file name.IAEAindex, stamped with the size in bytes
+// and the modification time of the phsp file it indexes. Returns OK or FAIL.
+int iaea_index_write(const iaea_history_index *index, const char *name,
+                     IAEA_I64 file_size, IAEA_I64 file_time);
+
+// Reads the index of name.IAEAindex. Returns NULL if it does not exist,
+// cannot be read, does not index n_records records or was written for a
+// phsp file of another size or modification time (it is out of date).
+iaea_history_index *iaea_index_read(const char *name, IAEA_I64 n_records,
+                                    IAEA_I64 file_size, IAEA_I64 file_time);
+
+#endif
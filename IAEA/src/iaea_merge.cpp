@@ -0,0 +1,76 @@
+/*
+ * iaea_merge: merges phase space files into one
+ *
+ * Usage: iaea_merge output input_1 [input_2 ...]
+ *
+ * The names are given without the .IAEAheader/.IAEAphsp extensions. The
+ * output gets the description of input_1 and the sum of the original
+ * histories, particle counters and statistics of the inputs. Inputs with
+ * the record layout of input_1 are copied without decoding their
+ * records (see iaea_merge_sources), the others are transcoded.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "iaea_phsp.h"
+
+int main(int argc, char *argv[])
+{
+   if(argc < 3)
+   {
+      printf("\n Usage: %s output input_1 [input_2 ...]\n",argv[0]);
+      printf(" (file names without the .IAEAheader/.IAEAphsp extensions)\n\n");
+      return(1);
+   }
+
+   IAEA_I32 n_sources = argc - 2, result, len;
+   IAEA_I32 access_read = 1, access_write = 2;
+   IAEA_I32 *source = (IAEA_I32 *) malloc(n_sources*sizeof(IAEA_I32));
+   if(source == NULL) return(1);
+
+   IAEA_I32 i;
+   for(i=0; i<n_sources; i++)
+   {
+      len = (IAEA_I32) strlen(argv[i+2]);
+      iaea_new_source(&source[i], argv[i+2], &access_read, &result, len);
+      if(result < 0)
+      {
+         printf("\n ERROR: cannot open phase space %s (%ld)\n",argv[i+2],(long)result);
+         return(1);
+      }
+   }
+
+   IAEA_I32 destiny;
+   len = (IAEA_I32) strlen(argv[1]);
+   iaea_new_source(&destiny, argv[1], &access_write, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot create phase space %s (%ld)\n",argv[1],(long)result);
+      return(1);
+   }
+
+   // Description of the first input, histories summed by the merge
+   IAEA_I64 orig_histories = 0;
+   iaea_copy_header(&source[0], &destiny, &result);
+   iaea_set_total_original_particles(&destiny, &orig_histories);
+
+   iaea_merge_sources(&n_sources, source, &destiny, &result);
+   if(result != 0)
+   {
+      printf("\n ERROR: merging the phase spaces failed (%ld)\n",(long)result);
+      return(1);
+   }
+
+   IAEA_I32 type = -1;
+   IAEA_I64 n_particles;
+   iaea_get_max_particles(&destiny, &type, &n_particles);
+   iaea_get_total_original_particles(&destiny, &orig_histories);
+   printf("\n Merged %ld phase spaces into %s: %lld particles, %lld histories\n",
+          (long)n_sources, argv[1], n_particles, orig_histories);
+
+   for(i=0; i<n_sources; i++) iaea_destroy_source(&source[i], &result);
+   iaea_destroy_source(&destiny, &result);
+   free(source);
+
+   return(0);
+}
@@ -0,0 +1,361 @@
+/******************************************************************************
+ *
+ *  Histogram models of phase spaces (.IAEAmodel)
+ *
+ *  Many beams are reproduced well enough, e.g. for commissioning, by
+ *  sampling histograms of their phase space instead of reading it: a
+ *  model of a few MB replaces a file of many GB. iaea_fit builds the
+ *  model reading the phase space once, the event generator library
+ *  iaea_model (model_event_generator.cpp) samples it.
+ *
+ *  The file holds the magic string IAEA_MODEL_MAGIC, nx, ny, n_r and n_e
+ *  (4 bytes each), the four bin widths (8-byte doubles) and
+ *  orig_histories (8 bytes), then for every type its n_particles (8
+ *  bytes) and, if it is not 0, its weight, weight_z and weight_backward
+ *  (8-byte doubles), its position sums and its energy sums (4-byte
+ *  floats). Numbers are little-endian.
+ *
+ *****************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include "utilities.h"
+#include "iaea_model.h"
+
+#define IAEA_MODEL_MAGIC "IAEAmodel1\n"
+#define MODEL_MAX_BINS   4096      // at most, on every axis
+#define MODEL_SUMS       5         // per position bin
+#define MODEL_MIN_WIDTH  (1./1024) // first bin width of all axes
+
+/* *********************************************************************** */
+// Little-endian numbers
+
+static int put_u64(FILE *f, IAEA_I64 value)
+{
+  unsigned char buf[8];
+  unsigned long long v = (unsigned long long) value;
+  for(int i=0; i<8; i++) buf[i] = (unsigned char)(v >> 8*i);
+  return fwrite(buf, 1, 8, f) == 8 ? OK : FAIL;
+}
+
+static int get_u64(FILE *f, IAEA_I64 *value)
+{
+  unsigned char buf[8];
+  if(fread(buf, 1, 8, f) != 8) return(FAIL);
+  unsigned long long v = 0;
+  for(int i=0; i<8; i++) v |= (unsigned long long) buf[i] << 8*i;
+  *value = (IAEA_I64) v;
+  return(OK);
+}
+
+static int put_u32(FILE *f, int value)
+{
+  unsigned char buf[4];
+  for(int i=0; i<4; i++) buf[i] = (unsigned char)((unsigned int) value >> 8*i);
+  return fwrite(buf, 1, 4, f) == 4 ? OK : FAIL;
+}
+
+static int get_u32(FILE *f, int *value)
+{
+  unsigned char buf[4];
+  if(fread(buf, 1, 4, f) != 4) return(FAIL);
+  unsigned int v = 0;
+  for(int i=0; i<4; i++) v |= (unsigned int) buf[i] << 8*i;
+  *value = (int) v;
+  return(OK);
+}
+
+static int put_f64(FILE *f, double value)
+{
+  IAEA_I64 v;
+  memcpy(&v, &value, 8);
+  return put_u64(f, v);
+}
+
+static int get_f64(FILE *f, double *value)
+{
+  IAEA_I64 v;
+  if(get_u64(f, &v) != OK) return(FAIL);
+  memcpy(value, &v, 8);
+  return(OK);
+}
+
+// The n values of a as 4-byte floats
+static int put_floats(FILE *f, const double *a, IAEA_I64 n)
+{
+  unsigned char buf[4096];
+  while(n > 0)
+  {
+     int m = (n < 1024) ? (int) n : 1024;
+     for(int i=0; i<m; i++)
+     {
+        float x = (float) a[i];
+        unsigned int v;
+        memcpy(&v, &x, 4);
+        for(int k=0; k<4; k++) buf[4*i+k] = (unsigned char)(v >> 8*k);
+     }
+     if(fwrite(buf, 4, m, f) != (size_t) m) return(FAIL);
+     a += m; n -= m;
+  }
+  return(OK);
+}
+
+static int get_floats(FILE *f, double *a, IAEA_I64 n)
+{
+  unsigned char buf[4096];
+  while(n > 0)
+  {
+     int m = (n < 1024) ? (int) n : 1024;
+     if(fread(buf, 4, m, f) != (size_t) m) return(FAIL);
+     for(int i=0; i<m; i++)
+     {
+        unsigned int v = 0;
+        for(int k=0; k<4; k++) v |= (unsigned int) buf[4*i+k] << 8*k;
+        float x;
+        memcpy(&x, &v, 4);
+        a[i] = x;
+     }
+     a += m; n -= m;
+  }
+  return(OK);
+}
+
+/* *********************************************************************** */
+// Doubling the bin width of an axis
+
+// Bin of the new width for bin i of a grid of n bins centered on 0
+static int merged_centered(int i, int n)
+{
+  int k = i - n/2;
+  k = (k >= 0) ? k/2 : -((1-k)/2);
+  return k + n/2;
+}
+
+// Merges the n blocks of size doubles at p, the bins of a grid centered
+// on 0, in pairs into the middle half. The blocks are merged from the
+// center outwards, so none is overwritten before it is read.
+static void merge_centered(double *p, int n, IAEA_I64 size)
+{
+  for(int i=n/2; i<n; i++)
+  {
+     double *to = p + merged_centered(i, n)*size, *from = p + i*size;
+     if(i % 2 == 0) memmove(to, from, size*sizeof(double));
+     else for(IAEA_I64 k=0; k<size; k++) to[k] += from[k];
+  }
+  for(int i=n/2-1; i>=0; i--)
+  {
+     double *to = p + merged_centered(i, n)*size, *from = p + i*size;
+     if(i % 2 == 1) memmove(to, from, size*sizeof(double));
+     else for(IAEA_I64 k=0; k<size; k++) to[k] += from[k];
+  }
+  memset(p, 0, (n/4)*size*sizeof(double));
+  memset(p + (n/4 + n/2)*size, 0, (n/4)*size*sizeof(double));
+}
+
+static void double_x(iaea_model *m)
+{
+  IAEA_I64 row = (IAEA_I64) MODEL_SUMS*m->nx;
+  for(int t=0; t<MODEL_TYPES; t++)
+  {
+     double *p = m->type[t].position;
+     if(p == NULL) continue;
+     for(int iy=0; iy<m->ny; iy++) merge_centered(p + iy*row, m->nx, MODEL_SUMS);
+  }
+  m->x_width *= 2;
+}
+
+static void double_y(iaea_model *m)
+{
+  IAEA_I64 row = (IAEA_I64) MODEL_SUMS*m->nx;
+  for(int t=0; t<MODEL_TYPES; t++)
+  {
+     double *p = m->type[t].position;
+     if(p != NULL) merge_centered(p, m->ny, row);
+  }
+  m->y_width *= 2;
+}
+
+static void double_r(iaea_model *m)
+{
+  for(int t=0; t<MODEL_TYPES; t++)
+  {
+     double *e = m->type[t].energy;
+     if(e == NULL) continue;
+     for(int ir=0; ir<m->n_r; ir++)
+     {
+        double *from = e + (IAEA_I64) m->n_e*ir, *to = e + (IAEA_I64) m->n_e*(ir/2);
+        if(ir % 2 == 0) memmove(to, from, m->n_e*sizeof(double));
+        else for(int ie=0; ie<m->n_e; ie++) to[ie] += from[ie];
+     }
+     memset(e + (IAEA_I64) m->n_e*((m->n_r+1)/2), 0,
+            (IAEA_I64) m->n_e*(m->n_r - (m->n_r+1)/2)*sizeof(double));
+  }
+  m->r_width *= 2;
+}
+
+static void double_e(iaea_model *m)
+{
+  for(int t=0; t<MODEL_TYPES; t++)
+  {
+     double *e = m->type[t].energy;
+     if(e == NULL) continue;
+     for(int ir=0; ir<m->n_r; ir++)
+     {
+        double *s = e + (IAEA_I64) m->n_e*ir;
+        for(int ie=0; ie<m->n_e; ie++)
+        {
+           if(ie % 2 == 0) s[ie/2] = s[ie];
+           else s[ie/2] += s[ie];
+        }
+        for(int ie=(m->n_e+1)/2; ie<m->n_e; ie++) s[ie] = 0;
+     }
+  }
+  m->e_width *= 2;
+}
+
+/* *********************************************************************** */
+
+iaea_model *iaea_model_new(int nx, int ny, int n_r, int n_e)
+{
+  if(nx < 4 || ny < 4 || nx % 4 != 0 || ny % 4 != 0 ||
+     nx > MODEL_MAX_BINS || ny > MODEL_MAX_BINS ||
+     n_r < 1 || n_r > MODEL_MAX_BINS || n_e < 1 || n_e > MODEL_MAX_BINS) return NULL;
+
+  iaea_model *m = (iaea_model *) calloc(1, sizeof(iaea_model));
+  if(m == NULL) return NULL;
+  m->nx = nx; m->ny = ny; m->n_r = n_r; m->n_e = n_e;
+  m->x_width = m->y_width = m->r_width = m->e_width = MODEL_MIN_WIDTH;
+  return m;
+}
+
+static int alloc_type(const iaea_model *m, iaea_model_type *t)
+{
+  t->position = (double *) calloc((size_t) MODEL_SUMS*m->nx*m->ny, sizeof(double));
+  t->energy = (double *) calloc((size_t) m->n_r*m->n_e, sizeof(double));
+  return (t->position != NULL && t->energy != NULL) ? OK : FAIL;
+}
+
+int iaea_model_add(iaea_model *m, IAEA_I32 n, const IAEA_I32 *type,
+                   const IAEA_Float *E, const IAEA_Float *wt, const IAEA_Float *x,
+                   const IAEA_Float *y, const IAEA_Float *z, const IAEA_Float *u,
+                   const IAEA_Float *v, const IAEA_Float *w)
+{
+  for(IAEA_I32 i=0; i<n; i++)
+  {
+     if(type[i] < 1 || type[i] > MODEL_TYPES) continue;
+     double r = sqrt((double) x[i]*x[i] + (double) y[i]*y[i]);
+     // (also false for NaN)
+     if(!(E[i] >= 0 && fabs(wt[i]) < 1e30 && r < 1e30 && fabs(z[i]) < 1e30 &&
+          fabs(u[i]) <= 1 && fabs(v[i]) <= 1)) continue;
+
+     iaea_model_type *t = &m->type[type[i]-1];
+     if(t->position == NULL && alloc_type(m, t) != OK) return(FAIL);
+
+     while(fabs(x[i]) >= m->nx/2*m->x_width) double_x(m);
+     while(fabs(y[i]) >= m->ny/2*m->y_width) double_y(m);
+     while(r >= m->n_r*m->r_width) double_r(m);
+     while(E[i] >= m->n_e*m->e_width) double_e(m);
+
+     int ix = (int) floor(x[i]/m->x_width) + m->nx/2;
+     int iy = (int) floor(y[i]/m->y_width) + m->ny/2;
+     int ir = (int) (r/m->r_width);
+     int ie = (int) (E[i]/m->e_width);
+
+     double weight = wt[i];
+     double *s = t->position + MODEL_SUMS*(ix + (IAEA_I64) m->nx*iy);
+     s[0] += weight;
+     s[1] += weight*u[i];
+     s[2] += weight*v[i];
+     s[3] += weight*u[i]*u[i];
+     s[4] += weight*v[i]*v[i];
+     t->energy[ie + (IAEA_I64) m->n_e*ir] += weight;
+
+     t->n_particles++;
+     t->weight += weight;
+     t->weight_z += weight*z[i];
+     if(w[i] < 0) t->weight_backward += weight;
+  }
+  return(OK);
+}
+
+int iaea_model_write(const iaea_model *m, const char *file)
+{
+  FILE *f = fopen(file, "wb");
+  if(f == NULL) return(FAIL);
+
+  size_t len = strlen(IAEA_MODEL_MAGIC);
+  int status = (fwrite(IAEA_MODEL_MAGIC, 1, len, f) == len) ? OK : FAIL;
+  if(status == OK) status = put_u32(f, m->nx);
+  if(status == OK) status = put_u32(f, m->ny);
+  if(status == OK) status = put_u32(f, m->n_r);
+  if(status == OK) status = put_u32(f, m->n_e);
+  if(status == OK) status = put_f64(f, m->x_width);
+  if(status == OK) status = put_f64(f, m->y_width);
+  if(status == OK) status = put_f64(f, m->r_width);
+  if(status == OK) status = put_f64(f, m->e_width);
+  if(status == OK) status = put_u64(f, m->orig_histories);
+  for(int i=0; i<MODEL_TYPES && status == OK; i++)
+  {
+     const iaea_model_type *t = &m->type[i];
+     status = put_u64(f, t->n_particles);
+     if(t->n_particles == 0) continue;
+     if(status == OK) status = put_f64(f, t->weight);
+     if(status == OK) status = put_f64(f, t->weight_z);
+     if(status == OK) status = put_f64(f, t->weight_backward);
+     if(status == OK) status = put_floats(f, t->position, (IAEA_I64) MODEL_SUMS*m->nx*m->ny);
+     if(status == OK) status = put_floats(f, t->energy, (IAEA_I64) m->n_r*m->n_e);
+  }
+  if(fclose(f) != 0) status = FAIL;
+  return(status);
+}
+
+iaea_model *iaea_model_read(const char *file)
+{
+  FILE *f = fopen(file, "rb");
+  if(f == NULL) return NULL;
+
+  char magic[16];
+  size_t len = strlen(IAEA_MODEL_MAGIC);
+  int nx, ny, n_r, n_e;
+  iaea_model *m = NULL;
+  if(fread(magic, 1, len, f) != len || memcmp(magic, IAEA_MODEL_MAGIC, len) != 0 ||
+     get_u32(f, &nx) != OK || get_u32(f, &ny) != OK ||
+     get_u32(f, &n_r) != OK || get_u32(f, &n_e) != OK ||
+     (m = iaea_model_new(nx, ny, n_r, n_e)) == NULL) {fclose(f); return NULL;}
+
+  int status = get_f64(f, &m->x_width);
+  if(status == OK) status = get_f64(f, &m->y_width);
+  if(status == OK) status = get_f64(f, &m->r_width);
+  if(status == OK) status = get_f64(f, &m->e_width);
+  if(status == OK) status = get_u64(f, &m->orig_histories);
+  if(status == OK && !(m->x_width > 0 && m->y_width > 0 && m->r_width > 0 &&
+                       m->e_width > 0)) status = FAIL;
+  for(int i=0; i<MODEL_TYPES && status == OK; i++)
+  {
+     iaea_model_type *t = &m->type[i];
+     status = get_u64(f, &t->n_particles);
+     if(status != OK || t->n_particles == 0) continue;
+     if(t->n_particles < 0 || alloc_type(m, t) != OK) status = FAIL;
+     if(status == OK) status = get_f64(f, &t->weight);
+     if(status == OK) status = get_f64(f, &t->weight_z);
+     if(status == OK) status = get_f64(f, &t->weight_backward);
+     if(status == OK) status = get_floats(f, t->position, (IAEA_I64) MODEL_SUMS*m->nx*m->ny);
+     if(status == OK) status = get_floats(f, t->energy, (IAEA_I64) m->n_r*m->n_e);
+  }
+  fclose(f);
+  if(status != OK) {iaea_model_free(m); return NULL;}
+  return m;
+}
+
+void iaea_model_free(iaea_model *m)
+{
+  if(m == NULL) return;
+  for(int i=0; i<MODEL_TYPES; i++)
+  {
+     free(m->type[i].position);
+     free(m->type[i].energy);
+  }
+  free(m);
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ *  Histogram models of phase spaces (.IAEAmodel)
+ *
+ *****************************************************************************/
+#ifndef IAEA_MODEL
+#define IAEA_MODEL
+
+#include "iaea_config.h"
+
+#define MODEL_TYPES 5              // photons, electrons, positrons, neutrons, protons
+
+#ifndef MODEL_POSITION_BINS
+  #define MODEL_POSITION_BINS 128  // default bins in x and in y
+#endif
+#ifndef MODEL_RADIAL_BINS
+  #define MODEL_RADIAL_BINS    32  // default rings of the energy spectra
+#endif
+#ifndef MODEL_ENERGY_BINS
+  #define MODEL_ENERGY_BINS   256  // default bins of an energy spectrum
+#endif
+
+/* *********************************************************************** */
+// A phase space is reduced, per particle type, to
+//  - the sums of w, w*u, w*v, w*u*u and w*v*v (w being the weight) of the
+//    particles in every bin of an nx*ny grid in (x,y), which give the
+//    fluence and the mean direction and its spread at every position,
+//  - the sums of w in the n_e energy bins of every one of n_r rings of
+//    radius r = sqrt(x*x+y*y), the spectrum at every distance to the axis,
+//  - the particles, the sums of w and of w*z and the w of the particles
+//    going backwards (w < 0).
+// The phase space is streamed once, so the ranges are not known in
+// advance: the bins start small and, whenever a particle falls outside
+// the grid, the bin width of that axis is doubled, merging bins in pairs.
+// The grid thus ends covering at most twice the range of the particles.
+// The (x,y) grid is centered on the axis, rings and energies start at 0.
+struct iaea_model_type
+{
+  IAEA_I64 n_particles;
+  double weight;             // sum of w
+  double weight_z;           // sum of w*z
+  double weight_backward;    // sum of w of the particles with w < 0
+  double *position;          // 5 sums per bin, bin ix + nx*iy, NULL if no
+                             // particle of this type was added
+  double *energy;            // bin ie + n_e*ir
+};
+
+struct iaea_model
+{
+  int nx, ny, n_r, n_e;      // bins
+  double x_width, y_width;   // bin widths, the grid is
+  double r_width, e_width;   // [-nx/2*x_width,nx/2*x_width) x ...
+  IAEA_I64 orig_histories;   // histories of the phase space
+  iaea_model_type type[MODEL_TYPES];  // type[0] = photons, ...
+};
+
+/* *********************************************************************** */
+// Returns an empty model with nx*ny position bins (nx, ny multiples of 4), n_r
+// rings and n_e energy bins, or NULL if out of memory or the bins are wrong
+iaea_model *iaea_model_new(int nx, int ny, int n_r, int n_e);
+
+// Adds n particles as returned by iaea_get_particles. Particles of unknown
+// types or with values which are not finite are skipped. Returns OK or FAIL
+// if out of memory.
+int iaea_model_add(iaea_model *m, IAEA_I32 n, const IAEA_I32 *type,
+                   const IAEA_Float *E, const IAEA_Float *wt, const IAEA_Float *x,
+                   const IAEA_Float *y, const IAEA_Float *z, const IAEA_Float *u,
+                   const IAEA_Float *v, const IAEA_Float *w);
+
+// Writes m to file (little-endian, sums as 32-bit floats). Returns OK or FAIL.
+int iaea_model_write(const iaea_model *m, const char *file);
+
+// Reads the model of file. Returns NULL if it cannot be read or is not a model.
+iaea_model *iaea_model_read(const char *file);
+
+void iaea_model_free(iaea_model *m);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * iaea_pack: writes a compressed copy of a phase space file
+ *
+ * Usage: iaea_pack input output [block_records]
+ *
+ * The names are given without the .IAEAheader/.IAEAphsp extensions. The
+ * output gets the records of the input in a .IAEAphspz file, compressed
+ * in blocks of block_records records (see iaea_set_compression), and the
+ * header of the input. Compressed files are read by the library like the
+ * others; iaea_convert writes them back uncompressed.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "iaea_phsp.h"
+
+int main(int argc, char *argv[])
+{
+   if(argc < 3 || argc > 4)
+   {
+      printf("\n Usage: %s input output [block_records]\n",argv[0]);
+      printf(" (file names without the .IAEAheader/.IAEAphsp extensions)\n\n");
+      return(1);
+   }
+
+   IAEA_I32 result, len;
+   IAEA_I32 access_read = 1, access_write = 2;
+   IAEA_I32 block_records = (argc == 4) ? atoi(argv[3]) : 0;
+
+   IAEA_I32 source;
+   len = (IAEA_I32) strlen(argv[1]);
+   iaea_new_source(&source, argv[1], &access_read, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot open phase space %s (%ld)\n",argv[1],(long)result);
+      return(1);
+   }
+
+   IAEA_I32 destiny;
+   len = (IAEA_I32) strlen(argv[2]);
+   iaea_new_source(&destiny, argv[2], &access_write, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot create phase space %s (%ld)\n",argv[2],(long)result);
+      return(1);
+   }
+
+   iaea_set_compression(&destiny, &block_records, &result);
+   if(result != 0)
+   {
+      printf("\n ERROR: wrong number of records per block %ld (%ld)\n",
+             (long)block_records,(long)result);
+      return(1);
+   }
+
+   iaea_copy_header(&source, &destiny, &result);
+   iaea_convert_source(&source, &destiny, &result);
+   if(result != 0)
+   {
+      printf("\n ERROR: compressing the phase space failed (%ld)\n",(long)result);
+      return(1);
+   }
+
+   IAEA_I32 type = -1;
+   IAEA_I64 n_particles;
+   iaea_get_max_particles(&destiny, &type, &n_particles);
+
+   iaea_destroy_source(&source, &result);
+   iaea_destroy_source(&destiny, &result);
+
+   printf("\n Compressed %lld particles of %s into %s\n",
+          n_particles, argv[1], argv[2]);
+
+   return(0);
+}
@@ -55,6 +55,11 @@
 #include "iaea_record.h"
 #include "iaea_header.h"
 #include "iaea_phsp.h"
+#include "iaea_thread.h"
+#include "iaea_index.h"
+#include "iaea_compress.h"
+#include "iaea_event_generator.h"
+#include "iaea_recycle.h"
 
 #define false 0
 #define true  1
@@ -62,9 +67,465 @@
 // These variables are defined globally. They contain pointers 
 // to header and record structures defined by calling iaea_new_source() 
 // routine to maintain a list of already initialized IAEA sources.
+//
+// The list is a table of pages of SOURCE_PAGE_SIZE slots. Pages are
+// allocated when needed and never moved or freed, so sources are looked
+// up without locking while other threads open or destroy sources; only
+// taking and releasing slots is serialized by __iaea_source_lock.
+
+struct iaea_dispatcher;
+struct iaea_writers;
+
+struct iaea_source_slot
+{
+   iaea_header_type *header;
+   iaea_record_type *record;
+   int used;
+   int access;        // access the source was opened with
+   IAEA_I32 owner;    // for cursors and writers the source they read or
+                      // write, otherwise -1
+   int n_cursors;     // cursors open on this source
+   IAEA_I64 read_indep_histories; // histories read through a cursor
+   int particles_read; // particles read were counted in the header, whose
+                       // counters no longer describe the file
+   iaea_dispatcher *dispatcher;   // see iaea_set_dispatcher, or NULL
+   iaea_writers *writers;         // see iaea_set_writers, or NULL
+   int i_writer;      // for writers the thread (and statistics shard of the
+                      // header) they write for, otherwise -1
+   char *name;        // file name without extension (not for cursors)
+   iaea_history_index *index;     // see iaea_index_histories, or NULL
+   IAEA_EventGenerator *generator; // for event generators (FILE_TYPE 1),
+                                   // otherwise NULL
+   iaea_recycler *recycler;       // see iaea_set_recycling, or NULL
+};
+
+static iaea_source_slot *__iaea_source_pages[MAX_SOURCE_PAGES];
+static IAEA_I32 __iaea_n_source = 0; // slots handed out so far
+static IAEA_MUTEX __iaea_source_lock = IAEA_MUTEX_INITIALIZER;
+
+// Returned for ids not referring to an open source. Its fheader is NULL,
+// so the usual "No header found" checks reject such ids.
+static iaea_header_type __iaea_closed_header;
+static iaea_record_type __iaea_closed_record;
+
+static iaea_source_slot *source_slot(IAEA_I32 id)
+{
+   if(id < 0 || id >= MAX_NUM_SOURCES) return NULL;
+   iaea_source_slot *page = __iaea_source_pages[id/SOURCE_PAGE_SIZE];
+   if(page == NULL) return NULL;
+   return &page[id%SOURCE_PAGE_SIZE];
+}
+
+static iaea_header_type *source_header(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot == NULL || slot->header == NULL) return &__iaea_closed_header;
+   return slot->header;
+}
+
+static iaea_record_type *source_record(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot == NULL || slot->record == NULL) return &__iaea_closed_record;
+   return slot->record;
+}
+
+// Takes a free slot, growing the table if needed. Returns -1 if all
+// MAX_NUM_SOURCES slots are in use.
+static IAEA_I32 take_source_slot()
+{
+   IAEA_I32 sid = -1;
+
+   IAEA_MUTEX_LOCK(&__iaea_source_lock);
+
+   // do we have a spare spot in the table ?
+   // (e.g. because a source was destroyed)
+   for(IAEA_I32 j=0; j<__iaea_n_source; j++) {
+       if( !source_slot(j)->used ) { sid = j; break; }
+   }
+   if( sid < 0 && __iaea_n_source < MAX_NUM_SOURCES ) {
+       // so, we don't => use the next slot, allocating its page 
+       // if it is the first one
+       iaea_source_slot **page = &__iaea_source_pages[__iaea_n_source/SOURCE_PAGE_SIZE];
+       if(*page == NULL) 
+           *page = (iaea_source_slot *) calloc(SOURCE_PAGE_SIZE, sizeof(iaea_source_slot));
+       if(*page != NULL) sid = __iaea_n_source++;
+   }
+   if( sid >= 0 ) {
+       iaea_source_slot *slot = source_slot(sid);
+       slot->used = true;
+       slot->owner = -1;
+       slot->n_cursors = 0;
+       slot->read_indep_histories = 0;
+       slot->particles_read = false;
+       slot->dispatcher = NULL;
+       slot->writers = NULL;
+       slot->i_writer = -1;
+       slot->name = NULL;
+       slot->index = NULL;
+       slot->generator = NULL;
+       slot->recycler = NULL;
+   }
+
+   IAEA_MUTEX_UNLOCK(&__iaea_source_lock);
+   return sid;
+}
+
+static void release_source_slot(IAEA_I32 sid)
+{
+   IAEA_MUTEX_LOCK(&__iaea_source_lock);
+   if(source_slot(sid)->owner >= 0 && source_slot(sid)->i_writer < 0)
+       source_slot(source_slot(sid)->owner)->n_cursors--;
+   source_slot(sid)->header = NULL;
+   source_slot(sid)->record = NULL;
+   free(source_slot(sid)->name);
+   iaea_index_free(source_slot(sid)->index);
+   iaea_recycler_free(source_slot(sid)->recycler);
+   source_slot(sid)->recycler = NULL;
+   source_slot(sid)->used = false;
+   IAEA_MUTEX_UNLOCK(&__iaea_source_lock);
+}
+
+static int is_cursor(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   return slot != NULL && slot->owner >= 0;
+}
+
+static int is_writer(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   return slot != NULL && slot->i_writer >= 0;
+}
+
+static int has_writers(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   return slot != NULL && slot->writers != NULL;
+}
+
+// Source id was opened for writing (access = 2 or 3), or is a writer of one
+static int is_output(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   return slot != NULL && slot->header != NULL && slot->header->fheader != NULL &&
+          (slot->access == 2 || slot->access == 3);
+}
+
+static IAEA_EventGenerator *source_generator(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   return slot == NULL ? NULL : slot->generator;
+}
+
+// Releases a cursor: it owns nothing but its record and its block buffer
+static void free_cursor(IAEA_I32 id)
+{
+   source_record(id)->set_prefetch(0, 0);
+   source_record(id)->free_block();
+   free(source_record(id));
+   release_source_slot(id);
+}
+
+// Work-stealing dispatcher of a source (see iaea_set_dispatcher). The
+// records are split into batches; every thread keeps a local queue of
+// batches [head,tail) that it consumes from the head, refills it with
+// DISPATCH_GRAIN batches from the shared counter next_batch and, once
+// that is exhausted, steals half of the queue of another thread from
+// its tail. Each thread reads through its own cursor.
+#define DISPATCH_BATCH_RECORDS 16384 // default nominal records per batch
+#define DISPATCH_GRAIN 4             // batches taken from next_batch at once
+
+struct iaea_dispatch_queue
+{
+   IAEA_MUTEX lock;
+   IAEA_I64 head, tail;       // batches still queued for this thread
+   IAEA_I64 n_histories;      // histories read by the thread (atomic)
+   IAEA_I32 cursor;           // cursor the thread reads through
+   char pad[64];              // queues of different threads on different
+                              // cache lines
+};
+
+struct iaea_dispatcher
+{
+   IAEA_I32 n_threads;
+   IAEA_I64 first, last;      // records [first,last) are dispatched
+   IAEA_I64 batch_records;    // nominal records per batch
+   IAEA_I64 n_batches;
+   IAEA_I64 next_batch;       // first batch not yet queued (atomic)
+   iaea_dispatch_queue *queue;
+};
+
+// Histories read so far through the dispatcher of slot
+static IAEA_I64 dispatched_histories(iaea_source_slot *slot)
+{
+   IAEA_I64 n = 0;
+   if(slot->dispatcher == NULL) return n;
+   for(IAEA_I32 t=0; t<slot->dispatcher->n_threads; t++)
+       n += IAEA_ATOMIC_LOAD64(&slot->dispatcher->queue[t].n_histories);
+   return n;
+}
+
+// Destroys the dispatcher of source id, if any, and its cursors. The
+// histories read through it are added to the header counter.
+static void free_dispatcher(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   iaea_dispatcher *d = slot->dispatcher;
+   if(d == NULL) return;
+
+   slot->header->read_indep_histories += dispatched_histories(slot);
+   slot->dispatcher = NULL;
+
+   for(IAEA_I32 t=0; t<d->n_threads; t++)
+   {
+       if(d->queue[t].cursor >= 0) free_cursor(d->queue[t].cursor);
+       IAEA_MUTEX_DESTROY(&d->queue[t].lock);
+   }
+   free(d->queue);
+   free(d);
+}
+
+// Writers of a source (see iaea_set_writers). Each thread writes through
+// its own writer, which collects whole histories in its block buffer and
+// writes them at an offset reserved by advancing end, and counts them in
+// its statistics shard of the header.
+struct iaea_writers
+{
+   IAEA_I32 n_threads;
+   IAEA_I64 end;              // end of the data reserved so far (atomic)
+   IAEA_I32 *writer;          // writer of each thread, -1 once destroyed
+   IAEA_I32 n_live;           // writers not destroyed yet (source lock)
+};
+
+// Releases writer id after writing the records left in its block buffer
+static int free_writer(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   int status = source_record(id)->flush_block();
+
+   source_slot(slot->owner)->writers->writer[slot->i_writer] = -1;
+   source_record(id)->free_block();
+   free(source_record(id));
+   release_source_slot(id);
+   return(status);
+}
+
+// Releases the writers of source id, if any. The statistics of the
+// threads are merged into the header in the order of the threads, and the
+// source itself continues writing after the data of the writers.
+static int free_writers(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   iaea_writers *w = slot->writers;
+   if(w == NULL) return(OK);
+
+   int status = OK;
+   for(IAEA_I32 t=0; t<w->n_threads; t++)
+       if(w->writer[t] >= 0 && free_writer(w->writer[t]) != OK) status = FAIL;
+   slot->writers = NULL;
+
+   slot->header->set_shards(0);
+   if(slot->record->seek(w->end) != OK) status = FAIL;
 
-static iaea_header_type *p_iaea_header[MAX_NUM_SOURCES];
-static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
+   free(w->writer);
+   free(w);
+   return(status);
+}
+
+// History index of source id or of the source of cursor id, if it has one
+// that can be used for reading (of a source opened for reading)
+static iaea_history_index *source_index(IAEA_I32 id)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot->owner >= 0) slot = source_slot(slot->owner);
+   if(slot->access != 1 && slot->access != 4) return NULL;
+   return slot->index;
+}
+
+// Drops the history index of source id, which is no longer up to date
+static void drop_index(IAEA_I32 id)
+{
+   iaea_index_free(source_slot(id)->index);
+   source_slot(id)->index = NULL;
+}
+
+// Counters updated for every particle written. Writers count in their
+// statistics shard of the header of their source. The histories are
+// indexed if requested (see iaea_index_histories).
+static void count_written(IAEA_I32 id, iaea_record_type *p)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot->index != NULL && p->IsNewHistory > 0 &&
+      iaea_index_add(slot->index, slot->header->nParticles, p->IsNewHistory) != OK)
+      drop_index(id);
+   if(slot->i_writer < 0) slot->header->update_counters(p);
+   else slot->header->update_counters(slot->i_writer, p);
+}
+
+// The same for the n particles written at once from caller arrays (see
+// iaea_write_particles), with one update of the counters, or of the shard
+// of a writer. Variables not stored in the records are counted with their
+// constant value, as for a single particle, COUNT_CHUNK particles at a time.
+#define COUNT_CHUNK 256
+static void count_written(IAEA_I32 id, const iaea_record_type *p, IAEA_I32 n,
+                          const IAEA_I32 *n_stat, const IAEA_I32 *type,
+                          const IAEA_Float *E, const IAEA_Float *wt,
+                          const IAEA_Float *x, const IAEA_Float *y,
+                          const IAEA_Float *z)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot->index != NULL)
+      for(IAEA_I32 i=0; i<n; i++)
+         if(n_stat[i] > 0 && iaea_index_add(slot->index,
+               slot->header->nParticles + i, n_stat[i]) != OK)
+            {drop_index(id); break;}
+
+   IAEA_Float cwt[COUNT_CHUNK], cx[COUNT_CHUNK], cy[COUNT_CHUNK], cz[COUNT_CHUNK];
+   IAEA_I32 chunk = n;
+   if(p->iweight == 0 || p->ix == 0 || p->iy == 0 || p->iz == 0)
+   {
+      chunk = COUNT_CHUNK;
+      for(int i=0; i<COUNT_CHUNK; i++)
+         {cwt[i] = p->weight; cx[i] = p->x; cy[i] = p->y; cz[i] = p->z;}
+   }
+
+   for(IAEA_I32 k=0; k<n; k+=chunk)
+   {
+      IAEA_I32 m = (n - k < chunk) ? n - k : chunk;
+      const IAEA_Float *w_k = (p->iweight > 0) ? wt+k : cwt;
+      const IAEA_Float *x_k = (p->ix > 0) ? x+k : cx;
+      const IAEA_Float *y_k = (p->iy > 0) ? y+k : cy;
+      const IAEA_Float *z_k = (p->iz > 0) ? z+k : cz;
+      if(slot->i_writer < 0)
+         slot->header->update_counters(m, n_stat+k, type+k, E+k, w_k, x_k, y_k, z_k);
+      else
+         slot->header->update_counters(slot->i_writer, m, n_stat+k, type+k,
+                                       E+k, w_k, x_k, y_k, z_k);
+   }
+}
+
+// Counters updated for every particle read. Cursors share the header of
+// their source and only count the histories they read.
+static void count_particle(IAEA_I32 id, iaea_record_type *p)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot->owner < 0)
+   {
+      slot->header->update_counters(p);
+      slot->particles_read = true;
+   }
+   else if(p->IsNewHistory > 0) slot->read_indep_histories += p->IsNewHistory;
+}
+
+// The same for n particles read into caller arrays
+static void count_particles(IAEA_I32 id, IAEA_I32 n, const IAEA_I32 *n_stat,
+                            const IAEA_I32 *type, const IAEA_Float *E,
+                            const IAEA_Float *wt, const IAEA_Float *x,
+                            const IAEA_Float *y, const IAEA_Float *z)
+{
+   iaea_source_slot *slot = source_slot(id);
+   if(slot->owner < 0)
+   {
+      slot->header->update_counters(n, n_stat, type, E, wt, x, y, z);
+      slot->particles_read = true;
+   }
+   else
+      for(IAEA_I32 i=0; i<n; i++)
+         if(n_stat[i] > 0) slot->read_indep_histories += n_stat[i];
+}
+
+// Non-zero if the phase space of header h was written on a machine of the
+// other byte order
+static int foreign_byte_order(const iaea_header_type *h)
+{
+   int machine = host_byte_order();
+   return (machine == LITTLE_ENDIAN || machine == BIG_ENDIAN) &&
+          (h->byte_order == LITTLE_ENDIAN || h->byte_order == BIG_ENDIAN) &&
+          h->byte_order != machine;
+}
+
+// Sets path to the file named in the header of source name (the header
+// file name without extension): relative names are taken from the
+// directory of the header
+static void header_path(const char *name, const char *file, char *path)
+{
+   while(isspace(*file)) file++;
+   size_t len = strlen(file);
+   while(len > 0 && isspace(file[len-1])) len--;
+
+   size_t dir = 0;
+   int absolute = (len > 0 && (file[0] == '/' || file[0] == '\\'));
+#ifdef WIN32
+   if(len > 1 && file[1] == ':') absolute = true;
+#endif
+   if(!absolute)
+      for(size_t i=0; name[i]; i++) if(name[i] == '/' || name[i] == '\\') dir = i+1;
+   if(dir + len >= MAX_STR_LEN) dir = len = 0;
+
+   memcpy(path, name, dir);
+   memcpy(path + dir, file, len);
+   path[dir + len] = '\0';
+}
+
+// Loads the event generator of the header of source id and takes the
+// extra variables of its particles into the header
+static int open_generator(IAEA_I32 id, const char *name)
+{
+   iaea_header_type *h = source_header(id);
+   char library[MAX_STR_LEN], input_file[MAX_STR_LEN];
+   header_path(name, *h->event_generator_library ? 
+               h->event_generator_library : name, library);
+   header_path(name, h->input_file_for_event_generator, input_file);
+
+   IAEA_EventGenerator *g = new IAEA_EventGenerator(library, input_file);
+   if(!g->isOk()) {delete g; return(FAIL);}
+
+   IAEA_I32 n_float, n_long, index = 0, res;
+   IAEA_I32 long_types[NUM_EXTRA_LONG], float_types[NUM_EXTRA_FLOAT];
+   g->getExtraNumbers(&n_float, &n_long);
+   if(n_float < 0 || n_float > NUM_EXTRA_FLOAT || 
+      n_long < 0 || n_long > NUM_EXTRA_LONG) {delete g; return(FAIL);}
+   g->getTypeExtraVariables(&index, &res, long_types, float_types);
+
+   h->record_contents[7] = n_float;
+   h->record_contents[8] = n_long;
+   for(int i=0; i<n_float; i++) h->extrafloat_contents[i] = float_types[i];
+   for(int j=0; j<n_long; j++)  h->extralong_contents[j] = long_types[j];
+
+   source_slot(id)->generator = g;
+   return(OK);
+}
+
+// Undoes a source whose opening failed in iaea_new_source: closes its
+// files, releases its memory and its slot without writing the header, and
+// sets the result
+static void fail_new_source(IAEA_I32 *source_ID, IAEA_I32 *result,
+                            IAEA_I32 code)
+{
+   iaea_source_slot *slot = source_slot(*source_ID);
+
+   delete slot->generator;
+   slot->generator = NULL;
+
+   if(slot->header != NULL)
+   {
+      if(slot->header->fheader != NULL) fclose(slot->header->fheader);
+      slot->header->free_text();
+      free(slot->header);
+   }
+   if(slot->record != NULL)
+   {
+      slot->record->unmap_file();
+      if(slot->record->p_file != NULL) fclose(slot->record->p_file);
+      slot->record->free_block();
+      free(slot->record);
+   }
+   release_source_slot(*source_ID);
+
+   *source_ID = -1;
+   *result = code;
+}
 
 /************************************************************************
 * Initialization 
@@ -85,12 +546,34 @@ static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
 * access = 1 => opening read-only file
 * access = 2 => opening file for writing
 * access = 3 => opening file for appending/updating
+* access = 4 => opening read-only file through a memory mapping of the
+*               whole phase space file (falls back to access = 1 if the
+*               file cannot be mapped)
+*
+* Phase space files written on a machine of the other byte order (see
+* BYTE_ORDER in the header) are read all the same: their records are
+* swapped to the byte order of this machine as they are read. They cannot
+* be appended to (result = -92); convert them first (see iaea_convert_source).
+*
+* Compressed phase space files (.IAEAphspz, see iaea_set_compression) are
+* read like the others with access = 1 or 4 (not mapped), but cannot be
+* appended to either (result = -92).
+*
+* Headers of event generators (FILE_TYPE 1) are opened with access = 1
+* or 4. The generator library named by EVENT_GENERATOR_LIBRARY (the
+* header file name if not given; without the platform prefix and
+* extension, see IAEA_EventGenerator) is loaded with the input file
+* INPUT_FILE_FOR_EVENT_GENERATOR, relative names being taken from the
+* directory of the header. iaea_get_particle, iaea_get_particles and
+* iaea_get_dispatched_particles then return the particles of the
+* generator, with the extra variables it declares, iaea_set_parallel
+* selects its random stream and iaea_get_used_original_particles
+* returns the histories it has run. Generators have no records to seek,
+* index, split, merge or convert and cannot be appended to 
+* (result = -92). result = -90 if the generator cannot be loaded.
 *
 ***********************************************************************/
 
-static int __iaea_source_used[MAX_NUM_SOURCES];
-static int __iaea_n_source = 0;
-
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_new_source(IAEA_I32 *source_ID, char *header_file,   
                      const IAEA_I32 *access, IAEA_I32 *result, 
@@ -99,7 +582,7 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
    if( !header_file ) {
        *result = 105; *source_ID = -1; return;
    } // null header file name
-   if(*access != 1 && *access != 2 && *access != 3) { 
+   if(*access != 1 && *access != 2 && *access != 3 && *access != 4) { 
        *result = -99 ; *source_ID = -1; return;
    } // Wrong access requested
 
@@ -110,24 +593,13 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
        *result = -101 ; *source_ID = -1; return;
    } // String length < 1
 
-   if( !__iaea_n_source ) { // called for the first time
-       for(int j=0; j<MAX_NUM_SOURCES; j++) __iaea_source_used[j] = false;
-   }
-   int sid=-1;
-   // do we have a spare spot in the arrays ?
-   // (e.g. because a source was destroyed)
-   for(int j=0; j<__iaea_n_source; j++) {
-       if( !__iaea_source_used[j] ) { sid = j; break; }
-   }
+   // Sources may be created concurrently from several threads
+   IAEA_I32 sid = take_source_slot();
    if( sid < 0 ) {
-       // so, we don't => increase source count and check if 
-       // space left in arrays.
-       if( ++__iaea_n_source >= MAX_NUM_SOURCES ) {
-           *result = -98; *source_ID = -1; return; 
-       }
-       sid = __iaea_n_source-1; *source_ID = sid;
+       *result = -98; *source_ID = -1; return; 
    }
-   __iaea_source_used[sid] = true;
+   *source_ID = sid;
+   source_slot(sid)->access = *access;
 
    //int ilen = strlen(header_file);
    // the above requires a null-terminated string, which may not be 
@@ -140,89 +612,136 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
    }
 
    // Creating IAEA phsp header and allocating memory for it
-   p_iaea_header[*source_ID] = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+   source_slot(sid)->header = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+   source_header(sid)->init_text();
+   source_header(sid)->statistics = IAEA_STATISTICS_EACH;
    // Opening header file 
-   if(*access == 1) p_iaea_header[*source_ID]->fheader = 
+   if(*access == 1 || *access == 4) source_header(*source_ID)->fheader = 
          open_file(header_file,".IAEAheader","rb");   
-   if(*access == 2) p_iaea_header[*source_ID]->fheader = 
+   if(*access == 2) source_header(*source_ID)->fheader = 
          open_file(header_file,".IAEAheader","wb");                
-   if(*access == 3) p_iaea_header[*source_ID]->fheader = 
+   if(*access == 3) source_header(*source_ID)->fheader = 
          open_file(header_file,".IAEAheader","r+b");               
 
-   if(p_iaea_header[*source_ID]->fheader == NULL) { *result = -96; return;} // phsp failed to open,
+   if(source_header(sid)->fheader == NULL) { // phsp failed to open,
+       fail_new_source(source_ID, result, -96); return;
+   }
+
+   // The name is kept for the files next to the header (.IAEAindex)
+   source_slot(sid)->name = (char *) malloc(strlen(header_file) + 1);
+   if(source_slot(sid)->name != NULL) strcpy(source_slot(sid)->name, header_file);
 
    // Creating IAEA record and allocating memory for it
-   p_iaea_record[*source_ID] = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
+   source_slot(sid)->record = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
 
-   p_iaea_header[*source_ID]->initialize_counters();   
+   source_header(*source_ID)->initialize_counters();   
    
    switch( *access ) 
    {
          case 2: // writing a new phsp
 
-             strcpy(p_iaea_header[*source_ID]->title,"PHASESPACE in IAEA format");   
+             source_header(*source_ID)->set_text(&source_header(*source_ID)->title,
+                                                 "PHASESPACE in IAEA format");
              // Default IAEA index 
-             *result = p_iaea_header[*source_ID]->iaea_index = 1000; 
+             *result = source_header(*source_ID)->iaea_index = 1000; 
     
-             p_iaea_record[*source_ID]->p_file = 
+             source_record(*source_ID)->p_file = 
                  open_file(header_file, ".IAEAphsp", "wb");
 
-             if(p_iaea_record[*source_ID]->p_file == NULL) { *result = -94 ; return; } 
+             if(source_record(*source_ID)->p_file == NULL)
+                 { fail_new_source(source_ID, result, -94); return;}
 
              // Setting default i/o flags 
-             if(p_iaea_record[*source_ID]->initialize() != OK) 
-                 {*result = -1; return;}
+             if(source_record(*source_ID)->initialize() != OK) 
+                 {fail_new_source(source_ID, result, -1); return;}
 
-             if( p_iaea_header[*source_ID]->set_record_contents(p_iaea_record[*source_ID]) 
-                 == FAIL ) { *result = -95; return;} 
+             if( source_header(*source_ID)->set_record_contents(source_record(*source_ID)) 
+                 == FAIL ) { fail_new_source(source_ID, result, -95); return;} 
 
              return;
 
          case 3 : // appending to the existing phsp
            
-             if( p_iaea_header[*source_ID]->read_header() != OK)
-                 { *result = -93; return;} 
+             if( source_header(*source_ID)->read_header() != OK)
+                 { fail_new_source(source_ID, result, -93); return;} 
+
+             // Compressed files and event generators cannot be appended to
+             if( source_header(*source_ID)->compression_block > 0 ||
+                 source_header(*source_ID)->file_type == 1)
+                     { fail_new_source(source_ID, result, -92); return;}
 
              int i;
              // Setting up Average Kinetic Energy counters to usable values
              for(i=0;i<MAX_NUM_PARTICLES;i++) 
-                 p_iaea_header[*source_ID]->averageKineticEnergy[i] *= 
-                 p_iaea_header[*source_ID]->sumParticleWeight[i];
+                 source_header(*source_ID)->averageKineticEnergy[i] *= 
+                 source_header(*source_ID)->sumParticleWeight[i];
 
              // Opening phsp file to append
-             p_iaea_record[*source_ID]->p_file = 
+             source_record(*source_ID)->p_file = 
                  open_file(header_file, ".IAEAphsp", "a+b");
 
-             if(p_iaea_record[*source_ID]->p_file == NULL) { *result = -94 ; return; } 
+             if(source_record(*source_ID)->p_file == NULL)
+                 { fail_new_source(source_ID, result, -94); return;}
 
-             if(p_iaea_record[*source_ID]->initialize() != OK) {*result = -1; return;}
+             if(source_record(*source_ID)->initialize() != OK)
+                 {fail_new_source(source_ID, result, -1); return;}
    
              // Get read/write logical block from the header
-             if( p_iaea_header[*source_ID]->get_record_contents(p_iaea_record[*source_ID]) 
-                 == FAIL) { *result = -91; return;} 
+             if( source_header(*source_ID)->get_record_contents(source_record(*source_ID)) 
+                 == FAIL) { fail_new_source(source_ID, result, -91); return;} 
 
-             *result = p_iaea_header[*source_ID]->iaea_index; // returning IAEA index
+             // Records of the other byte order cannot be appended to
+             if( foreign_byte_order(source_header(*source_ID)) )
+                 { fail_new_source(source_ID, result, -92); return;}
+
+             *result = source_header(*source_ID)->iaea_index; // returning IAEA index
 
              break;
 
          case 1 : // reading existing phsp
+         case 4 : // reading existing phsp through a memory mapping
+
+             if( source_header(*source_ID)->read_header() != OK)
+                 { fail_new_source(source_ID, result, -93); return;}
 
-             if( p_iaea_header[*source_ID]->read_header() != OK) { *result = -93; return;} 
+             // Event generators are loaded instead of a phsp file
+             if( source_header(*source_ID)->file_type == 1)
+             {
+                 if( open_generator(*source_ID, header_file) != OK)
+                    { fail_new_source(source_ID, result, -90); return;} 
+                 *result = source_header(*source_ID)->iaea_index;
+                 break;
+             }
 
              // Opening phsp file to read
-             p_iaea_record[*source_ID]->p_file = 
-                 open_file(header_file, ".IAEAphsp", "rb");
+             source_record(*source_ID)->p_file = 
+                 open_file(header_file, 
+                     source_header(*source_ID)->compression_block > 0 ? 
+                     (char *) ".IAEAphspz" : (char *) ".IAEAphsp", "rb");
 
-             if(p_iaea_record[*source_ID]->p_file == NULL)
-                 { *result = -94 ; return; } 
+             if(source_record(*source_ID)->p_file == NULL)
+                 { fail_new_source(source_ID, result, -94); return;} 
          
-             if(p_iaea_record[*source_ID]->initialize() != OK) {*result = -1; return;}
+             if(source_record(*source_ID)->initialize() != OK)
+                 {fail_new_source(source_ID, result, -1); return;}
    
              // Get read/write logical block from the header
-             if( p_iaea_header[*source_ID]->get_record_contents(p_iaea_record[*source_ID]) 
-                 == FAIL) { *result = -91; return;} 
+             if( source_header(*source_ID)->get_record_contents(source_record(*source_ID)) 
+                 == FAIL) { fail_new_source(source_ID, result, -91); return;} 
 
-             *result = p_iaea_header[*source_ID]->iaea_index; // returning IAEA index
+             source_record(*source_ID)->swap_bytes = 
+                 foreign_byte_order(source_header(*source_ID));
+
+             // Compressed files are read at decompressed positions, unmapped
+             if( source_header(*source_ID)->compression_block > 0)
+             {
+                 if(source_record(*source_ID)->open_compressed() != OK)
+                    { fail_new_source(source_ID, result, -94); return;} 
+             }
+             else if(*access == 4 && source_record(*source_ID)->map_file() != OK)
+                 printf("\n Unable to map phase space file, reading it through stdio\n");
+
+             *result = source_header(*source_ID)->iaea_index; // returning IAEA index
 
              break;
    }
@@ -261,6 +780,358 @@ void IAEA_NEW_SOURCE__(IAEA_I32 *source_ID, char *header_file,
     iaea_new_source(source_ID,header_file,access,result,hf_length);
 }
 
+/**************************************************************************
+* Reader cursor on a source
+*
+* Create a cursor on the source with Id source_ID, which must have been
+* opened for reading (access = 1 or 4), and return its Id in cursor_ID.
+* A cursor shares the parsed header of its source and, for access = 4,
+* the memory mapping of the phase space file, but has its own position,
+* record range and block buffer; without a mapping it reads the file with
+* pread(). The cursor Id can be passed to all reading functions
+* (iaea_get_particle, iaea_get_particles, iaea_set_record, 
+* iaea_set_parallel, iaea_set_parallel_chunk, ...), so several threads
+* can read one phase space, each through its own cursor, without locking.
+* Cursors do not update the header statistics of their source;
+* iaea_get_used_original_particles returns the histories read through
+* the cursor. Cursors are destroyed with iaea_destroy_source, which must
+* be done before destroying their source.
+* result is set to 0 if OK, -1 if source_ID does not exist, -2 if it was
+* not opened for reading or is an event generator (whose threads are set
+* up with iaea_set_dispatcher) and -98 if no more Ids are available.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_new_cursor(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result)
+{
+   *cursor_ID = -1;
+   if(source_header(*source_ID)->fheader == NULL) {*result = -1; return;}
+
+   // A cursor on a cursor reads the same source
+   IAEA_I32 owner = *source_ID;
+   if(is_cursor(owner)) owner = source_slot(owner)->owner;
+
+   iaea_source_slot *src = source_slot(owner);
+   if(src->generator != NULL || (src->access != 1 && src->access != 4))
+      {*result = -2; return;}
+
+   IAEA_I32 sid = take_source_slot();
+   if( sid < 0 ) {*result = -98; return;}
+
+   iaea_source_slot *slot = source_slot(sid);
+   slot->access = src->access;
+   slot->record = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
+   if(slot->record == NULL || slot->record->share(source_record(*source_ID)) != OK)
+   {
+      free(slot->record);
+      release_source_slot(sid);
+      *result = -1; return;
+   }
+
+   IAEA_MUTEX_LOCK(&__iaea_source_lock);
+   slot->owner = owner;
+   src->n_cursors++;
+   IAEA_MUTEX_UNLOCK(&__iaea_source_lock);
+
+   slot->header = src->header; // shared, never freed through the cursor
+
+   *cursor_ID = sid;
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_new_cursor_(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result)
+{ iaea_new_cursor(source_ID, cursor_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_new_cursor__(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result)
+{ iaea_new_cursor(source_ID, cursor_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEW_CURSOR(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result)
+{ iaea_new_cursor(source_ID, cursor_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEW_CURSOR_(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result)
+{ iaea_new_cursor(source_ID, cursor_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEW_CURSOR__(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result)
+{ iaea_new_cursor(source_ID, cursor_ID, result); }
+
+/**************************************************************************
+* Prefetching of phase space records
+*
+* Switch reading ahead on (n_buffers > 0) or off (n_buffers = 0) for the
+* source or cursor with Id id, opened for reading. A background thread then
+* reads the following records into a ring of n_buffers buffers of
+* buffer_records records each (about 1 MB per buffer if buffer_records = 0)
+* while the particles of the current buffer are returned, so reading from
+* slow or network storage overlaps with the calculation. Seeking
+* (iaea_set_record, iaea_set_parallel, ...) restarts the read-ahead at the
+* new position. Sources read through a memory mapping (access = 4) and
+* compressed files are left unchanged. Prefetching stops when the source
+* is destroyed.
+* result is set to 0 if OK, -1 if the source does not exist or on errors,
+* -2 if n_buffers or buffer_records is negative and -3 if the source was
+* not opened for reading.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_prefetch(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   if(*n_buffers < 0 || *buffer_records < 0) {*result = -2; return;}
+
+   int access = source_slot(*id)->access;
+   if(source_header(*id)->file_type == 1 || (access != 1 && access != 4))
+      {*result = -3; return;}
+
+   iaea_record_type *p = source_record(*id);
+   int n_records = *buffer_records;
+   if(n_records == 0) n_records = (1 << 20)/p->get_reclength() + 1;
+
+   *result = (p->set_prefetch(*n_buffers, n_records) == OK) ? 0 : -1;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_prefetch_(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result)
+{ iaea_set_prefetch(id, n_buffers, buffer_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_prefetch__(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result)
+{ iaea_set_prefetch(id, n_buffers, buffer_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_PREFETCH(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result)
+{ iaea_set_prefetch(id, n_buffers, buffer_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_PREFETCH_(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result)
+{ iaea_set_prefetch(id, n_buffers, buffer_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_PREFETCH__(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result)
+{ iaea_set_prefetch(id, n_buffers, buffer_records, result); }
+
+/**************************************************************************
+* Compressed phase space files
+*
+* Store the records written to the source with Id id, opened for writing
+* (access = 2), in the file .IAEAphspz instead of .IAEAphsp, compressed in
+* blocks of block_records records (COMPRESSION_BLOCK_RECORDS, 4096, if
+* block_records = 0). Each block is compressed on its own, so reading can
+* start at any record (iaea_set_record, iaea_set_parallel, cursors, the
+* dispatcher, ...) decompressing a single block. The header keyword
+* COMPRESSION gives the records per block. Compressed files are read with
+* iaea_new_source like the others, but cannot be appended to and have no
+* writers (see iaea_set_writers). The file is complete once the source is
+* destroyed. This must be done before the first particle is written.
+* result is set to 0 if OK, -1 if the source does not exist or on errors,
+* -2 if block_records is negative and -3 if the source is not a phase
+* space file opened for writing, is already compressed or has particles.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_compression(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL || is_cursor(*id) || is_writer(*id))
+      {*result = -1; return;}
+   if(*block_records < 0) {*result = -2; return;}
+
+   iaea_source_slot *slot = source_slot(*id);
+   iaea_record_type *p = slot->record;
+   if(slot->header->file_type == 1 || slot->access != 2 || has_writers(*id) ||
+      p->compressed != NULL || slot->header->nParticles > 0 || p->block_fill > 0)
+      {*result = -3; return;}
+   if(slot->name == NULL) {*result = -1; return;}
+
+   // The records go to name.IAEAphspz, the empty name.IAEAphsp is removed
+   char *file = (char *) malloc(strlen(slot->name) + strlen(".IAEAphsp") + 1);
+   if(file == NULL) {*result = -1; return;}
+   strcpy(file, slot->name);
+   strcat(file, ".IAEAphsp");
+
+   FILE *f = open_file(slot->name, (char *) ".IAEAphspz", (char *) "wb");
+   int block = (*block_records > 0) ? *block_records : COMPRESSION_BLOCK_RECORDS;
+   if(f == NULL || p->set_compressed(block) != OK)
+   {
+      if(f != NULL) fclose(f);
+      free(file);
+      *result = -1; return;
+   }
+   fclose(p->p_file);
+   remove(file);
+   free(file);
+   p->p_file = f;
+   slot->header->compression_block = block;
+
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_compression_(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result)
+{ iaea_set_compression(id, block_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_compression__(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result)
+{ iaea_set_compression(id, block_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_COMPRESSION(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result)
+{ iaea_set_compression(id, block_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_COMPRESSION_(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result)
+{ iaea_set_compression(id, block_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_COMPRESSION__(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result)
+{ iaea_set_compression(id, block_records, result); }
+
+/**************************************************************************
+* Accumulation of the header statistics
+*
+* Select how the statistics of the header of the source with Id id
+* (weights, kinetic energies and X,Y,Z ranges per particle type) are
+* accumulated while particles are read or written:
+*   mode = 0 : not accumulated, for sources opened for reading only
+*   mode = 1 : updated with every particle (the default)
+*   mode = 2 : particles are collected in batches that are reduced at once
+*              (with SSE2 when available). The statistics are complete when
+*              the header is written (iaea_update_header, iaea_destroy_source)
+*              or printed and in iaea_get_maximum_energy.
+* The number of particles of each type and of statistically independent
+* histories is always kept up to date. Sums may differ between mode 1 and
+* mode 2 in the last digits. NaN values are left out of the minima and
+* maxima in both modes; a minimum or maximum of zero may differ in sign.
+* result is set to 0 if OK, -1 if the source does not exist, is a cursor
+* or on errors, -2 if mode is not valid and -3 if mode = 0 is selected for
+* a source opened for writing.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   if(is_cursor(*id)) {*result = -1; return;} // cursors keep no statistics
+   if(*mode < IAEA_STATISTICS_OFF || *mode > IAEA_STATISTICS_DEFERRED)
+      {*result = -2; return;}
+
+   int access = source_slot(*id)->access;
+   if(*mode == IAEA_STATISTICS_OFF && access != 1 && access != 4)
+      {*result = -3; return;}
+
+   *result = (source_header(*id)->set_statistics((int)*mode) == OK) ? 0 : -1;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics_(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics__(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STATISTICS(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STATISTICS_(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STATISTICS__(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+
+/**************************************************************************
+* Recycling of particles
+*
+* Return every particle read from the source or cursor with Id id, opened
+* for reading, n_recycle times in a row by iaea_get_particle and
+* iaea_get_particles. The copies after the first have n_stat = 0, and 0 in
+* the extralongs of type 1 (incremental history number), so each history is
+* still counted once (also by iaea_get_used_original_particles), and all
+* copies get the weight divided by n_recycle, so results per
+* original history do not change. The copies are made on the decoded
+* particles, each record is read once. symmetry selects how the copies are
+* transformed, in (x,y) and in (u,v) alike:
+*   symmetry = 0 : identical copies
+*   symmetry = 1 : every copy rotated about the z axis by a random angle.
+*                  The angles come from stream id of the random sequence
+*                  of seed seed (see iaea_random.h), so runs are repeatable
+*                  and sources and cursors get different angles.
+*   symmetry = 2 : copy k (from 0) rotated by 2*pi*k/n_recycle
+*   symmetry = 3 : copy k reflected x -> -x if k%4 = 1, y -> -y if k%4 = 2,
+*                  both if k%4 = 3
+* n_recycle = 1 with symmetry = 0 switches recycling off. Particles read
+* through the dispatcher (iaea_get_dispatched_particles) are not recycled.
+* Moving the source (iaea_set_record, iaea_set_parallel, ...) drops the
+* copies of the last particle not yet returned.
+* result is set to 0 if OK, -1 if the source does not exist or on errors,
+* -2 if n_recycle or symmetry is not valid and -3 if the source was not
+* opened for reading or is an event generator.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_recycling(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL || is_writer(*id)) {*result = -1; return;}
+   if(*n_recycle < 1 || *symmetry < IAEA_RECYCLE_NONE || 
+      *symmetry > IAEA_RECYCLE_REFLECT) {*result = -2; return;}
+
+   iaea_source_slot *slot = source_slot(*id);
+   if(slot->header->file_type == 1 || (slot->access != 1 && slot->access != 4))
+      {*result = -3; return;}
+
+   iaea_recycler *r = NULL;
+   if(*n_recycle > 1 || *symmetry != IAEA_RECYCLE_NONE)
+   {
+      r = iaea_recycler_new(*n_recycle, (int)*symmetry,
+                            (unsigned long long)(unsigned int) *seed,
+                            (unsigned long long) *id,
+                            slot->header->record_contents[8],
+                            slot->header->extralong_contents);
+      if(r == NULL) {*result = -1; return;}
+   }
+   iaea_recycler_free(slot->recycler);
+   slot->recycler = r;
+
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_recycling_(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result)
+{ iaea_set_recycling(id, n_recycle, symmetry, seed, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_recycling__(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result)
+{ iaea_set_recycling(id, n_recycle, symmetry, seed, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_RECYCLING(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result)
+{ iaea_set_recycling(id, n_recycle, symmetry, seed, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_RECYCLING_(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result)
+{ iaea_set_recycling(id, n_recycle, symmetry, seed, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_RECYCLING__(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result)
+{ iaea_set_recycling(id, n_recycle, symmetry, seed, result); }
+
 /************************************************************************
 * Maximum number of particles 
 *
@@ -276,9 +1147,9 @@ void iaea_get_max_particles(const IAEA_I32 *id, const IAEA_I32 *type,
                                   IAEA_I64 *n_particle)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) {*n_particle = -1; return;}
+      if(source_header(*id)->fheader == NULL) {*n_particle = -1; return;}
 
-      int file_type = p_iaea_header[*id]->file_type;
+      int file_type = source_header(*id)->file_type;
 
       IAEA_I64 itmp=2;      
       if(file_type == 1) // Event generator
@@ -296,10 +1167,10 @@ void iaea_get_max_particles(const IAEA_I32 *id, const IAEA_I32 *type,
             return;
       }
       // phsp file
-      if (*type < 0) {*n_particle = p_iaea_header[*id]->nParticles; return;}
+      if (*type < 0) {*n_particle = source_header(*id)->nParticles; return;}
       if ( (*type >= MAX_NUM_PARTICLES) || (*type ==0) ) {*n_particle = 0; return;} 
       
-      *n_particle = p_iaea_header[*id]->particle_number[*type-1];
+      *n_particle = source_header(*id)->particle_number[*type-1];
 
       return;
 }
@@ -339,17 +1210,24 @@ IAEA_EXTERN_C IAEA_EXPORT
 void iaea_get_maximum_energy(const IAEA_I32 *id, IAEA_Float *Emax)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) {*Emax = -1.f; return;}
+      if(source_header(*id)->fheader == NULL) {*Emax = -1.f; return;}
 
-      int file_type = p_iaea_header[*id]->file_type;
+      int file_type = source_header(*id)->file_type;
       
-      if(file_type == 1) {*Emax = -1.f; return;}// Event generator
+      if(file_type == 1) // Event generator
+      {
+            IAEA_EventGenerator *g = source_generator(*id);
+            if(g != NULL) g->getMaximumEnergy(Emax);
+            else *Emax = -1.f;
+            return;
+      }
 
       // phsp file
+      source_header(*id)->flush_statistics();
       *Emax = 0.f;
       for(int i=0;i<MAX_NUM_PARTICLES;i++)
       {
-        *Emax = (IAEA_Float) max(*Emax,p_iaea_header[*id]->maximumKineticEnergy[i]);
+        *Emax = (IAEA_Float) max(*Emax,source_header(*id)->maximumKineticEnergy[i]);
       }
       return;
 }
@@ -382,11 +1260,11 @@ void iaea_get_extra_numbers(const IAEA_I32 *id, IAEA_I32 *n_extra_float,
                                           IAEA_I32 *n_extra_int)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) 
+      if(source_header(*id)->fheader == NULL) 
             {*n_extra_float = *n_extra_int = -1; return;}
 
-      *n_extra_float = p_iaea_header[*id]->record_contents[7];
-      *n_extra_int   = p_iaea_header[*id]->record_contents[8];
+      *n_extra_float = source_header(*id)->record_contents[7];
+      *n_extra_int   = source_header(*id)->record_contents[8];
       return;
 }
 IAEA_EXTERN_C IAEA_EXPORT
@@ -427,13 +1305,13 @@ void iaea_set_extra_numbers(const IAEA_I32 *id, IAEA_I32 *n_extra_float,
                                   IAEA_I32 *n_extra_int)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) return;
+      if(source_header(*id)->fheader == NULL) return;
 
-      p_iaea_header[*id]->record_contents[7] = *n_extra_float;
-      p_iaea_header[*id]->record_contents[8] = *n_extra_int;
+      source_header(*id)->record_contents[7] = *n_extra_float;
+      source_header(*id)->record_contents[8] = *n_extra_int;
 
     // Store read/write logical block in the PHSP header
-    if( p_iaea_header[*id]->get_record_contents(p_iaea_record[*id]) 
+    if( source_header(*id)->get_record_contents(source_record(*id)) 
          == FAIL) return;
 
       return;
@@ -495,13 +1373,13 @@ void iaea_set_type_extralong_variable(const IAEA_I32 *id,
                                             IAEA_I32 *type)
 {
    // No header found
-   if(p_iaea_header[*id]->fheader == NULL) {*type = -1; return;}
+   if(source_header(*id)->fheader == NULL) {*type = -1; return;}
 
    if((*index < 0) || (*index >= NUM_EXTRA_LONG) ) {*type = -2; return;}
 
    if((*type < 0) || (*type > MAX_NUMB_EXTRALONG_TYPES) ) {*type = -3; return;}
 
-   p_iaea_header[*id]->extralong_contents[*index] = *type;
+   source_header(*id)->extralong_contents[*index] = *type;
         
    return;
 }
@@ -563,13 +1441,13 @@ void iaea_set_type_extrafloat_variable(const IAEA_I32 *id,
                                              IAEA_I32 *type)
 {
    // No header found
-   if(p_iaea_header[*id]->fheader == NULL) {*type = -1; return;}
+   if(source_header(*id)->fheader == NULL) {*type = -1; return;}
    
    if((*index < 0) || (*index >= NUM_EXTRA_FLOAT) ) {*type = -2; return;}
 
    if((*type < 0) || (*type > MAX_NUMB_EXTRAFLOAT_TYPES) ) {*type = -3; return;}
 
-   p_iaea_header[*id]->extrafloat_contents[*index] = *type;
+   source_header(*id)->extrafloat_contents[*index] = *type;
        
    return;
 }
@@ -640,13 +1518,13 @@ void iaea_get_type_extra_variables(const IAEA_I32 *id, IAEA_I32 *result,
       IAEA_I32 extralong_types[], IAEA_I32 extrafloat_types[])
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+      if(source_header(*id)->fheader == NULL) {*result = -1; return;}
 
-      for (int i=0;i<p_iaea_header[*id]->record_contents[8];i++ )
-          extralong_types[i] = p_iaea_header[*id]->extralong_contents[i];
+      for (int i=0;i<source_header(*id)->record_contents[8];i++ )
+          extralong_types[i] = source_header(*id)->extralong_contents[i];
 
-      for (int j=0;j<p_iaea_header[*id]->record_contents[7];j++ )
-          extrafloat_types[j] = p_iaea_header[*id]->extrafloat_contents[j];
+      for (int j=0;j<source_header(*id)->record_contents[7];j++ )
+          extrafloat_types[j] = source_header(*id)->extrafloat_contents[j];
   
       *result = +1;
       return;
@@ -697,15 +1575,15 @@ void iaea_set_constant_variable(const IAEA_I32 *id, const IAEA_I32 *index,
                                                IAEA_Float *constant)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) {*constant = -1.f; return;}
+      if(source_header(*id)->fheader == NULL) {*constant = -1.f; return;}
 
       if((*index < 0) || (*index > 6) ) {*constant = -2.f; return;}
 
-      p_iaea_header[*id]->record_contents[*index] = 0; // variable is constant
-      p_iaea_header[*id]->record_constant[*index] = *constant;
+      source_header(*id)->record_contents[*index] = 0; // variable is constant
+      source_header(*id)->record_constant[*index] = *constant;
 
       // Store read/write logical block changes in the PHSP header
-      p_iaea_header[*id]->get_record_contents(p_iaea_record[*id]); 
+      source_header(*id)->get_record_contents(source_record(*id)); 
 
       return;
 }
@@ -756,12 +1634,12 @@ void iaea_get_constant_variable(const IAEA_I32 *id, const IAEA_I32 *index,
 {
       *result=0;
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+      if(source_header(*id)->fheader == NULL) {*result = -1; return;}
 
       if((*index < 0) || (*index > 6) ) {*result = -2; return;}
 
-      if( p_iaea_header[*id]->record_contents[*index] == 0) {
-          *constant=p_iaea_header[*id]->record_constant[*index]; 
+      if( source_header(*id)->record_contents[*index] == 0) {
+          *constant=source_header(*id)->record_constant[*index]; 
       }
       else { *result=-3;}
 
@@ -803,10 +1681,14 @@ IAEA_EXTERN_C IAEA_EXPORT
 void iaea_get_used_original_particles(const IAEA_I32 *id, IAEA_I64 *n_indep_particles)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) {*n_indep_particles = -1; return;}
+      if(source_header(*id)->fheader == NULL) {*n_indep_particles = -1; return;}
 
       // (Number of electron histories for linacs)
-      *n_indep_particles = p_iaea_header[*id]->read_indep_histories; 
+      IAEA_EventGenerator *g = source_generator(*id);
+      if(g != NULL) g->getOriginalHistories(n_indep_particles);
+      else if(is_cursor(*id)) *n_indep_particles = source_slot(*id)->read_indep_histories;
+      else *n_indep_particles = source_header(*id)->read_indep_histories +
+                                dispatched_histories(source_slot(*id));
       return;
 }
 IAEA_EXTERN_C IAEA_EXPORT
@@ -829,7 +1711,8 @@ void IAEA_GET_USED_ORIGINAL_PARTICLES__(const IAEA_I32 *id, IAEA_I64 *n_indep_pa
 * Get Total Number of Original Particles from the Source with Id id. 
 *
 * For a typical linac it should be equal to the total number of electrons
-* incident on the primary target. 
+* incident on the primary target. For event generators it is the number
+* of histories run so far.
 *
 * Set number_of_original_particles to negative if such source does not exist.
 ******************************************************************************/
@@ -838,10 +1721,13 @@ void iaea_get_total_original_particles(const IAEA_I32 *id,
                                        IAEA_I64 *number_of_original_particles)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) 
+      if(source_header(*id)->fheader == NULL) 
           {*number_of_original_particles = -1; return;}
 
-      *number_of_original_particles = p_iaea_header[*id]->orig_histories; 
+      IAEA_EventGenerator *g = source_generator(*id);
+      if(g != NULL) {g->getOriginalHistories(number_of_original_particles); return;}
+
+      *number_of_original_particles = source_header(*id)->orig_histories; 
 
       return;
 }
@@ -879,11 +1765,11 @@ void iaea_set_total_original_particles(const IAEA_I32 *id,
                                        IAEA_I64 *number_of_original_particles)
 {
       // No header found
-      if(p_iaea_header[*id]->fheader == NULL) 
+      if(source_header(*id)->fheader == NULL) 
             {*number_of_original_particles = -1; return;}
       
       // Bug corrected, RCN, dec. 2006  
-      p_iaea_header[*id]->orig_histories = *number_of_original_particles; 
+      source_header(*id)->orig_histories = *number_of_original_particles; 
       return;
 }
 IAEA_EXTERN_C IAEA_EXPORT
@@ -908,57 +1794,193 @@ void IAEA_SET_TOTAL_ORIGINAL_PARTICLES__(const IAEA_I32 *id,
 { iaea_set_total_original_particles(id, number_of_original_particles); }
 
 /**************************************************************************
-* Partitioning for parallel runs 
-*
-* i_parallel is the job number, i_chunk the calculation chunk,
-* n_chunk the total number of calculation chunks. This function
-* should divide the available phase space of source with Id id
-* into n_chunk equal portions and from now on deliver particles
-* from the i_chunk-th portion. (i_chunk must be between 1 and n_chunk)
-* The extra parameter i_parallel is needed
-* for the cases where the source is an event generator and should
-* be used to adjust the random number sequence.
-* The variable result should be set to 0 if everything went smoothly,
-* or to some error code if it didnt.
+* Helpers for partitioning a phase space file into chunks of records
 **************************************************************************/
-IAEA_EXTERN_C IAEA_EXPORT
-void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
-                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
-                                       IAEA_I32 *result)
+
+// Index of the extralong holding the incremental history number n_stat
+// (type 1), -1 if there is none
+static int history_extralong(IAEA_I32 id)
 {
-   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
-   if(*n_chunk <= 0) {*result = -2; return;}
-   if( (*i_chunk < 1) || (*i_chunk > *n_chunk) ) {*result = -3; return;}
+   int jhist = -1;
+   for(int j=0;j<source_record(id)->iextralong;j++) 
+       if(source_header(id)->extralong_contents[j] == 1) jhist = j;
+   return jhist;
+}
 
-   if(p_iaea_header[*id]->file_type == 1) 
+// n_stat of a raw record, as returned by iaea_get_particle
+static IAEA_I32 record_n_stat(const iaea_record_type *p, int jhist,
+                              const unsigned char *record)
+{
+   if(jhist >= 0)
    {
-         // set i_parallel for event generators
-         *result = 0; 
-         return;
+      IAEA_I32 n_stat;
+      memcpy(&n_stat, record + p->layout.offset_extralong + 
+                      jhist*sizeof(IAEA_I32), sizeof(IAEA_I32));
+      return n_stat;
    }
-   
-   IAEA_I64 nrecords =  p_iaea_header[*id]->nParticles;
-   IAEA_I32 record_length =  p_iaea_header[*id]->record_length;
-   IAEA_I32 number_record_per_chunk = (IAEA_I32)nrecords/(*n_chunk);
-
+   float energy;
+   memcpy(&energy, record + sizeof(char), sizeof(float));
+   return energy < 0 ? 1 : 0;
+}
 
-   IAEA_I32 offset = ((*i_chunk)-1)*record_length * number_record_per_chunk;
-   /*
-   SEEK_CUR   Current position of file pointer
-   SEEK_END   End of file
-   SEEK_SET   Beginning of file
-   stream   Pointer to FILE structure
-   offset   Number of bytes from origin
-   origin   Initial position
-   */
-   if( fseek(p_iaea_record[*id]->p_file, offset ,SEEK_SET) == 0) 
+// Scans records [first,last) (counted from 0) of source id. If 
+// stop_at_history is set, returns the first of them starting a new
+// history (n_stat > 0), otherwise last. If n_hist is not NULL the n_stat
+// of all scanned records are added to it. Returns -1 on read errors.
+// The file position is left undefined. With a history index nothing is read.
+static IAEA_I64 scan_records(IAEA_I32 id, IAEA_I64 first, IAEA_I64 last,
+                             int stop_at_history, IAEA_I64 *n_hist)
+{
+   iaea_history_index *index = source_index(id);
+   if(index != NULL)
    {
-         IAEA_I32 pos = ftell(p_iaea_record[*id]->p_file);
-         *result = 0; 
-         return;
+      IAEA_I64 n_first, n_last;
+      IAEA_I64 irec = iaea_index_next(index, first, &n_first);
+      if(stop_at_history) return (irec < last) ? irec : last;
+      iaea_index_next(index, last, &n_last);
+      if(n_hist != NULL) *n_hist += n_last - n_first;
+      return last;
    }
 
-   *result = -1; 
+   iaea_record_type *p = source_record(id);
+   int jhist = history_extralong(id);
+   int reclength = p->get_reclength();
+
+   if(p->set_range(first*reclength, last*reclength) != OK) return -1;
+
+   // A new history is usually a few records away: start with small reads
+   IAEA_I32 nmax = stop_at_history ? 64 : NUM_BLOCK_RECORDS;
+
+   IAEA_I64 irec = first;
+   while(irec < last)
+   {
+      IAEA_I32 nblock;
+      const unsigned char *block = p->read_block(nmax, &nblock);
+      if(block == NULL || nblock <= 0) return -1;
+      if(nmax < NUM_BLOCK_RECORDS) nmax *= 2;
+
+      for(IAEA_I32 i=0; i<nblock; i++, irec++)
+      {
+         IAEA_I32 n_stat = record_n_stat(p, jhist, block + i*reclength);
+         if(n_stat > 0 && stop_at_history) return irec;
+         if(n_stat > 0 && n_hist != NULL) *n_hist += n_stat;
+      }
+   }
+   return irec;
+}
+
+// Divides the records of source id into n_chunk portions using 64-bit
+// record numbers and offsets (the last portion gets the remainder),
+// optionally moving the boundaries to the next new history, and 
+// restricts reading to the i_chunk-th portion. Returns 0 if OK or -1.
+static IAEA_I32 set_chunk(IAEA_I32 id, IAEA_I32 i_chunk, IAEA_I32 n_chunk,
+                          int snap, IAEA_I64 *first_record,
+                          IAEA_I64 *n_records, IAEA_I64 *n_histories)
+{
+   iaea_record_type *p = source_record(id);
+   int reclength = p->get_reclength();
+
+   IAEA_I64 size = p->file_size();
+   if(size < 0) return -1;
+
+   IAEA_I64 nrecords = size/reclength;
+   IAEA_I64 per_chunk = nrecords/n_chunk;
+
+   IAEA_I64 first = (IAEA_I64)(i_chunk-1)*per_chunk;
+   IAEA_I64 last  = (i_chunk == n_chunk) ? nrecords : (IAEA_I64)i_chunk*per_chunk;
+
+   if(snap)
+   {
+      // No history is split: every chunk starts at a new history
+      if(first > 0) first = scan_records(id, first, nrecords, 1, NULL);
+      if(last < nrecords) last = scan_records(id, last, nrecords, 1, NULL);
+      if(first < 0 || last < 0) return -1;
+      if(last < first) last = first;
+   }
+
+   if(n_histories != NULL)
+   {
+      *n_histories = 0;
+      if(scan_records(id, first, last, 0, n_histories) < 0) return -1;
+   }
+
+   if(p->set_range(first*reclength, last*reclength) != OK) return -1;
+
+   *first_record = first + 1;    // numbered from 1, as in iaea_set_record
+   *n_records = last - first;
+   return 0;
+}
+
+// Indexes the histories of the nrecords records of source id, reading
+// them once. Returns the index, or NULL on read errors. The source is
+// left at its first record.
+static iaea_history_index *build_index(IAEA_I32 id, IAEA_I64 nrecords)
+{
+   iaea_record_type *p = source_record(id);
+   int jhist = history_extralong(id);
+   int reclength = p->get_reclength();
+
+   iaea_history_index *index = iaea_index_new();
+   int status = (index != NULL) ? p->set_range(0, nrecords*reclength) : FAIL;
+
+   IAEA_I64 irec = 0;
+   while(irec < nrecords && status == OK)
+   {
+      IAEA_I32 nblock;
+      const unsigned char *block = p->read_block(NUM_BLOCK_RECORDS, &nblock);
+      if(block == NULL || nblock <= 0) {status = FAIL; break;}
+
+      for(IAEA_I32 i=0; i<nblock && status == OK; i++, irec++)
+      {
+         IAEA_I32 n_stat = record_n_stat(p, jhist, block + i*reclength);
+         if(n_stat > 0) status = iaea_index_add(index, irec, n_stat);
+      }
+   }
+   p->set_range(0, -1);
+
+   if(status != OK) {iaea_index_free(index); return NULL;}
+   iaea_index_end(index, nrecords);
+   return index;
+}
+
+/**************************************************************************
+* Partitioning for parallel runs 
+*
+* i_parallel is the job number, i_chunk the calculation chunk,
+* n_chunk the total number of calculation chunks. This function
+* should divide the available phase space of source with Id id
+* into n_chunk equal portions and from now on deliver particles
+* from the i_chunk-th portion. (i_chunk must be between 1 and n_chunk)
+* The extra parameter i_parallel is needed
+* for the cases where the source is an event generator and should
+* be used to adjust the random number sequence.
+* Records are counted with 64-bit offsets, the last portion also gets
+* the remainder records, and end of file (n_stat = -2) is signaled at the
+* end of the portion (see also iaea_set_parallel_chunk).
+* The variable result should be set to 0 if everything went smoothly,
+* or to some error code if it didnt.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                                       IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   if(*n_chunk <= 0) {*result = -2; return;}
+   if( (*i_chunk < 1) || (*i_chunk > *n_chunk) ) {*result = -3; return;}
+
+   if(source_header(*id)->file_type == 1) 
+   {
+         // set i_parallel for event generators
+         IAEA_EventGenerator *g = source_generator(*id);
+         if(g != NULL) g->setParallelRun(i_parallel, i_chunk, n_chunk, result);
+         else *result = 0; 
+         return;
+   }
+   
+   iaea_recycle_drop(source_slot(*id)->recycler);
+   IAEA_I64 first_record, n_records;
+   *result = set_chunk(*id, *i_chunk, *n_chunk, 0, &first_record, &n_records, NULL);
    return;
 }
 IAEA_EXTERN_C IAEA_EXPORT
@@ -1006,22 +2028,25 @@ void IAEA_SET_PARALLEL__(const IAEA_I32 *id,
 * checksum and the byte order = the byte order of the machine being run on.
 * Returns -1 if the header does not exist; -2 if the function fseek fails
 * for some reason; -3 if there is a file size mismatch; -4 if there is a
-* byte order mismatch; -5 if there is a mismatch in both
+* byte order mismatch; -5 if there is a mismatch in both.
+* A byte order mismatch does not prevent reading the file, whose records
+* are swapped as they are read (see iaea_new_source).
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_check_file_size_byte_order(const IAEA_I32 *id, 
                                        IAEA_I32 *result)
 {
-   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   if(source_generator(*id) != NULL) {*result = -1; return;} // no file
 
-   IAEA_I64 current_pos = ftell(p_iaea_record[*id]->p_file);
    int machine_byte_order = check_byte_order();
+   IAEA_I64 file_size = source_record(*id)->file_size();
 
-   if (fseek(p_iaea_record[*id]->p_file, 0L ,SEEK_END) == 0)
+   if (file_size >= 0)
    {
-       if (ftell(p_iaea_record[*id]->p_file) == p_iaea_header[*id]->checksum)
+       if (file_size == source_header(*id)->checksum)
        {
-           if (machine_byte_order==p_iaea_header[*id]->byte_order)
+           if (machine_byte_order==source_header(*id)->byte_order)
            {
               *result=0;
            }
@@ -1030,7 +2055,7 @@ void iaea_check_file_size_byte_order(const IAEA_I32 *id,
            }
        }
        else {
-           if (machine_byte_order==p_iaea_header[*id]->byte_order)
+           if (machine_byte_order==source_header(*id)->byte_order)
            {
               *result=-3;
            }
@@ -1038,10 +2063,6 @@ void iaea_check_file_size_byte_order(const IAEA_I32 *id,
               *result=-5;
            }
        }
-       if (fseek(p_iaea_record[*id]->p_file,current_pos,SEEK_SET) != 0)
-       {
-           *result=-2;
-       }
    }
    else {
        *result=-2;
@@ -1070,6 +2091,670 @@ void IAEA_CHECK_FILE_SIZE_BYTE_ORDER__(const IAEA_I32 *id,
 { iaea_check_file_size_byte_order( id, result);}
 
 
+/**************************************************************************
+* History-aligned partitioning for parallel runs 
+*
+* Same as iaea_set_parallel, but the chunk is described to the caller.
+* The records are divided with 64-bit offsets into n_chunk portions, the
+* last one getting the remainder, and from now on only the records of the
+* i_chunk-th portion are delivered (n_stat = -2 at the end of the chunk,
+* after which reading restarts at its first record).
+* If snap is not zero, the chunk boundaries are moved forward to the next
+* record starting a new history (n_stat > 0), so histories are never split
+* between chunks.
+* first_record returns the number of the first record of the chunk (from 1,
+* as used by iaea_set_record), n_records the number of records in it and
+* n_histories the number of original histories it covers, i.e. the sum of
+* n_stat over its records (computed by scanning the chunk once).
+* The variable result is set to 0 if everything went smoothly, to -1 if
+* the source does not exist or on i/o errors, -2 if n_chunk <= 0 and -3 if
+* i_chunk is not between 1 and n_chunk.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_parallel_chunk(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   if(*n_chunk <= 0) {*result = -2; return;}
+   if( (*i_chunk < 1) || (*i_chunk > *n_chunk) ) {*result = -3; return;}
+
+   *first_record = *n_records = *n_histories = 0;
+
+   if(source_header(*id)->file_type == 1) 
+   {
+         // set i_parallel for event generators
+         IAEA_EventGenerator *g = source_generator(*id);
+         if(g != NULL) g->setParallelRun(i_parallel, i_chunk, n_chunk, result);
+         else *result = 0; 
+         return;
+   }
+
+   iaea_recycle_drop(source_slot(*id)->recycler);
+   *result = set_chunk(*id, *i_chunk, *n_chunk, *snap, first_record, 
+                       n_records, n_histories);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_parallel_chunk_(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result)
+{ iaea_set_parallel_chunk(id, i_parallel, i_chunk, n_chunk, snap, 
+                          first_record, n_records, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_parallel_chunk__(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result)
+{ iaea_set_parallel_chunk(id, i_parallel, i_chunk, n_chunk, snap, 
+                          first_record, n_records, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_PARALLEL_CHUNK(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result)
+{ iaea_set_parallel_chunk(id, i_parallel, i_chunk, n_chunk, snap, 
+                          first_record, n_records, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_PARALLEL_CHUNK_(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result)
+{ iaea_set_parallel_chunk(id, i_parallel, i_chunk, n_chunk, snap, 
+                          first_record, n_records, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_PARALLEL_CHUNK__(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result)
+{ iaea_set_parallel_chunk(id, i_parallel, i_chunk, n_chunk, snap, 
+                          first_record, n_records, n_histories, result); }
+
+/**************************************************************************
+* Index of the histories
+*
+* Give the source with Id id an index of its histories: the first record
+* of every history and the original histories (n_stat) it accounts for,
+* kept in the file <name>.IAEAindex next to the header (see iaea_index.h).
+* For a source opened for reading the index is read from that file if it
+* is up to date (made for a phase space of the same size and modification
+* time), otherwise it is built reading the phase space once (the
+* source is left at its first particle) and saved, if the directory can
+* be written, for the next time. For a source opened with access = 2 the
+* histories are indexed as they are written and the file is saved when
+* the source is destroyed; the index is dropped if particles are added in
+* another way (iaea_merge_sources, iaea_split_source, iaea_set_writers).
+* With the index of a source opened for reading, iaea_set_parallel_chunk,
+* iaea_set_dispatcher and iaea_split_source find history boundaries and
+* count histories without reading the records, and the histories can be
+* located with iaea_get_history_records and iaea_seek_history.
+* n_histories returns the number of histories indexed (0 when writing).
+* result is set to 0 if OK, -1 if the source does not exist or on i/o
+* errors and -3 if the source is an event generator, a cursor or a
+* writer, or was opened with access = 3.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_index_histories(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result)
+{
+   *n_histories = 0;
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+
+   iaea_source_slot *slot = source_slot(*id);
+   if(slot->header->file_type == 1 || is_cursor(*id) || slot->access == 3)
+      {*result = -3; return;}
+
+   *result = 0;
+   if(slot->access == 2)
+   {
+      // histories added by count_written from now on
+      if(slot->index == NULL && slot->header->nParticles == 0 && 
+         slot->record->block_fill == 0) slot->index = iaea_index_new();
+      if(slot->index == NULL) *result = -1;
+      return;
+   }
+
+   if(slot->index == NULL)
+   {
+      iaea_record_type *p = slot->record;
+      IAEA_I64 size = p->file_size();
+      if(size < 0 || slot->name == NULL) {*result = -1; return;}
+      IAEA_I64 nrecords = size/p->get_reclength();
+      IAEA_I64 time = p->file_time();
+
+      // a saved index is only trusted if it was made for this very file
+      if(time >= 0)
+         slot->index = iaea_index_read(slot->name, nrecords, size, time);
+      if(slot->index == NULL)
+      {
+         slot->index = build_index(*id, nrecords);
+         if(slot->index == NULL) {*result = -1; return;}
+         if(time >= 0) iaea_index_write(slot->index, slot->name, size, time);
+      }
+   }
+   *n_histories = slot->index->n_histories;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_index_histories_(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result)
+{ iaea_index_histories(id, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_index_histories__(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result)
+{ iaea_index_histories(id, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_INDEX_HISTORIES(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result)
+{ iaea_index_histories(id, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_INDEX_HISTORIES_(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result)
+{ iaea_index_histories(id, n_histories, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_INDEX_HISTORIES__(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result)
+{ iaea_index_histories(id, n_histories, result); }
+
+/**************************************************************************
+* Records of a history
+*
+* Return for the k-th history (counted from 1) of the source with Id id
+* (or of the source of cursor id) the number of its first record in
+* first_record (counted from 1, as used by iaea_set_record), the number
+* of its records in n_records and in n_orig the original histories up to
+* and including it, i.e. the sum of the n_stat of histories 1 to k.
+* The source needs an index (see iaea_index_histories).
+* result is set to 0 if OK, -1 if the source does not exist, -2 if it
+* has no index and -3 if k is not between 1 and the number of histories.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   iaea_history_index *index = source_index(*id);
+   if(index == NULL) {*result = -2; return;}
+
+   IAEA_I64 first, last;
+   if(iaea_index_find(index, *k - 1, &first, &last, n_orig) != OK)
+      {*result = -3; return;}
+   *first_record = first + 1;
+   *n_records = last - first;
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records_(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result)
+{ iaea_get_history_records(id, k, first_record, n_records, n_orig, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records__(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result)
+{ iaea_get_history_records(id, k, first_record, n_records, n_orig, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_HISTORY_RECORDS(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result)
+{ iaea_get_history_records(id, k, first_record, n_records, n_orig, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_HISTORY_RECORDS_(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result)
+{ iaea_get_history_records(id, k, first_record, n_records, n_orig, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_HISTORY_RECORDS__(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result)
+{ iaea_get_history_records(id, k, first_record, n_records, n_orig, result); }
+
+/**************************************************************************
+* Seek a history
+*
+* Position the source with Id id (or cursor id) at the k-th history
+* (counted from 1), so that the next particle read is its first one.
+* The source needs an index (see iaea_index_histories).
+* result is set to 0 if OK, -1 if the source does not exist or the
+* position cannot be set, -2 if it has no index, -3 if k is not
+* between 1 and the number of histories and -4 if the history is not in
+* the portion of the file reading is restricted to (see iaea_set_record).
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_seek_history(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
+   iaea_history_index *index = source_index(*id);
+   if(index == NULL) {*result = -2; return;}
+
+   IAEA_I64 first, last, n_orig;
+   if(iaea_index_find(index, *k - 1, &first, &last, &n_orig) != OK)
+      {*result = -3; return;}
+
+   iaea_record_type *p = source_record(*id);
+   if(!p->in_range(first*p->get_reclength())) {*result = -4; return;}
+
+   iaea_recycle_drop(source_slot(*id)->recycler);
+   *result = (p->seek(first*p->get_reclength()) == OK) ? 0 : -1;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_seek_history_(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result)
+{ iaea_seek_history(id, k, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_seek_history__(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result)
+{ iaea_seek_history(id, k, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SEEK_HISTORY(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result)
+{ iaea_seek_history(id, k, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SEEK_HISTORY_(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result)
+{ iaea_seek_history(id, k, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SEEK_HISTORY__(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result)
+{ iaea_seek_history(id, k, result); }
+
+/**************************************************************************
+* Helpers of the work-stealing dispatcher
+**************************************************************************/
+
+// Next batch for thread t: from its own queue, else a new group of
+// batches from the shared counter, else stolen from the tail of the
+// queue of another thread. Returns -1 when no batch is left.
+static IAEA_I64 take_batch(iaea_dispatcher *d, IAEA_I32 t)
+{
+   iaea_dispatch_queue *q = &d->queue[t];
+   IAEA_I64 b = -1;
+
+   IAEA_MUTEX_LOCK(&q->lock);
+   if(q->head < q->tail) b = q->head++;
+   IAEA_MUTEX_UNLOCK(&q->lock);
+   if(b >= 0) return b;
+
+   b = IAEA_ATOMIC_ADD64(&d->next_batch, (IAEA_I64)DISPATCH_GRAIN);
+   if(b < d->n_batches)
+   {
+      IAEA_I64 end = b + DISPATCH_GRAIN;
+      if(end > d->n_batches) end = d->n_batches;
+      IAEA_MUTEX_LOCK(&q->lock);
+      q->head = b + 1;
+      q->tail = end;
+      IAEA_MUTEX_UNLOCK(&q->lock);
+      return b;
+   }
+
+   for(IAEA_I32 k=1; k<d->n_threads; k++)
+   {
+      iaea_dispatch_queue *victim = &d->queue[(t+k)%d->n_threads];
+      IAEA_I64 first = 0, end = 0;
+
+      IAEA_MUTEX_LOCK(&victim->lock);
+      IAEA_I64 n_left = victim->tail - victim->head;
+      if(n_left > 0)
+      {
+         end = victim->tail;
+         victim->tail -= (n_left + 1)/2;
+         first = victim->tail;
+      }
+      IAEA_MUTEX_UNLOCK(&victim->lock);
+
+      if(end > first)
+      {
+         IAEA_MUTEX_LOCK(&q->lock);
+         q->head = first + 1;
+         q->tail = end;
+         IAEA_MUTEX_UNLOCK(&q->lock);
+         return first;
+      }
+   }
+   return -1;
+}
+
+// Restricts the cursor of thread t to batch b. The nominal boundaries
+// are moved forward to the next new history, which gives the same
+// record for the end of a batch and the start of the following one.
+static IAEA_I32 set_batch(iaea_dispatcher *d, IAEA_I32 t, IAEA_I64 b)
+{
+   IAEA_I32 cursor = d->queue[t].cursor;
+   int reclength = source_record(cursor)->get_reclength();
+
+   IAEA_I64 first = d->first + b*d->batch_records;
+   IAEA_I64 last = (b == d->n_batches - 1) ? d->last : first + d->batch_records;
+
+   if(b > 0) first = scan_records(cursor, first, d->last, 1, NULL);
+   if(last < d->last) last = scan_records(cursor, last, d->last, 1, NULL);
+   if(first < 0 || last < 0) return -1;
+   if(last < first) last = first;
+
+   if(source_record(cursor)->set_range(first*reclength, last*reclength) != OK)
+      return -1;
+   return 0;
+}
+
+/**************************************************************************
+* Work-stealing dispatcher for multi-threaded runs
+*
+* Set up the source with Id id, opened for reading (access = 1 or 4), to
+* be read by n_threads threads through iaea_get_dispatched_particles.
+* The records of the source (or of its current chunk, see
+* iaea_set_parallel) are split into batches of about batch_records
+* records (16384 if batch_records = 0) whose boundaries are moved
+* forward to the next new history, so histories are never split between
+* threads. Batches are handed out on demand from a shared counter through
+* small per-thread queues; a thread that runs out of work steals batches
+* queued for other threads, so threads reading expensive histories do not
+* hold back the others. Each thread reads through its own cursor (see
+* iaea_new_cursor). Calling this function again restarts the dispatch;
+* it must not be called while other threads read the source.
+* The dispatcher is released by iaea_destroy_source.
+* For event generators (see iaea_new_source) every thread gets its own
+* instance of the generator instead, loaded here from the same input
+* file, with a random stream of its own within the chunk set by
+* iaea_set_parallel (see IAEA_EventGenerator::setThreads); batch_records
+* is not used.
+* result is set to 0 if OK, -1 if the source does not exist or on i/o
+* errors, -2 if n_threads <= 0 or batch_records < 0, -3 if the source is
+* not a phase space file or event generator opened for reading and -98
+* if no more Ids are available for the cursors.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_dispatcher(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL || is_cursor(*id)) {*result = -1; return;}
+   if(*n_threads <= 0 || *batch_records < 0) {*result = -2; return;}
+
+   iaea_source_slot *slot = source_slot(*id);
+   if(slot->generator != NULL)
+   {
+      slot->generator->setThreads(n_threads, result);
+      if(*result != 0) *result = -1;
+      return;
+   }
+   if(slot->header->file_type == 1 || (slot->access != 1 && slot->access != 4))
+      {*result = -3; return;}
+
+   free_dispatcher(*id);
+
+   iaea_record_type *p = source_record(*id);
+   int reclength = p->get_reclength();
+   IAEA_I64 size = p->file_size();
+   if(size < 0) {*result = -1; return;}
+
+   iaea_dispatcher *d = (iaea_dispatcher *) calloc(1, sizeof(iaea_dispatcher));
+   if(d == NULL) {*result = -1; return;}
+   d->queue = (iaea_dispatch_queue *) calloc(*n_threads, sizeof(iaea_dispatch_queue));
+   if(d->queue == NULL) {free(d); *result = -1; return;}
+
+   // Only the current chunk of the source is dispatched
+   d->n_threads = *n_threads;
+   d->first = p->has_range ? p->range_begin/reclength : 0;
+   d->last  = p->has_range ? p->range_end/reclength : size/reclength;
+   d->batch_records = *batch_records > 0 ? *batch_records : DISPATCH_BATCH_RECORDS;
+   d->n_batches = (d->last - d->first + d->batch_records - 1)/d->batch_records;
+   d->next_batch = 0;
+   for(IAEA_I32 t=0; t<d->n_threads; t++)
+   {
+      IAEA_MUTEX_INIT(&d->queue[t].lock);
+      d->queue[t].cursor = -1;
+   }
+   slot->dispatcher = d;
+
+   *result = 0;
+   for(IAEA_I32 t=0; t<d->n_threads && *result == 0; t++)
+   {
+      IAEA_I32 res;
+      iaea_new_cursor(id, &d->queue[t].cursor, &res);
+      if(res != 0) *result = (res == -98) ? -98 : -1;
+      else  // empty range: the first read takes a batch
+         source_record(d->queue[t].cursor)->set_range(d->first*reclength, 
+                                                      d->first*reclength);
+   }
+   if(*result != 0) free_dispatcher(*id);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_dispatcher_(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result)
+{ iaea_set_dispatcher(id, n_threads, batch_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_dispatcher__(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result)
+{ iaea_set_dispatcher(id, n_threads, batch_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_DISPATCHER(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result)
+{ iaea_set_dispatcher(id, n_threads, batch_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_DISPATCHER_(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result)
+{ iaea_set_dispatcher(id, n_threads, batch_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_DISPATCHER__(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result)
+{ iaea_set_dispatcher(id, n_threads, batch_records, result); }
+
+/**************************************************************************
+* Get a block of particles from the dispatcher
+*
+* Same as iaea_get_particles, for the thread number i_thread (between 1
+* and n_threads) of the dispatcher of source id (see iaea_set_dispatcher).
+* The particles read come from one batch only, so n_read may be smaller
+* than n_max; the next batch is taken by the following call. Several
+* threads may call this function at the same time with different
+* i_thread. n_read is set to -1 if the source has no dispatcher, i_thread
+* is out of range or on read errors, and to -2 once all batches have been
+* read. Event generators fill the arrays from the instance of the thread
+* and never end.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_dispatched_particles(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{
+      *n_read = -1;
+      if(source_header(*id)->fheader == NULL) return;
+
+      IAEA_EventGenerator *g = source_generator(*id);
+      if(g != NULL)
+      {
+         g->getNextParticles(i_thread, n_max, n_read, n_stat, type, 
+                             E, wt, x, y, z, u, v, w, extra_floats, extra_ints);
+         return;
+      }
+
+      iaea_dispatcher *d = source_slot(*id)->dispatcher;
+      if(d == NULL || *i_thread < 1 || *i_thread > d->n_threads) return;
+
+      IAEA_I32 t = *i_thread - 1;
+      iaea_dispatch_queue *q = &d->queue[t];
+      iaea_record_type *p = source_record(q->cursor);
+
+      while(p->at_end())
+      {
+         IAEA_I64 b = take_batch(d, t);
+         if(b < 0) {*n_read = -2; return;}
+         if(set_batch(d, t, b) != 0) return;
+      }
+
+      IAEA_I64 n_hist = source_slot(q->cursor)->read_indep_histories;
+      iaea_get_particles(&q->cursor, n_max, n_read, n_stat, type, 
+                         E, wt, x, y, z, u, v, w, extra_floats, extra_ints);
+      n_hist = source_slot(q->cursor)->read_indep_histories - n_hist;
+      if(n_hist != 0) IAEA_ATOMIC_ADD64(&q->n_histories, n_hist);
+      return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_dispatched_particles_(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_dispatched_particles(id, i_thread, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_dispatched_particles__(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_dispatched_particles(id, i_thread, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_DISPATCHED_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_dispatched_particles(id, i_thread, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_DISPATCHED_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_dispatched_particles(id, i_thread, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_DISPATCHED_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_dispatched_particles(id, i_thread, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+
+/**************************************************************************
+* Histories read through the dispatcher
+*
+* Set n_histories to the number of original histories (sum of n_stat)
+* read so far by the thread i_thread of the dispatcher of source id, or
+* by all its threads if i_thread = 0. These histories are also included
+* in iaea_get_used_original_particles for the source. n_histories is set
+* to -1 if the source has no dispatcher or i_thread is out of range.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_dispatched_histories(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories)
+{
+   *n_histories = -1;
+   if(source_header(*id)->fheader == NULL) return;
+
+   iaea_source_slot *slot = source_slot(*id);
+   if(slot->generator != NULL)
+   {
+      if(*i_thread == 0) slot->generator->getOriginalHistories(n_histories);
+      else slot->generator->getOriginalHistories(i_thread, n_histories);
+      return;
+   }
+
+   iaea_dispatcher *d = slot->dispatcher;
+   if(d == NULL || *i_thread < 0 || *i_thread > d->n_threads) return;
+
+   if(*i_thread == 0) *n_histories = dispatched_histories(slot);
+   else *n_histories = IAEA_ATOMIC_LOAD64(&d->queue[*i_thread-1].n_histories);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_dispatched_histories_(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories)
+{ iaea_get_dispatched_histories(id, i_thread, n_histories); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_dispatched_histories__(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories)
+{ iaea_get_dispatched_histories(id, i_thread, n_histories); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_DISPATCHED_HISTORIES(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories)
+{ iaea_get_dispatched_histories(id, i_thread, n_histories); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_DISPATCHED_HISTORIES_(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories)
+{ iaea_get_dispatched_histories(id, i_thread, n_histories); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_DISPATCHED_HISTORIES__(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories)
+{ iaea_get_dispatched_histories(id, i_thread, n_histories); }
+
 /**************************************************************************
 * setting the pointer to a user-specified record no. in the file 
 *
@@ -1078,19 +2763,26 @@ void IAEA_CHECK_FILE_SIZE_BYTE_ORDER__(const IAEA_I32 *id,
 * particles in the file + 1, then the position is set to the end of the
 * file.
 * The variable result should be set to 0 if everything went smoothly,
-* or to some error code if it didnt.
+* or to some error code if it didnt. If reading is restricted to a
+* portion of the file (iaea_set_parallel, iaea_set_parallel_chunk),
+* record_num must be in it (or just past its end), otherwise result is
+* set to -4 and the position is not changed.
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
                                        IAEA_I32 *result)
 {
-   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+   if(source_header(*id)->fheader == NULL) {*result = -1; return;}
    if(*record_num <= 0) {*result = -2; return;}
-   if(*record_num > p_iaea_header[*id]->nParticles+1) {*result = -3; return;}
+   if(*record_num > source_header(*id)->nParticles+1) {*result = -3; return;}
+   if(source_generator(*id) != NULL) {*result = -3; return;} // no records
 
-   IAEA_I32 record_length =  p_iaea_header[*id]->record_length;
+   IAEA_I64 record_length =  source_record(*id)->get_reclength();
 
    IAEA_I64 offset = (*record_num-1) * record_length;
+   if(!source_record(*id)->in_range(offset)) {*result = -4; return;}
+
+   iaea_recycle_drop(source_slot(*id)->recycler);
    /*
    SEEK_CUR   Current position of file pointer
    SEEK_END   End of file
@@ -1100,9 +2792,8 @@ void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
    origin   Initial position
    */
    
-   if( fseek(p_iaea_record[*id]->p_file, offset ,SEEK_SET) == 0) 
+   if( source_record(*id)->seek(offset) == OK) 
    {
-         IAEA_I32 pos = ftell(p_iaea_record[*id]->p_file);
          *result = 0; 
          return;
    }
@@ -1136,6 +2827,122 @@ void IAEA_SET_RECORD__(const IAEA_I32 *id,
                                             IAEA_I32 *is_ok)
 { iaea_set_record(id, record_num, is_ok); }
 
+// Reads up to n_max consecutive particles of the phase space file of
+// source id into the arrays, as iaea_get_particles does, but with extra
+// variable k of particle i at [k*stride+i]. At the end of the file n_read
+// is -2 and the file is left there, to be rewound by the caller once it
+// signals the end.
+static void read_particles(IAEA_I32 id, IAEA_I32 n_max, IAEA_I32 stride,
+                           IAEA_I32 *n_read, IAEA_I32 *n_stat, IAEA_I32 *type,
+                           IAEA_Float *E, IAEA_Float *wt, IAEA_Float *x,
+                           IAEA_Float *y, IAEA_Float *z, IAEA_Float *u,
+                           IAEA_Float *v, IAEA_Float *w,
+                           IAEA_Float *extra_floats, IAEA_I32 *extra_ints)
+{
+      iaea_header_type *h = source_header(id);
+      iaea_record_type *p = source_record(id);
+      *n_read = 0;
+
+      // Looking for incremental number of histories  
+      // (Type 1 of the extralong stored variable)
+      int jhist = history_extralong(id);
+
+      while(*n_read < n_max)
+      {
+         IAEA_I32 nblock;
+         const unsigned char *block = p->read_block(n_max - *n_read, &nblock);
+         if(block == NULL) {*n_read = -1; return;}
+         if(nblock <= 0) break;
+
+         // Whole block unpacked at once by the layout specific decoder
+         IAEA_I32 i0 = *n_read;
+         iaea_decode_block(&p->layout, h->record_constant, block, nblock,
+                           n_stat+i0, type+i0, E+i0, wt+i0, 
+                           x+i0, y+i0, z+i0, u+i0, v+i0, w+i0,
+                           extra_floats+i0, extra_ints+i0, stride);
+
+         if(jhist >= 0)
+            for(IAEA_I32 i=i0; i<i0+nblock; i++) n_stat[i] = extra_ints[jhist*stride+i];
+
+         // Same counters as updated by iaea_get_particle
+         count_particles(id, nblock, n_stat+i0, type+i0, E+i0, wt+i0,
+                         x+i0, y+i0, z+i0);
+         *n_read += nblock;
+
+         if(p->at_end() || p->read_error()) break;
+      }
+
+      if(*n_read == 0 && p->at_end()) *n_read = -2;
+}
+
+// Ends a call of recycle_particles on the result nr < 0 of read_particles
+// after i0 particles were given: an error is returned at once, the end of
+// the file only if no particle was given, and the file is then rewound.
+// Otherwise the file stays at its end and the next call signals it.
+static void end_recycling(iaea_record_type *p, IAEA_I32 nr, IAEA_I32 i0,
+                          IAEA_I32 *n_read)
+{
+      if(nr == -1) *n_read = -1;
+      else if(i0 == 0)
+      {
+         *n_read = -2;
+         p->rewind_file();
+      }
+}
+
+// The same returning every particle n_recycle times (see
+// iaea_set_recycling). As many whole particles as fit are read at once and
+// expanded in place; once fewer places than copies are left, one particle
+// is read into the recycler, which gives its copies over the next calls.
+// The end of the file is only signaled (and the file rewound) once all
+// copies have been given.
+static void recycle_particles(IAEA_I32 id, IAEA_I32 n_max, IAEA_I32 *n_read,
+                              IAEA_I32 *n_stat, IAEA_I32 *type, IAEA_Float *E,
+                              IAEA_Float *wt, IAEA_Float *x, IAEA_Float *y,
+                              IAEA_Float *z, IAEA_Float *u, IAEA_Float *v,
+                              IAEA_Float *w, IAEA_Float *extra_floats,
+                              IAEA_I32 *extra_ints)
+{
+      iaea_recycler *r = source_slot(id)->recycler;
+      iaea_record_type *p = source_record(id);
+      IAEA_I32 nf = p->iextrafloat, nl = p->iextralong;
+
+      *n_read = iaea_recycle_held(r, n_max, n_max, nf, nl, n_stat, type, E,
+                                  wt, x, y, z, u, v, w, extra_floats, extra_ints);
+      while(*n_read < n_max)
+      {
+         IAEA_I32 i0 = *n_read, nr;
+         if(i0 > 0 && (p->at_end() || p->read_error())) break;
+
+         IAEA_I32 m = (n_max - i0)/r->n_recycle;
+         if(m > 0)
+         {
+            read_particles(id, m, n_max, &nr, n_stat+i0, type+i0, E+i0, wt+i0,
+                           x+i0, y+i0, z+i0, u+i0, v+i0, w+i0,
+                           extra_floats+i0, extra_ints+i0);
+            if(nr < 0) {end_recycling(p, nr, i0, n_read); return;}
+            iaea_recycle_expand(r, nr, n_max, nf, nl, n_stat+i0, type+i0,
+                                E+i0, wt+i0, x+i0, y+i0, z+i0, u+i0, v+i0,
+                                w+i0, extra_floats+i0, extra_ints+i0);
+            *n_read += nr*r->n_recycle;
+            if(nr < m) break;
+         }
+         else
+         {
+            read_particles(id, 1, 1, &nr, &r->n_stat, &r->type, &r->E, &r->wt,
+                           &r->x, &r->y, &r->z, &r->u, &r->v, &r->w,
+                           r->extra_floats, r->extra_longs);
+            if(nr < 0) {end_recycling(p, nr, i0, n_read); return;}
+            if(nr == 0) break;
+            iaea_recycle_hold(r);
+            *n_read += iaea_recycle_held(r, n_max - i0, n_max, nf, nl,
+                                         n_stat+i0, type+i0, E+i0, wt+i0,
+                                         x+i0, y+i0, z+i0, u+i0, v+i0, w+i0,
+                                         extra_floats+i0, extra_ints+i0);
+         }
+      }
+}
+
 /**************************************************************************
 * Get a particle 
 *
@@ -1164,18 +2971,46 @@ IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
 {
-      if(feof(p_iaea_record[*id]->p_file)) {
+      if(source_header(*id)->fheader == NULL) {*n_stat = -1; return;}
+
+      IAEA_EventGenerator *g = source_generator(*id);
+      if(g != NULL) 
+      {
+         g->getNextParticle(n_stat, type, E, wt, x, y, z, u, v, w, 
+                            extra_floats, extra_ints);
+         return;
+      }
+
+      if(source_slot(*id) != NULL && source_slot(*id)->recycler != NULL)
+      {
+         IAEA_I32 n_read;
+         recycle_particles(*id, 1, &n_read, n_stat, type, E, wt, x, y, z,
+                           u, v, w, extra_floats, extra_ints);
+         if(n_read <= 0) *n_stat = (n_read == 0) ? -2 : n_read;
+         return;
+      }
+
+      if(source_record(*id)->at_end()) {
          *n_stat = -2; 
-         rewind (p_iaea_record[*id]->p_file);
+         source_record(*id)->rewind_file();
          return;
       }
 
-      if( p_iaea_record[*id]->read_particle() == FAIL ) { *n_stat = -1; return;}
+      iaea_record_type *p = source_record(*id);
 
-      iaea_record_type *p = p_iaea_record[*id];
+      if( p->read_particle() == FAIL ) {
+         // Reading past the last record: end of file as for mapped files,
+         // which see it in advance
+         if(p->at_end() && !p->read_error()) {
+            *n_stat = -2;
+            p->rewind_file();
+         }
+         else *n_stat = -1;
+         return;
+      }
 
       // Corrected on Dec. 2006. Before n_stat was not assigned if 
-      // (p->iextralong > 0)  and (p_iaea_header[*id]->extralong_contents[j] != 1)
+      // (p->iextralong > 0)  and (source_header(*id)->extralong_contents[j] != 1)
 
       if( p->IsNewHistory > 0) *n_stat=1;
       else                     *n_stat=0;
@@ -1184,7 +3019,7 @@ IAEA_I32 *extra_ints)
           for(int j=0;j<p->iextralong ;j++) {
               // Looking for incremental number of histories  
               // (Type 1 of the extralong stored variable)
-              if(p_iaea_header[*id]->extralong_contents[j] == 1) {
+              if(source_header(*id)->extralong_contents[j] == 1) {
                   *n_stat = p->extralong[j];
                   p->IsNewHistory = *n_stat;
               }
@@ -1195,45 +3030,177 @@ IAEA_I32 *extra_ints)
       *E     = p->energy;   /* kinetic energy in MeV */
       
       if(p->ix > 0) *x = p->x;
-      else          *x = p_iaea_header[*id]->record_constant[0];
+      else          *x = source_header(*id)->record_constant[0];
      
       if(p->iy > 0) *y = p->y;
-      else          *y = p_iaea_header[*id]->record_constant[1];      
+      else          *y = source_header(*id)->record_constant[1];      
       
       if(p->iz > 0) *z = p->z; /* position in cartesian coordinates*/
-      else          *z = p_iaea_header[*id]->record_constant[2];
+      else          *z = source_header(*id)->record_constant[2];
       
       if(p->iu > 0) *u = p->u;
-      else          *u = p_iaea_header[*id]->record_constant[3];
+      else          *u = source_header(*id)->record_constant[3];
       
       if(p->iv > 0) *v = p->v;
-      else          *v = p_iaea_header[*id]->record_constant[4];
+      else          *v = source_header(*id)->record_constant[4];
       
       if(p->iw > 0) *w = p->w; /* direction in cartesian coordinates*/
-      else          *w = p_iaea_header[*id]->record_constant[5];      
+      else          *w = source_header(*id)->record_constant[5];      
+
+      if(p->iweight > 0) *wt = p->weight;   /* statistical weight */
+      else               *wt = source_header(*id)->record_constant[6];      
+      
+      for(int k=0;k<p->iextrafloat;k++) extra_floats[k] = p->extrafloat[k];
+      for(int j=0;j<p->iextralong ;j++) extra_ints[j] = p->extralong[j];
+      
+      /*
+        Updating counters including:
+        Min and Max Weight per particle,
+        Total Weight per particle,
+        Min and Max Kinetic energy per particle,
+        Min and Max X,Y,Z coordinates,
+        Total number of particles, 
+        Total number of each particle type
+        Number of statistically independent histories
+      */  
+      count_particle(*id, source_record(*id));
+      
+      return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particle_(const IAEA_I32 *id, IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particle(id, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particle__(const IAEA_I32 *id, IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particle(id, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLE(const IAEA_I32 *id, IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particle(id, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLE_(const IAEA_I32 *id, IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particle(id, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLE__(const IAEA_I32 *id, IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particle(id, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+
+/**************************************************************************
+* Get a block of particles
+*
+* Read up to n_max consecutive particles from the source with Id id into
+* caller-provided arrays (one entry per particle) and return in n_read the
+* number of particles actually read. The meaning of each n_stat[i] is the
+* same as for iaea_get_particle. Extra variables are returned per variable:
+* extra_floats[k*n_max+i] holds the k-th extra float of the i-th particle
+* and extra_ints[k*n_max+i] the k-th extra long (i.e. Fortran arrays
+* dimensioned (n_max,n_extra)).
+* Set n_read to -1, if a source with Id id does not exist or a read error
+* occured. Set n_read to -2, if end of file of the phase space source was
+* reached before any particle was read. Event generators (see
+* iaea_new_source) fill the arrays with one call to the generator library
+* if it exports get_next_particles (see IAEA_EventGenerator).
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{
+      *n_read = 0;
+      if(source_header(*id)->fheader == NULL) {*n_read = -1; return;}
 
-      if(p->iweight > 0) *wt = p->weight;   /* statistical weight */
-      else               *wt = p_iaea_header[*id]->record_constant[6];      
-      
-      for(int k=0;k<p->iextrafloat;k++) extra_floats[k] = p->extrafloat[k];
-      for(int j=0;j<p->iextralong ;j++) extra_ints[j] = p->extralong[j];
-      
-      /*
-        Updating counters including:
-        Min and Max Weight per particle,
-        Total Weight per particle,
-        Min and Max Kinetic energy per particle,
-        Min and Max X,Y,Z coordinates,
-        Total number of particles, 
-        Total number of each particle type
-        Number of statistically independent histories
-      */  
-      p_iaea_header[*id]->update_counters(p_iaea_record[*id]);
-      
+      IAEA_EventGenerator *g = source_generator(*id);
+      if(g != NULL) 
+      {
+         g->getNextParticles(n_max, n_read, n_stat, type, E, wt, x, y, z, 
+                             u, v, w, extra_floats, extra_ints);
+         return;
+      }
+
+      if(source_slot(*id)->recycler != NULL)
+         recycle_particles(*id, *n_max, n_read, n_stat, type, E, wt, x, y, z,
+                           u, v, w, extra_floats, extra_ints);
+      else
+      {
+         read_particles(*id, *n_max, *n_max, n_read, n_stat, type, E, wt,
+                        x, y, z, u, v, w, extra_floats, extra_ints);
+         if(*n_read == -2) source_record(*id)->rewind_file();
+      }
       return;
 }
 IAEA_EXTERN_C IAEA_EXPORT
-void iaea_get_particle_(const IAEA_I32 *id, IAEA_I32 *n_stat,
+void iaea_get_particles_(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
 IAEA_I32 *type, /* particle type */
 IAEA_Float *E,  /* kinetic energy in MeV */
 IAEA_Float *wt, /* statistical weight */
@@ -1245,10 +3212,12 @@ IAEA_Float *v,
 IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
-{ iaea_get_particle(id, n_stat, type, 
-                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+{ iaea_get_particles(id, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 IAEA_EXTERN_C IAEA_EXPORT
-void iaea_get_particle__(const IAEA_I32 *id, IAEA_I32 *n_stat,
+void iaea_get_particles__(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
 IAEA_I32 *type, /* particle type */
 IAEA_Float *E,  /* kinetic energy in MeV */
 IAEA_Float *wt, /* statistical weight */
@@ -1260,10 +3229,12 @@ IAEA_Float *v,
 IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
-{ iaea_get_particle(id, n_stat, type, 
-                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+{ iaea_get_particles(id, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 IAEA_EXTERN_C IAEA_EXPORT
-void IAEA_GET_PARTICLE(const IAEA_I32 *id, IAEA_I32 *n_stat,
+void IAEA_GET_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
 IAEA_I32 *type, /* particle type */
 IAEA_Float *E,  /* kinetic energy in MeV */
 IAEA_Float *wt, /* statistical weight */
@@ -1275,10 +3246,12 @@ IAEA_Float *v,
 IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
-{ iaea_get_particle(id, n_stat, type, 
-                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+{ iaea_get_particles(id, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 IAEA_EXTERN_C IAEA_EXPORT
-void IAEA_GET_PARTICLE_(const IAEA_I32 *id, IAEA_I32 *n_stat,
+void IAEA_GET_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
 IAEA_I32 *type, /* particle type */
 IAEA_Float *E,  /* kinetic energy in MeV */
 IAEA_Float *wt, /* statistical weight */
@@ -1290,10 +3263,12 @@ IAEA_Float *v,
 IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
-{ iaea_get_particle(id, n_stat, type, 
-                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+{ iaea_get_particles(id, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 IAEA_EXTERN_C IAEA_EXPORT
-void IAEA_GET_PARTICLE__(const IAEA_I32 *id, IAEA_I32 *n_stat,
+void IAEA_GET_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
 IAEA_I32 *type, /* particle type */
 IAEA_Float *E,  /* kinetic energy in MeV */
 IAEA_Float *wt, /* statistical weight */
@@ -1305,8 +3280,8 @@ IAEA_Float *v,
 IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
-{ iaea_get_particle(id, n_stat, type, 
-                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+{ iaea_get_particles(id, n_max, n_read, n_stat, type, 
+                          E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 
 /**************************************************************************
 * Write a particle 
@@ -1314,7 +3289,8 @@ IAEA_I32 *extra_ints)
 * n_stat > 0 for an independent particle 
 *
 * Write a particle to the source with Id id. 
-* Set n_stat to -1, if ERROR (source with Id id does not exist).
+* Set n_stat to -1, if ERROR (source with Id id does not exist or was not
+* opened for writing with access = 2 or 3).
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_write_particle(const IAEA_I32 *id, IAEA_I32 *n_stat, 
@@ -1330,8 +3306,11 @@ const IAEA_Float *w,  /* direction in cartesian coordinates*/
 const IAEA_Float *extra_floats,
 const IAEA_I32 *extra_ints)
 {
+      if(!is_output(*id)) {*n_stat = -1; return;} // not opened for writing
+      if(is_cursor(*id) && !is_writer(*id)) {*n_stat = -1; return;} // cursors only read
+      if(has_writers(*id)) {*n_stat = -1; return;} // the writers write now
 
-      iaea_record_type *p = p_iaea_record[*id];
+      iaea_record_type *p = source_record(*id);
 
       if( *n_stat > 0 ) p->IsNewHistory = *n_stat;
       else              p->IsNewHistory = 0;
@@ -1361,7 +3340,7 @@ const IAEA_I32 *extra_ints)
         Total number of each particle type
         Number of statistically independent histories so far
       */  
-      p_iaea_header[*id]->update_counters(p_iaea_record[*id]);
+      count_written(*id, source_record(*id));
 
       return;
 }
@@ -1441,36 +3420,353 @@ const IAEA_I32 *extra_ints)
 { iaea_write_particle(id, n_stat, type, 
                                 E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 
+/**************************************************************************
+* Write a block of particles
+*
+* Write n consecutive particles held in caller-provided arrays (one entry
+* per particle) to the source with Id id. The meaning of each n_stat[i] is
+* the same as for iaea_write_particle. Extra variables are passed per
+* variable as in iaea_get_particles: extra_floats[k*n+i] holds the k-th 
+* extra float of the i-th particle and extra_ints[k*n+i] the k-th extra
+* long. Particles are packed into the output block of the source, which is
+* written to disk with a single write each time it fills up (and when the
+* header is updated or the source is destroyed).
+* Return in n_written the number of particles written.
+* Set n_written to -1, if ERROR (source with Id id does not exist or was
+* not opened for writing with access = 2 or 3, or a write error occured).
+* The counters of the header are updated once for the whole block.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{
+      *n_written = 0;
+      if(!is_output(*id)) {*n_written = -1; return;} // not opened for writing
+      if(is_cursor(*id) && !is_writer(*id)) {*n_written = -1; return;} // cursors only read
+      if(has_writers(*id)) {*n_written = -1; return;} // the writers write now
+
+      iaea_record_type *p = source_record(*id);
+      IAEA_I32 np = *n;
+
+      for(IAEA_I32 i=0; i<np; i++)
+      {
+         if( n_stat[i] > 0 ) p->IsNewHistory = n_stat[i];
+         else                p->IsNewHistory = 0;
+
+         p->particle = (short)type[i]; /* particle type */
+         p->energy   = E[i];    /* kinetic energy in MeV */
+         if(p->iweight > 0) p->weight = wt[i];   /* statistical weight */
+         if(p->ix > 0) p->x = x[i]; /* position in cartesian coordinates*/
+         if(p->iy > 0) p->y = y[i];
+         if(p->iz > 0) p->z = z[i]; 
+         if(p->iu > 0) p->u = u[i]; /* direction in cartesian coordinates*/
+         if(p->iv > 0) p->v = v[i];
+         if(p->iw > 0) p->w = w[i]; 
+
+         for(int k=0;k<p->iextrafloat;k++) p->extrafloat[k] = extra_floats[k*np+i];
+         for(int j=0;j<p->iextralong ;j++)  p->extralong[j] = extra_ints[j*np+i];
+
+         // Encoded into the output block, flushed with one fwrite when full
+         if( p->write_particle() == FAIL ) break;
+         (*n_written)++;
+      }
+
+      // Counters of the particles encoded, updated once
+      count_written(*id, p, *n_written, n_stat, type, E, wt, x, y, z);
+      if(*n_written < np) *n_written = -1;
+      return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles_(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles__(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type, 
+                                E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+
+/**************************************************************************
+* Concurrent writers
+*
+* Set up n_threads writers on the source with Id id, opened for writing
+* (access = 2 or 3), and return their Ids in writer_IDs[0..n_threads-1].
+* Thread t writes its particles with iaea_write_particle or
+* iaea_write_particles on writer_IDs[t], without locking. Each writer
+* collects the particles in its own buffer and writes whole histories (a
+* particle with n_stat > 0 and the particles following it) with one
+* positional write at an offset reserved atomically at the end of the
+* file, so the histories of different threads are never interleaved,
+* but their order in the file depends on the scheduling of the threads.
+* The counters and statistics of each thread are kept apart and merged
+* into the header in the order of the threads when the writers are
+* released, so the header does not depend on the scheduling.
+* While writers are set the source itself cannot be written to and its
+* header cannot be updated. A writer is released with iaea_destroy_source
+* on its Id; destroying the last writer, calling this function with
+* n_threads = 0 or destroying the source releases all the writers of the
+* source, which must have finished writing, and the source continues
+* writing after their data.
+* result is set to 0 if OK, -1 if the source does not exist or on write
+* errors, -2 if n_threads < 0, -3 if the source is not a phase space file
+* opened for writing, or is compressed (see iaea_set_compression), and -98
+* if no more Ids are available.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_writers(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result)
+{
+   if(source_header(*id)->fheader == NULL || is_cursor(*id)) {*result = -1; return;}
+   if(*n_threads < 0) {*result = -2; return;}
+
+   iaea_source_slot *slot = source_slot(*id);
+   if(slot->header->file_type == 1 || (slot->access != 2 && slot->access != 3) ||
+      slot->record->compressed != NULL) {*result = -3; return;}
+
+   if(free_writers(*id) != OK) {*result = -1; return;}
+   if(*n_threads == 0) {*result = 0; return;}
+
+   // The writers append to the data written so far by the source, in an
+   // order that is not known here
+   drop_index(*id);
+   iaea_record_type *p = source_record(*id);
+   if(p->flush_block() != OK || fflush(p->p_file) != 0) {*result = -1; return;}
+
+   iaea_writers *w = (iaea_writers *) calloc(1, sizeof(iaea_writers));
+   if(w == NULL) {*result = -1; return;}
+   w->writer = (IAEA_I32 *) malloc(*n_threads*sizeof(IAEA_I32));
+   if(w->writer == NULL || slot->header->set_shards(*n_threads) != OK)
+      {free(w->writer); free(w); *result = -1; return;}
+   w->n_threads = *n_threads;
+   w->end = p->tell();
+   for(IAEA_I32 t=0; t<w->n_threads; t++) w->writer[t] = writer_IDs[t] = -1;
+   slot->writers = w;
+
+   *result = 0;
+   for(IAEA_I32 t=0; t<w->n_threads && *result == 0; t++)
+   {
+      IAEA_I32 sid = take_source_slot();
+      if( sid < 0 ) {*result = -98; break;}
+
+      iaea_source_slot *ws = source_slot(sid);
+      ws->access = slot->access;
+      ws->record = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
+      if(ws->record == NULL || ws->record->share_writer(p, &w->end) != OK)
+      {
+         free(ws->record);
+         release_source_slot(sid);
+         *result = -1; break;
+      }
+      ws->header = slot->header; // shared, counted in shard t
+      ws->i_writer = t;
+      ws->owner = *id;
+      w->writer[t] = writer_IDs[t] = sid;
+      w->n_live++;
+   }
+   if(*result != 0) free_writers(*id);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_writers_(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result)
+{ iaea_set_writers(id, n_threads, writer_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_writers__(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result)
+{ iaea_set_writers(id, n_threads, writer_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_WRITERS(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result)
+{ iaea_set_writers(id, n_threads, writer_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_WRITERS_(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result)
+{ iaea_set_writers(id, n_threads, writer_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_WRITERS__(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result)
+{ iaea_set_writers(id, n_threads, writer_IDs, result); }
+
 /***************************************************************************
 * Destroy a source 
 *
 * This function de-initializes the source with Id id, closing all open
 * files, deallocating memory, etc. Nothing happens if a source with that
 * id does not exist. Header is updated.
+* Destroying a cursor (see iaea_new_cursor) only releases the cursor. A
+* source with open cursors is not destroyed and result is set to -2.
+* Destroying a writer (see iaea_set_writers) writes the particles left in
+* its buffer and releases it; the writers still open when their source is
+* destroyed are released first. result is set to -1 on write errors.
 ****************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_destroy_source(const IAEA_I32 *source_ID, IAEA_I32 *result)
 {
-   if(*source_ID > MAX_NUM_SOURCES) { *result = -98 ; return;} // Too big phsp ID
+   if(*source_ID >= MAX_NUM_SOURCES) { *result = -98 ; return;} // Too big phsp ID
    if(*source_ID < 0)               { *result = -97 ; return;} // wrong ID number
 
-   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+   if(source_header(*source_ID)->fheader == NULL) {*result = -1; return;}
+
+   if(is_writer(*source_ID))
+   {
+      // the last writer destroyed releases the writers of the source,
+      // which can then be written to again
+      IAEA_I32 owner = source_slot(*source_ID)->owner;
+      iaea_writers *w = source_slot(owner)->writers;
+      *result = (free_writer(*source_ID) == OK) ? 1 : -1;
+      IAEA_MUTEX_LOCK(&__iaea_source_lock);
+      int last = (--w->n_live == 0);
+      IAEA_MUTEX_UNLOCK(&__iaea_source_lock);
+      if(last && free_writers(owner) != OK) *result = -1;
+      return;
+   }
+   if(is_cursor(*source_ID))
+   {
+      free_cursor(*source_ID);
+      *result = 1;
+      return;
+   }
+   IAEA_MUTEX_LOCK(&__iaea_source_lock);
+   int n_cursors = source_slot(*source_ID)->n_cursors;
+   IAEA_MUTEX_UNLOCK(&__iaea_source_lock);
+   // the cursors of the dispatcher are released with it
+   if(source_slot(*source_ID)->dispatcher != NULL)
+      n_cursors -= source_slot(*source_ID)->dispatcher->n_threads;
+   if(n_cursors > 0) {*result = -2; return;} // cursors still open
+
+   free_dispatcher(*source_ID);
+   free_writers(*source_ID);
+
+   // Unloading the event generator, if any
+   delete source_slot(*source_ID)->generator;
+   source_slot(*source_ID)->generator = NULL;
+
+   // Writing particles still pending in the output block
+   source_record(*source_ID)->flush_block();
+   // and the last block and the block offsets of a compressed file
+   source_record(*source_ID)->close_compressed();
+
+   // Saving the index of the histories written, if requested
+   iaea_source_slot *slot = source_slot(*source_ID);
+   if(slot->index != NULL && slot->access == 2 && slot->name != NULL)
+   {
+      iaea_index_end(slot->index, slot->header->nParticles);
+      IAEA_I64 size = slot->record->file_size();
+      IAEA_I64 time = slot->record->file_time();
+      if(size >= 0 && time >= 0)
+         iaea_index_write(slot->index, slot->name, size, time);
+   }
 
   /* Write an IAEA header */
    // For read-only files nothing happens
-   p_iaea_header[*source_ID]->write_header();
+   source_header(*source_ID)->write_header();
 
    // Closing header file
-   fclose(p_iaea_header[*source_ID]->fheader); 
-   // Deallocating IAEA phsp header 
-   free(p_iaea_header[*source_ID]);
-
-   // Closing phsp file
-   fclose(p_iaea_record[*source_ID]->p_file); 
-   // Deallocating IAEA record 
-   free(p_iaea_record[*source_ID]);
-
-   __iaea_source_used[*source_ID] = false;
+   fclose(source_header(*source_ID)->fheader); 
+   // Deallocating IAEA phsp header, its text blocks, statistics batch and shards
+   source_header(*source_ID)->free_text();
+   source_header(*source_ID)->set_statistics(IAEA_STATISTICS_EACH);
+   source_header(*source_ID)->set_shards(0);
+   free(source_header(*source_ID));
+
+   // Closing phsp file (and its mapping or prefetch thread, if any)
+   source_record(*source_ID)->set_prefetch(0, 0);
+   source_record(*source_ID)->unmap_file();
+   if(source_record(*source_ID)->p_file != NULL)
+      fclose(source_record(*source_ID)->p_file); 
+   // Deallocating IAEA record and its block buffer
+   source_record(*source_ID)->free_block();
+   free(source_record(*source_ID));
+
+   release_source_slot(*source_ID);
    
    *result = 1; // Return OK
 
@@ -1500,10 +3796,10 @@ void IAEA_DESTROY_SOURCE__(const IAEA_I32 *source_ID, IAEA_I32 *result)
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_print_header(const IAEA_I32 *source_ID, IAEA_I32 *result)
 {
-   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+   if(source_header(*source_ID)->fheader == NULL) {*result = -1; return;}
 
   /* Print current IAEA header for source id */
-   p_iaea_header[*source_ID]->print_header();
+   source_header(*source_ID)->print_header();
 
    *result = 1; // Return OK
 
@@ -1535,82 +3831,84 @@ IAEA_EXTERN_C IAEA_EXPORT
 void iaea_copy_header(const IAEA_I32 *source_ID, 
                                 const IAEA_I32 *destiny_ID, IAEA_I32 *result)
 {
-   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
-   if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+   if(source_header(*source_ID)->fheader == NULL) {*result = -1; return;}
+   if(source_header(*destiny_ID)->fheader == NULL) {*result = -1; return;}
 
    // Selective copy of string variables
 
-      p_iaea_header[*destiny_ID]->checksum = 
-            p_iaea_header[*source_ID]->checksum ;
-      p_iaea_header[*destiny_ID]->record_length = 
-            p_iaea_header[*source_ID]->record_length ;
-      p_iaea_header[*destiny_ID]->byte_order = 
-            p_iaea_header[*source_ID]->byte_order ;
+      source_header(*destiny_ID)->checksum = 
+            source_header(*source_ID)->checksum ;
+      source_header(*destiny_ID)->record_length = 
+            source_header(*source_ID)->record_length ;
+      source_header(*destiny_ID)->byte_order = 
+            source_header(*source_ID)->byte_order ;
 
 // ******************************************************************************
 // 2. Mandatory description of the phsp
 
-      strcpy(p_iaea_header[*destiny_ID]->coordinate_system_description, 
-            p_iaea_header[*source_ID]->coordinate_system_description) ;
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->coordinate_system_description,
+            source_header(*source_ID)->coordinate_system_description);
 
-      int file_type = p_iaea_header[*source_ID]->file_type; 
+      int file_type = source_header(*source_ID)->file_type; 
       if(file_type == 1) 
       {
             // For event generators
-            strcpy(p_iaea_header[*destiny_ID]->input_file_for_event_generator, 
-                  p_iaea_header[*source_ID]->input_file_for_event_generator) ;
+            source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->input_file_for_event_generator,
+                  source_header(*source_ID)->input_file_for_event_generator);
+            source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->event_generator_library,
+                  source_header(*source_ID)->event_generator_library);
             *result = 1; // Return OK
             return;
       }
 
-      p_iaea_header[*destiny_ID]->orig_histories = 
-            p_iaea_header[*source_ID]->orig_histories ;
+      source_header(*destiny_ID)->orig_histories = 
+            source_header(*source_ID)->orig_histories ;
 
 // ******************************************************************************
 // 3. Mandatory additional information
       /*********************************************/
-      strcpy(p_iaea_header[*destiny_ID]->machine_type,
-            p_iaea_header[*source_ID]->machine_type);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->machine_type,
+            source_header(*source_ID)->machine_type);
 
-      strcpy(p_iaea_header[*destiny_ID]->MC_code_and_version, 
-            p_iaea_header[*source_ID]->MC_code_and_version);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->MC_code_and_version,
+            source_header(*source_ID)->MC_code_and_version);
 
-      p_iaea_header[*destiny_ID]->global_photon_energy_cutoff = 
-            p_iaea_header[*source_ID]->global_photon_energy_cutoff;
+      source_header(*destiny_ID)->global_photon_energy_cutoff = 
+            source_header(*source_ID)->global_photon_energy_cutoff;
 
-      p_iaea_header[*destiny_ID]->global_particle_energy_cutoff = 
-            p_iaea_header[*source_ID]->global_particle_energy_cutoff;
+      source_header(*destiny_ID)->global_particle_energy_cutoff = 
+            source_header(*source_ID)->global_particle_energy_cutoff;
 
-      strcpy(p_iaea_header[*destiny_ID]->transport_parameters, 
-            p_iaea_header[*source_ID]->transport_parameters);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->transport_parameters,
+            source_header(*source_ID)->transport_parameters);
 
 // ******************************************************************************
 // 4. Optional description
-      strcpy(p_iaea_header[*destiny_ID]->beam_name, 
-            p_iaea_header[*source_ID]->beam_name);
-      strcpy(p_iaea_header[*destiny_ID]->field_size, 
-            p_iaea_header[*source_ID]->field_size);
-      strcpy(p_iaea_header[*destiny_ID]->nominal_SSD, 
-            p_iaea_header[*source_ID]->nominal_SSD);
-      strcpy(p_iaea_header[*destiny_ID]->variance_reduction_techniques, 
-            p_iaea_header[*source_ID]->variance_reduction_techniques);
-      strcpy(p_iaea_header[*destiny_ID]->initial_source_description, 
-            p_iaea_header[*source_ID]->initial_source_description);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->beam_name,
+            source_header(*source_ID)->beam_name);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->field_size,
+            source_header(*source_ID)->field_size);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->nominal_SSD,
+            source_header(*source_ID)->nominal_SSD);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->variance_reduction_techniques,
+            source_header(*source_ID)->variance_reduction_techniques);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->initial_source_description,
+            source_header(*source_ID)->initial_source_description);
   
       // Documentation sub-section
       /*********************************************/
-      strcpy(p_iaea_header[*destiny_ID]->MC_input_filename, 
-            p_iaea_header[*source_ID]->MC_input_filename);
-      strcpy(p_iaea_header[*destiny_ID]->published_reference, 
-            p_iaea_header[*source_ID]->published_reference);
-      strcpy(p_iaea_header[*destiny_ID]->authors, 
-            p_iaea_header[*source_ID]->authors);
-      strcpy(p_iaea_header[*destiny_ID]->institution, 
-            p_iaea_header[*source_ID]->institution);
-      strcpy(p_iaea_header[*destiny_ID]->link_validation, 
-            p_iaea_header[*source_ID]->link_validation);
-      strcpy(p_iaea_header[*destiny_ID]->additional_notes, 
-            p_iaea_header[*source_ID]->additional_notes);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->MC_input_filename,
+            source_header(*source_ID)->MC_input_filename);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->published_reference,
+            source_header(*source_ID)->published_reference);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->authors,
+            source_header(*source_ID)->authors);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->institution,
+            source_header(*source_ID)->institution);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->link_validation,
+            source_header(*source_ID)->link_validation);
+      source_header(*destiny_ID)->set_text(&source_header(*destiny_ID)->additional_notes,
+            source_header(*source_ID)->additional_notes);
 
     *result = 1; // Return OK
 
@@ -1644,19 +3942,456 @@ void IAEA_COPY_HEADER__(const IAEA_I32 *source_ID,
 { iaea_copy_header(source_ID, destiny_ID, result); }
 
 
+// For each of the n extra variables of the types types, sets from to the
+// index of the first variable of the same type, not taken yet, among the
+// n_src ones of the types src_types, or to -1 if there is none
+static void map_extra_types(const int *types, int n, const int *src_types,
+                            int n_src, int *from)
+{
+   int taken[NUM_EXTRA_FLOAT + NUM_EXTRA_LONG] = {0};
+   for(int k=0; k<n; k++)
+   {
+      from[k] = -1;
+      for(int j=0; j<n_src; j++)
+         if(!taken[j] && src_types[j] == types[k]) {from[k] = j; taken[j] = 1; break;}
+   }
+}
+
+/***************************************************************************
+* Merge phase spaces
+*
+* Append the particles of the n_sources sources with Ids source_IDs,
+* opened for reading, to the source with Id destiny_ID, opened for
+* writing, and add their ORIG_HISTORIES to those of the destination.
+* Sources whose records are laid out as those of the destination (same
+* variables, constants, extra variables and byte order) are copied as
+* whole files without decoding the records (inside the kernel with
+* copy_file_range() where available) and their particle counters and
+* statistics are taken from their headers, so the sources must not have
+* been read from; if they or the destination are compressed (see
+* iaea_set_compression) the records are decompressed and compressed again
+* on the way. The other sources are read and rewritten particle by
+* particle, their extra variables matched to those of the destination by
+* type (EXTRA_FLOATS/EXTRA_LONGS of the header); a history counter
+* (extralong type 1) missing in a source is made from the n_stat of its
+* particles, other missing extra variables are written as 0. A destination
+* opened with access = 2 that holds no particles yet takes the layout of
+* the first source. Use iaea_copy_header to give it the description of
+* that source too (and reset its ORIG_HISTORIES, which iaea_copy_header
+* copies, with iaea_set_total_original_particles).
+* result is set to 0 if OK, -1 if a source does not exist or on i/o
+* errors, -2 if n_sources < 0 and -3 if the destination is not a phase
+* space opened for writing (or has writers open), a source is not a
+* phase space opened for reading or a source to be copied as it is has
+* been read from.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_sources(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{
+   if(source_header(*destiny_ID)->fheader == NULL || is_cursor(*destiny_ID))
+      {*result = -1; return;}
+   if(*n_sources < 0) {*result = -2; return;}
+
+   iaea_source_slot *dest = source_slot(*destiny_ID);
+   if(dest->header->file_type == 1 || dest->writers != NULL ||
+      (dest->access != 2 && dest->access != 3)) {*result = -3; return;}
+
+   IAEA_I32 i;
+   for(i=0; i<*n_sources; i++)
+   {
+      if(source_header(source_IDs[i])->fheader == NULL) {*result = -1; return;}
+      iaea_source_slot *src = source_slot(source_IDs[i]);
+      if(src->header->file_type == 1 || (src->access != 1 && src->access != 4))
+         {*result = -3; return;}
+   }
+
+   iaea_header_type *h = dest->header;
+   iaea_record_type *p = dest->record;
+
+   // The counters of the sources copied as they are come from their
+   // headers, which are no longer those of the file once read from
+   int take_layout = *n_sources > 0 && dest->access == 2 && h->nParticles == 0 &&
+                     p->block_fill == 0;
+   for(i=0; i<*n_sources; i++)
+   {
+      iaea_source_slot *src = source_slot(source_IDs[i]);
+      iaea_header_type *hl = take_layout ? source_header(source_IDs[0]) : h;
+      if(src->particles_read && hl->same_layout(src->header) &&
+         src->header->byte_order == host_byte_order()) {*result = -3; return;}
+   }
+
+   h->flush_statistics();
+   drop_index(*destiny_ID);
+   if(take_layout)
+   {
+      h->copy_layout(source_header(source_IDs[0]));
+      if(h->get_record_contents(p) == FAIL) {*result = -1; return;}
+   }
+
+   *result = 0;
+   for(i=0; i<*n_sources && *result == 0; i++)
+   {
+      const IAEA_I32 *id = &source_IDs[i];
+      iaea_header_type *hs = source_header(*id);
+
+      if(h->same_layout(hs) && hs->byte_order == host_byte_order())
+      {
+         // Records copied as they are, counters taken from the header
+         iaea_record_type *ps = source_record(*id);
+         IAEA_I64 size = ps->file_size();
+         if(size < 0) {*result = -1; break;}
+         IAEA_I64 n_bytes = size/ps->get_reclength()*ps->get_reclength();
+         if(p->append_file(ps, 0, n_bytes) != OK) {*result = -1; break;}
+         h->merge_counters(hs);
+         continue;
+      }
+
+      // Different layouts: records read and written again
+      const IAEA_I32 n_max = NUM_BLOCK_RECORDS;
+      IAEA_I32 *ibuf = (IAEA_I32 *) malloc((2 + 2*NUM_EXTRA_LONG)*n_max*sizeof(IAEA_I32));
+      IAEA_Float *fbuf = (IAEA_Float *) malloc((8 + 2*NUM_EXTRA_FLOAT)*n_max*sizeof(IAEA_Float));
+      if(ibuf == NULL || fbuf == NULL) {free(ibuf); free(fbuf); *result = -1; break;}
+      IAEA_I32 *n_stat = ibuf, *type = ibuf + n_max, *extra_ints = ibuf + 2*n_max;
+      IAEA_I32 *out_ints = extra_ints + NUM_EXTRA_LONG*n_max;
+      IAEA_Float *E = fbuf, *wt = fbuf + n_max, *x = fbuf + 2*n_max,
+                 *y = fbuf + 3*n_max, *z = fbuf + 4*n_max, *u = fbuf + 5*n_max,
+                 *v = fbuf + 6*n_max, *w = fbuf + 7*n_max, *extra_floats = fbuf + 8*n_max;
+      IAEA_Float *out_floats = extra_floats + NUM_EXTRA_FLOAT*n_max;
+
+      // Extra variables taken from those of the same type in the source
+      int nf = h->record_contents[7], nl = h->record_contents[8];
+      int float_from[NUM_EXTRA_FLOAT], long_from[NUM_EXTRA_LONG];
+      map_extra_types(h->extrafloat_contents, nf, hs->extrafloat_contents,
+                      hs->record_contents[7], float_from);
+      map_extra_types(h->extralong_contents, nl, hs->extralong_contents,
+                      hs->record_contents[8], long_from);
+
+      source_record(*id)->set_range(0, -1);
+      for(;;)
+      {
+         IAEA_I32 n_read, n_written;
+         iaea_get_particles(id, &n_max, &n_read, n_stat, type, E, wt, x, y, z,
+                            u, v, w, extra_floats, extra_ints);
+         if(n_read == -2 || n_read == 0) break;
+         if(n_read < 0) {*result = -1; break;}
+
+         // Extra variables from (n_max,n_extra) to (n_read,n_extra) arrays.
+         // A history counter (extralong type 1) the source lacks is taken
+         // from n_stat, the other missing variables are written as 0.
+         IAEA_I32 k, j;
+         for(k=0; k<nf; k++) for(j=0; j<n_read; j++)
+            out_floats[k*n_read+j] = (float_from[k] >= 0) ?
+                                     extra_floats[float_from[k]*n_max+j] : 0;
+         for(k=0; k<nl; k++) for(j=0; j<n_read; j++)
+            out_ints[k*n_read+j] = (long_from[k] >= 0) ?
+                                   extra_ints[long_from[k]*n_max+j] :
+                                   (h->extralong_contents[k] == 1) ? n_stat[j] : 0;
+
+         iaea_write_particles(destiny_ID, &n_read, &n_written, n_stat, type, E, wt,
+                              x, y, z, u, v, w, out_floats, out_ints);
+         if(n_written != n_read) {*result = -1; break;}
+      }
+      free(ibuf);
+      free(fbuf);
+      h->orig_histories += hs->orig_histories;
+   }
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_sources_(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_sources(n_sources, source_IDs, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_sources__(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_sources(n_sources, source_IDs, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_SOURCES(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_sources(n_sources, source_IDs, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_SOURCES_(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_sources(n_sources, source_IDs, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_SOURCES__(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_sources(n_sources, source_IDs, destiny_ID, result); }
+
+/***************************************************************************
+* Split a phase space
+*
+* Distribute the particles of the source with Id source_ID, opened for
+* reading, over the n_parts sources with Ids destiny_IDs, opened for
+* writing with access = 2 and holding no particles yet. The file is cut
+* into n_parts portions of about the same number of records, the cuts
+* moved forward to the next record starting a new history, so no history
+* is split (a destination gets no particles if the histories are longer
+* than a portion). The records are copied as they are, inside the kernel
+* where possible; each destination takes the layout of the source and
+* the particle counters and statistics of its own records.
+* The ORIG_HISTORIES of the source are apportioned by the histories of
+* each portion, counted from the n_stat of its records: with an extralong
+* of type 1 these include the histories without particles, and those
+* after the last particle go to the last destination; without it, the
+* ORIG_HISTORIES are apportioned in proportion to the histories found.
+* Use iaea_copy_header beforehand to give the destinations the
+* description of the source. The source is left at its first particle.
+* result is set to 0 if OK, -1 if a source does not exist or on i/o
+* errors, -2 if n_parts < 1 and -3 if the source is not a phase space
+* opened for reading (or is of the other byte order, see
+* iaea_convert_source) or a destination is not an empty phase space
+* opened with access = 2.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_split_source(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result)
+{
+   if(source_header(*source_ID)->fheader == NULL) {*result = -1; return;}
+   if(*n_parts < 1) {*result = -2; return;}
+
+   iaea_source_slot *src = source_slot(*source_ID);
+   if(src->header->file_type == 1 || (src->access != 1 && src->access != 4) ||
+      src->record->swap_bytes) {*result = -3; return;}
+
+   IAEA_I32 i, n = *n_parts;
+   for(i=0; i<n; i++)
+   {
+      if(source_header(destiny_IDs[i])->fheader == NULL || is_cursor(destiny_IDs[i]))
+         {*result = -1; return;}
+      iaea_source_slot *dest = source_slot(destiny_IDs[i]);
+      if(dest->header->file_type == 1 || dest->writers != NULL || dest->access != 2 ||
+         dest->header->nParticles != 0 || dest->record->block_fill != 0)
+         {*result = -3; return;}
+   }
+
+   iaea_header_type *hs = src->header;
+   iaea_record_type *ps = src->record;
+   int reclength = ps->get_reclength();
+   int jhist = history_extralong(*source_ID);
+
+   IAEA_I64 size = ps->file_size();
+   if(size < 0) {*result = -1; return;}
+   IAEA_I64 nrecords = size/reclength;
+
+   // Cuts at the portions of set_chunk, moved to the next new history
+   IAEA_I64 *cut = (IAEA_I64 *) malloc(2*(n+1)*sizeof(IAEA_I64));
+   const IAEA_I32 n_max = NUM_BLOCK_RECORDS;
+   IAEA_I32 *ibuf = (IAEA_I32 *) malloc((2 + NUM_EXTRA_LONG)*n_max*sizeof(IAEA_I32));
+   IAEA_Float *fbuf = (IAEA_Float *) malloc((8 + NUM_EXTRA_FLOAT)*n_max*sizeof(IAEA_Float));
+   if(cut == NULL || ibuf == NULL || fbuf == NULL)
+      {free(cut); free(ibuf); free(fbuf); *result = -1; return;}
+   IAEA_I64 *n_hist = cut + n + 1;
+   IAEA_I32 *n_stat = ibuf, *type = ibuf + n_max, *extra_ints = ibuf + 2*n_max;
+   IAEA_Float *E = fbuf, *wt = fbuf + n_max, *x = fbuf + 2*n_max,
+              *y = fbuf + 3*n_max, *z = fbuf + 4*n_max, *u = fbuf + 5*n_max,
+              *v = fbuf + 6*n_max, *w = fbuf + 7*n_max, *extra_floats = fbuf + 8*n_max;
+
+   *result = 0;
+   IAEA_I64 per_part = nrecords/n;
+   cut[0] = 0;
+   cut[n] = nrecords;
+   for(i=1; i<n && *result == 0; i++)
+   {
+      IAEA_I64 first = (IAEA_I64)i*per_part;
+      cut[i] = (first <= cut[i-1]) ? cut[i-1] : 
+               scan_records(*source_ID, first, nrecords, 1, NULL);
+      if(cut[i] < 0) *result = -1;
+   }
+
+   // Each portion copied as it is, then read to count its particles
+   for(i=0; i<n && *result == 0; i++)
+   {
+      iaea_header_type *h = source_header(destiny_IDs[i]);
+      iaea_record_type *p = source_record(destiny_IDs[i]);
+
+      drop_index(destiny_IDs[i]);
+      h->copy_layout(hs);
+      if(h->get_record_contents(p) == FAIL ||
+         p->append_file(ps, cut[i]*reclength, (cut[i+1] - cut[i])*reclength) != OK ||
+         ps->set_range(cut[i]*reclength, cut[i+1]*reclength) != OK)
+         {*result = -1; break;}
+
+      IAEA_I64 n_before = h->read_indep_histories;
+      IAEA_I64 irec = cut[i];
+      while(irec < cut[i+1])
+      {
+         IAEA_I32 nblock;
+         const unsigned char *block = ps->read_block(n_max, &nblock);
+         if(block == NULL || nblock <= 0) {*result = -1; break;}
+
+         iaea_decode_block(&ps->layout, hs->record_constant, block, nblock,
+                           n_stat, type, E, wt, x, y, z, u, v, w,
+                           extra_floats, extra_ints, n_max);
+         if(jhist >= 0)
+            for(IAEA_I32 k=0; k<nblock; k++) n_stat[k] = extra_ints[jhist*n_max+k];
+
+         h->update_counters(nblock, n_stat, type, E, wt, x, y, z);
+         irec += nblock;
+      }
+      n_hist[i] = h->read_indep_histories - n_before;
+   }
+
+   if(*result == 0)
+   {
+      // ORIG_HISTORIES apportioned by the histories of the portions
+      IAEA_I64 n_total = 0;
+      for(i=0; i<n; i++) n_total += n_hist[i];
+
+      IAEA_I64 orig = hs->orig_histories, assigned = 0, found = 0;
+      for(i=0; i<n; i++)
+      {
+         IAEA_I64 n_orig;
+         found += n_hist[i];
+         if(orig <= 0) n_orig = n_hist[i];
+         else if(i == n-1) n_orig = orig - assigned;
+         else if(jhist >= 0 && n_total <= orig) n_orig = n_hist[i];
+         else if(n_total > 0)
+            n_orig = (IAEA_I64)((long double)orig*found/n_total) - assigned;
+         else n_orig = 0;
+         source_header(destiny_IDs[i])->orig_histories = n_orig;
+         assigned += n_orig;
+      }
+   }
+
+   ps->set_range(0, -1);
+   free(cut);
+   free(ibuf);
+   free(fbuf);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_split_source_(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result)
+{ iaea_split_source(source_ID, n_parts, destiny_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_split_source__(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result)
+{ iaea_split_source(source_ID, n_parts, destiny_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SPLIT_SOURCE(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result)
+{ iaea_split_source(source_ID, n_parts, destiny_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SPLIT_SOURCE_(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result)
+{ iaea_split_source(source_ID, n_parts, destiny_IDs, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SPLIT_SOURCE__(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result)
+{ iaea_split_source(source_ID, n_parts, destiny_IDs, result); }
+
+/***************************************************************************
+* Convert a phase space to the byte order of this machine
+*
+* Write the particles of the source with Id source_ID, opened for
+* reading, to the source with Id destiny_ID, opened for writing with
+* access = 2 and holding no particles yet, in the byte order of this
+* machine. The records are swapped block by block without decoding them
+* (a source already in the byte order of this machine is copied as it
+* is) and the destination takes the layout, particle counters, statistics
+* and ORIG_HISTORIES of the source, so the source must not have been read
+* from. Use iaea_copy_header beforehand to give the destination the
+* description of the source. A destination made compressed beforehand
+* (see iaea_set_compression) gets the records compressed. The source is
+* left at its first particle.
+* result is set to 0 if OK, -1 if a source does not exist or on i/o
+* errors and -3 if the source is not a phase space opened for reading (or
+* has been read from) or the destination is not an empty phase space
+* opened with access = 2.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_convert_source(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result)
+{
+   if(source_header(*source_ID)->fheader == NULL ||
+      source_header(*destiny_ID)->fheader == NULL || is_cursor(*destiny_ID))
+      {*result = -1; return;}
+
+   iaea_source_slot *src = source_slot(*source_ID);
+   iaea_source_slot *dest = source_slot(*destiny_ID);
+   if(src->header->file_type == 1 || (src->access != 1 && src->access != 4) ||
+      src->particles_read ||
+      dest->header->file_type == 1 || dest->writers != NULL || dest->access != 2 ||
+      dest->header->nParticles != 0 || dest->record->block_fill != 0)
+      {*result = -3; return;}
+
+   iaea_header_type *hs = src->header, *h = dest->header;
+   iaea_record_type *ps = src->record, *p = dest->record;
+   int reclength = ps->get_reclength();
+
+   IAEA_I64 size = ps->file_size();
+   if(size < 0) {*result = -1; return;}
+   IAEA_I64 nrecords = size/reclength;
+
+   drop_index(*destiny_ID);
+   h->copy_layout(hs);
+   if(h->get_record_contents(p) == FAIL) {*result = -1; return;}
+   h->flush_statistics();
+   h->orig_histories = 0;
+   h->merge_counters(hs);
+
+   *result = 0;
+   if(!ps->swap_bytes)
+   {
+      if(p->append_file(ps, 0, nrecords*reclength) != OK) *result = -1;
+      return;
+   }
+
+   // read_block returns the records swapped
+   if(ps->set_range(0, nrecords*reclength) != OK) {*result = -1; return;}
+   IAEA_I64 irec = 0;
+   while(irec < nrecords)
+   {
+      IAEA_I32 nblock;
+      const unsigned char *block = ps->read_block(NUM_BLOCK_RECORDS, &nblock);
+      if(block == NULL || nblock <= 0 || p->write_records(block, nblock) != OK)
+         {*result = -1; break;}
+      irec += nblock;
+   }
+   ps->set_range(0, -1);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_convert_source_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result)
+{ iaea_convert_source(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_convert_source__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result)
+{ iaea_convert_source(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_CONVERT_SOURCE(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result)
+{ iaea_convert_source(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_CONVERT_SOURCE_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result)
+{ iaea_convert_source(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_CONVERT_SOURCE__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result)
+{ iaea_convert_source(source_ID, destiny_ID, result); }
+
 /***************************************************************************
 * Update header of the source_id 
 *
-* result is set to negative if phsp source does not exist.
+* result is set to negative if phsp source does not exist, and to -2 if
+* writers are open on it (release them first with iaea_set_writers).
 ****************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_update_header(const IAEA_I32 *source_ID, IAEA_I32 *result)
 {
-   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+   if(source_header(*source_ID)->fheader == NULL) {*result = -1; return;}
+   if(has_writers(*source_ID) || is_writer(*source_ID)) {*result = -2; return;}
+
+   // Writing particles still pending in the output block
+   if(source_record(*source_ID)->flush_block() != OK) {*result = -1; return;}
 
   /* Write an IAEA header */
    // For read-only files nothing happens
-   p_iaea_header[*source_ID]->write_header();
+   source_header(*source_ID)->write_header();
    
    *result = 1; // Return OK
    return;
@@ -70,6 +70,31 @@
 * access = 1 => opening read-only file
 * access = 2 => opening file for writing
 * access = 3 => opening file for appending/updating
+* access = 4 => opening read-only file through a memory mapping of the
+*               whole phase space file (falls back to access = 1 if the
+*               file cannot be mapped)
+*
+* Phase space files written on a machine of the other byte order (see
+* BYTE_ORDER in the header) are read all the same: their records are
+* swapped to the byte order of this machine as they are read. They cannot
+* be appended to (result = -92); convert them first (see iaea_convert_source).
+*
+* Compressed phase space files (.IAEAphspz, see iaea_set_compression) are
+* read like the others with access = 1 or 4 (not mapped), but cannot be
+* appended to either (result = -92).
+*
+* Headers of event generators (FILE_TYPE 1) are opened with access = 1
+* or 4. The generator library named by EVENT_GENERATOR_LIBRARY (the
+* header file name if not given; without the platform prefix and
+* extension, see IAEA_EventGenerator) is loaded with the input file
+* INPUT_FILE_FOR_EVENT_GENERATOR, relative names being taken from the
+* directory of the header. iaea_get_particle, iaea_get_particles and
+* iaea_get_dispatched_particles then return the particles of the
+* generator, with the extra variables it declares, iaea_set_parallel
+* selects its random stream and iaea_get_used_original_particles
+* returns the histories it has run. Generators have no records to seek,
+* index, split, merge or convert and cannot be appended to 
+* (result = -92). result = -90 if the generator cannot be loaded.
 *
 ***********************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT 
@@ -77,6 +102,129 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
                      const IAEA_I32 *access, IAEA_I32 *result, 
                      int hf_length);
 
+/**************************************************************************
+* Reader cursor on a source
+*
+* Create a cursor on the source with Id source_ID, which must have been
+* opened for reading (access = 1 or 4), and return its Id in cursor_ID.
+* A cursor shares the parsed header of its source and, for access = 4,
+* the memory mapping of the phase space file, but has its own position,
+* record range and block buffer; without a mapping it reads the file with
+* pread(). The cursor Id can be passed to all reading functions
+* (iaea_get_particle, iaea_get_particles, iaea_set_record, 
+* iaea_set_parallel, iaea_set_parallel_chunk, ...), so several threads
+* can read one phase space, each through its own cursor, without locking.
+* Cursors do not update the header statistics of their source;
+* iaea_get_used_original_particles returns the histories read through
+* the cursor. Cursors are destroyed with iaea_destroy_source, which must
+* be done before destroying their source.
+* result is set to 0 if OK, -1 if source_ID does not exist, -2 if it was
+* not opened for reading or is an event generator (whose threads are set
+* up with iaea_set_dispatcher) and -98 if no more Ids are available.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_new_cursor(const IAEA_I32 *source_ID, IAEA_I32 *cursor_ID,
+                     IAEA_I32 *result);
+
+/**************************************************************************
+* Prefetching of phase space records
+*
+* Switch reading ahead on (n_buffers > 0) or off (n_buffers = 0) for the
+* source or cursor with Id id, opened for reading. A background thread then
+* reads the following records into a ring of n_buffers buffers of
+* buffer_records records each (about 1 MB per buffer if buffer_records = 0)
+* while the particles of the current buffer are returned, so reading from
+* slow or network storage overlaps with the calculation. Seeking
+* (iaea_set_record, iaea_set_parallel, ...) restarts the read-ahead at the
+* new position. Sources read through a memory mapping (access = 4) and
+* compressed files are left unchanged. Prefetching stops when the source
+* is destroyed.
+* result is set to 0 if OK, -1 if the source does not exist or on errors,
+* -2 if n_buffers or buffer_records is negative and -3 if the source was
+* not opened for reading.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_prefetch(const IAEA_I32 *id, const IAEA_I32 *n_buffers,
+                       const IAEA_I32 *buffer_records, IAEA_I32 *result);
+
+/**************************************************************************
+* Compressed phase space files
+*
+* Store the records written to the source with Id id, opened for writing
+* (access = 2), in the file .IAEAphspz instead of .IAEAphsp, compressed in
+* blocks of block_records records (COMPRESSION_BLOCK_RECORDS, 4096, if
+* block_records = 0). Each block is compressed on its own, so reading can
+* start at any record (iaea_set_record, iaea_set_parallel, cursors, the
+* dispatcher, ...) decompressing a single block. The header keyword
+* COMPRESSION gives the records per block. Compressed files are read with
+* iaea_new_source like the others, but cannot be appended to and have no
+* writers (see iaea_set_writers). The file is complete once the source is
+* destroyed. This must be done before the first particle is written.
+* result is set to 0 if OK, -1 if the source does not exist or on errors,
+* -2 if block_records is negative and -3 if the source is not a phase
+* space file opened for writing, is already compressed or has particles.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_compression(const IAEA_I32 *id, const IAEA_I32 *block_records,
+                          IAEA_I32 *result);
+
+/**************************************************************************
+* Accumulation of the header statistics
+*
+* Select how the statistics of the header of the source with Id id
+* (weights, kinetic energies and X,Y,Z ranges per particle type) are
+* accumulated while particles are read or written:
+*   mode = 0 : not accumulated, for sources opened for reading only
+*   mode = 1 : updated with every particle (the default)
+*   mode = 2 : particles are collected in batches that are reduced at once
+*              (with SSE2 when available). The statistics are complete when
+*              the header is written (iaea_update_header, iaea_destroy_source)
+*              or printed and in iaea_get_maximum_energy.
+* The number of particles of each type and of statistically independent
+* histories is always kept up to date. Sums may differ between mode 1 and
+* mode 2 in the last digits. NaN values are left out of the minima and
+* maxima in both modes; a minimum or maximum of zero may differ in sign.
+* result is set to 0 if OK, -1 if the source does not exist, is a cursor
+* or on errors, -2 if mode is not valid and -3 if mode = 0 is selected for
+* a source opened for writing.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_statistics(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result);
+
+/**************************************************************************
+* Recycling of particles
+*
+* Return every particle read from the source or cursor with Id id, opened
+* for reading, n_recycle times in a row by iaea_get_particle and
+* iaea_get_particles. The copies after the first have n_stat = 0, and 0 in
+* the extralongs of type 1 (incremental history number), so each history is
+* still counted once (also by iaea_get_used_original_particles), and all
+* copies get the weight divided by n_recycle, so results per
+* original history do not change. The copies are made on the decoded
+* particles, each record is read once. symmetry selects how the copies are
+* transformed, in (x,y) and in (u,v) alike:
+*   symmetry = 0 : identical copies
+*   symmetry = 1 : every copy rotated about the z axis by a random angle.
+*                  The angles come from stream id of the random sequence
+*                  of seed seed (see iaea_random.h), so runs are repeatable
+*                  and sources and cursors get different angles.
+*   symmetry = 2 : copy k (from 0) rotated by 2*pi*k/n_recycle
+*   symmetry = 3 : copy k reflected x -> -x if k%4 = 1, y -> -y if k%4 = 2,
+*                  both if k%4 = 3
+* n_recycle = 1 with symmetry = 0 switches recycling off. Particles read
+* through the dispatcher (iaea_get_dispatched_particles) are not recycled.
+* Moving the source (iaea_set_record, iaea_set_parallel, ...) drops the
+* copies of the last particle not yet returned.
+* result is set to 0 if OK, -1 if the source does not exist or on errors,
+* -2 if n_recycle or symmetry is not valid and -3 if the source was not
+* opened for reading or is an event generator.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_recycling(const IAEA_I32 *id, const IAEA_I32 *n_recycle,
+                        const IAEA_I32 *symmetry, const IAEA_I32 *seed,
+                        IAEA_I32 *result);
+
 /************************************************************************
 * Maximum number of particles 
 *
@@ -262,7 +410,8 @@ void iaea_get_used_original_particles(const IAEA_I32 *id,
 * Get Total Number of Original Particles from the Source with Id id. 
 *
 * For a typical linac it should be equal to the total number of electrons
-* incident on the primary target. 
+* incident on the primary target. For event generators it is the number
+* of histories run so far.
 *
 * Set number_of_original_particles to negative if such source does not exist.
 ******************************************************************************/
@@ -293,6 +442,9 @@ void iaea_set_total_original_particles(const IAEA_I32 *id,
 * The extra parameter i_parallel is needed
 * for the cases where the source is an event generator and should
 * be used to adjust the random number sequence.
+* Records are counted with 64-bit offsets, the last portion also gets
+* the remainder records, and end of file (n_stat = -2) is signaled at the
+* end of the portion (see also iaea_set_parallel_chunk).
 * The variable is_ok should be set to 0 if everything went smoothly,
 * or to some error code if it didnt.
 **************************************************************************/
@@ -301,13 +453,174 @@ void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
                        const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
                        IAEA_I32 *is_ok);
 
+/**************************************************************************
+* History-aligned partitioning for parallel runs 
+*
+* Same as iaea_set_parallel, but the chunk is described to the caller.
+* The records are divided with 64-bit offsets into n_chunk portions, the
+* last one getting the remainder, and from now on only the records of the
+* i_chunk-th portion are delivered (n_stat = -2 at the end of the chunk,
+* after which reading restarts at its first record).
+* If snap is not zero, the chunk boundaries are moved forward to the next
+* record starting a new history (n_stat > 0), so histories are never split
+* between chunks.
+* first_record returns the number of the first record of the chunk (from 1,
+* as used by iaea_set_record), n_records the number of records in it and
+* n_histories the number of original histories it covers, i.e. the sum of
+* n_stat over its records (computed by scanning the chunk once).
+* The variable result is set to 0 if everything went smoothly, to -1 if
+* the source does not exist or on i/o errors, -2 if n_chunk <= 0 and -3 if
+* i_chunk is not between 1 and n_chunk.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_parallel_chunk(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
+                       const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
+                       const IAEA_I32 *snap, IAEA_I64 *first_record,
+                       IAEA_I64 *n_records, IAEA_I64 *n_histories,
+                       IAEA_I32 *result);
+
+/**************************************************************************
+* Index of the histories
+*
+* Give the source with Id id an index of its histories: the first record
+* of every history and the original histories (n_stat) it accounts for,
+* kept in the file <name>.IAEAindex next to the header (see iaea_index.h).
+* For a source opened for reading the index is read from that file if it
+* is up to date (made for a phase space of the same size and modification
+* time), otherwise it is built reading the phase space once (the
+* source is left at its first particle) and saved, if the directory can
+* be written, for the next time. For a source opened with access = 2 the
+* histories are indexed as they are written and the file is saved when
+* the source is destroyed; the index is dropped if particles are added in
+* another way (iaea_merge_sources, iaea_split_source, iaea_set_writers).
+* With the index of a source opened for reading, iaea_set_parallel_chunk,
+* iaea_set_dispatcher and iaea_split_source find history boundaries and
+* count histories without reading the records, and the histories can be
+* located with iaea_get_history_records and iaea_seek_history.
+* n_histories returns the number of histories indexed (0 when writing).
+* result is set to 0 if OK, -1 if the source does not exist or on i/o
+* errors and -3 if the source is an event generator, a cursor or a
+* writer, or was opened with access = 3.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_index_histories(const IAEA_I32 *id, IAEA_I64 *n_histories,
+                          IAEA_I32 *result);
+
+/**************************************************************************
+* Records of a history
+*
+* Return for the k-th history (counted from 1) of the source with Id id
+* (or of the source of cursor id) the number of its first record in
+* first_record (counted from 1, as used by iaea_set_record), the number
+* of its records in n_records and in n_orig the original histories up to
+* and including it, i.e. the sum of the n_stat of histories 1 to k.
+* The source needs an index (see iaea_index_histories).
+* result is set to 0 if OK, -1 if the source does not exist, -2 if it
+* has no index and -3 if k is not between 1 and the number of histories.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_get_history_records(const IAEA_I32 *id, const IAEA_I64 *k,
+                              IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I64 *n_orig, IAEA_I32 *result);
+
+/**************************************************************************
+* Seek a history
+*
+* Position the source with Id id (or cursor id) at the k-th history
+* (counted from 1), so that the next particle read is its first one.
+* The source needs an index (see iaea_index_histories).
+* result is set to 0 if OK, -1 if the source does not exist or the
+* position cannot be set, -2 if it has no index, -3 if k is not
+* between 1 and the number of histories and -4 if the history is not in
+* the portion of the file reading is restricted to (see iaea_set_record).
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_seek_history(const IAEA_I32 *id, const IAEA_I64 *k,
+                       IAEA_I32 *result);
+
+/**************************************************************************
+* Work-stealing dispatcher for multi-threaded runs
+*
+* Set up the source with Id id, opened for reading (access = 1 or 4), to
+* be read by n_threads threads through iaea_get_dispatched_particles.
+* The records of the source (or of its current chunk, see
+* iaea_set_parallel) are split into batches of about batch_records
+* records (16384 if batch_records = 0) whose boundaries are moved
+* forward to the next new history, so histories are never split between
+* threads. Batches are handed out on demand from a shared counter through
+* small per-thread queues; a thread that runs out of work steals batches
+* queued for other threads, so threads reading expensive histories do not
+* hold back the others. Each thread reads through its own cursor (see
+* iaea_new_cursor). Calling this function again restarts the dispatch;
+* it must not be called while other threads read the source.
+* The dispatcher is released by iaea_destroy_source.
+* For event generators (see iaea_new_source) every thread gets its own
+* instance of the generator instead, loaded here from the same input
+* file, with a random stream of its own within the chunk set by
+* iaea_set_parallel (see IAEA_EventGenerator::setThreads); batch_records
+* is not used.
+* result is set to 0 if OK, -1 if the source does not exist or on i/o
+* errors, -2 if n_threads <= 0 or batch_records < 0, -3 if the source is
+* not a phase space file or event generator opened for reading and -98
+* if no more Ids are available for the cursors.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_dispatcher(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                         const IAEA_I32 *batch_records, IAEA_I32 *result);
+
+/**************************************************************************
+* Get a block of particles from the dispatcher
+*
+* Same as iaea_get_particles, for the thread number i_thread (between 1
+* and n_threads) of the dispatcher of source id (see iaea_set_dispatcher).
+* The particles read come from one batch only, so n_read may be smaller
+* than n_max; the next batch is taken by the following call. Several
+* threads may call this function at the same time with different
+* i_thread. n_read is set to -1 if the source has no dispatcher, i_thread
+* is out of range or on read errors, and to -2 once all batches have been
+* read. Event generators fill the arrays from the instance of the thread
+* and never end.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_get_dispatched_particles(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints);
+
+/**************************************************************************
+* Histories read through the dispatcher
+*
+* Set n_histories to the number of original histories (sum of n_stat)
+* read so far by the thread i_thread of the dispatcher of source id, or
+* by all its threads if i_thread = 0. These histories are also included
+* in iaea_get_used_original_particles for the source. n_histories is set
+* to -1 if the source has no dispatcher or i_thread is out of range.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_get_dispatched_histories(const IAEA_I32 *id, const IAEA_I32 *i_thread,
+                                  IAEA_I64 *n_histories);
+
 /**************************************************************************
 * setting the pointer to a user-specified record no. in the file
 *
 * record_num is the user-specified record number passed to the function.
 * id is the phase space file identifier.
 * The variable result should be set to 0 if everything went smoothly,
-* or to some error code if it didnt.
+* or to some error code if it didnt. If reading is restricted to a
+* portion of the file (iaea_set_parallel, iaea_set_parallel_chunk),
+* record_num must be in it (or just past its end), otherwise result is
+* set to -4 and the position is not changed.
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
@@ -319,6 +632,8 @@ void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
 * id is the phase space file identifier.  If the size of the phase space
 * file is not equal to checksum, then result returns -1, otherwise result
 * is set to 0.
+* A byte order mismatch does not prevent reading the file, whose records
+* are swapped as they are read (see iaea_new_source).
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_check_file_size_byte_order(const IAEA_I32 *id, IAEA_I32 *result);
@@ -350,13 +665,46 @@ IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints);
 
+/**************************************************************************
+* Get a block of particles
+*
+* Read up to n_max consecutive particles from the source with Id id into
+* caller-provided arrays (one entry per particle) and return in n_read the
+* number of particles actually read. The meaning of each n_stat[i] is the
+* same as for iaea_get_particle. Extra variables are returned per variable:
+* extra_floats[k*n_max+i] holds the k-th extra float of the i-th particle
+* and extra_ints[k*n_max+i] the k-th extra long (i.e. Fortran arrays
+* dimensioned (n_max,n_extra)).
+* Set n_read to -1, if a source with Id id does not exist or a read error
+* occured. Set n_read to -2, if end of file of the phase space source was
+* reached before any particle was read. Event generators (see
+* iaea_new_source) fill the arrays with one call to the generator library
+* if it exports get_next_particles (see IAEA_EventGenerator).
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_get_particles(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints);
+
 /**************************************************************************
 * Write a particle 
 * n_stat = 0 for a secondary particle
 * n_stat > 0 for an independent particle 
 *
 * Write a particle to the source with Id id. 
-* Set n_stat to -1, if ERROR (source with Id id does not exist).
+* Set n_stat to -1, if ERROR (source with Id id does not exist or was not
+* opened for writing with access = 2 or 3).
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT 
 void iaea_write_particle(const IAEA_I32 *id, IAEA_I32 *n_stat, 
@@ -372,12 +720,79 @@ const IAEA_Float *w,  /* direction in cartesian coordinates*/
 const IAEA_Float *extra_floats,
 const IAEA_I32 *extra_ints);
 
+/**************************************************************************
+* Write a block of particles
+*
+* Write n consecutive particles held in caller-provided arrays (one entry
+* per particle) to the source with Id id. The meaning of each n_stat[i] is
+* the same as for iaea_write_particle. Extra variables are passed per
+* variable as in iaea_get_particles: extra_floats[k*n+i] holds the k-th 
+* extra float of the i-th particle and extra_ints[k*n+i] the k-th extra
+* long. Particles are packed into the output block of the source, which is
+* written to disk with a single write each time it fills up (and when the
+* header is updated or the source is destroyed).
+* Return in n_written the number of particles written.
+* Set n_written to -1, if ERROR (source with Id id does not exist or was
+* not opened for writing with access = 2 or 3, or a write error occured).
+* The counters of the header are updated once for the whole block.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_write_particles(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints);
+
+/**************************************************************************
+* Concurrent writers
+*
+* Set up n_threads writers on the source with Id id, opened for writing
+* (access = 2 or 3), and return their Ids in writer_IDs[0..n_threads-1].
+* Thread t writes its particles with iaea_write_particle or
+* iaea_write_particles on writer_IDs[t], without locking. Each writer
+* collects the particles in its own buffer and writes whole histories (a
+* particle with n_stat > 0 and the particles following it) with one
+* positional write at an offset reserved atomically at the end of the
+* file, so the histories of different threads are never interleaved,
+* but their order in the file depends on the scheduling of the threads.
+* The counters and statistics of each thread are kept apart and merged
+* into the header in the order of the threads when the writers are
+* released, so the header does not depend on the scheduling.
+* While writers are set the source itself cannot be written to and its
+* header cannot be updated. A writer is released with iaea_destroy_source
+* on its Id; destroying the last writer, calling this function with
+* n_threads = 0 or destroying the source releases all the writers of the
+* source, which must have finished writing, and the source continues
+* writing after their data.
+* result is set to 0 if OK, -1 if the source does not exist or on write
+* errors, -2 if n_threads < 0, -3 if the source is not a phase space file
+* opened for writing, or is compressed (see iaea_set_compression), and -98
+* if no more Ids are available.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_set_writers(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                      IAEA_I32 *writer_IDs, IAEA_I32 *result);
+
 /***************************************************************************
 * Destroy a source 
 *
 * This function de-initializes the source with Id id, closing all open
 * files, deallocating memory, etc. Nothing happens if a source with that
 * id does not exist. Header is updated.
+* Destroying a cursor (see iaea_new_cursor) only releases the cursor. A
+* source with open cursors is not destroyed and result is set to -2.
+* Destroying a writer (see iaea_set_writers) writes the particles left in
+* its buffer and releases it; the writers still open when their source is
+* destroyed are released first. result is set to -1 on write errors.
 ****************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT 
 void iaea_destroy_source(const IAEA_I32 *source_ID, IAEA_I32 *result);
@@ -397,8 +812,95 @@ IAEA_EXTERN_C IAEA_EXPORT
 void iaea_copy_header(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID, 
                       IAEA_I32 *result);
 
+/***************************************************************************
+* Merge phase spaces
+*
+* Append the particles of the n_sources sources with Ids source_IDs,
+* opened for reading, to the source with Id destiny_ID, opened for
+* writing, and add their ORIG_HISTORIES to those of the destination.
+* Sources whose records are laid out as those of the destination (same
+* variables, constants, extra variables and byte order) are copied as
+* whole files without decoding the records (inside the kernel with
+* copy_file_range() where available) and their particle counters and
+* statistics are taken from their headers, so the sources must not have
+* been read from; if they or the destination are compressed (see
+* iaea_set_compression) the records are decompressed and compressed again
+* on the way. The other sources are read and rewritten particle by
+* particle, their extra variables matched to those of the destination by
+* type (EXTRA_FLOATS/EXTRA_LONGS of the header); a history counter
+* (extralong type 1) missing in a source is made from the n_stat of its
+* particles, other missing extra variables are written as 0. A destination
+* opened with access = 2 that holds no particles yet takes the layout of
+* the first source. Use iaea_copy_header to give it the description of
+* that source too (and reset its ORIG_HISTORIES, which iaea_copy_header
+* copies, with iaea_set_total_original_particles).
+* result is set to 0 if OK, -1 if a source does not exist or on i/o
+* errors, -2 if n_sources < 0 and -3 if the destination is not a phase
+* space opened for writing (or has writers open), a source is not a
+* phase space opened for reading or a source to be copied as it is has
+* been read from.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_merge_sources(const IAEA_I32 *n_sources, const IAEA_I32 *source_IDs,
+                        const IAEA_I32 *destiny_ID, IAEA_I32 *result);
+
+/***************************************************************************
+* Split a phase space
+*
+* Distribute the particles of the source with Id source_ID, opened for
+* reading, over the n_parts sources with Ids destiny_IDs, opened for
+* writing with access = 2 and holding no particles yet. The file is cut
+* into n_parts portions of about the same number of records, the cuts
+* moved forward to the next record starting a new history, so no history
+* is split (a destination gets no particles if the histories are longer
+* than a portion). The records are copied as they are, inside the kernel
+* where possible; each destination takes the layout of the source and
+* the particle counters and statistics of its own records.
+* The ORIG_HISTORIES of the source are apportioned by the histories of
+* each portion, counted from the n_stat of its records: with an extralong
+* of type 1 these include the histories without particles, and those
+* after the last particle go to the last destination; without it, the
+* ORIG_HISTORIES are apportioned in proportion to the histories found.
+* Use iaea_copy_header beforehand to give the destinations the
+* description of the source. The source is left at its first particle.
+* result is set to 0 if OK, -1 if a source does not exist or on i/o
+* errors, -2 if n_parts < 1 and -3 if the source is not a phase space
+* opened for reading (or is of the other byte order, see
+* iaea_convert_source) or a destination is not an empty phase space
+* opened with access = 2.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_split_source(const IAEA_I32 *source_ID, const IAEA_I32 *n_parts,
+                       const IAEA_I32 *destiny_IDs, IAEA_I32 *result);
+
+/***************************************************************************
+* Convert a phase space to the byte order of this machine
+*
+* Write the particles of the source with Id source_ID, opened for
+* reading, to the source with Id destiny_ID, opened for writing with
+* access = 2 and holding no particles yet, in the byte order of this
+* machine. The records are swapped block by block without decoding them
+* (a source already in the byte order of this machine is copied as it
+* is) and the destination takes the layout, particle counters, statistics
+* and ORIG_HISTORIES of the source, so the source must not have been read
+* from. Use iaea_copy_header beforehand to give the destination the
+* description of the source. A destination made compressed beforehand
+* (see iaea_set_compression) gets the records compressed. The source is
+* left at its first particle.
+* result is set to 0 if OK, -1 if a source does not exist or on i/o
+* errors and -3 if the source is not a phase space opened for reading (or
+* has been read from) or the destination is not an empty phase space
+* opened with access = 2.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_convert_source(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         IAEA_I32 *result);
+
 /***************************************************************************
 * Update header of the source_id 
+*
+* result is set to -2 if writers are open on the source (see
+* iaea_set_writers).
 ****************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT 
 void iaea_update_header(const IAEA_I32 *source_ID, IAEA_I32 *result);
@@ -0,0 +1,279 @@
+/******************************************************************************
+ *
+ *  Background prefetching of phase space records into a ring of buffers
+ *
+ *  Synchronous reads stall the transport thread whenever the phase space
+ *  sits on slow or network storage. With prefetching enabled a reader
+ *  thread keeps the next n_buffers buffers of records in memory, so the
+ *  consumer only waits if it drains the records faster than the storage
+ *  delivers them. Records are kept packed; they are decoded as usual by
+ *  the consumer (see iaea_decode_block).
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "iaea_prefetch.h"
+
+#ifdef WIN32
+
+#include <io.h>
+
+IAEA_I64 iaea_pread(int fd, unsigned char *buf, IAEA_I64 n, IAEA_I64 offset)
+{
+  IAEA_I64 ndone = 0;
+  while(ndone < n)
+  {
+     OVERLAPPED ov;
+     DWORD nread, nwant = (DWORD) ((n - ndone > 0x40000000) ? 0x40000000 : n - ndone);
+     memset(&ov, 0, sizeof(ov));
+     ov.Offset = (DWORD) (offset + ndone);
+     ov.OffsetHigh = (DWORD) ((offset + ndone) >> 32);
+     if(!ReadFile((HANDLE) _get_osfhandle(fd), buf + ndone, nwant, &nread, &ov)) break;
+     if(nread == 0) break;
+     ndone += nread;
+  }
+  return(ndone);
+}
+
+IAEA_I64 iaea_pwrite(int fd, const unsigned char *buf, IAEA_I64 n,
+                     IAEA_I64 offset)
+{
+  IAEA_I64 ndone = 0;
+  while(ndone < n)
+  {
+     OVERLAPPED ov;
+     DWORD nwritten, nwant = (DWORD) ((n - ndone > 0x40000000) ? 0x40000000 : n - ndone);
+     memset(&ov, 0, sizeof(ov));
+     ov.Offset = (DWORD) (offset + ndone);
+     ov.OffsetHigh = (DWORD) ((offset + ndone) >> 32);
+     if(!WriteFile((HANDLE) _get_osfhandle(fd), buf + ndone, nwant, &nwritten, &ov)) break;
+     if(nwritten == 0) break;
+     ndone += nwritten;
+  }
+  return(ndone);
+}
+
+#else
+
+#include <sys/types.h>
+#include <unistd.h>
+
+IAEA_I64 iaea_pread(int fd, unsigned char *buf, IAEA_I64 n, IAEA_I64 offset)
+{
+  IAEA_I64 ndone = 0;
+  while(ndone < n)
+  {
+     ssize_t nread = pread(fd, buf + ndone, (size_t)(n - ndone), (off_t)(offset + ndone));
+     if(nread <= 0) break;
+     ndone += nread;
+  }
+  return(ndone);
+}
+
+IAEA_I64 iaea_pwrite(int fd, const unsigned char *buf, IAEA_I64 n,
+                     IAEA_I64 offset)
+{
+  IAEA_I64 ndone = 0;
+  while(ndone < n)
+  {
+     ssize_t nwritten = pwrite(fd, buf + ndone, (size_t)(n - ndone),
+                               (off_t)(offset + ndone));
+     if(nwritten <= 0) break;
+     ndone += nwritten;
+  }
+  return(ndone);
+}
+
+#endif
+
+IAEA_I64 iaea_copy_range(int fd_in, IAEA_I64 offset_in, int fd_out,
+                         IAEA_I64 offset_out, IAEA_I64 n)
+{
+  IAEA_I64 ndone = 0;
+#if defined(__linux__) && defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+  // no data through user space; falls back to reading and writing below
+  // if the file system does not support it
+  while(ndone < n)
+  {
+     loff_t off_in = offset_in + ndone, off_out = offset_out + ndone;
+     ssize_t ncopied = copy_file_range(fd_in, &off_in, fd_out, &off_out,
+                                       (size_t)(n - ndone), 0);
+     if(ncopied <= 0) break;
+     ndone += ncopied;
+  }
+#endif
+
+  const IAEA_I64 chunk = 1 << 20;
+  unsigned char *buf = NULL;
+  if(ndone < n) buf = (unsigned char *) malloc((size_t)chunk);
+  while(buf != NULL && ndone < n)
+  {
+     IAEA_I64 nwant = (n - ndone > chunk) ? chunk : n - ndone;
+     IAEA_I64 nread = iaea_pread(fd_in, buf, nwant, offset_in + ndone);
+     if(nread <= 0) break;
+     if(iaea_pwrite(fd_out, buf, nread, offset_out + ndone) != nread) break;
+     ndone += nread;
+  }
+  free(buf);
+  return(ndone);
+}
+
+/* *********************************************************************** */
+
+static IAEA_THREAD_FUNC(prefetch_reader, arg)
+{
+  iaea_prefetch *pf = (iaea_prefetch *) arg;
+
+  IAEA_MUTEX_LOCK(&pf->lock);
+  for(;;)
+  {
+     while(!pf->stop && pf->n_ready == pf->n_buffers)
+        IAEA_COND_WAIT(&pf->space, &pf->lock);
+     if(pf->stop || pf->next >= pf->end) break;
+
+     // The buffer after the filled ones is not seen by the consumer
+     int ibuf = (pf->head + pf->n_ready) % pf->n_buffers;
+     IAEA_I64 offset = pf->next;
+     IAEA_I64 nwant = pf->end - offset;
+     if(nwant > (IAEA_I64) pf->buffer_size) nwant = pf->buffer_size;
+     IAEA_MUTEX_UNLOCK(&pf->lock);
+
+     IAEA_I64 nread = iaea_pread(pf->fd, pf->buffer[ibuf], nwant, offset);
+
+     IAEA_MUTEX_LOCK(&pf->lock);
+     pf->fill[ibuf] = (size_t) (nread - nread % pf->reclength);
+     pf->next = offset + pf->fill[ibuf];
+     pf->n_ready++;
+     IAEA_COND_SIGNAL(&pf->ready);
+     if(nread < nwant) {pf->error = 1; break;}
+  }
+  pf->done = 1;
+  IAEA_COND_SIGNAL(&pf->ready);
+  IAEA_MUTEX_UNLOCK(&pf->lock);
+  return IAEA_THREAD_RETURN;
+}
+
+static void prefetch_stop(iaea_prefetch *pf)
+{
+  if(!pf->running) return;
+
+  IAEA_MUTEX_LOCK(&pf->lock);
+  pf->stop = 1;
+  IAEA_COND_SIGNAL(&pf->space);
+  IAEA_MUTEX_UNLOCK(&pf->lock);
+
+  IAEA_THREAD_JOIN(pf->thread);
+  pf->running = 0;
+}
+
+static int prefetch_start(iaea_prefetch *pf, IAEA_I64 pos, IAEA_I64 end)
+{
+  prefetch_stop(pf);
+
+  pf->head = pf->n_ready = 0;
+  pf->next = pf->pos = pos;
+  pf->end = end;
+  pf->done = pf->error = pf->stop = 0;
+  pf->used = pf->avail = 0;
+
+  if(IAEA_THREAD_CREATE(&pf->thread, prefetch_reader, pf) != 0)
+  {
+     pf->done = pf->error = 1;
+     return(0);
+  }
+  pf->running = 1;
+  return(1);
+}
+
+/* *********************************************************************** */
+
+iaea_prefetch *iaea_prefetch_new(int fd, int reclength, int n_buffers,
+                                 int buffer_records)
+{
+  if(reclength <= 0 || n_buffers <= 0 || buffer_records <= 0) return(NULL);
+
+  iaea_prefetch *pf = (iaea_prefetch *) calloc(1, sizeof(iaea_prefetch));
+  if(pf == NULL) return(NULL);
+
+  IAEA_MUTEX_INIT(&pf->lock);
+  IAEA_COND_INIT(&pf->ready);
+  IAEA_COND_INIT(&pf->space);
+
+  pf->fd = fd;
+  pf->reclength = reclength;
+  pf->n_buffers = n_buffers;
+  pf->buffer_size = (size_t)buffer_records*reclength;
+  pf->buffer = (unsigned char **) calloc(n_buffers, sizeof(unsigned char *));
+  pf->fill = (size_t *) calloc(n_buffers, sizeof(size_t));
+  if(pf->buffer == NULL || pf->fill == NULL) {iaea_prefetch_free(pf); return(NULL);}
+
+  for(int i=0; i<n_buffers; i++)
+  {
+     pf->buffer[i] = (unsigned char *) malloc(pf->buffer_size);
+     if(pf->buffer[i] == NULL) {iaea_prefetch_free(pf); return(NULL);}
+  }
+  return(pf);
+}
+
+const unsigned char *iaea_prefetch_read(iaea_prefetch *pf, IAEA_I64 pos,
+                                        IAEA_I64 end, IAEA_I32 n_max,
+                                        IAEA_I32 *n_read)
+{
+  *n_read = 0;
+  if(!pf->running || pos != pf->pos || end != pf->end)
+     prefetch_start(pf, pos, end);
+
+  if(pf->used == pf->avail)
+  {
+     // Head drained (or not taken yet): release it and wait for the next
+     IAEA_MUTEX_LOCK(&pf->lock);
+     if(pf->avail > 0)
+     {
+        pf->head = (pf->head + 1) % pf->n_buffers;
+        pf->n_ready--;
+        IAEA_COND_SIGNAL(&pf->space);
+     }
+     pf->used = pf->avail = 0;
+     while(pf->n_ready == 0 && !pf->done) IAEA_COND_WAIT(&pf->ready, &pf->lock);
+     if(pf->n_ready > 0) pf->avail = pf->fill[pf->head];
+     IAEA_MUTEX_UNLOCK(&pf->lock);
+
+     if(pf->avail == 0) return(pf->buffer[pf->head]); // end or read error
+  }
+
+  // Records of the head buffer are handed out without locking
+  IAEA_I64 navail = (IAEA_I64)((pf->avail - pf->used)/pf->reclength);
+  if(navail < n_max) n_max = (IAEA_I32) navail;
+
+  const unsigned char *records = pf->buffer[pf->head] + pf->used;
+  pf->used += (size_t)n_max*pf->reclength;
+  pf->pos += (IAEA_I64)n_max*pf->reclength;
+  *n_read = n_max;
+  return(records);
+}
+
+int iaea_prefetch_error(iaea_prefetch *pf)
+{
+  IAEA_MUTEX_LOCK(&pf->lock);
+  int error = pf->error;
+  IAEA_MUTEX_UNLOCK(&pf->lock);
+  return(error);
+}
+
+void iaea_prefetch_free(iaea_prefetch *pf)
+{
+  if(pf == NULL) return;
+  prefetch_stop(pf);
+
+  if(pf->buffer != NULL)
+     for(int i=0; i<pf->n_buffers; i++) free(pf->buffer[i]);
+  free(pf->buffer);
+  free(pf->fill);
+
+  IAEA_COND_DESTROY(&pf->space);
+  IAEA_COND_DESTROY(&pf->ready);
+  IAEA_MUTEX_DESTROY(&pf->lock);
+  free(pf);
+}
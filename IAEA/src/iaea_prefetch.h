@@ -0,0 +1,84 @@
+/******************************************************************************
+ *
+ *  Background prefetching of phase space records into a ring of buffers
+ *
+ *****************************************************************************/
+#ifndef IAEA_PREFETCH
+#define IAEA_PREFETCH
+
+#include "iaea_config.h"
+#include "iaea_thread.h"
+
+/* *********************************************************************** */
+// A reader thread fills n_buffers buffers with consecutive bytes of the
+// file while the consumer drains them. The consumer only ever touches
+// the buffer at head; the reader fills the buffers after the n_ready
+// ones already filled, so both work on different buffers and only the
+// hand-over is locked.
+struct iaea_prefetch
+{
+  int fd;                    // file read with positional reads
+  int reclength;             // buffers hold whole records
+  int n_buffers;
+  size_t buffer_size;        // bytes per buffer, a multiple of reclength
+  unsigned char **buffer;
+  size_t *fill;              // bytes read into each buffer
+
+  IAEA_MUTEX lock;
+  IAEA_COND  ready;          // signaled when a buffer was filled
+  IAEA_COND  space;          // signaled when a buffer was released
+  IAEA_THREAD_T thread;
+  int running;               // the reader thread was started
+
+  // shared between the reader and the consumer, under lock
+  int head;                  // buffer being drained by the consumer
+  int n_ready;               // filled buffers, including head
+  IAEA_I64 next;             // offset of the next byte to be read
+  int done;                  // the reader has stopped
+  int error;                 // a read failed
+  int stop;                  // the reader has to stop
+
+  // consumer only
+  IAEA_I64 pos;              // offset of the next byte to be delivered
+  IAEA_I64 end;              // reading stops here
+  size_t used;               // bytes of buffer head already delivered
+  size_t avail;              // bytes in buffer head (0 = not taken yet)
+};
+
+/* *********************************************************************** */
+// Reads n bytes at offset of fd, retrying short reads. Returns the number
+// of bytes read. On Windows the file pointer of fd is moved as well.
+IAEA_I64 iaea_pread(int fd, unsigned char *buf, IAEA_I64 n, IAEA_I64 offset);
+
+// The same for writing n bytes at offset of fd (see the writers of a source)
+IAEA_I64 iaea_pwrite(int fd, const unsigned char *buf, IAEA_I64 n,
+                     IAEA_I64 offset);
+
+// Copies n bytes at offset_in of fd_in to offset_out of fd_out, inside the
+// kernel with copy_file_range() where available. Returns the number of
+// bytes copied.
+IAEA_I64 iaea_copy_range(int fd_in, IAEA_I64 offset_in, int fd_out,
+                         IAEA_I64 offset_out, IAEA_I64 n);
+
+// Allocates the ring for records of reclength bytes read from fd, with
+// n_buffers buffers of buffer_records records. The reader thread is
+// started by the first iaea_prefetch_read(). Returns NULL on failure.
+iaea_prefetch *iaea_prefetch_new(int fd, int reclength, int n_buffers,
+                                 int buffer_records);
+
+// Returns up to n_max records starting at the byte offset pos, reading
+// ahead up to the offset end, and sets n_read to their number. The
+// records stay valid until the next call. If pos or end differ from
+// the previous call (e.g. after a seek), the reader is restarted at pos.
+// n_read is 0 at end and on read errors (see iaea_prefetch_error).
+const unsigned char *iaea_prefetch_read(iaea_prefetch *pf, IAEA_I64 pos,
+                                        IAEA_I64 end, IAEA_I32 n_max,
+                                        IAEA_I32 *n_read);
+
+// Non-zero if a read of the reader thread failed
+int iaea_prefetch_error(iaea_prefetch *pf);
+
+// Stops the reader thread and frees the ring
+void iaea_prefetch_free(iaea_prefetch *pf);
+
+#endif
@@ -0,0 +1,103 @@
+/******************************************************************************
+ *
+ *  Counter-based random numbers for event generators (Philox4x32-10)
+ *
+ *  Event generators running one instance per thread (see
+ *  IAEA_EventGenerator::setThreads) need random sequences which do not
+ *  overlap. Philox4x32-10 (J. Salmon et al., "Parallel random numbers:
+ *  as easy as 1, 2, 3", SC11) turns a 128-bit counter into 4 random
+ *  32-bit numbers with a bijection fixed by a 64-bit key. Here the key is
+ *  the seed, the high half of the counter is the stream number and the
+ *  low half counts the blocks of 4 numbers given, so different streams
+ *  of one seed are disjoint parts of a single sequence of period 2^130:
+ *  they cannot overlap before 2^66 numbers of a stream are used. Jumping
+ *  ahead is setting the counter.
+ *
+ *  Header only, so generator libraries need not link the IAEA library.
+ *
+ *****************************************************************************/
+#ifndef IAEA_RANDOM
+#define IAEA_RANDOM
+
+struct iaea_random
+{
+  unsigned int key[2];       // the seed
+  unsigned int counter[4];   // [0..1] = block of 4 numbers, [2..3] = stream
+  unsigned int out[4];       // the numbers of the current block
+  int n_used;                // numbers of out already given
+};
+
+/* *********************************************************************** */
+
+static inline void iaea_random_mulhilo(unsigned int a, unsigned int b,
+                                       unsigned int *hi, unsigned int *lo)
+{
+  unsigned long long p = (unsigned long long) a*b;
+  *hi = (unsigned int)(p >> 32);
+  *lo = (unsigned int) p;
+}
+
+// The 10 rounds of Philox4x32 on counter with key
+static inline void iaea_random_block(const unsigned int key[2],
+                                     const unsigned int counter[4],
+                                     unsigned int out[4])
+{
+  unsigned int c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  unsigned int k0 = key[0], k1 = key[1];
+  for(int round=0; round<10; round++)
+  {
+     unsigned int hi0, lo0, hi1, lo1;
+     iaea_random_mulhilo(0xD2511F53u, c0, &hi0, &lo0);
+     iaea_random_mulhilo(0xCD9E8D57u, c2, &hi1, &lo1);
+     c0 = hi1 ^ c1 ^ k0;
+     c1 = lo1;
+     c2 = hi0 ^ c3 ^ k1;
+     c3 = lo0;
+     k0 += 0x9E3779B9u;
+     k1 += 0xBB67AE85u;
+  }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// Starts stream number stream of the sequence of seed
+static inline void iaea_random_init(iaea_random *r, unsigned long long seed,
+                                    unsigned long long stream)
+{
+  r->key[0] = (unsigned int) seed;
+  r->key[1] = (unsigned int)(seed >> 32);
+  r->counter[0] = r->counter[1] = 0;
+  r->counter[2] = (unsigned int) stream;
+  r->counter[3] = (unsigned int)(stream >> 32);
+  r->n_used = 4;
+}
+
+// Moves to the n-th number of the stream (counted from 0)
+static inline void iaea_random_skip_to(iaea_random *r, unsigned long long n)
+{
+  unsigned long long block = n/4;
+  r->counter[0] = (unsigned int) block;
+  r->counter[1] = (unsigned int)(block >> 32);
+  iaea_random_block(r->key, r->counter, r->out);
+  r->n_used = (int)(n%4);
+  if(++r->counter[0] == 0) r->counter[1]++;
+}
+
+// Next 32 random bits
+static inline unsigned int iaea_random_u32(iaea_random *r)
+{
+  if(r->n_used == 4)
+  {
+     iaea_random_block(r->key, r->counter, r->out);
+     r->n_used = 0;
+     if(++r->counter[0] == 0) r->counter[1]++;
+  }
+  return r->out[r->n_used++];
+}
+
+// Uniform in (0,1), never 0 or 1
+static inline double iaea_random_uniform(iaea_random *r)
+{
+  return ((double) iaea_random_u32(r) + 0.5)*(1.0/4294967296.0);
+}
+
+#endif
@@ -45,7 +45,36 @@
 //#define DEBUG // Comment to avoid printing for every particle write or read
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "iaea_record.h"
+#include "iaea_codec.h"
+#include "iaea_prefetch.h"
+#include "iaea_compress.h"
+
+#ifdef WIN32
+
+#include <windows.h>
+#include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define FSEEK64(f,offset) _fseeki64(f,offset,SEEK_SET)
+#define FTELL64(f)        _ftelli64(f)
+#define FSEEK64_END(f)    _fseeki64(f,0,SEEK_END)
+
+#else
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define FSEEK64(f,offset) fseeko(f,(off_t)(offset),SEEK_SET)
+#define FTELL64(f)        ((IAEA_I64) ftello(f))
+#define FSEEK64_END(f)    fseeko(f,0,SEEK_END)
+
+#endif
 
 short iaea_record_type::initialize()
 {
@@ -84,19 +113,55 @@ short iaea_record_type::initialize()
 
 short iaea_record_type::write_particle()
 {
-  float floatArray[NUM_EXTRA_FLOAT+7];
-  IAEA_I32 longArray[NUM_EXTRA_LONG];
+  // The record is encoded into the block buffer which is written to the 
+  // file with a single fwrite once it holds NUM_BLOCK_RECORDS records
+  int reclength = get_reclength();
 
-  char ishort = (char) particle;
-  if(w < 0) ishort = -ishort; // Sign of w is stored in particle type
-  
-  if( fwrite(&ishort, sizeof(char),   1, p_file) != 1)
+  if(IsNewHistory > 0) history_fill = block_fill;
+  if(block_fill + reclength > block_size)
   {
-    fprintf(stderr, "\n ERROR: write_particle: Failed to write particle type\n");
-    return (FAIL);;
+     if(reserve != NULL)
+     {
+        if(flush_histories(reclength) != OK) return (FAIL);
+     }
+     else
+     {
+        if(flush_block() != OK) return (FAIL);
+        if(alloc_block(NUM_BLOCK_RECORDS*reclength) != OK) return (FAIL);
+     }
   }
 
-  int reclength = sizeof(char);
+  encode_particle(block + block_fill);
+  block_fill += reclength;
+
+  #ifdef DEBUG
+  // charge defined 
+  int iaea_charge[MAX_NUM_PARTICLES]={0,-1,+1,0,+1};
+  int charge = iaea_charge[particle - 1];
+  int j;
+
+  printf("\n Wrote a particle with a record lenght %d",reclength);
+  printf("\n Q %d E %f X %f Y %f Z %f \n\t u %f v %f w %f W %f Part %d \n",
+  charge, energy, x, y, z, u, v, w, weight, particle);
+  if( iextrafloat > 0) printf(" EXTRA FLOATs:"); 
+  for(j=0;j<iextrafloat;j++) printf(" F%i %f",j+1,extrafloat[j]);
+  if( iextralong > 0)  printf(" EXTRA LONGs:"); 
+  for(j=0;j<iextralong;j++) printf(" L%i %d", j+1,extralong[j]);
+  printf("\n"); 
+  #endif
+    
+  return(OK);
+}
+
+void iaea_record_type::encode_particle(unsigned char *record)
+{
+  if(codec_encode != NULL) {codec_encode(this, record); return;}
+
+  float floatArray[NUM_EXTRA_FLOAT+7];
+
+  char ishort = (char) particle;
+  if(w < 0) ishort = -ishort; // Sign of w is stored in particle type
+  record[0] = (unsigned char) ishort;
 
   if(IsNewHistory > 0) energy *= (-1); // New history is signaled by negative energy
 
@@ -114,66 +179,168 @@ short iaea_record_type::write_particle()
   int j;
   for(j=0;j<iextrafloat;j++) floatArray[++i] = extrafloat[j];
 
-  reclength += (i+1)*sizeof(float);
+  memcpy(record + sizeof(char), floatArray, (i+1)*sizeof(float));
+
+  if(iextralong > 0) 
+     memcpy(record + sizeof(char) + (i+1)*sizeof(float), extralong,
+            iextralong*sizeof(IAEA_I32));
+}
+
+short iaea_record_type::flush_block()
+{
+  // Writes the records encoded so far with a single fwrite
+  if(block_fill <= 0) return(OK);
 
-  if( fwrite(floatArray, sizeof(float), (size_t)(i+1), p_file) != (size_t) (i+1))
+  size_t nbytes = (size_t) block_fill;
+  block_fill = history_fill = 0;
+  if(reserve != NULL)
   {
-     fprintf(stderr, "\n ERROR: write_particle: Failed to write FLOAT phsp data\n");
-     return (FAIL);
+     IAEA_I64 offset = IAEA_ATOMIC_ADD64(reserve, (IAEA_I64)nbytes);
+     if( iaea_pwrite(fd, block, nbytes, offset) != (IAEA_I64)nbytes)
+     {
+        fprintf(stderr, "\n ERROR: flush_block: Failed to write phsp data\n");
+        return (FAIL);
+     }
+     return(OK);
   }
-
-  if(iextralong > 0) 
+  if(compressed != NULL)
   {
-     for(j=0;j<iextralong;j++) longArray[j] = extralong[j];
-     reclength += iextralong*sizeof(IAEA_I32);
-     if( fwrite(longArray, sizeof(IAEA_I32), (size_t)iextralong, p_file) != (size_t)iextralong)
+     // Compressed file: whole blocks are compressed as they fill up
+     if( iaea_compressed_write(compressed, p_file, block, nbytes/get_reclength(),
+                               get_reclength()) != OK)
      {
-        fprintf(stderr, "\n ERROR: write_particle: Failed to write LONG phsp data\n");
+        fprintf(stderr, "\n ERROR: flush_block: Failed to write phsp data\n");
         return (FAIL);
      }
+     return(OK);
+  }
+  if( fwrite(block, sizeof(unsigned char), nbytes, p_file) != nbytes)
+  {
+     fprintf(stderr, "\n ERROR: flush_block: Failed to write phsp data\n");
+     return (FAIL);
+  }
+  return(OK);
+}
+
+short iaea_record_type::flush_histories(int needed)
+{
+  // For writers: writes the whole histories of the block, keeping the
+  // records of the current one, which may not be complete yet, so each
+  // history ends up in one piece in the file. Then makes room for needed
+  // more bytes, growing the block if a single history fills it.
+  if(history_fill > 0)
+  {
+     int n_whole = history_fill, n_current = block_fill - history_fill;
+     block_fill = n_whole;
+     if(flush_block() != OK) return (FAIL);
+     memmove(block, block + n_whole, n_current);
+     block_fill = n_current;
+  }
+
+  int size = (block_size > 0) ? block_size : NUM_BLOCK_RECORDS*needed;
+  while(block_fill + needed > size) size *= 2;
+  return(alloc_block(size));
+}
+
+short iaea_record_type::alloc_block(int needed)
+{
+  if(needed <= block_size) return(OK);
+
+  unsigned char *tmp = (unsigned char *) realloc(block, needed);
+  if(tmp == NULL)
+  {
+     fprintf(stderr, "\n ERROR: alloc_block: Failed to allocate %d bytes\n",needed);
+     return(FAIL);
+  }
+  block = tmp;
+  block_size = needed;
+  return(OK);
+}
+
+short iaea_record_type::read_particle()
+{
+  IAEA_I32 n_read;
+
+  // IAEA_I32 pos = ftell(p_file); // To check file position
+
+  // The whole record is fetched at once and decoded from memory
+  const unsigned char *record = read_block(1, &n_read);
+  // The end of the file is not an error (stdio only sees it here)
+  if( record != NULL && n_read == 0 && at_end() && !read_error() )
+     return(FAIL);
+  if( record == NULL || n_read != 1 )
+  {
+    fprintf(stderr, "\n ERROR: read_particle: Failed to read particle record\n");
+    return (FAIL);
   }
 
-  if(reclength == 0) return(FAIL);
+  decode_particle(record);
+
+  int reclength = get_reclength();
 
   #ifdef DEBUG
   // charge defined 
   int iaea_charge[MAX_NUM_PARTICLES]={0,-1,+1,0,+1};
   int charge = iaea_charge[particle - 1];
+  int j;
 
-  printf("\n Wrote a particle with a record lenght %d",reclength);
+  printf("\n Read a particle with a record lenght %d (New History: %d)",
+               reclength,IsNewHistory);
   printf("\n Q %d E %f X %f Y %f Z %f \n\t u %f v %f w %f W %f Part %d \n",
   charge, energy, x, y, z, u, v, w, weight, particle);
   if( iextrafloat > 0) printf(" EXTRA FLOATs:"); 
   for(j=0;j<iextrafloat;j++) printf(" F%i %f",j+1,extrafloat[j]);
   if( iextralong > 0)  printf(" EXTRA LONGs:"); 
-  for(j=0;j<iextralong;j++) printf(" L%i %d", j+1,extralong[j]);
+  for(j=0;j<iextralong;j++)  printf(" L%i %d",j+1,extralong[j]);
   printf("\n"); 
   #endif
-    
-  return(OK);
+  return(reclength);
 }
 
-short iaea_record_type::read_particle()
+int iaea_record_type::get_reclength()
 {
-  float floatArray[NUM_EXTRA_FLOAT+7];
-  IAEA_I32 longArray[NUM_EXTRA_LONG+7];
-  int i,j,is,reclength;
-  char ctmp; 
+  // Number of bytes of one record as laid out by write_particle(),
+  // fixed by set_layout() whenever the record contents change
+  return(layout.reclength);
+}
 
-  // IAEA_I32 pos = ftell(p_file); // To check file position
+void iaea_record_type::set_layout()
+{
+  // Offsets of the stored quantities, in the order written by
+  // encode_particle(). Done once when the record contents are known.
+  int stored[7] = {ix, iy, iz, iu, iv, 0, iweight};
+  int offset = sizeof(char) + sizeof(float); // particle type and energy
 
-  if( fread(&ctmp, sizeof(char),   1, p_file) != 1) // particle type is always read
+  for(int j=0;j<7;j++)
   {
-    fprintf(stderr, "\n ERROR: read_particle: Failed to read particle type\n");
-    return (FAIL);;
+    layout.offset[j] = -1;
+    if(stored[j] > 0) {layout.offset[j] = offset; offset += sizeof(float);}
   }
-  
-  particle = (short) ctmp;
+  layout.iw = iw;
+  layout.iextrafloat = iextrafloat;
+  layout.offset_extrafloat = offset;
+  offset += iextrafloat*sizeof(float);
+  layout.iextralong = iextralong;
+  layout.offset_extralong = offset;
+  offset += iextralong*sizeof(IAEA_I32);
+  layout.reclength = offset;
+
+  // Layout specific codec used by decode_particle()/encode_particle()
+  iaea_select_codec(this);
+}
+
+void iaea_record_type::decode_particle(const unsigned char *record)
+{
+  if(codec_decode != NULL) {codec_decode(this, record); return;}
+
+  float floatArray[NUM_EXTRA_FLOAT+7];
+  int i,j,is;
+
+  particle = (short) ((const char *) record)[0];
 
   is = 1; // getting sign of Z director cosine w
   if(particle < 0) {is = -1; particle = -particle;}
 
-  reclength = sizeof(char);      // particle type is always read
   unsigned int rec_to_read = 1;    // energy is always read
 
   if(ix > 0) rec_to_read++;
@@ -184,15 +351,9 @@ short iaea_record_type::read_particle()
   if(iweight > 0) rec_to_read++;
   if(iextrafloat>0) rec_to_read += iextrafloat;
 
-  if( fread(floatArray, sizeof(float), rec_to_read, p_file) != rec_to_read)
-  {
-    fprintf(stderr, "\n ERROR: read_particle: Failed to read FLOATs \n");
-    return (FAIL);;
-  }
-  
-  reclength += rec_to_read*sizeof(float);
+  // records are packed, so the floats are not aligned in memory
+  memcpy(floatArray, record + sizeof(char), rec_to_read*sizeof(float));
 
-  
   IsNewHistory = 0;
   if(floatArray[0]<0) IsNewHistory = 1; // like egsnrc   
   energy = fabs(floatArray[0]);
@@ -220,30 +381,467 @@ short iaea_record_type::read_particle()
   }
 
   if(iextralong > 0) 
+     memcpy(extralong, record + sizeof(char) + rec_to_read*sizeof(float),
+            iextralong*sizeof(IAEA_I32));
+}
+
+const unsigned char *iaea_record_type::read_block(IAEA_I32 n_max, IAEA_I32 *n_read)
+{
+  // Reads up to n_max consecutive records in the byte order of this
+  // machine. Records of a file of the other byte order are swapped in the
+  // block buffer, as mapped and prefetched records cannot be changed.
+  if(!swap_bytes) return(read_raw(n_max, n_read));
+
+  if(n_max > NUM_BLOCK_RECORDS) n_max = NUM_BLOCK_RECORDS;
+  const unsigned char *records = read_raw(n_max, n_read);
+  if(records == NULL || *n_read <= 0) return(records);
+
+  int reclength = get_reclength();
+  if(records != block)
+  {
+     if(alloc_block(*n_read*reclength) != OK) return(NULL);
+     memcpy(block, records, (size_t)(*n_read)*reclength);
+  }
+  iaea_swap_block(&layout, block, *n_read);
+  return(block);
+}
+
+const unsigned char *iaea_record_type::read_raw(IAEA_I32 n_max, IAEA_I32 *n_read)
+{
+  // Reads up to n_max consecutive records (at most NUM_BLOCK_RECORDS)
+  // with a single fread into the record's block buffer, as they are in
+  // the file.
+  *n_read = 0;
+  if(n_max <= 0) return(NULL);
+
+  int reclength = get_reclength();
+
+  if(has_range)
   {
-     if( fread(longArray, sizeof(IAEA_I32), (size_t)iextralong, p_file) != (size_t)iextralong)
+     // Do not read past the end of the record range (see set_range)
+     IAEA_I64 navail = (range_end - tell())/reclength;
+     if(navail < 0) navail = 0;
+     if(navail < n_max) n_max = (IAEA_I32) navail;
+     if(n_max <= 0)
      {
-       fprintf(stderr, "\n ERROR: read_particle: Failed to read LONGS\n");
-       return (FAIL);
+        // Nothing left in the range, but this is not a read error
+        if(p_map != NULL) return(p_map + map_pos);
+        if(alloc_block(reclength) != OK) return(NULL);
+        return(block);
      }
-     for(int l=0,j=0;j<iextralong;j++) extralong[j] = longArray[l++];
-     reclength += (iextralong)*sizeof(IAEA_I32);
   }
 
-  #ifdef DEBUG
-  // charge defined 
-  int iaea_charge[MAX_NUM_PARTICLES]={0,-1,+1,0,+1};
-  int charge = iaea_charge[particle - 1];
+  if(p_map != NULL)
+  {
+     // Mapped file: records are decoded in place, nothing is copied
+     IAEA_I64 navail = (map_size - map_pos)/reclength;
+     if(navail < 0) navail = 0;
+     if(navail < n_max) n_max = (IAEA_I32) navail;
+     const unsigned char *records = p_map + map_pos;
+     map_pos += (IAEA_I64)n_max*reclength;
+     *n_read = n_max;
+     return(records);
+  }
 
-  printf("\n Read a particle with a record lenght %d (New History: %d)",
-               reclength,IsNewHistory);
-  printf("\n Q %d E %f X %f Y %f Z %f \n\t u %f v %f w %f W %f Part %d \n",
-  charge, energy, x, y, z, u, v, w, weight, particle);
-  if( iextrafloat > 0) printf(" EXTRA FLOATs:"); 
-  for(j=0;j<iextrafloat;j++) printf(" F%i %f",j+1,extrafloat[j]);
-  if( iextralong > 0)  printf(" EXTRA LONGs:"); 
-  for(j=0;j<iextralong;j++)  printf(" L%i %d",j+1,extralong[j]);
-  printf("\n"); 
-  #endif
-  return(reclength);
+  if(prefetch != NULL)
+  {
+     // Records already read ahead by the prefetch thread
+     IAEA_I64 end = has_range ? range_end : map_size;
+     const unsigned char *records = iaea_prefetch_read(prefetch, map_pos, end, 
+                                                       n_max, n_read);
+     map_pos += (IAEA_I64)(*n_read)*reclength;
+     return(records);
+  }
+
+  if(compressed != NULL)
+  {
+     // Compressed file: records are taken from the block holding map_pos,
+     // decompressed once into the cache of this record
+     IAEA_I64 navail = (map_size - map_pos)/reclength;
+     if(navail < n_max) n_max = (IAEA_I32) (navail > 0 ? navail : 0);
+     if(n_max <= 0)
+     {
+        if(alloc_block(reclength) != OK) return(NULL);
+        return(block);
+     }
+     const unsigned char *records = iaea_compressed_read(compressed, fd, &zcache,
+                                              map_pos/reclength, n_max, n_read);
+     if(records == NULL) {pread_failed = 1; return(NULL);}
+     map_pos += (IAEA_I64)(*n_read)*reclength;
+     return(records);
+  }
+
+  if(n_max > NUM_BLOCK_RECORDS) n_max = NUM_BLOCK_RECORDS;
+  if(alloc_block(n_max*reclength) != OK) return(NULL);
+
+  if(use_pread)
+  {
+     // Cursor: own position, the shared file descriptor is not moved
+     IAEA_I64 navail = (map_size - map_pos)/reclength;
+     if(navail < 0) navail = 0;
+     if(navail < n_max) n_max = (IAEA_I32) navail;
+
+     IAEA_I64 nbytes = (IAEA_I64)n_max*reclength;
+     IAEA_I64 ndone = iaea_pread(fd, block, nbytes, map_pos);
+     *n_read = (IAEA_I32) (ndone/reclength);
+     map_pos += (IAEA_I64)(*n_read)*reclength;
+     if(ndone < nbytes) pread_failed = 1;
+     return(block);
+  }
+
+  *n_read = (IAEA_I32) fread(block, reclength, (size_t)n_max, p_file);
+  return(block);
+}
+
+void iaea_record_type::free_block()
+{
+  if(block != NULL) free(block);
+  block = NULL;
+  block_size = block_fill = 0;
+  iaea_compressed_cache_free(zcache);
+  zcache = NULL;
+}
+
+short iaea_record_type::map_file()
+{
+  // Maps the whole phase space file read-only. On failure the record 
+  // keeps reading through p_file.
+  if(p_file == NULL || compressed != NULL) return(FAIL);
+
+  IAEA_I64 size = file_size();
+  if(size <= 0) return(FAIL);
+
+#ifdef WIN32
+  HANDLE hfile = (HANDLE) _get_osfhandle(_fileno(p_file));
+  HANDLE hmap = CreateFileMapping(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(hmap == NULL) return(FAIL);
+  void *addr = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(hmap); // the view keeps the mapping alive
+  if(addr == NULL) return(FAIL);
+#else
+  void *addr = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fileno(p_file), 0);
+  if(addr == MAP_FAILED) return(FAIL);
+#endif
+
+  p_map = (const unsigned char *) addr;
+  map_size = size;
+  map_pos = 0;
+  return(OK);
+}
+
+short iaea_record_type::share(const iaea_record_type *source)
+{
+  // Sets this record up as a cursor on the phsp file of source: same
+  // layout and mapping, but its own position, range and block buffer.
+  // Without a mapping the cursor reads with pread() on the file 
+  // descriptor of source, leaving its FILE position alone.
+  *this = *source;
+  p_file = NULL;
+  block = NULL;
+  block_size = block_fill = 0;
+  has_range = 0;
+  range_begin = range_end = 0;
+  map_pos = 0;
+  pread_failed = 0;
+  prefetch = NULL;
+  zcache = NULL;
+
+  if(p_map != NULL || use_pread) return(OK);
+
+#ifdef WIN32
+  fd = _fileno(source->p_file);
+  struct _stati64 st;
+  if(_fstati64(fd, &st) != 0) return(FAIL);
+#else
+  fd = fileno(source->p_file);
+  struct stat st;
+  if(fstat(fd, &st) != 0) return(FAIL);
+#endif
+  map_size = st.st_size;
+  use_pread = 1;
+  return(OK);
+}
+
+short iaea_record_type::share_writer(const iaea_record_type *source, IAEA_I64 *end)
+{
+  // Sets this record up as a writer into the phsp file of source: same
+  // layout, but its own block buffer, written with pwrite() on the file
+  // descriptor of source at offsets reserved by advancing end. Nothing
+  // can be read through a writer (an empty positional record).
+  *this = *source;
+  p_file = NULL;
+  block = NULL;
+  block_size = block_fill = history_fill = 0;
+  has_range = 0;
+  range_begin = range_end = 0;
+  p_map = NULL;
+  map_size = map_pos = 0;
+  pread_failed = 0;
+  prefetch = NULL;
+  use_pread = 1;
+  reserve = end;
+
+#ifdef WIN32
+  fd = _fileno(source->p_file);
+#else
+  fd = fileno(source->p_file);
+#endif
+  return(OK);
+}
+
+void iaea_record_type::unmap_file()
+{
+  if(p_map == NULL) return;
+#ifdef WIN32
+  UnmapViewOfFile((LPCVOID) p_map);
+#else
+  munmap((void *) p_map, (size_t) map_size);
+#endif
+  p_map = NULL;
+  map_size = map_pos = 0;
+}
+
+short iaea_record_type::set_prefetch(int n_buffers, int buffer_records)
+{
+  // Starts (n_buffers > 0) or stops reading ahead in a background thread.
+  // While prefetching, the position is kept in map_pos and the file is
+  // read with positional reads, like for cursors.
+  if(prefetch != NULL)
+  {
+     iaea_prefetch_free(prefetch);
+     prefetch = NULL;
+     if(!use_pread)
+     {
+        clearerr(p_file);
+        if( FSEEK64(p_file, map_pos) != 0) return(FAIL);
+     }
+  }
+  if(n_buffers <= 0 || p_map != NULL || compressed != NULL) return(OK);
+
+  IAEA_I64 pos = tell(), size = file_size();
+  if(pos < 0 || size < 0) return(FAIL);
+
+  int fd_read = fd;
+  if(!use_pread)
+  {
+#ifdef WIN32
+     fd_read = _fileno(p_file);
+#else
+     fd_read = fileno(p_file);
+#endif
+  }
+
+  prefetch = iaea_prefetch_new(fd_read, get_reclength(), n_buffers, buffer_records);
+  if(prefetch == NULL) return(FAIL);
+  fd = fd_read;
+  map_pos = pos;
+  map_size = size;
+  return(OK);
+}
+
+short iaea_record_type::append_file(const iaea_record_type *source,
+                                    IAEA_I64 offset, IAEA_I64 n_bytes)
+{
+  // Appends n_bytes of the phsp file of source, starting at offset, to
+  // ours as they are, without going through the block buffers
+  if(compressed != NULL || source->compressed != NULL)
+  {
+     // Compressed on either side: the records are read through a cursor
+     // on source and compressed again if ours is
+     iaea_record_type cursor;
+     if(cursor.share(source) != OK || cursor.seek(offset) != OK) return(FAIL);
+     int reclength = cursor.get_reclength();
+     short status = OK;
+     while(n_bytes > 0 && status == OK)
+     {
+        IAEA_I32 n_read;
+        IAEA_I64 n_max = n_bytes/reclength;
+        if(n_max > NUM_BLOCK_RECORDS) n_max = NUM_BLOCK_RECORDS;
+        const unsigned char *records = cursor.read_raw((IAEA_I32) n_max, &n_read);
+        if(records == NULL || n_read <= 0) status = FAIL;
+        else status = write_records(records, n_read);
+        n_bytes -= (IAEA_I64)n_read*reclength;
+     }
+     cursor.free_block();
+     return(status);
+  }
+
+  if(flush_block() != OK || fflush(p_file) != 0) return(FAIL);
+  IAEA_I64 end = FTELL64(p_file);
+  if(end < 0) return(FAIL);
+
+#ifdef WIN32
+  int fd_in = (source->p_file != NULL) ? _fileno(source->p_file) : source->fd;
+  int fd_out = _fileno(p_file);
+#else
+  int fd_in = (source->p_file != NULL) ? fileno(source->p_file) : source->fd;
+  int fd_out = fileno(p_file);
+#endif
+  if(iaea_copy_range(fd_in, offset, fd_out, end, n_bytes) != n_bytes) return(FAIL);
+  if(FSEEK64(p_file, end + n_bytes) != 0) return(FAIL);
+  return(OK);
+}
+
+short iaea_record_type::write_records(const unsigned char *records, IAEA_I32 n)
+{
+  // Writes n records, already encoded, after those written so far
+  if(flush_block() != OK) return(FAIL);
+  int reclength = get_reclength();
+  if(compressed != NULL)
+     return(iaea_compressed_write(compressed, p_file, records, n, reclength) == OK ? OK : FAIL);
+  if(fwrite(records, reclength, (size_t)n, p_file) != (size_t)n) return(FAIL);
+  return(OK);
+}
+
+short iaea_record_type::seek(IAEA_I64 offset)
+{
+  if(positional())
+  {
+     if(offset < 0 || offset > map_size) return(FAIL);
+     map_pos = offset;
+     return(OK);
+  }
+  if( flush_block() != OK) return(FAIL);
+  if( FSEEK64(p_file, offset) != 0) return(FAIL);
+  return(OK);
+}
+
+IAEA_I64 iaea_record_type::tell()
+{
+  if(positional()) return(map_pos);
+  return(FTELL64(p_file) + block_fill);
+}
+
+IAEA_I64 iaea_record_type::file_size()
+{
+  if(positional()) return(map_size);
+  if(flush_block() != OK) return(FAIL);
+
+  IAEA_I64 current_pos = FTELL64(p_file);
+  if( FSEEK64_END(p_file) != 0) return(FAIL);
+  IAEA_I64 size = FTELL64(p_file);
+  if( FSEEK64(p_file, current_pos) != 0) return(FAIL);
+  return(size);
+}
+
+IAEA_I64 iaea_record_type::file_time()
+{
+  // Last modification of the phsp file in seconds since the epoch
+  int desc = fd;
+  if(p_file != NULL)
+  {
+     if(flush_block() != OK || fflush(p_file) != 0) return(FAIL);
+#ifdef WIN32
+     desc = _fileno(p_file);
+#else
+     desc = fileno(p_file);
+#endif
+  }
+#ifdef WIN32
+  struct _stat64 st;
+  if(_fstat64(desc, &st) != 0) return(FAIL);
+#else
+  struct stat st;
+  if(fstat(desc, &st) != 0) return(FAIL);
+#endif
+  return((IAEA_I64) st.st_mtime);
+}
+
+short iaea_record_type::set_range(IAEA_I64 begin, IAEA_I64 end)
+{
+  // Restricts reading to the bytes [begin,end) of the phsp file and 
+  // positions the file at begin. end < 0 removes the restriction.
+  has_range = end >= 0;
+  range_begin = has_range ? begin : 0;
+  range_end = end;
+  if(!positional()) clearerr(p_file);
+  return(seek(begin));
+}
+
+int iaea_record_type::in_range(IAEA_I64 offset)
+{
+  // The position offset does not leave the record range (see set_range)
+  return(!has_range || (offset >= range_begin && offset <= range_end));
+}
+
+int iaea_record_type::at_end()
+{
+  if(has_range && tell() + get_reclength() > range_end) return(1);
+  if(positional()) return(map_pos + get_reclength() > map_size);
+  return(feof(p_file));
+}
+
+int iaea_record_type::read_error()
+{
+  if(p_map != NULL) return(0);
+  if(prefetch != NULL) return(iaea_prefetch_error(prefetch));
+  if(use_pread) return(pread_failed);
+  return(ferror(p_file));
+}
+
+int iaea_record_type::positional()
+{
+  // Mapped files, cursors and prefetching records keep their own 
+  // position in map_pos
+  return(p_map != NULL || use_pread || prefetch != NULL);
+}
+
+void iaea_record_type::rewind_file()
+{
+  // Back to the first record (of the range, if any)
+  if(positional()) {map_pos = range_begin; pread_failed = 0;}
+  else if(range_begin > 0) {clearerr(p_file); seek(range_begin);}
+  else rewind(p_file);
+}
+
+short iaea_record_type::open_compressed()
+{
+  // Reads the block offsets of the compressed phsp file open as p_file,
+  // which is then read like by a cursor, at decompressed positions
+#ifdef WIN32
+  int fd_read = _fileno(p_file);
+#else
+  int fd_read = fileno(p_file);
+#endif
+  compressed = iaea_compressed_open(fd_read);
+  if(compressed == NULL) return(FAIL);
+  if(compressed->n_records > 0 && compressed->reclength != get_reclength())
+  {
+     iaea_compressed_free(compressed);
+     compressed = NULL;
+     return(FAIL);
+  }
+  fd = fd_read;
+  use_pread = 1;
+  map_pos = 0;
+  map_size = compressed->n_records*get_reclength();
+  return(OK);
+}
+
+short iaea_record_type::set_compressed(int block_records)
+{
+  // The records written from now on are compressed in blocks of
+  // block_records records (see close_compressed)
+  if(compressed != NULL || block_fill > 0) return(FAIL);
+  compressed = iaea_compressed_new(block_records);
+  return(compressed != NULL ? OK : FAIL);
+}
+
+short iaea_record_type::close_compressed()
+{
+  // Writer: compresses the records left and writes the block offsets.
+  // Then releases the compressed file, which must not be used by any
+  // cursor any more.
+  if(compressed == NULL) return(OK);
+  short status = OK;
+  if(!use_pread)
+  {
+     if(flush_block() != OK || iaea_compressed_close(compressed, p_file) != OK)
+        status = FAIL;
+  }
+  iaea_compressed_free(compressed);
+  compressed = NULL;
+  iaea_compressed_cache_free(zcache);
+  zcache = NULL;
+  return(status);
 }
@@ -5,6 +5,7 @@
 
 #include "utilities.h"
 #include "iaea_config.h"
+#include "iaea_decoder.h"
 
 /* *********************************************************************** */
 // defines
@@ -24,7 +25,18 @@
                             // 3 positrons
                             // 4 neutrons
                             // 5 protons
-#define MAX_NUM_SOURCES 30
+// Sources are kept in a table growing by pages of SOURCE_PAGE_SIZE slots
+#ifndef SOURCE_PAGE_SIZE
+  #define SOURCE_PAGE_SIZE 64
+#endif
+#ifndef MAX_SOURCE_PAGES
+  #define MAX_SOURCE_PAGES 16384
+#endif
+#define MAX_NUM_SOURCES (SOURCE_PAGE_SIZE*MAX_SOURCE_PAGES)
+
+#ifndef NUM_BLOCK_RECORDS
+  #define NUM_BLOCK_RECORDS 4096 // Maximum records transferred per block read
+#endif
 
 #define OK     0
 #define FAIL  -1
@@ -57,10 +69,77 @@ struct iaea_record_type
   float extrafloat[NUM_EXTRA_FLOAT];  // (default: no extra float stored)
   IAEA_I32 extralong[NUM_EXTRA_LONG];      // (default: one extra long stored)
 
+  unsigned char *block;  // buffer holding raw records for block reads/writes
+  int block_size;        // allocated size of block in bytes
+  int block_fill;        // bytes of encoded records not yet written to p_file
+
+  const unsigned char *p_map; // read-only mapping of the phsp file (access = 4)
+  IAEA_I64 map_size;          // size of the mapping in bytes
+  IAEA_I64 map_pos;           // current offset of the next record in the mapping
+
+  int use_pread;              // cursor reading the file with pread() at map_pos,
+  int fd;                     // map_size holds the file size (p_file = NULL)
+  int pread_failed;           // a pread() returned less than requested
+
+  struct iaea_prefetch *prefetch; // background reader, see set_prefetch()
+
+  int      has_range;         // only records in [range_begin,range_end) bytes
+  IAEA_I64 range_begin;       // are delivered (parallel chunk), otherwise
+  IAEA_I64 range_end;         // the whole file
+
+  IAEA_I64 *reserve;          // writer of a shared file (see share_writer):
+                              // end of the data reserved so far (atomic)
+  int history_fill;           // writer: bytes of block holding whole histories
+
+  int swap_bytes;             // the file has the other byte order: records
+                              // are swapped by read_block (see iaea_swap_block)
+
+  struct iaea_compressed_file *compressed; // .IAEAphspz file (iaea_compress.h),
+                              // shared by the cursors; read like a cursor with
+                              // map_pos and map_size counting decompressed bytes
+  struct iaea_compressed_cache *zcache;    // block last decompressed by this record
+
+  iaea_record_layout layout;  // byte layout of the records, see set_layout()
+
+  // Codec specialized for this layout (iaea_codec.cpp), NULL => generic code
+  void (*codec_decode)(iaea_record_type *p, const unsigned char *record);
+  void (*codec_encode)(iaea_record_type *p, unsigned char *record);
+
 public:
       short read_particle();
       short write_particle();
       short initialize();
+      int   get_reclength();
+      void  set_layout();
+      void  decode_particle(const unsigned char *record);
+      void  encode_particle(unsigned char *record);
+      const unsigned char *read_block(IAEA_I32 n_max, IAEA_I32 *n_read);
+      const unsigned char *read_raw(IAEA_I32 n_max, IAEA_I32 *n_read);
+      short flush_block();
+      short alloc_block(int needed);
+      void  free_block();
+      short map_file();
+      short share(const iaea_record_type *source);
+      short share_writer(const iaea_record_type *source, IAEA_I64 *end);
+      short flush_histories(int needed);
+      short append_file(const iaea_record_type *source, IAEA_I64 offset,
+                        IAEA_I64 n_bytes);
+      short write_records(const unsigned char *records, IAEA_I32 n);
+      void  unmap_file();
+      short set_prefetch(int n_buffers, int buffer_records);
+      short seek(IAEA_I64 offset);
+      IAEA_I64 tell();
+      IAEA_I64 file_size();
+      IAEA_I64 file_time();
+      short set_range(IAEA_I64 begin, IAEA_I64 end);
+      int   in_range(IAEA_I64 offset);
+      int   at_end();
+      int   read_error();
+      int   positional();
+      void  rewind_file();
+      short open_compressed();
+      short set_compressed(int block_records);
+      short close_compressed();
 };
 
 #endif
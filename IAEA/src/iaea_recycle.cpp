@@ -0,0 +1,265 @@
+/******************************************************************************
+ *
+ *  Recycling of the particles read from a phase space
+ *
+ *  Transport codes often use every particle of a phase space several
+ *  times, rotated about the beam axis or reflected, to get more particles
+ *  out of the same file. The copies are made here on the decoded arrays
+ *  of iaea_get_particles, so no record is read or decoded twice. The
+ *  symmetry is a 2x2 matrix per copy applied to (x,y) and (u,v); the
+ *  random rotations need a sine and a cosine per copy, computed for
+ *  RECYCLE_CHUNK copies at once with polynomials, four at a time with
+ *  SSE2. Compile with -DIAEA_NO_SIMD to get the scalar code only.
+ *
+ *****************************************************************************/
+
+#include <cstdlib>
+#include <cmath>
+#include "iaea_recycle.h"
+
+#if !defined(IAEA_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || \
+                              (defined(_M_IX86_FP) && _M_IX86_FP >= 2) )
+  #define IAEA_SSE2
+  #include <emmintrin.h>
+#endif
+
+/* *********************************************************************** */
+// sin and cos of 2*pi*t: t is reduced to the nearest quarter q/4, the
+// rest a = 2*pi*(t-q/4) in [-pi/4,pi/4] gives sin(a) and cos(a) with
+// Taylor polynomials (errors below 3e-7) and the quarter swaps them and
+// sets the signs.
+
+#define SIN_C3 (-1.f/6)
+#define SIN_C5 (1.f/120)
+#define SIN_C7 (-1.f/5040)
+#define COS_C2 (-1.f/2)
+#define COS_C4 (1.f/24)
+#define COS_C6 (-1.f/720)
+#define COS_C8 (1.f/40320)
+#define TWO_PI 6.28318530717958648f
+
+static void sincos_scalar(IAEA_I32 n, const float *t, float *c, float *s)
+{
+  for(IAEA_I32 i=0; i<n; i++)
+  {
+     int q = (int)(4*t[i] + 0.5f);
+     float a = TWO_PI*(t[i] - 0.25f*q), a2 = a*a;
+     float sa = a*(1 + a2*(SIN_C3 + a2*(SIN_C5 + a2*SIN_C7)));
+     float ca = 1 + a2*(COS_C2 + a2*(COS_C4 + a2*(COS_C6 + a2*COS_C8)));
+     float cq = (q & 1) ? sa : ca, sq = (q & 1) ? ca : sa;
+     c[i] = ((q+1) & 2) ? -cq : cq;
+     s[i] = (q & 2) ? -sq : sq;
+  }
+}
+
+#ifdef IAEA_SSE2
+static void sincos_sse2(IAEA_I32 n, const float *t, float *c, float *s)
+{
+  const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+  IAEA_I32 k = 0;
+  for(; k+4<=n; k+=4)
+  {
+     __m128 tv = _mm_loadu_ps(t+k);
+     __m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(tv, _mm_set1_ps(4.f)),
+                                             _mm_set1_ps(0.5f)));
+     __m128 a = _mm_mul_ps(_mm_set1_ps(TWO_PI),
+                _mm_sub_ps(tv, _mm_mul_ps(_mm_set1_ps(0.25f), _mm_cvtepi32_ps(q))));
+     __m128 a2 = _mm_mul_ps(a, a);
+
+     __m128 sa = _mm_add_ps(_mm_set1_ps(SIN_C5), _mm_mul_ps(a2, _mm_set1_ps(SIN_C7)));
+     sa = _mm_add_ps(_mm_set1_ps(SIN_C3), _mm_mul_ps(a2, sa));
+     sa = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(a2, sa));
+     sa = _mm_mul_ps(a, sa);
+
+     __m128 ca = _mm_add_ps(_mm_set1_ps(COS_C6), _mm_mul_ps(a2, _mm_set1_ps(COS_C8)));
+     ca = _mm_add_ps(_mm_set1_ps(COS_C4), _mm_mul_ps(a2, ca));
+     ca = _mm_add_ps(_mm_set1_ps(COS_C2), _mm_mul_ps(a2, ca));
+     ca = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(a2, ca));
+
+     // odd quarters swap sin and cos, the signs are moved to bit 31
+     __m128 odd = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+     __m128 cq = _mm_or_ps(_mm_and_ps(odd, sa), _mm_andnot_ps(odd, ca));
+     __m128 sq = _mm_or_ps(_mm_and_ps(odd, ca), _mm_andnot_ps(odd, sa));
+     __m128 c_sign = _mm_castsi128_ps(_mm_slli_epi32(
+                         _mm_and_si128(_mm_add_epi32(q, one), two), 30));
+     __m128 s_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+     _mm_storeu_ps(c+k, _mm_xor_ps(cq, c_sign));
+     _mm_storeu_ps(s+k, _mm_xor_ps(sq, s_sign));
+  }
+  sincos_scalar(n-k, t+k, c+k, s+k);
+}
+#endif
+
+void iaea_sincos_2pi(IAEA_I32 n, const float *t, float *c, float *s)
+{
+#ifdef IAEA_SSE2
+  sincos_sse2(n, t, c, s);
+#else
+  sincos_scalar(n, t, c, s);
+#endif
+}
+
+/* *********************************************************************** */
+// The symmetry of the n consecutive copies starting with copy k0 (counted
+// modulo n_recycle)
+static void apply_symmetry(iaea_recycler *r, IAEA_I32 k0, IAEA_I32 n,
+                           IAEA_Float *x, IAEA_Float *y,
+                           IAEA_Float *u, IAEA_Float *v)
+{
+  if(r->symmetry == IAEA_RECYCLE_NONE) return;
+
+  float t[RECYCLE_CHUNK], c[RECYCLE_CHUNK], s[RECYCLE_CHUNK];
+  IAEA_I32 k = k0 % r->n_recycle;
+  for(IAEA_I32 i0=0; i0<n; i0+=RECYCLE_CHUNK)
+  {
+     IAEA_I32 m = (n-i0 < RECYCLE_CHUNK) ? n-i0 : RECYCLE_CHUNK;
+     if(r->symmetry == IAEA_RECYCLE_RANDOM)
+     {
+        for(IAEA_I32 i=0; i<m; i++)
+           t[i] = (float)(iaea_random_u32(&r->rng) >> 8)*(1.f/16777216);
+        iaea_sincos_2pi(m, t, c, s);
+        for(IAEA_I32 i=0; i<m; i++)
+        {
+           IAEA_Float xi = x[i0+i], yi = y[i0+i], ui = u[i0+i], vi = v[i0+i];
+           x[i0+i] = c[i]*xi - s[i]*yi;  y[i0+i] = s[i]*xi + c[i]*yi;
+           u[i0+i] = c[i]*ui - s[i]*vi;  v[i0+i] = s[i]*ui + c[i]*vi;
+        }
+     }
+     else
+     {
+        for(IAEA_I32 i=0; i<m; i++)
+        {
+           const float *a = r->matrix + 4*k;
+           IAEA_Float xi = x[i0+i], yi = y[i0+i], ui = u[i0+i], vi = v[i0+i];
+           x[i0+i] = a[0]*xi + a[1]*yi;  y[i0+i] = a[2]*xi + a[3]*yi;
+           u[i0+i] = a[0]*ui + a[1]*vi;  v[i0+i] = a[2]*ui + a[3]*vi;
+           if(++k == r->n_recycle) k = 0;
+        }
+     }
+  }
+}
+
+/* *********************************************************************** */
+
+iaea_recycler *iaea_recycler_new(IAEA_I32 n_recycle, int symmetry,
+                                 unsigned long long seed,
+                                 unsigned long long stream,
+                                 int n_long, const int *long_types)
+{
+  if(n_recycle < 1 || symmetry < IAEA_RECYCLE_NONE ||
+     symmetry > IAEA_RECYCLE_REFLECT || n_long < 0 ||
+     n_long > NUM_EXTRA_LONG) return NULL;
+
+  iaea_recycler *r = (iaea_recycler *) calloc(1, sizeof(iaea_recycler));
+  if(r == NULL) return NULL;
+  r->n_recycle = n_recycle;
+  r->symmetry = symmetry;
+  r->n_given = n_recycle;
+  for(int j=0; j<n_long; j++) r->counter_long[j] = (long_types[j] == 1);
+  iaea_random_init(&r->rng, seed, stream);
+
+  if(symmetry == IAEA_RECYCLE_EVEN || symmetry == IAEA_RECYCLE_REFLECT)
+  {
+     r->matrix = (float *) malloc(4*n_recycle*sizeof(float));
+     if(r->matrix == NULL) {free(r); return NULL;}
+     for(IAEA_I32 k=0; k<n_recycle; k++)
+     {
+        float *a = r->matrix + 4*k;
+        if(symmetry == IAEA_RECYCLE_EVEN)
+        {
+           double phi = 6.283185307179586*k/n_recycle;
+           a[0] = a[3] = (float) cos(phi);
+           a[2] = (float) sin(phi);
+           a[1] = -a[2];
+        }
+        else
+        {
+           a[0] = (k % 4 == 1 || k % 4 == 3) ? -1.f : 1.f;
+           a[3] = (k % 4 == 2 || k % 4 == 3) ? -1.f : 1.f;
+           a[1] = a[2] = 0.f;
+        }
+     }
+  }
+  return r;
+}
+
+void iaea_recycler_free(iaea_recycler *r)
+{
+  if(r == NULL) return;
+  free(r->matrix);
+  free(r);
+}
+
+void iaea_recycle_expand(iaea_recycler *r, IAEA_I32 n, IAEA_I32 stride,
+                         IAEA_I32 n_extra_float, IAEA_I32 n_extra_long,
+                         IAEA_I32 *n_stat, IAEA_I32 *type, IAEA_Float *E,
+                         IAEA_Float *wt, IAEA_Float *x, IAEA_Float *y,
+                         IAEA_Float *z, IAEA_Float *u, IAEA_Float *v,
+                         IAEA_Float *w, IAEA_Float *extra_floats,
+                         IAEA_I32 *extra_longs)
+{
+  IAEA_I32 nr = r->n_recycle;
+
+  // From the last copy of the last particle backwards, so that no
+  // particle is overwritten before it is copied
+  for(IAEA_I32 i=n-1; i>=0; i--)
+  {
+     for(IAEA_I32 k=nr-1; k>=0; k--)
+     {
+        IAEA_I32 d = i*nr + k;
+        n_stat[d] = (k == 0) ? n_stat[i] : 0;
+        type[d] = type[i];
+        E[d] = E[i];
+        wt[d] = wt[i]/nr;
+        x[d] = x[i]; y[d] = y[i]; z[d] = z[i];
+        u[d] = u[i]; v[d] = v[i]; w[d] = w[i];
+        for(IAEA_I32 j=0; j<n_extra_float; j++)
+           extra_floats[j*stride+d] = extra_floats[j*stride+i];
+        for(IAEA_I32 j=0; j<n_extra_long; j++)
+           extra_longs[j*stride+d] = (k > 0 && r->counter_long[j]) ?
+                                     0 : extra_longs[j*stride+i];
+     }
+  }
+  apply_symmetry(r, 0, n*nr, x, y, u, v);
+}
+
+void iaea_recycle_hold(iaea_recycler *r)
+{
+  r->n_given = 0;
+}
+
+void iaea_recycle_drop(iaea_recycler *r)
+{
+  if(r != NULL) r->n_given = r->n_recycle;
+}
+
+IAEA_I32 iaea_recycle_held(iaea_recycler *r, IAEA_I32 n_max, IAEA_I32 stride,
+                           IAEA_I32 n_extra_float, IAEA_I32 n_extra_long,
+                           IAEA_I32 *n_stat, IAEA_I32 *type, IAEA_Float *E,
+                           IAEA_Float *wt, IAEA_Float *x, IAEA_Float *y,
+                           IAEA_Float *z, IAEA_Float *u, IAEA_Float *v,
+                           IAEA_Float *w, IAEA_Float *extra_floats,
+                           IAEA_I32 *extra_longs)
+{
+  IAEA_I32 m = r->n_recycle - r->n_given;
+  if(m > n_max) m = n_max;
+  if(m <= 0) return 0;
+
+  for(IAEA_I32 i=0; i<m; i++)
+  {
+     n_stat[i] = (r->n_given + i == 0) ? r->n_stat : 0;
+     type[i] = r->type;
+     E[i] = r->E;
+     wt[i] = r->wt/r->n_recycle;
+     x[i] = r->x; y[i] = r->y; z[i] = r->z;
+     u[i] = r->u; v[i] = r->v; w[i] = r->w;
+     for(IAEA_I32 j=0; j<n_extra_float; j++)
+        extra_floats[j*stride+i] = r->extra_floats[j];
+     for(IAEA_I32 j=0; j<n_extra_long; j++)
+        extra_longs[j*stride+i] = (r->n_given + i > 0 && r->counter_long[j]) ?
+                                  0 : r->extra_longs[j];
+  }
+  apply_symmetry(r, r->n_given, m, x, y, u, v);
+  r->n_given += m;
+  return m;
+}
@@ -0,0 +1,92 @@
+/******************************************************************************
+ *
+ *  Recycling of the particles read from a phase space
+ *
+ *****************************************************************************/
+#ifndef IAEA_RECYCLE
+#define IAEA_RECYCLE
+
+#include "iaea_config.h"
+#include "iaea_record.h"
+#include "iaea_random.h"
+
+// Symmetry applied to (x,y) and (u,v) of the copies of a particle
+#define IAEA_RECYCLE_NONE     0 // identical copies
+#define IAEA_RECYCLE_RANDOM   1 // every copy rotated about the z axis by a
+                                // random angle
+#define IAEA_RECYCLE_EVEN     2 // copy k rotated by 2*pi*k/n_recycle
+#define IAEA_RECYCLE_REFLECT  3 // copy k reflected by x -> -x if k%4 = 1,
+                                // y -> -y if k%4 = 2, both if k%4 = 3
+
+#define RECYCLE_CHUNK 256       // copies transformed at once
+
+/* *********************************************************************** */
+// Every particle read is returned n_recycle times. The copies after the
+// first have n_stat = 0 and a history counter (extralong of type 1) of 0,
+// so the histories are counted once, and all get the weight divided by
+// n_recycle, so tallies per history do not change.
+// Particles are expanded in place in the arrays of iaea_get_particles;
+// when fewer places than copies are left, the particle is held here and
+// its copies are given over the following calls.
+struct iaea_recycler
+{
+  IAEA_I32 n_recycle;
+  int symmetry;
+  int counter_long[NUM_EXTRA_LONG];    // extralongs counting histories
+  iaea_random rng;                     // angles of IAEA_RECYCLE_RANDOM
+  float *matrix;                       // (x,y) -> (m0*x+m1*y, m2*x+m3*y)
+                                       // of every copy, or NULL
+  // the particle held and the copies of it already given (n_recycle if
+  // none is held)
+  IAEA_I32 n_given;
+  IAEA_I32 n_stat, type;
+  IAEA_Float E, wt, x, y, z, u, v, w;
+  IAEA_Float extra_floats[NUM_EXTRA_FLOAT];
+  IAEA_I32 extra_longs[NUM_EXTRA_LONG];
+};
+
+/* *********************************************************************** */
+// Returns a recycler giving n_recycle copies with symmetry, the random
+// angles coming from stream stream of seed seed (see iaea_random.h), of
+// particles with the n_long extralongs of types long_types (the
+// extralong_contents of the header), or NULL if out of memory or the
+// arguments are wrong.
+iaea_recycler *iaea_recycler_new(IAEA_I32 n_recycle, int symmetry,
+                                 unsigned long long seed,
+                                 unsigned long long stream,
+                                 int n_long, const int *long_types);
+
+void iaea_recycler_free(iaea_recycler *r);
+
+// Expands in place the n particles at the start of the arrays into their
+// n*n_recycle copies, those of particle i from i*n_recycle on. Extra
+// variable k of particle i is at [k*stride+i], as in iaea_get_particles,
+// and there must be room for n*n_recycle particles.
+void iaea_recycle_expand(iaea_recycler *r, IAEA_I32 n, IAEA_I32 stride,
+                         IAEA_I32 n_extra_float, IAEA_I32 n_extra_long,
+                         IAEA_I32 *n_stat, IAEA_I32 *type, IAEA_Float *E,
+                         IAEA_Float *wt, IAEA_Float *x, IAEA_Float *y,
+                         IAEA_Float *z, IAEA_Float *u, IAEA_Float *v,
+                         IAEA_Float *w, IAEA_Float *extra_floats,
+                         IAEA_I32 *extra_longs);
+
+// Holds the particle stored in the fields of r, none of its copies given
+void iaea_recycle_hold(iaea_recycler *r);
+
+// Forgets the particle held, if any (the source was moved)
+void iaea_recycle_drop(iaea_recycler *r);
+
+// Gives up to n_max copies of the particle held. Returns the number given.
+IAEA_I32 iaea_recycle_held(iaea_recycler *r, IAEA_I32 n_max, IAEA_I32 stride,
+                           IAEA_I32 n_extra_float, IAEA_I32 n_extra_long,
+                           IAEA_I32 *n_stat, IAEA_I32 *type, IAEA_Float *E,
+                           IAEA_Float *wt, IAEA_Float *x, IAEA_Float *y,
+                           IAEA_Float *z, IAEA_Float *u, IAEA_Float *v,
+                           IAEA_Float *w, IAEA_Float *extra_floats,
+                           IAEA_I32 *extra_longs);
+
+// cos(2*pi*t[i]) and sin(2*pi*t[i]) of the n numbers t[i] in [0,1), with
+// float accuracy
+void iaea_sincos_2pi(IAEA_I32 n, const float *t, float *c, float *s);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * iaea_split: splits a phase space file into parts at history boundaries
+ *
+ * Usage: iaea_split input n_parts output_prefix
+ *
+ * The names are given without the .IAEAheader/.IAEAphsp extensions. The
+ * parts are written to output_prefix_1 ... output_prefix_<n_parts>, each
+ * with the description of the input, the counters and statistics of its
+ * own particles and its share of the original histories. The records are
+ * copied without decoding them again (see iaea_split_source).
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "iaea_phsp.h"
+
+int main(int argc, char *argv[])
+{
+   if(argc < 4 || atoi(argv[2]) < 1)
+   {
+      printf("\n Usage: %s input n_parts output_prefix\n",argv[0]);
+      printf(" (file names without the .IAEAheader/.IAEAphsp extensions)\n\n");
+      return(1);
+   }
+
+   IAEA_I32 n_parts = atoi(argv[2]), result, len;
+   IAEA_I32 access_read = 1, access_write = 2;
+
+   IAEA_I32 source;
+   len = (IAEA_I32) strlen(argv[1]);
+   iaea_new_source(&source, argv[1], &access_read, &result, len);
+   if(result < 0)
+   {
+      printf("\n ERROR: cannot open phase space %s (%ld)\n",argv[1],(long)result);
+      return(1);
+   }
+
+   IAEA_I32 *destiny = (IAEA_I32 *) malloc(n_parts*sizeof(IAEA_I32));
+   char *name = (char *) malloc(strlen(argv[3]) + 16);
+   if(destiny == NULL || name == NULL) return(1);
+
+   IAEA_I32 i;
+   for(i=0; i<n_parts; i++)
+   {
+      sprintf(name,"%s_%ld",argv[3],(long)(i+1));
+      len = (IAEA_I32) strlen(name);
+      iaea_new_source(&destiny[i], name, &access_write, &result, len);
+      if(result < 0)
+      {
+         printf("\n ERROR: cannot create phase space %s (%ld)\n",name,(long)result);
+         return(1);
+      }
+      iaea_copy_header(&source, &destiny[i], &result);
+   }
+
+   iaea_split_source(&source, &n_parts, destiny, &result);
+   if(result != 0)
+   {
+      printf("\n ERROR: splitting the phase space failed (%ld)\n",(long)result);
+      return(1);
+   }
+
+   for(i=0; i<n_parts; i++)
+   {
+      IAEA_I32 type = -1;
+      IAEA_I64 n_particles, orig_histories;
+      iaea_get_max_particles(&destiny[i], &type, &n_particles);
+      iaea_get_total_original_particles(&destiny[i], &orig_histories);
+      printf(" %s_%ld: %lld particles, %lld histories\n",
+             argv[3], (long)(i+1), n_particles, orig_histories);
+   }
+
+   iaea_destroy_source(&source, &result);
+   for(i=0; i<n_parts; i++) iaea_destroy_source(&destiny[i], &result);
+   free(destiny);
+   free(name);
+
+   return(0);
+}
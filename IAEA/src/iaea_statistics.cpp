@@ -0,0 +1,269 @@
+/******************************************************************************
+ *
+ *  Deferred accumulation of the header statistics of a phase space
+ *
+ *  Updating the minima, maxima and sums of the header one particle at a
+ *  time costs a dozen compares and branches per particle. In the deferred
+ *  mode the particles are collected in a batch of STAT_BATCH particles,
+ *  with the weights and energies sorted by particle type, and reduced at
+ *  once, four particles at a time with SSE2, into an iaea_statistics that
+ *  is then merged into the header. Compile with -DIAEA_NO_SIMD to get the
+ *  scalar code only.
+ *
+ *  Threads writing to the same phase space keep their own counters and
+ *  statistics in a shard (iaea_stat_shard), merged into the header by the
+ *  owner of the source.
+ *
+ *****************************************************************************/
+
+#include <cmath>
+#include "iaea_statistics.h"
+
+#if !defined(IAEA_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || \
+                              (defined(_M_IX86_FP) && _M_IX86_FP >= 2) )
+  #define IAEA_SSE2
+  #include <emmintrin.h>
+#endif
+
+void iaea_statistics_init(iaea_statistics *s)
+{
+  for(int i=0; i<MAX_NUM_PARTICLES; i++)
+  {
+     s->sum_weight[i] = s->sum_energy[i] = 0.;
+     s->min_weight[i] = s->min_energy[i] = HUGE_VAL;
+     s->max_weight[i] = s->max_energy[i] = -HUGE_VAL;
+  }
+  s->min_x = s->min_y = s->min_z = HUGE_VAL;
+  s->max_x = s->max_y = s->max_z = -HUGE_VAL;
+}
+
+void iaea_stat_batch_clear(iaea_stat_batch *batch)
+{
+  batch->n = 0;
+  for(int i=0; i<MAX_NUM_PARTICLES; i++) batch->n_type[i] = 0;
+}
+
+void iaea_stat_batch_add_n(iaea_stat_batch *batch, int n, const IAEA_I32 *type,
+                           const IAEA_Float *E, const IAEA_Float *wt,
+                           const IAEA_Float *x, const IAEA_Float *y,
+                           const IAEA_Float *z, IAEA_I64 *particle_number)
+{
+  int k, n0 = batch->n;
+  for(k=0; k<n; k++) batch->x[n0+k] = (float) x[k];
+  for(k=0; k<n; k++) batch->y[n0+k] = (float) y[k];
+  for(k=0; k<n; k++) batch->z[n0+k] = (float) z[k];
+  batch->n += n;
+
+  // Weights and energies go to the columns of their type
+  int n_type[MAX_NUM_PARTICLES];
+  for(int i=0; i<MAX_NUM_PARTICLES; i++) n_type[i] = batch->n_type[i];
+  for(k=0; k<n; k++)
+  {
+     unsigned int i = (unsigned int) (type[k] - 1);
+     if(i >= MAX_NUM_PARTICLES) continue;
+     float e = (float) E[k];
+     batch->wt[i][n_type[i]] = (float) wt[k];
+     batch->E[i][n_type[i]++] = (e < 0) ? -e : e;
+  }
+  for(int i=0; i<MAX_NUM_PARTICLES; i++)
+  {
+     particle_number[i] += n_type[i] - batch->n_type[i];
+     batch->n_type[i] = n_type[i];
+  }
+}
+
+/* *********************************************************************** */
+// Scalar kernels
+
+static void range_scalar(int n, const float *a, double *amin, double *amax)
+{
+  float lo = HUGE_VALF, hi = -HUGE_VALF;
+  for(int k=0; k<n; k++)
+  {
+     if(a[k] < lo) lo = a[k];
+     if(a[k] > hi) hi = a[k];
+  }
+  if(lo < *amin) *amin = lo;
+  if(hi > *amax) *amax = hi;
+}
+
+// Sums of wt and wt*E are added to sum_w and sum_e
+static void sums_scalar(int n, const float *wt, const float *E,
+                        double *sum_w, double *sum_e)
+{
+  double sw = 0., se = 0.;
+  for(int k=0; k<n; k++)
+  {
+     sw += wt[k];
+     se += wt[k]*E[k];
+  }
+  *sum_w += sw;
+  *sum_e += se;
+}
+
+/* *********************************************************************** */
+// SSE2 kernels. The element of a is the first operand of min/max, which
+// return the second one if either is NaN: a NaN never replaces the result,
+// as with the compares of the scalar code. Of equal elements min/max keep
+// the second, so -0 and +0 may come out the other way round.
+
+#ifdef IAEA_SSE2
+static float hmin(__m128 v)
+{
+  v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1,0,3,2)));
+  v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2,3,0,1)));
+  return _mm_cvtss_f32(v);
+}
+
+static float hmax(__m128 v)
+{
+  v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1,0,3,2)));
+  v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2,3,0,1)));
+  return _mm_cvtss_f32(v);
+}
+
+static void range_sse2(int n, const float *a, double *amin, double *amax)
+{
+  // two sets of accumulators, so consecutive min/max do not wait
+  __m128 lo0 = _mm_set1_ps(HUGE_VALF), hi0 = _mm_set1_ps(-HUGE_VALF);
+  __m128 lo1 = lo0, hi1 = hi0;
+  int k = 0;
+  for(; k+8 <= n; k+=8)
+  {
+     __m128 v0 = _mm_loadu_ps(a+k), v1 = _mm_loadu_ps(a+k+4);
+     lo0 = _mm_min_ps(v0, lo0); hi0 = _mm_max_ps(v0, hi0);
+     lo1 = _mm_min_ps(v1, lo1); hi1 = _mm_max_ps(v1, hi1);
+  }
+
+  float l = hmin(_mm_min_ps(lo0, lo1)), h = hmax(_mm_max_ps(hi0, hi1));
+  if(l < *amin) *amin = l;
+  if(h > *amax) *amax = h;
+  range_scalar(n-k, a+k, amin, amax);
+}
+
+static void sums_sse2(int n, const float *wt, const float *E,
+                      double *sum_w, double *sum_e)
+{
+  // the products are rounded to float, as in the scalar code, and
+  // summed in double in four lanes
+  __m128d sw_lo = _mm_setzero_pd(), sw_hi = sw_lo, se_lo = sw_lo, se_hi = sw_lo;
+  int k = 0;
+  for(; k+4 <= n; k+=4)
+  {
+     __m128 w  = _mm_loadu_ps(wt+k);
+     __m128 we = _mm_mul_ps(w, _mm_loadu_ps(E+k));
+     sw_lo = _mm_add_pd(sw_lo, _mm_cvtps_pd(w));
+     sw_hi = _mm_add_pd(sw_hi, _mm_cvtps_pd(_mm_movehl_ps(w, w)));
+     se_lo = _mm_add_pd(se_lo, _mm_cvtps_pd(we));
+     se_hi = _mm_add_pd(se_hi, _mm_cvtps_pd(_mm_movehl_ps(we, we)));
+  }
+
+  double l[2], h[2];
+  _mm_storeu_pd(l, sw_lo); _mm_storeu_pd(h, sw_hi);
+  *sum_w += (l[0] + l[1]) + (h[0] + h[1]);
+  _mm_storeu_pd(l, se_lo); _mm_storeu_pd(h, se_hi);
+  *sum_e += (l[0] + l[1]) + (h[0] + h[1]);
+  sums_scalar(n-k, wt+k, E+k, sum_w, sum_e);
+}
+#endif
+
+/* *********************************************************************** */
+
+void iaea_statistics_reduce(const iaea_stat_batch *batch, iaea_statistics *s)
+{
+  void (*range)(int, const float *, double *, double *) = range_scalar;
+  void (*sums)(int, const float *, const float *, double *, double *) = sums_scalar;
+#ifdef IAEA_SSE2
+  range = range_sse2;
+  sums = sums_sse2;
+#endif
+
+  iaea_statistics_init(s);
+
+  range(batch->n, batch->x, &s->min_x, &s->max_x);
+  range(batch->n, batch->y, &s->min_y, &s->max_y);
+  range(batch->n, batch->z, &s->min_z, &s->max_z);
+
+  for(int i=0; i<MAX_NUM_PARTICLES; i++)
+  {
+     int n = batch->n_type[i];
+     if(n == 0) continue;
+     range(n, batch->wt[i], &s->min_weight[i], &s->max_weight[i]);
+     range(n, batch->E[i], &s->min_energy[i], &s->max_energy[i]);
+     sums(n, batch->wt[i], batch->E[i], &s->sum_weight[i], &s->sum_energy[i]);
+  }
+}
+
+void iaea_statistics_merge(iaea_statistics *to, const iaea_statistics *from)
+{
+  if(from->min_x < to->min_x) to->min_x = from->min_x;
+  if(from->max_x > to->max_x) to->max_x = from->max_x;
+  if(from->min_y < to->min_y) to->min_y = from->min_y;
+  if(from->max_y > to->max_y) to->max_y = from->max_y;
+  if(from->min_z < to->min_z) to->min_z = from->min_z;
+  if(from->max_z > to->max_z) to->max_z = from->max_z;
+
+  for(int i=0; i<MAX_NUM_PARTICLES; i++)
+  {
+     to->sum_weight[i] += from->sum_weight[i];
+     to->sum_energy[i] += from->sum_energy[i];
+     if(from->min_weight[i] < to->min_weight[i]) to->min_weight[i] = from->min_weight[i];
+     if(from->max_weight[i] > to->max_weight[i]) to->max_weight[i] = from->max_weight[i];
+     if(from->min_energy[i] < to->min_energy[i]) to->min_energy[i] = from->min_energy[i];
+     if(from->max_energy[i] > to->max_energy[i]) to->max_energy[i] = from->max_energy[i];
+  }
+}
+
+/* *********************************************************************** */
+// Shards
+
+void iaea_stat_shard_clear(iaea_stat_shard *shard)
+{
+  shard->nParticles = 0;
+  shard->read_indep_histories = 0;
+  for(int i=0; i<MAX_NUM_PARTICLES; i++) shard->particle_number[i] = 0;
+  iaea_statistics_init(&shard->statistics);
+  iaea_stat_batch_clear(&shard->batch);
+}
+
+void iaea_stat_shard_add_n(iaea_stat_shard *shard, IAEA_I32 n,
+                           const IAEA_I32 *n_stat, const IAEA_I32 *type,
+                           const IAEA_Float *E, const IAEA_Float *wt,
+                           const IAEA_Float *x, const IAEA_Float *y,
+                           const IAEA_Float *z)
+{
+  shard->nParticles += n;
+  for(IAEA_I32 k=0; k<n; k++)
+     if(n_stat[k] > 0) shard->read_indep_histories += n_stat[k];
+
+  for(IAEA_I32 k=0; k<n; )
+  {
+     int m = STAT_BATCH - shard->batch.n;
+     if(m > n - k) m = (int)(n - k);
+     iaea_stat_batch_add_n(&shard->batch, m, type+k, E+k, wt+k, x+k, y+k, z+k,
+                           shard->particle_number);
+     if(shard->batch.n == STAT_BATCH) iaea_stat_shard_flush(shard);
+     k += m;
+  }
+}
+
+void iaea_stat_shard_add(iaea_stat_shard *shard, IAEA_I32 n_stat, int type,
+                         float E, float wt, float x, float y, float z)
+{
+  shard->nParticles++;
+  if(n_stat > 0) shard->read_indep_histories += n_stat;
+  if(type >= 1 && type <= MAX_NUM_PARTICLES) shard->particle_number[type-1]++;
+
+  iaea_stat_batch_add(&shard->batch, type, E, wt, x, y, z);
+  if(shard->batch.n == STAT_BATCH) iaea_stat_shard_flush(shard);
+}
+
+void iaea_stat_shard_flush(iaea_stat_shard *shard)
+{
+  if(shard->batch.n == 0) return;
+
+  iaea_statistics s;
+  iaea_statistics_reduce(&shard->batch, &s);
+  iaea_statistics_merge(&shard->statistics, &s);
+  iaea_stat_batch_clear(&shard->batch);
+}
@@ -0,0 +1,114 @@
+/******************************************************************************
+ *
+ *  Deferred accumulation of the header statistics of a phase space
+ *
+ *****************************************************************************/
+#ifndef IAEA_STATISTICS
+#define IAEA_STATISTICS
+
+#include "iaea_config.h"
+#include "iaea_record.h"
+
+// How the statistics of the header (weights, energies, X,Y,Z ranges) are
+// accumulated. Particle and history counters are always kept up to date.
+#define IAEA_STATISTICS_OFF      0 // not accumulated (read sources only)
+#define IAEA_STATISTICS_EACH     1 // updated with every particle (default)
+#define IAEA_STATISTICS_DEFERRED 2 // particles are collected in a batch
+
+#define STAT_BATCH 1024 // particles collected before they are reduced
+
+/* *********************************************************************** */
+// Statistics of a set of particles, in the units of the header fields.
+// Minima start at +HUGE_VAL and maxima at -HUGE_VAL, so merging an empty
+// set changes nothing.
+struct iaea_statistics
+{
+  double sum_weight[MAX_NUM_PARTICLES];   // sum of the weights ...
+  double sum_energy[MAX_NUM_PARTICLES];   // ... and of weight*|E|
+  double min_weight[MAX_NUM_PARTICLES], max_weight[MAX_NUM_PARTICLES];
+  double min_energy[MAX_NUM_PARTICLES], max_energy[MAX_NUM_PARTICLES];
+  double min_x, max_x, min_y, max_y, min_z, max_z;
+};
+
+// Particles waiting to be added to the statistics. Weights and energies
+// are sorted by particle type when added, so they are reduced without
+// masking; particles of other types only count for the X,Y,Z ranges.
+struct iaea_stat_batch
+{
+  int n;                                      // particles collected ...
+  int n_type[MAX_NUM_PARTICLES];              // ... of each type
+  float x[STAT_BATCH], y[STAT_BATCH], z[STAT_BATCH];
+  float wt[MAX_NUM_PARTICLES][STAT_BATCH];
+  float E[MAX_NUM_PARTICLES][STAT_BATCH];     // |E|
+};
+
+// Counters and statistics of the particles written by one thread. Each
+// thread only touches its own shard; the shards are merged into the header
+// in the order of their index, so the header only depends on which
+// particles went to which shard, not on the scheduling of the threads.
+struct iaea_stat_shard
+{
+  IAEA_I64 nParticles;
+  IAEA_I64 read_indep_histories;
+  IAEA_I64 particle_number[MAX_NUM_PARTICLES];
+  iaea_statistics statistics;                 // of the reduced batches
+  iaea_stat_batch batch;                      // particles not yet reduced
+};
+
+/* *********************************************************************** */
+// Sets s to the statistics of an empty set of particles
+void iaea_statistics_init(iaea_statistics *s);
+
+// Empties batch
+void iaea_stat_batch_clear(iaea_stat_batch *batch);
+
+// Adds a particle to batch, which must not be full (batch->n < STAT_BATCH)
+inline void iaea_stat_batch_add(iaea_stat_batch *batch, int type, float E,
+                                float wt, float x, float y, float z)
+{
+  int k = batch->n++;
+  batch->x[k] = x; batch->y[k] = y; batch->z[k] = z;
+  if(type >= 1 && type <= MAX_NUM_PARTICLES)
+  {
+     k = batch->n_type[type-1]++;
+     batch->wt[type-1][k] = wt;
+     batch->E[type-1][k] = (E < 0) ? -E : E;
+  }
+}
+
+// Adds the n particles of the arrays to batch, which must have room for
+// them (n <= STAT_BATCH - batch->n), and the number of particles of each
+// type to particle_number
+void iaea_stat_batch_add_n(iaea_stat_batch *batch, int n, const IAEA_I32 *type,
+                           const IAEA_Float *E, const IAEA_Float *wt,
+                           const IAEA_Float *x, const IAEA_Float *y,
+                           const IAEA_Float *z, IAEA_I64 *particle_number);
+
+// Sets s to the statistics of the particles of batch. Uses SSE2 when
+// available. Minima and maxima are exact; the order of the sums only
+// depends on the particles of the batch.
+void iaea_statistics_reduce(const iaea_stat_batch *batch, iaea_statistics *s);
+
+// Merges the statistics of from into to
+void iaea_statistics_merge(iaea_statistics *to, const iaea_statistics *from);
+
+// Empties shard
+void iaea_stat_shard_clear(iaea_stat_shard *shard);
+
+// Adds the n particles of the arrays to the counters and the batch of
+// shard, reducing the batch every STAT_BATCH particles. n_stat are the
+// numbers of new histories of the particles (IsNewHistory).
+void iaea_stat_shard_add_n(iaea_stat_shard *shard, IAEA_I32 n,
+                           const IAEA_I32 *n_stat, const IAEA_I32 *type,
+                           const IAEA_Float *E, const IAEA_Float *wt,
+                           const IAEA_Float *x, const IAEA_Float *y,
+                           const IAEA_Float *z);
+
+// The same for one particle
+void iaea_stat_shard_add(iaea_stat_shard *shard, IAEA_I32 n_stat, int type,
+                         float E, float wt, float x, float y, float z);
+
+// Reduces the particles left in the batch of shard into its statistics
+void iaea_stat_shard_flush(iaea_stat_shard *shard);
+
+#endif
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ *  Portable threads, locking and atomic primitives (POSIX threads or Win32)
+ *
+ *****************************************************************************/
+#ifndef IAEA_THREAD
+#define IAEA_THREAD
+
+#ifdef WIN32
+
+#include <windows.h>
+
+#define IAEA_MUTEX                SRWLOCK
+#define IAEA_MUTEX_INITIALIZER    SRWLOCK_INIT
+#define IAEA_MUTEX_INIT(m)        InitializeSRWLock(m)
+#define IAEA_MUTEX_LOCK(m)        AcquireSRWLockExclusive(m)
+#define IAEA_MUTEX_UNLOCK(m)      ReleaseSRWLockExclusive(m)
+#define IAEA_MUTEX_DESTROY(m)
+
+// 64-bit atomics on IAEA_I64; IAEA_ATOMIC_ADD64 returns the old value
+#define IAEA_ATOMIC_ADD64(p,v)    InterlockedExchangeAdd64((volatile LONGLONG *)(p),(v))
+#define IAEA_ATOMIC_LOAD64(p)     InterlockedCompareExchange64((volatile LONGLONG *)(p),0,0)
+
+#define IAEA_COND                 CONDITION_VARIABLE
+#define IAEA_COND_INIT(c)         InitializeConditionVariable(c)
+#define IAEA_COND_WAIT(c,m)       SleepConditionVariableSRW(c,m,INFINITE,0)
+#define IAEA_COND_SIGNAL(c)       WakeConditionVariable(c)
+#define IAEA_COND_DESTROY(c)
+
+// Threads run functions declared with IAEA_THREAD_FUNC(name,arg) and
+// finishing with return IAEA_THREAD_RETURN. IAEA_THREAD_CREATE is 0 if OK
+#define IAEA_THREAD_T             HANDLE
+#define IAEA_THREAD_FUNC(f,arg)   DWORD WINAPI f(LPVOID arg)
+#define IAEA_THREAD_RETURN        0
+#define IAEA_THREAD_CREATE(t,f,arg) \
+        ((*(t) = CreateThread(NULL,0,f,arg,0,NULL)) == NULL)
+#define IAEA_THREAD_JOIN(t)       (WaitForSingleObject(t,INFINITE), CloseHandle(t))
+
+#else
+
+#include <pthread.h>
+
+#define IAEA_MUTEX                pthread_mutex_t
+#define IAEA_MUTEX_INITIALIZER    PTHREAD_MUTEX_INITIALIZER
+#define IAEA_MUTEX_INIT(m)        pthread_mutex_init(m,NULL)
+#define IAEA_MUTEX_LOCK(m)        pthread_mutex_lock(m)
+#define IAEA_MUTEX_UNLOCK(m)      pthread_mutex_unlock(m)
+#define IAEA_MUTEX_DESTROY(m)     pthread_mutex_destroy(m)
+
+#define IAEA_ATOMIC_ADD64(p,v)    __atomic_fetch_add((p),(v),__ATOMIC_SEQ_CST)
+#define IAEA_ATOMIC_LOAD64(p)     __atomic_load_n((p),__ATOMIC_SEQ_CST)
+
+#define IAEA_COND                 pthread_cond_t
+#define IAEA_COND_INIT(c)         pthread_cond_init(c,NULL)
+#define IAEA_COND_WAIT(c,m)       pthread_cond_wait(c,m)
+#define IAEA_COND_SIGNAL(c)       pthread_cond_signal(c)
+#define IAEA_COND_DESTROY(c)      pthread_cond_destroy(c)
+
+#define IAEA_THREAD_T             pthread_t
+#define IAEA_THREAD_FUNC(f,arg)   void *f(void *arg)
+#define IAEA_THREAD_RETURN        NULL
+#define IAEA_THREAD_CREATE(t,f,arg) pthread_create(t,NULL,f,arg)
+#define IAEA_THREAD_JOIN(t)       pthread_join(t,NULL)
+
+#endif
+
+#endif
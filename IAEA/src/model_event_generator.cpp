@@ -0,0 +1,345 @@
+/******************************************************************************
+ *
+ *  Event generator sampling a histogram model of a phase space
+ *
+ *  The input file is a .IAEAmodel written by iaea_fit (see iaea_model.h).
+ *  Particles are sampled with alias tables (A. J. Walker, ACM TOMS 3,
+ *  1977; M. D. Vose, IEEE TSE 17, 1991), one random number and one table
+ *  look-up per choice whatever the number of bins:
+ *   - the type, in proportion to its particles in the phase space,
+ *   - the (x,y) bin, in proportion to its weight, and a position inside it,
+ *   - the direction, Gaussian in u and in v with the mean and the spread
+ *     of the bin, going backwards with the probability of the type,
+ *   - the energy, from the spectrum of the ring of the position.
+ *  All particles of a type get the mean weight of the type and the mean z.
+ *  Histories are spread evenly over the particles, so that n_stat adds up
+ *  to the histories of the phase space after as many particles as it had.
+ *  Random numbers come from a stream per parallel chunk (iaea_random.h).
+ *
+ *****************************************************************************/
+
+#include "iaea_config.h"
+#include "iaea_random.h"
+#include "iaea_model.h"
+
+#include <vector>
+#include <cmath>
+
+using namespace std;
+
+// Walker's alias table of a discrete distribution
+class AliasTable {
+
+public:
+
+    // p: the n unnormalized probabilities (negatives taken as 0).
+    // Returns false if they are all 0.
+    bool  init(const double *p, int n, int stride = 1);
+    // The bin for a uniform number r in (0,1)
+    int   sample(double r) const {
+            double x = r*prob.size(); int i = (int) x;
+            if( i >= (int) prob.size() ) i = prob.size() - 1;
+            return ( x - i < prob[i] ) ? i : alias[i];
+          };
+
+private:
+
+    vector<float> prob;
+    vector<int>   alias;
+
+};
+
+bool AliasTable::init(const double *p, int n, int stride) {
+    double sum = 0;
+    for(int i=0; i<n; i++) if( p[i*stride] > 0 ) sum += p[i*stride];
+    prob.assign(n,1); alias.resize(n);
+    for(int i=0; i<n; i++) alias[i] = i;
+    if( !(sum > 0) ) return false;
+
+    vector<double> scaled(n);
+    vector<int> small, large;
+    for(int i=0; i<n; i++) {
+        scaled[i] = p[i*stride] > 0 ? p[i*stride]*n/sum : 0;
+        if( scaled[i] < 1 ) small.push_back(i); else large.push_back(i);
+    }
+    while( !small.empty() && !large.empty() ) {
+        int s = small.back(); small.pop_back();
+        int l = large.back();
+        prob[s] = scaled[s]; alias[s] = l;
+        scaled[l] -= 1 - scaled[s];
+        if( scaled[l] < 1 ) { large.pop_back(); small.push_back(l); }
+    }
+    // the rest are 1 but for rounding
+    return true;
+}
+
+class MyModelSource {
+
+public:
+
+    MyModelSource(const char *input_file);
+    ~MyModelSource() {};
+
+    bool  isOk() const { return ok; };
+    float getMaximumEnergy() const { return e_max; };
+    float getMinimumEnergy() const { return e_min; };
+    void  getExtraNumbers(IAEA_I32 *nf, IAEA_I32 *ni) const {
+                          *nf = 0; *ni = 0; };
+    int   getTypeExtraLongVariables(IAEA_I32) const { return -1; };
+    int   getTypeExtraFloatVariables(IAEA_I32) const { return -1; };
+    IAEA_I64 getNstat() const { return (IAEA_I64) floor(count*histories); };
+    // Stream i_chunk of seed i_parallel
+    void  setParallelRun(const IAEA_I32 *i_parallel,const IAEA_I32 *i_chunk,
+           const IAEA_I32 *, IAEA_I32 *is_ok) {
+            iaea_random_init(&rng,*i_parallel,*i_chunk-1); *is_ok = 0; };
+    void  getNextParticle(IAEA_I32 *n_stat, IAEA_I32 *type, float *E,
+           float *wt, float *x, float *y, float *z, float *u, float *v,
+           float *w);
+
+private:
+
+    struct TypeTables {
+        bool  present;
+        float weight, z, backward;  // per particle, probability of w < 0
+        AliasTable position;
+        vector<float> direction;    // mean u, sd u, mean v, sd v per bin
+        vector<AliasTable> energy;  // per ring
+        vector<int> ring;           // table of every ring, the nearest
+                                    // with particles if it has none
+    };
+
+    double gauss(double *second);
+
+    int   nx, ny, n_r, n_e;
+    double x_width, y_width, r_width, e_width;
+    double histories;               // per particle
+    float e_min, e_max;
+    AliasTable types;
+    TypeTables tables[MODEL_TYPES];
+    IAEA_I64 count;
+    iaea_random rng;
+    bool  ok;
+
+};
+
+MyModelSource::MyModelSource(const char *input_file) :
+           e_min(0), e_max(0), count(0), ok(false) {
+    iaea_random_init(&rng,0,0);
+    iaea_model *m = iaea_model_read(input_file);
+    if( !m ) return;
+    nx = m->nx; ny = m->ny; n_r = m->n_r; n_e = m->n_e;
+    x_width = m->x_width; y_width = m->y_width;
+    r_width = m->r_width; e_width = m->e_width;
+
+    double n_particles[MODEL_TYPES], total = 0;
+    int ie_min = n_e, ie_max = -1;
+    for(int t=0; t<MODEL_TYPES; t++) {
+        const iaea_model_type *mt = &m->type[t];
+        TypeTables *tt = &tables[t];
+        n_particles[t] = (double) mt->n_particles;
+        tt->present = mt->n_particles > 0 && mt->weight > 0 &&
+                      tt->position.init(mt->position,nx*ny,5);
+        if( !tt->present ) continue;
+        tt->weight = mt->weight/mt->n_particles;
+        tt->z = mt->weight_z/mt->weight;
+        tt->backward = mt->weight_backward/mt->weight;
+
+        tt->direction.resize(4*nx*ny);
+        for(int i=0; i<nx*ny; i++) {
+            const double *s = mt->position + 5*i;
+            float *d = &tt->direction[4*i];
+            if( s[0] > 0 ) {
+                double mu = s[1]/s[0], mv = s[2]/s[0];
+                d[0] = mu; d[1] = sqrt(fmax(s[3]/s[0] - mu*mu, 0.));
+                d[2] = mv; d[3] = sqrt(fmax(s[4]/s[0] - mv*mv, 0.));
+            } else d[0] = d[1] = d[2] = d[3] = 0;
+        }
+
+        tt->energy.resize(n_r); tt->ring.assign(n_r,-1);
+        for(int ir=0; ir<n_r; ir++) {
+            const double *s = mt->energy + (IAEA_I64) n_e*ir;
+            if( !tt->energy[ir].init(s,n_e) ) continue;
+            tt->ring[ir] = ir;
+            for(int ie=0; ie<n_e; ie++) if( s[ie] > 0 ) {
+                if( ie < ie_min ) ie_min = ie;
+                if( ie > ie_max ) ie_max = ie;
+            }
+        }
+        for(int ir=0; ir<n_r; ir++) {
+            if( tt->ring[ir] == ir ) continue;
+            for(int d=1; d<n_r && tt->ring[ir] < 0; d++) {
+                if( ir-d >= 0 && tt->ring[ir-d] == ir-d ) tt->ring[ir] = ir-d;
+                else if( ir+d < n_r && tt->ring[ir+d] == ir+d ) tt->ring[ir] = ir+d;
+            }
+        }
+        if( tt->ring[0] < 0 ) tt->present = false;
+    }
+    for(int t=0; t<MODEL_TYPES; t++) {
+        if( !tables[t].present ) n_particles[t] = 0;
+        total += n_particles[t];
+    }
+    if( types.init(n_particles,MODEL_TYPES) && ie_max >= 0 ) {
+        ok = true;
+        e_min = ie_min*e_width; e_max = (ie_max+1)*e_width;
+        histories = m->orig_histories > 0 ? m->orig_histories/total : 1;
+    }
+    iaea_model_free(m);
+}
+
+// Marsaglia's polar method: two Gaussian numbers from a point drawn
+// uniformly in the unit circle, without sin and cos
+double MyModelSource::gauss(double *second) {
+    double a, b, s;
+    do {
+        a = 2*iaea_random_uniform(&rng) - 1;
+        b = 2*iaea_random_uniform(&rng) - 1;
+        s = a*a + b*b;
+    } while( s >= 1 );
+    double f = sqrt(-2*log(s)/s);
+    *second = b*f;
+    return a*f;
+}
+
+void MyModelSource::getNextParticle(IAEA_I32 *n_stat, IAEA_I32 *type,
+           float *E, float *wt, float *x, float *y, float *z, float *u,
+           float *v, float *w) {
+    int t = types.sample(iaea_random_uniform(&rng));
+    const TypeTables *tt = &tables[t];
+
+    int i = tt->position.sample(iaea_random_uniform(&rng));
+    double xx = (i%nx - nx/2 + iaea_random_uniform(&rng))*x_width;
+    double yy = (i/nx - ny/2 + iaea_random_uniform(&rng))*y_width;
+
+    // Directions out of the unit circle are drawn again, a few times at most
+    const float *d = &tt->direction[4*i];
+    double uu, vv, uv;
+    for(int k=0; k<16; k++) {
+        double g1, g2; g1 = gauss(&g2);
+        uu = d[0] + d[1]*g1; vv = d[2] + d[3]*g2;
+        uv = uu*uu + vv*vv;
+        if( uv < 1 ) break;
+    }
+    if( uv >= 1 ) { uu /= sqrt(uv); vv /= sqrt(uv); uv = 1; }
+    double ww = sqrt(1 - uv);
+    if( iaea_random_uniform(&rng) < tt->backward ) ww = -ww;
+
+    int ir = (int) (sqrt(xx*xx + yy*yy)/r_width);
+    if( ir >= n_r ) ir = n_r - 1;
+    int ie = tt->energy[tt->ring[ir]].sample(iaea_random_uniform(&rng));
+
+    *n_stat = (IAEA_I32) (floor((count+1)*histories) - floor(count*histories));
+    *type = t + 1;
+    *E = (ie + iaea_random_uniform(&rng))*e_width;
+    *wt = tt->weight;
+    *x = xx; *y = yy; *z = tt->z;
+    *u = uu; *v = vv; *w = ww;
+    count++;
+}
+
+#ifdef WIN32
+
+#define MY_EXPORT __declspec(dllexport)
+#define MY_LOCAL
+
+#else
+
+#ifdef HAVE_VISIBILITY
+#define MY_EXPORT __attribute__ ((visibility ("default")))
+#define MY_LOCAL  __attribute__ ((visibility ("hidden")))
+#else
+#define MY_EXPORT
+#define MY_LOCAL
+#endif
+
+#endif
+
+static MY_LOCAL vector<MyModelSource *> sources;
+
+extern "C" {
+
+MY_EXPORT void init_source(IAEA_I32 *id,const char *inpfile,IAEA_I32 *result,
+    int) {
+    MyModelSource *new_source = new MyModelSource(inpfile);
+    int j;
+    for(j=0; j<(int) sources.size(); j++) {
+        if( !sources[j] ) break;
+    }
+    if( j < (int) sources.size() ) { sources[j] = new_source; *id = j; }
+    else { *id = sources.size(); sources.push_back(new_source); }
+    if( new_source->isOk() ) *result = 0; else *result = -1;
+}
+
+MY_EXPORT void get_maximum_energy(const IAEA_I32 *id, float *energy) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        *energy = sources[*id]->getMaximumEnergy();
+}
+
+MY_EXPORT void get_minimum_energy(const IAEA_I32 *id, float *energy) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        *energy = sources[*id]->getMinimumEnergy();
+}
+
+MY_EXPORT void get_extra_numbers(const IAEA_I32 *id, IAEA_I32 *ni, IAEA_I32 *nf) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() ) sources[*id]->getExtraNumbers(ni,nf);
+    else { *ni = 0; *nf = 0; }
+}
+
+MY_EXPORT void get_type_extra_long_variable(const IAEA_I32 *id, const IAEA_I32 *ind,
+                                            IAEA_I32 *typ) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        *typ = sources[*id]->getTypeExtraLongVariables(*ind);
+    else *typ = -1;
+}
+
+MY_EXPORT void get_type_extra_float_variable(const IAEA_I32 *id, const IAEA_I32 *ind,
+                                             IAEA_I32 *typ) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        *typ = sources[*id]->getTypeExtraFloatVariables(*ind);
+    else *typ = -1;
+}
+
+MY_EXPORT void get_nstat(const IAEA_I32 *id, IAEA_I64 *nstat) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        *nstat = sources[*id]->getNstat();
+    else *nstat = -1;
+}
+
+MY_EXPORT void set_parallel_run(const IAEA_I32 *id, const IAEA_I32 *iparallel,
+           const IAEA_I32 *ichunk, const IAEA_I32 *nchunk, IAEA_I32 *result) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        sources[*id]->setParallelRun(iparallel,ichunk,nchunk,result);
+    else *result = -1;
+}
+
+MY_EXPORT void get_next_particle(const IAEA_I32 *id,IAEA_I32 *n_stat,
+           IAEA_I32 *type, float *E, float *wt,
+           float *x, float *y, float *z, float *u, float *v,
+           float *w, float *, IAEA_I32 *) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() )
+        sources[*id]->getNextParticle(n_stat,type,E,wt,x,y,z,u,v,w);
+    else *n_stat = -1;
+}
+
+// A block of particles at once, saving a call through the loader per
+// particle (the model has no extra variables)
+MY_EXPORT void get_next_particles(const IAEA_I32 *id, const IAEA_I32 *n_max,
+           IAEA_I32 *n_read, IAEA_I32 *n_stat, IAEA_I32 *type, float *E,
+           float *wt, float *x, float *y, float *z, float *u, float *v,
+           float *w, float *, IAEA_I32 *) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() && sources[*id] ) {
+        MyModelSource *s = sources[*id];
+        for(IAEA_I32 i=0; i<*n_max; i++)
+            s->getNextParticle(&n_stat[i],&type[i],&E[i],&wt[i],&x[i],&y[i],
+                               &z[i],&u[i],&v[i],&w[i]);
+        *n_read = *n_max;
+    }
+    else *n_read = -1;
+}
+
+MY_EXPORT void destroy_source(const IAEA_I32 *id,IAEA_I32 *result) {
+    if( *id >= 0 && *id < (IAEA_I32) sources.size() ) {
+        if( sources[*id] ) { delete sources[*id]; sources[*id] = 0; *result=0;}
+    } else *result = -1;
+}
+
+}
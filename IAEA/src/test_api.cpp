@@ -0,0 +1,633 @@
+/*
+ * test_api: checks of the library on phase spaces it writes itself
+ *
+ * Usage: test_api
+ *
+ * Small phase spaces named test_api_* are written in the current
+ * directory, read back through the functions checked and removed. Every
+ * failed check is printed; the exit code is the number of failures.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#ifdef WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+#include "iaea_phsp.h"
+
+#define TEST_BLOCK 1000
+
+static int n_failed = 0;
+
+static void check(int ok, const char *what)
+{
+   if(!ok)
+   {
+      printf(" FAILED: %s\n", what);
+      n_failed++;
+   }
+}
+
+static IAEA_I32 open_phsp(const char *name, IAEA_I32 access)
+{
+   char path[256];
+   strcpy(path, name);
+   IAEA_I32 id, result, len = (IAEA_I32) strlen(path);
+   iaea_new_source(&id, path, &access, &result, len);
+   return (result < 0) ? -1 : id;
+}
+
+static void close_phsp(IAEA_I32 id)
+{
+   IAEA_I32 result;
+   iaea_destroy_source(&id, &result);
+}
+
+static void remove_phsp(const char *name)
+{
+   const char *ext[] = {".IAEAheader", ".IAEAphsp", ".IAEAindex"};
+   char path[256];
+   for(int i=0; i<3; i++)
+   {
+      sprintf(path, "%s%s", name, ext[i]);
+      remove(path);
+   }
+}
+
+// Writes n_hist histories of 1 to 3 particles with the n_long (<= 2)
+// extralongs of types long_types: history counter (1), latch = 1000 +
+// history (2) or 7 (others). With skip every fifth history has n_stat = 2.
+// Returns the sum of n_stat, or -1 if the file cannot be written.
+static IAEA_I64 write_phsp(const char *name, int n_hist, IAEA_I32 n_long,
+                           const IAEA_I32 *long_types, int skip)
+{
+   IAEA_I32 id = open_phsp(name, 2);
+   if(id < 0) return -1;
+
+   IAEA_I32 n_float = 0, index, t;
+   iaea_set_extra_numbers(&id, &n_float, &n_long);
+   for(index=0; index<n_long; index++)
+   {
+      t = long_types[index];
+      iaea_set_type_extralong_variable(&id, &index, &t);
+   }
+
+   IAEA_I64 n_orig = 0;
+   for(int h=0; h<n_hist; h++)
+   {
+      for(int k=0; k<=h%3; k++)
+      {
+         IAEA_I32 n_stat = (k > 0) ? 0 : (skip && h%5 == 0) ? 2 : 1;
+         IAEA_I32 type = 1 + (h+k)%2, extra_ints[2];
+         IAEA_Float E = 1.f + h%7, wt = 1.f, x = (IAEA_Float) h, y = (IAEA_Float) k;
+         IAEA_Float z = 0.f, u = 0.f, v = 0.f, w = 1.f, extra_floats[1];
+         for(int j=0; j<n_long; j++)
+            extra_ints[j] = (long_types[j] == 1) ? n_stat :
+                            (long_types[j] == 2) ? 1000 + h : 7;
+         n_orig += n_stat;
+         iaea_write_particle(&id, &n_stat, &type, &E, &wt, &x, &y, &z,
+                             &u, &v, &w, extra_floats, extra_ints);
+      }
+   }
+   close_phsp(id);
+   return n_orig;
+}
+
+// Particles of one of the phase spaces written by write_phsp
+static IAEA_I64 phsp_particles(int n_hist)
+{
+   IAEA_I64 n = 0;
+   for(int h=0; h<n_hist; h++) n += 1 + h%3;
+   return n;
+}
+
+/* *********************************************************************** */
+// Writing blocks: iaea_write_particles gives the same file, header and
+// index as a call of iaea_write_particle per particle, also with a
+// variable stored as a constant, and sources opened for reading reject
+// both.
+
+// Non-zero if the files name_a.ext and name_b.ext hold the same bytes,
+// lines naming the files aside
+static int same_files(const char *name_a, const char *name_b, const char *ext)
+{
+   char path[256], line_a[512], line_b[512];
+   sprintf(path, "%s%s", name_a, ext);
+   FILE *a = fopen(path, "rb");
+   sprintf(path, "%s%s", name_b, ext);
+   FILE *b = fopen(path, "rb");
+   int same = (a != NULL && b != NULL);
+   while(same)
+   {
+      char *ra = fgets(line_a, sizeof(line_a), a);
+      char *rb = fgets(line_b, sizeof(line_b), b);
+      if(ra == NULL || rb == NULL) {same = (ra == rb); break;}
+      if(strstr(line_a, name_a) != NULL && strstr(line_b, name_b) != NULL)
+         continue;
+      same = (strcmp(line_a, line_b) == 0);
+   }
+   if(a != NULL) fclose(a);
+   if(b != NULL) fclose(b);
+   return same;
+}
+
+static void test_write_block()
+{
+   const IAEA_I32 n = 2500, n_block = 700;
+   const char *names[2] = {"test_api_w1", "test_api_wn"};
+   static IAEA_I32 n_stat[n], type[n], extra_ints[n];
+   static IAEA_Float f[7*n], extra_floats[1];
+   for(IAEA_I32 i=0; i<n; i++)
+   {
+      n_stat[i] = (i%3 == 0) ? 1 + i%2 : 0;
+      type[i] = 1 + i%3;
+      extra_ints[i] = i;
+      f[i] = 0.5f + i%11;                  // E
+      f[n+i] = 1.f + 0.01f*(i%5);          // wt
+      f[2*n+i] = -3.f + 0.1f*(i%61);       // x
+      f[3*n+i] = 2.f - 0.2f*(i%17);        // y
+      f[4*n+i] = 100.f;                    // z, not stored
+      f[5*n+i] = 0.f; f[6*n+i] = 0.f;      // u, v (w = 1)
+   }
+
+   IAEA_I64 n_hist_written = 0;
+   for(int j=0; j<2; j++)
+   {
+      IAEA_I32 id = open_phsp(names[j], 2), result;
+      IAEA_I32 n_float = 0, n_long = 1, index = 0, t = 2, iz = 2;
+      IAEA_Float z = 100.f, w = 1.f;
+      iaea_set_extra_numbers(&id, &n_float, &n_long);
+      iaea_set_type_extralong_variable(&id, &index, &t);
+      iaea_set_constant_variable(&id, &iz, &z);
+      IAEA_I64 n_histories;
+      iaea_index_histories(&id, &n_histories, &result);
+      check(result == 0, "write block: index while writing");
+
+      if(j == 0)
+         for(IAEA_I32 i=0; i<n; i++)
+         {
+            IAEA_I32 ns = n_stat[i];
+            iaea_write_particle(&id, &ns, &type[i], &f[i], &f[n+i], &f[2*n+i],
+                                &f[3*n+i], &f[4*n+i], &f[5*n+i], &f[6*n+i],
+                                &w, extra_floats, &extra_ints[i]);
+            if(ns < 0) {check(0, "write block: iaea_write_particle"); break;}
+         }
+      else
+         for(IAEA_I32 i=0; i<n; i+=n_block)
+         {
+            IAEA_I32 m = (n - i < n_block) ? n - i : n_block, n_written;
+            IAEA_Float *ws = f + 6*n;            // any m values, w is not stored
+            iaea_write_particles(&id, &m, &n_written, n_stat+i, type+i, f+i,
+                                 f+n+i, f+2*n+i, f+3*n+i, f+4*n+i, f+5*n+i,
+                                 f+6*n+i, ws, extra_floats, extra_ints+i);
+            if(n_written != m) {check(0, "write block: iaea_write_particles"); break;}
+         }
+      close_phsp(id);
+
+      id = open_phsp(names[j], 1);
+      iaea_index_histories(&id, &n_histories, &result);
+      if(j == 0) n_hist_written = n_histories;
+      else check(result == 0 && n_histories == n_hist_written && n_histories > 0,
+                 "write block: histories indexed");
+
+      // a source opened for reading is not written to
+      IAEA_I32 ns = 1, n_written, m = 1;
+      iaea_write_particle(&id, &ns, type, f, f+n, f+2*n, f+3*n, f+4*n, f+5*n,
+                          f+6*n, &w, extra_floats, extra_ints);
+      check(ns == -1, "write block: iaea_write_particle on a source read");
+      iaea_write_particles(&id, &m, &n_written, n_stat, type, f, f+n, f+2*n,
+                           f+3*n, f+4*n, f+5*n, f+6*n, f+6*n, extra_floats,
+                           extra_ints);
+      check(n_written == -1, "write block: iaea_write_particles on a source read");
+      close_phsp(id);
+   }
+   check(same_files(names[0], names[1], ".IAEAphsp"), "write block: same records");
+   check(same_files(names[0], names[1], ".IAEAheader"), "write block: same header");
+
+   remove_phsp(names[0]);
+   remove_phsp(names[1]);
+}
+
+/* *********************************************************************** */
+// Concurrent writers: once the last writer is destroyed the source writes
+// again, after the particles of the writers, and its header counts all.
+static void test_writers()
+{
+   IAEA_I32 id = open_phsp("test_api_t", 2), n_threads = 3, writers[3], result;
+   iaea_set_writers(&id, &n_threads, writers, &result);
+   check(result == 0, "writers: iaea_set_writers");
+
+   IAEA_I32 type = 1, ns;
+   IAEA_Float E = 1.f, wt = 1.f, x = 0.f, y = 0.f, z = 0.f, u = 0.f, v = 0.f,
+              w = 1.f, extra_floats[1];
+   IAEA_I32 extra_ints[1];
+   for(int t=0; t<n_threads; t++)
+      for(int i=0; i<=t; i++)
+      {
+         ns = 1;
+         iaea_write_particle(&writers[t], &ns, &type, &E, &wt, &x, &y, &z,
+                             &u, &v, &w, extra_floats, extra_ints);
+      }
+
+   ns = 1;
+   iaea_write_particle(&id, &ns, &type, &E, &wt, &x, &y, &z, &u, &v, &w,
+                       extra_floats, extra_ints);
+   check(ns == -1, "writers: the source is not written while writers are set");
+   for(int t=0; t<n_threads; t++)
+   {
+      iaea_destroy_source(&writers[t], &result);
+      check(result == 1, "writers: destroying a writer");
+   }
+   ns = 1;
+   iaea_write_particle(&id, &ns, &type, &E, &wt, &x, &y, &z, &u, &v, &w,
+                       extra_floats, extra_ints);
+   check(ns == 1, "writers: the source writes after its last writer");
+   close_phsp(id);
+
+   id = open_phsp("test_api_t", 1);
+   IAEA_I32 all = -1;
+   IAEA_I64 n_particles = 0;
+   iaea_get_max_particles(&id, &all, &n_particles);
+   check(n_particles == 7, "writers: particles of the writers and the source");
+   close_phsp(id);
+   remove_phsp("test_api_t");
+}
+
+/* *********************************************************************** */
+// Merging sources whose extra variables are laid out differently: the
+// extralongs are matched by type, and the history counter of a source
+// without one is made from the n_stat of its particles.
+static void test_merge_layouts()
+{
+   const IAEA_I32 types_a[2] = {1, 2}, types_b[2] = {2, 1};
+   const int n_hist[3] = {300, 200, 100};
+   IAEA_I64 n_orig[3];
+   n_orig[0] = write_phsp("test_api_a", n_hist[0], 2, types_a, 1);
+   n_orig[1] = write_phsp("test_api_b", n_hist[1], 2, types_b, 1);
+   n_orig[2] = write_phsp("test_api_c", n_hist[2], 0, NULL, 0);
+   check(n_orig[0] > 0 && n_orig[1] > 0 && n_orig[2] > 0,
+         "merge: writing the sources");
+
+   IAEA_I32 src[3], n_sources = 3, result;
+   src[0] = open_phsp("test_api_a", 1);
+   src[1] = open_phsp("test_api_b", 1);
+   src[2] = open_phsp("test_api_c", 1);
+   IAEA_I32 dest = open_phsp("test_api_m", 2);
+   iaea_merge_sources(&n_sources, src, &dest, &result);
+   check(result == 0, "merge: iaea_merge_sources");
+   for(int i=0; i<3; i++) close_phsp(src[i]);
+   close_phsp(dest);
+
+   // Read back with the layout of the first source: counter, latch
+   IAEA_I32 id = open_phsp("test_api_m", 1);
+   IAEA_I32 n_float, n_long;
+   iaea_get_extra_numbers(&id, &n_float, &n_long);
+   check(n_long == 2, "merge: layout of the first source");
+
+   static IAEA_I32 n_stat[TEST_BLOCK], type[TEST_BLOCK], extra_ints[2*TEST_BLOCK];
+   static IAEA_Float f[8*TEST_BLOCK], extra_floats[TEST_BLOCK];
+   IAEA_I64 hist[3] = {0, 0, 0}, end[3];
+   end[0] = phsp_particles(n_hist[0]);
+   end[1] = end[0] + phsp_particles(n_hist[1]);
+   end[2] = end[1] + phsp_particles(n_hist[2]);
+
+   IAEA_I64 i_particle = 0;
+   int h = -1, latch_ok = 1, counter_ok = 1;
+   IAEA_I32 n_max = TEST_BLOCK, n_read;
+   for(;;)
+   {
+      iaea_get_particles(&id, &n_max, &n_read, n_stat, type, f, f+n_max,
+                         f+2*n_max, f+3*n_max, f+4*n_max, f+5*n_max,
+                         f+6*n_max, f+7*n_max, extra_floats, extra_ints);
+      if(n_read <= 0) break;
+      for(IAEA_I32 i=0; i<n_read; i++, i_particle++)
+      {
+         int part = (i_particle < end[0]) ? 0 : (i_particle < end[1]) ? 1 : 2;
+         if(n_stat[i] > 0) h = (int) f[2*n_max+i]; // x holds the history
+         hist[part] += n_stat[i];
+         if(n_stat[i] != extra_ints[i]) counter_ok = 0;
+         if(extra_ints[n_max+i] != ((part < 2) ? 1000 + h : 0)) latch_ok = 0;
+      }
+   }
+   close_phsp(id);
+
+   check(i_particle == end[2], "merge: number of particles");
+   check(counter_ok, "merge: history counter equals n_stat");
+   check(latch_ok, "merge: latch matched by type");
+   check(hist[0] == n_orig[0], "merge: histories of the copied source");
+   check(hist[1] == n_orig[1], "merge: histories of the reordered source");
+   check(hist[2] == n_orig[2], "merge: histories of the source without counter");
+
+   remove_phsp("test_api_a");
+   remove_phsp("test_api_b");
+   remove_phsp("test_api_c");
+   remove_phsp("test_api_m");
+}
+
+/* *********************************************************************** */
+// Reading a phase space of the other byte order: a copy of a file written
+// here with the bytes of every float and extralong reversed and the byte
+// order of the header changed is read, and converted, to the same values.
+
+// Checks the particles of a phase space written by write_phsp with the
+// extralongs counter and latch. Returns the sum of n_stat.
+static IAEA_I64 read_phsp(const char *name, int n_hist, int *values_ok)
+{
+   IAEA_I32 id = open_phsp(name, 1);
+   static IAEA_I32 n_stat[TEST_BLOCK], type[TEST_BLOCK], extra_ints[2*TEST_BLOCK];
+   static IAEA_Float f[8*TEST_BLOCK], extra_floats[TEST_BLOCK];
+   IAEA_I64 n_orig = 0, i_particle = 0;
+   IAEA_I32 n_max = TEST_BLOCK, n_read;
+   int h = -1;
+   *values_ok = (id >= 0);
+   while(id >= 0)
+   {
+      iaea_get_particles(&id, &n_max, &n_read, n_stat, type, f, f+n_max,
+                         f+2*n_max, f+3*n_max, f+4*n_max, f+5*n_max,
+                         f+6*n_max, f+7*n_max, extra_floats, extra_ints);
+      if(n_read <= 0) break;
+      for(IAEA_I32 i=0; i<n_read; i++, i_particle++)
+      {
+         if(n_stat[i] > 0) h = (int) f[2*n_max+i];
+         n_orig += n_stat[i];
+         if(f[i] != 1.f + h%7 || f[7*n_max+i] != 1.f ||
+            extra_ints[i] != n_stat[i] ||
+            extra_ints[n_max+i] != 1000 + h) *values_ok = 0;
+      }
+   }
+   if(i_particle != phsp_particles(n_hist)) *values_ok = 0;
+   close_phsp(id);
+   return n_orig;
+}
+
+static void reverse_bytes(unsigned char *p, int n_bytes)
+{
+   for(int i=0, j=n_bytes-1; i<j; i++, j--)
+   {
+      unsigned char t = p[i]; p[i] = p[j]; p[j] = t;
+   }
+}
+
+// Writes name_to, the phase space name_from in the other byte order
+static int swap_phsp(const char *name_from, const char *name_to, int n_hist,
+                     int n_long)
+{
+   char path[256], line[256];
+   const short one = 1;
+   const char *order = (*(const char *) &one == 1) ? "1234" : "4321";
+   const char *other = (*(const char *) &one == 1) ? "4321" : "1234";
+
+   sprintf(path, "%s.IAEAheader", name_from);
+   FILE *in = fopen(path, "r");
+   sprintf(path, "%s.IAEAheader", name_to);
+   FILE *out = fopen(path, "w");
+   if(in == NULL || out == NULL) return 0;
+   int byte_order = 0, swapped = 0;
+   while(fgets(line, sizeof(line), in) != NULL)
+   {
+      if(byte_order && strncmp(line, order, 4) == 0)
+         {fprintf(out, "%s\n", other); swapped = 1;}
+      else fputs(line, out);
+      byte_order = (strncmp(line, "$BYTE_ORDER:", 12) == 0);
+   }
+   fclose(in);
+   fclose(out);
+
+   sprintf(path, "%s.IAEAphsp", name_from);
+   in = fopen(path, "rb");
+   sprintf(path, "%s.IAEAphsp", name_to);
+   out = fopen(path, "wb");
+   if(in == NULL || out == NULL) return 0;
+   fseek(in, 0, SEEK_END);
+   long size = ftell(in);
+   fseek(in, 0, SEEK_SET);
+   unsigned char *data = (unsigned char *) malloc(size > 0 ? size : 1);
+   int ok = swapped && data != NULL && fread(data, 1, size, in) == (size_t) size;
+   if(ok)
+   {
+      int reclength = (int)(size/phsp_particles(n_hist));
+      int offset_long = reclength - n_long*(int)sizeof(IAEA_I32);
+      for(unsigned char *r = data; r < data + size; r += reclength)
+      {
+         for(int k=1; k<offset_long; k+=4) reverse_bytes(r + k, 4);
+         for(int k=offset_long; k<reclength; k+=(int)sizeof(IAEA_I32))
+            reverse_bytes(r + k, (int)sizeof(IAEA_I32));
+      }
+      ok = fwrite(data, 1, size, out) == (size_t) size;
+   }
+   free(data);
+   fclose(in);
+   if(fclose(out) != 0) ok = 0;
+   return ok;
+}
+
+static void test_byte_order()
+{
+   const IAEA_I32 types[2] = {1, 2};
+   const int n_hist = 500;
+   IAEA_I64 n_orig = write_phsp("test_api_n", n_hist, 2, types, 1);
+   check(swap_phsp("test_api_n", "test_api_s", n_hist, 2),
+         "byte order: writing the swapped file");
+
+   IAEA_I32 id = open_phsp("test_api_s", 1), result;
+   iaea_check_file_size_byte_order(&id, &result);
+   check(result == -4, "byte order: file of the other byte order");
+   close_phsp(id);
+
+   int values_ok;
+   check(read_phsp("test_api_s", n_hist, &values_ok) == n_orig && values_ok,
+         "byte order: reading the swapped file");
+
+   IAEA_I32 source = open_phsp("test_api_s", 1);
+   IAEA_I32 dest = open_phsp("test_api_c", 2);
+   iaea_copy_header(&source, &dest, &result);
+   iaea_convert_source(&source, &dest, &result);
+   check(result == 0, "byte order: iaea_convert_source");
+   close_phsp(source);
+   close_phsp(dest);
+   check(read_phsp("test_api_c", n_hist, &values_ok) == n_orig && values_ok,
+         "byte order: reading the converted file");
+
+   remove_phsp("test_api_n");
+   remove_phsp("test_api_s");
+   remove_phsp("test_api_c");
+}
+
+/* *********************************************************************** */
+// Recycling: for every number of particles per call, above and below the
+// number of copies, the file gives each particle n_recycle times, ends
+// with -2 after the last copy and starts again from its first particle.
+static void test_recycling()
+{
+   const int n_hist = 40;
+   const IAEA_I64 n_particles = phsp_particles(n_hist);
+   IAEA_I64 n_orig = write_phsp("test_api_r", n_hist, 0, NULL, 0);
+
+   static IAEA_I32 n_stat[TEST_BLOCK], type[TEST_BLOCK], extra_ints[TEST_BLOCK];
+   static IAEA_Float f[8*TEST_BLOCK], extra_floats[TEST_BLOCK];
+   char what[128];
+   for(IAEA_I32 access=1; access<=4; access+=3)
+   for(IAEA_I32 n_recycle=2; n_recycle<=5; n_recycle+=3)
+   for(IAEA_I32 n_max=1; n_max<=2*n_recycle+1; n_max++)
+   {
+      IAEA_I32 id = open_phsp("test_api_r", access), result;
+      IAEA_I32 symmetry = 0, seed = 1, n_read;
+      iaea_set_recycling(&id, &n_recycle, &symmetry, &seed, &result);
+
+      IAEA_I64 n_given = 0, n_hists = 0, n_calls = 0;
+      int order_ok = 1, h = -1;
+      for(;;)
+      {
+         iaea_get_particles(&id, &n_max, &n_read, n_stat, type, f, f+n_max,
+                            f+2*n_max, f+3*n_max, f+4*n_max, f+5*n_max,
+                            f+6*n_max, f+7*n_max, extra_floats, extra_ints);
+         if(n_read < 0 || ++n_calls > n_particles*n_recycle) break;
+         for(IAEA_I32 i=0; i<n_read; i++, n_given++)
+         {
+            // copy 0 of the first particle of a history starts it
+            if(n_stat[i] > 0) h++;
+            if(f[2*n_max+i] != (IAEA_Float) h) order_ok = 0;
+            n_hists += n_stat[i];
+         }
+      }
+      sprintf(what, "recycling: access %ld, n_recycle %ld, n_max %ld",
+              (long) access, (long) n_recycle, (long) n_max);
+      check(result == 0 && n_read == -2 && n_given == n_particles*n_recycle &&
+            n_hists == n_orig && order_ok, what);
+
+      // rewound to the first particle
+      iaea_get_particles(&id, &n_max, &n_read, n_stat, type, f, f+n_max,
+                         f+2*n_max, f+3*n_max, f+4*n_max, f+5*n_max,
+                         f+6*n_max, f+7*n_max, extra_floats, extra_ints);
+      check(n_read > 0 && n_stat[0] > 0 && f[2*n_max] == 0.f, what);
+      close_phsp(id);
+   }
+   remove_phsp("test_api_r");
+
+   // the history counter of the copies after the first is 0
+   const IAEA_I32 types[1] = {1};
+   n_orig = write_phsp("test_api_r", n_hist, 1, types, 1);
+   for(IAEA_I32 n_max=1; n_max<=7; n_max+=3)
+   {
+      IAEA_I32 id = open_phsp("test_api_r", 1), result;
+      IAEA_I32 n_recycle = 3, symmetry = 0, seed = 1, n_read;
+      iaea_set_recycling(&id, &n_recycle, &symmetry, &seed, &result);
+
+      IAEA_I64 n_hists = 0, n_counted = 0, n_calls = 0;
+      for(;;)
+      {
+         iaea_get_particles(&id, &n_max, &n_read, n_stat, type, f, f+n_max,
+                            f+2*n_max, f+3*n_max, f+4*n_max, f+5*n_max,
+                            f+6*n_max, f+7*n_max, extra_floats, extra_ints);
+         if(n_read < 0 || ++n_calls > n_particles*n_recycle) break;
+         for(IAEA_I32 i=0; i<n_read; i++)
+         {
+            n_hists += n_stat[i];
+            n_counted += extra_ints[i];
+         }
+      }
+      sprintf(what, "recycling: history counter, n_max %ld", (long) n_max);
+      check(result == 0 && n_read == -2 && n_hists == n_orig &&
+            n_counted == n_orig, what);
+      close_phsp(id);
+   }
+   remove_phsp("test_api_r");
+}
+
+/* *********************************************************************** */
+// A phase space rewritten with as many particles as before, but other
+// histories, must not be read with the index saved for the old one. The
+// old file is dated back so that both do not share a modification time.
+static IAEA_I64 index_orig_histories(const char *name, int n_hist)
+{
+   IAEA_I32 id = open_phsp(name, 1), result;
+   IAEA_I64 n_histories = 0, k = n_hist, first, n_records, n_orig = -1;
+   iaea_index_histories(&id, &n_histories, &result);
+   if(result == 0 && n_histories == n_hist)
+      iaea_get_history_records(&id, &k, &first, &n_records, &n_orig, &result);
+   close_phsp(id);
+   return (result == 0) ? n_orig : -1;
+}
+
+static void test_index_stale()
+{
+   const IAEA_I32 types[1] = {1};
+   const int n_hist = 300;
+   IAEA_I64 n_orig = write_phsp("test_api_i", n_hist, 1, types, 0);
+   struct utimbuf old_time;
+   old_time.actime = old_time.modtime = 1000000000;
+   check(utime("test_api_i.IAEAphsp", &old_time) == 0, "index: dating the file");
+   check(index_orig_histories("test_api_i", n_hist) == n_orig,
+         "index: histories of the first file");
+   check(index_orig_histories("test_api_i", n_hist) == n_orig,
+         "index: histories of the saved index");
+
+   n_orig = write_phsp("test_api_i", n_hist, 1, types, 1);
+   check(index_orig_histories("test_api_i", n_hist) == n_orig,
+         "index: histories of the rewritten file");
+
+   remove_phsp("test_api_i");
+}
+
+// A source read from before merging: copied as it is its header counters
+// no longer hold, so it is rejected; transcoded it is read from its start.
+static void test_merge_read()
+{
+   const IAEA_I32 types_a[1] = {2}, types_b[1] = {1};
+   const int n_hist = 200;
+   write_phsp("test_api_a", n_hist, 1, types_a, 0);
+   write_phsp("test_api_b", n_hist, 1, types_b, 0);
+
+   static IAEA_I32 n_stat[TEST_BLOCK], type[TEST_BLOCK], extra_ints[TEST_BLOCK];
+   static IAEA_Float f[8*TEST_BLOCK], extra_floats[TEST_BLOCK];
+   IAEA_I32 n_max = 10, n_read, result, n_sources;
+   IAEA_I32 read_a = open_phsp("test_api_a", 1), read_b = open_phsp("test_api_b", 1);
+   for(int j=0; j<2; j++)
+      iaea_get_particles(j == 0 ? &read_a : &read_b, &n_max, &n_read, n_stat,
+                         type, f, f+n_max, f+2*n_max, f+3*n_max, f+4*n_max,
+                         f+5*n_max, f+6*n_max, f+7*n_max, extra_floats,
+                         extra_ints);
+
+   // the source not read (layout a) is copied, the one read with layout b
+   // transcoded, the one read with layout a rejected before anything
+   IAEA_I32 src_a = open_phsp("test_api_a", 1);
+   IAEA_I32 dest = open_phsp("test_api_m", 2);
+   IAEA_I32 rejected[2] = {src_a, read_a}, accepted[2] = {src_a, read_b};
+   n_sources = 2;
+   iaea_merge_sources(&n_sources, rejected, &dest, &result);
+   check(result == -3, "merge read: copying a source read from");
+   iaea_merge_sources(&n_sources, accepted, &dest, &result);
+   check(result == 0, "merge read: transcoding a source read from");
+   close_phsp(src_a);
+   close_phsp(read_a);
+   close_phsp(read_b);
+   close_phsp(dest);
+
+   IAEA_I32 id = open_phsp("test_api_m", 1), all = -1;
+   IAEA_I64 n_particles = 0;
+   iaea_get_max_particles(&id, &all, &n_particles);
+   check(n_particles == 2*phsp_particles(n_hist), "merge read: all particles");
+   close_phsp(id);
+
+   remove_phsp("test_api_a");
+   remove_phsp("test_api_b");
+   remove_phsp("test_api_m");
+}
+
+int main()
+{
+   test_write_block();
+   test_writers();
+   test_merge_layouts();
+   test_merge_read();
+   test_byte_order();
+   test_recycling();
+   test_index_stale();
+
+   if(n_failed == 0) printf("\n All checks passed\n");
+   else printf("\n %d checks failed\n", n_failed);
+   return n_failed;
+}
@@ -23,9 +23,9 @@ int main() {
     cout << "Maximum energy: " << emax << endl;
     cout << "Minimum energy: " << emin << endl;
     cout << "Extra floats: " << nef << endl;
-    float *extra_floats; IAEA_I32 *extra_longs;
+    float *extra_floats = 0; IAEA_I32 *extra_longs = 0;
     if( nef > 0 ) {
-        for(int j=0; j<nef; j++) {
+        for(IAEA_I32 j=0; j<nef; j++) {
             IAEA_I32 type;
             generator.getTypeExtraFloatVariable(&j,&type);
             cout << "   extra float " << j+1 << " is of type " << type << endl;
@@ -33,9 +33,9 @@ int main() {
         extra_floats = new float [nef];
     }
     if( nei > 0 ) {
-        for(int j=0; j<nei; j++) {
+        for(IAEA_I32 j=0; j<nei; j++) {
             IAEA_I32 type;
-            generator.getTypeExtraFloatVariable(&j,&type);
+            generator.getTypeExtraLongVariable(&j,&type);
             cout << "   extra long " << j+1 << " is of type " << type << endl;
         }
         extra_longs = new IAEA_I32 [nei];
@@ -63,6 +63,20 @@ int main() {
         }
     }
 
+    cout << "and the next 5 in one block:\n";
+
+    const IAEA_I32 n_max = 5;
+    IAEA_I32 n_read, nstat[n_max], type[n_max];
+    float E[n_max],wt[n_max],x[n_max],y[n_max],z[n_max],u[n_max],v[n_max],
+          w[n_max];
+    float *block_floats = nef > 0 ? new float [nef*n_max] : 0;
+    IAEA_I32 *block_longs = nei > 0 ? new IAEA_I32 [nei*n_max] : 0;
+    generator.getNextParticles(&n_max,&n_read,nstat,type,E,wt,x,y,z,u,v,w,
+                               block_floats,block_longs);
+    for(int j=0; j<n_read; j++) 
+        cout << j+6 << ": nstat=" << nstat[j] << " type=" << type[j] 
+             << " E=" << E[j] << " wt=" << wt[j] << endl;
+
     return 0;
 
 }
@@ -133,6 +133,16 @@ int check_byte_order()
   }
 }
 /* ************************************************** */
+int host_byte_order()
+{
+  /* The byte order on this machine, as check_byte_order but silently */
+  float ftest=1.0f;
+  char *pf = (char *) &ftest;
+  if(pf[0] == 0 && pf[3] != 0) return(LITTLE_ENDIAN);
+  if(pf[0] != 0 && pf[3] == 0) return(BIG_ENDIAN);
+  return(UNKNOWN_ENDIAN);
+}
+/* ************************************************** */
 void print_runtime_info(int argc, char *argv[])
 {  // print file header stuff
         printf("\n Command Line: ");
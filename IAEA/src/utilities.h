@@ -102,6 +102,7 @@ short reverse_short_byte_order(short xold);
 int reverse_int_byte_order(int xold);
 int advance(char *istr, int *sval, int len);
 int check_byte_order(void);
+int host_byte_order(void);
 int clean_name(char *tmp_path, char *opath);
 int clean_name(char *);
 int copy(char *SourceFile, char *DestinationFile);
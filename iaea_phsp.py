@@ -23,7 +23,8 @@ class IAEAPhaseSpace(object):
         path -- The path to the iaea phase space file
         
         Keyword arguments:
-        mode -- 'r' for read, 'w' for read/write or 'a' for 'append' (default 'r')        
+        mode -- 'r' for read, 'w' for read/write, 'a' for 'append' or 'm' for
+                read through a memory mapping of the file (default 'r')
         
         """        
         self._set_path(path)        
@@ -81,6 +82,80 @@ class IAEAPhaseSpace(object):
             raise iaea_errors.IAEAPhaseSpaceError(message="Source not initialized")
 
         return emax.value                
+    #----------------------------------------------------------------------
+    def extra_numbers(self):
+        """Return (number of extra floats, number of extra longs) per particle"""
+        
+        n_extra_float = iaea_types.IAEA_I32(0)
+        n_extra_int = iaea_types.IAEA_I32(0)
+        iaeadll.iaea_get_extra_numbers(byref(self._source_id),
+                                       byref(n_extra_float),byref(n_extra_int))
+        if n_extra_float.value < 0 or n_extra_int.value < 0:
+            raise iaea_errors.IAEAPhaseSpaceError(message="Source not initialized")
+
+        return n_extra_float.value, n_extra_int.value
+    #----------------------------------------------------------------------
+    def get_particles(self,n_max):
+        """Read up to n_max particles with a single library call
+
+        Returns a dict of lists keyed by 'n_stat', 'type', 'E', 'wt', 'x', 'y',
+        'z', 'u', 'v', 'w', 'extra_floats' and 'extra_ints' (the extra entries
+        are lists with one list per extra variable). The lists are empty
+        once the end of the phase space file is reached.
+        
+        Arguments:
+        n_max -- maximum number of particles to read
+        
+        """
+        
+        n_extra_float, n_extra_int = self.extra_numbers()
+
+        n_stat = (iaea_types.IAEA_I32*n_max)()
+        ptype = (iaea_types.IAEA_I32*n_max)()
+        floats = dict((k,(iaea_types.IAEA_Float*n_max)()) 
+                      for k in ('E','wt','x','y','z','u','v','w'))
+        extra_floats = (iaea_types.IAEA_Float*max(1,n_max*n_extra_float))()
+        extra_ints = (iaea_types.IAEA_I32*max(1,n_max*n_extra_int))()
+        n_read = iaea_types.IAEA_I32(0)
+        
+        iaeadll.iaea_get_particles(byref(self._source_id),
+                                   byref(iaea_types.IAEA_I32(n_max)),
+                                   byref(n_read), n_stat, ptype,
+                                   floats['E'], floats['wt'],
+                                   floats['x'], floats['y'], floats['z'],
+                                   floats['u'], floats['v'], floats['w'],
+                                   extra_floats, extra_ints)
+
+        if n_read.value == -1:
+            raise iaea_errors.IAEAPhaseSpaceError(message="Unable to read particles")
+        n = max(0,n_read.value)
+
+        particles = dict((k,a[:n]) for k,a in floats.items())
+        particles['n_stat'] = n_stat[:n]
+        particles['type'] = ptype[:n]
+        particles['extra_floats'] = [extra_floats[k*n_max:k*n_max+n] 
+                                     for k in range(n_extra_float)]
+        particles['extra_ints'] = [extra_ints[k*n_max:k*n_max+n] 
+                                   for k in range(n_extra_int)]
+        return particles
+    #----------------------------------------------------------------------
+    def particles(self,block_size=4096):
+        """Iterate over (n_stat, type, E, wt, x, y, z, u, v, w) of all particles
+        
+        Particles are read block_size at a time via get_particles.
+        
+        Keyword arguments:
+        block_size -- number of particles read per library call (default 4096)
+        
+        """
+        
+        keys = ('n_stat','type','E','wt','x','y','z','u','v','w')
+        while True:
+            block = self.get_particles(block_size)
+            if not block['type']:
+                return
+            for particle in zip(*[block[k] for k in keys]):
+                yield particle
     #--------------------------------------------------------------------------    
     @property
     def source_id(self):
@@ -17,7 +17,8 @@ PIAEA_I64 = ctypes.POINTER(IAEA_I64)
 iaea_file_modes = {
     'r': IAEA_I32(1),
     'w': IAEA_I32(2),
-    'a': IAEA_I32(3)
+    'a': IAEA_I32(3),
+    'm': IAEA_I32(4)
 }
 
 all_particles = -1
@@ -39,4 +40,4 @@ particle_types = {
 }
 
 
-max_sources = 30 
\ No newline at end of file
+max_sources = 64*16384 # MAX_NUM_SOURCES of IAEA/src/iaea_record.h